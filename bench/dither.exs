@@ -0,0 +1,39 @@
+# Compares the dither/3 methods in milliseconds per megapixel, for each
+# gray level count and for Y8 and RGB input.
+#
+# Run on the device with: mix run bench/dither.exs
+
+defmodule Bench.Dither do
+  @width 1448
+  @height 1072
+  @runs 10
+  @methods [:bayer, :blue_noise, :floyd_steinberg, :atkinson]
+
+  def run do
+    mp = @width * @height / 1_000_000
+    inputs = [y8: :rand.bytes(@width * @height), rgb: :rand.bytes(@width * @height * 3)]
+    IO.puts("#{@width}x#{@height} (#{Float.round(mp, 2)} MP), ms per megapixel")
+    IO.puts(Enum.map_join(["method", "format" | Enum.map([16, 4, 2], &"#{&1} levels")], &pad/1))
+
+    for method <- @methods, {format, data} <- inputs do
+      cells =
+        for levels <- [16, 4, 2] do
+          opts = [format: format, method: method, levels: levels]
+          us = median_us(fn -> {:ok, _} = FBInk.dither(data, @width, opts) end)
+          :erlang.float_to_binary(us / 1000 / mp, decimals: 2)
+        end
+
+      IO.puts(Enum.map_join([method, format | cells], &pad/1))
+    end
+  end
+
+  defp pad(cell), do: String.pad_trailing(to_string(cell), 18)
+
+  defp median_us(fun) do
+    fun.()
+    times = Enum.sort(for _ <- 1..@runs, do: elem(:timer.tc(fun), 0))
+    Enum.at(times, div(@runs, 2))
+  end
+end
+
+Bench.Dither.run()
@@ -0,0 +1,57 @@
+# Times get_dump_data/1 and get_dump_rect_data/2 on raw and compressed
+# full-screen dumps, and how late a 1 ms timer fires on a normal scheduler
+# while compressed dumps are being decoded.
+#
+# Run on the device with: mix run bench/dump_data.exs
+
+defmodule Bench.DumpData do
+  @runs 50
+
+  def run do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, %FBInk.Config{is_quiet: true})
+    {:ok, raw} = FBInk.dump(fb)
+    {:ok, packed} = FBInk.dump(fb, compress: true)
+    {:ok, %{area: area}} = FBInk.get_dump_data(raw)
+    rect = %{left: 0, top: div(area.height, 2), width: area.width, height: 64}
+
+    for {label, dump} <- [raw: raw, compressed: packed] do
+      report("get_dump_data/1 (#{label})", fn -> FBInk.get_dump_data(dump) end)
+      report("get_dump_rect_data/2 (#{label})", fn -> FBInk.get_dump_rect_data(dump, rect) end)
+    end
+
+    late = timer_lateness(fn -> FBInk.get_dump_data(packed) end)
+    IO.puts("1 ms timer, worst lateness while decoding: #{late} us")
+
+    FBInk.close(fb)
+  end
+
+  defp report(label, fun) do
+    {:ok, _} = fun.()
+    times = for _ <- 1..@runs, do: elem(:timer.tc(fun), 0)
+    sorted = Enum.sort(times)
+    median = Enum.at(sorted, div(@runs, 2))
+    IO.puts("#{String.pad_trailing(label, 40)} median #{median} us, max #{List.last(sorted)} us")
+  end
+
+  # Keep every normal scheduler busy with decodes while a process sleeps in
+  # 1 ms steps, and return how late its wake-ups were at worst
+  defp timer_lateness(fun) do
+    workers =
+      for _ <- 1..System.schedulers_online() do
+        spawn(fn -> Stream.repeatedly(fun) |> Stream.run() end)
+      end
+
+    late =
+      Enum.reduce(1..500, 0, fn _, worst ->
+        t0 = System.monotonic_time(:microsecond)
+        Process.sleep(1)
+        max(worst, System.monotonic_time(:microsecond) - t0 - 1000)
+      end)
+
+    Enum.each(workers, &Process.exit(&1, :kill))
+    late
+  end
+end
+
+Bench.DumpData.run()
@@ -0,0 +1,34 @@
+# Throughput of pack_buffer/2 from each source format into the live
+# framebuffer format, in MB/s of input.
+#
+# Run on the device with: mix run bench/pack_buffer.exs
+
+defmodule Bench.PackBuffer do
+  @width 1448
+  @height 1072
+  @runs 30
+
+  def run do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, %FBInk.Config{is_quiet: true})
+    %{bpp: bpp} = FBInk.get_state(%FBInk.Config{})
+    IO.puts("#{@width}x#{@height}, framebuffer #{bpp}bpp")
+
+    for {format, bytes_pp} <- [y8: 1, rgb: 3, rgba: 4] do
+      data = :rand.bytes(@width * @height * bytes_pp)
+      us = median_us(fn -> {:ok, _} = FBInk.pack_buffer(data, format) end)
+      mb_s = byte_size(data) / us
+      IO.puts("#{String.pad_trailing(inspect(format), 6)} #{round(us)} us, #{round(mb_s)} MB/s")
+    end
+
+    FBInk.close(fb)
+  end
+
+  defp median_us(fun) do
+    fun.()
+    times = Enum.sort(for _ <- 1..@runs, do: elem(:timer.tc(fun), 0))
+    Enum.at(times, div(@runs, 2))
+  end
+end
+
+Bench.PackBuffer.run()
@@ -0,0 +1,44 @@
+# Times fitting a 4 MP photo to the panel with scale_buffer/4, for each
+# filter and format, against the 100 ms budget.
+#
+# Run on the device with: mix run bench/scale.exs
+
+defmodule Bench.Scale do
+  @src {2448, 1632}
+  @runs 10
+
+  def run do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, %FBInk.Config{is_quiet: true})
+    %{screen_width: sw, screen_height: sh} = FBInk.get_state(%FBInk.Config{})
+    FBInk.close(fb)
+
+    {w, h} = @src
+    dst = fit(@src, {sw, sh})
+    IO.puts("#{w}x#{h} -> #{elem(dst, 0)}x#{elem(dst, 1)}, #{System.schedulers_online()} cores")
+
+    for format <- [:y8, :rgba], filter <- [:box, :bilinear, :lanczos] do
+      data = :rand.bytes(w * h * if(format == :rgba, do: 4, else: 1))
+      opts = [format: format, filter: filter]
+      us = median_us(fn -> {:ok, _} = FBInk.scale_buffer(data, w, dst, opts) end)
+      verdict = if us < 100_000, do: "ok", else: "over budget"
+      IO.puts("#{pad(format)}#{pad(filter)}#{round(us / 1000)} ms  #{verdict}")
+    end
+  end
+
+  # Largest size within the screen keeping the source's aspect ratio
+  defp fit({w, h}, {sw, sh}) do
+    scale = min(sw / w, sh / h)
+    {max(1, round(w * scale)), max(1, round(h * scale))}
+  end
+
+  defp pad(cell), do: String.pad_trailing(to_string(cell), 10)
+
+  defp median_us(fun) do
+    fun.()
+    times = Enum.sort(for _ <- 1..@runs, do: elem(:timer.tc(fun), 0))
+    Enum.at(times, div(@runs, 2))
+  end
+end
+
+Bench.Scale.run()
@@ -0,0 +1,64 @@
+# Scaling of the band-parallel pipeline with the :threads option (1, 2 and
+# 4): scale_buffer/4 alone, and print_raw_data/8 scaling and dithering a
+# 4 MP image straight to the screen (without refreshing; the screen is put
+# back afterwards). Also checks that every thread count gives the same bytes.
+#
+# Run on the device with: mix run bench/threads.exs
+
+defmodule Bench.Threads do
+  @src {2448, 1632}
+  @runs 10
+  @threads [1, 2, 4]
+
+  def run do
+    {:ok, fb} = FBInk.open()
+    quiet = %FBInk.Config{is_quiet: true, no_refresh: true}
+    {:ok, _} = FBInk.init(fb, quiet)
+    %{screen_width: sw, screen_height: sh} = FBInk.get_state(quiet)
+    {:ok, saved} = FBInk.dump(fb)
+
+    {w, h} = @src
+    data = :rand.bytes(w * h)
+    dst = {sw, sh}
+    IO.puts("#{w}x#{h} Y8 -> #{sw}x#{sh}, #{System.schedulers_online()} cores")
+
+    outputs =
+      for n <- @threads do
+        {:ok, out} = FBInk.scale_buffer(data, w, dst, threads: n)
+        out
+      end
+
+    IO.puts("identical output across thread counts: #{length(Enum.uniq(outputs)) == 1}")
+
+    sweep("scale_buffer/4", fn n ->
+      {:ok, _} = FBInk.scale_buffer(data, w, dst, threads: n)
+    end)
+
+    sweep("print_raw_data/8", fn n ->
+      opts = [scale: dst, dither: :floyd_steinberg, levels: 16, threads: n]
+      {:ok, _} = FBInk.print_raw_data(fb, data, w, h, 0, 0, quiet, opts)
+    end)
+
+    FBInk.restore(fb, quiet, saved)
+    FBInk.close(fb)
+  end
+
+  defp sweep(label, fun) do
+    times = for n <- @threads, do: {n, median_us(fn -> fun.(n) end)}
+    {_, base} = hd(times)
+
+    for {n, us} <- times do
+      speedup = :erlang.float_to_binary(base / us, decimals: 2)
+      ms = round(us / 1000)
+      IO.puts("#{String.pad_trailing(label, 18)} threads: #{n}  #{ms} ms  x#{speedup}")
+    end
+  end
+
+  defp median_us(fun) do
+    fun.()
+    times = Enum.sort(for _ <- 1..@runs, do: elem(:timer.tc(fun), 0))
+    Enum.at(times, div(@runs, 2))
+  end
+end
+
+Bench.Threads.run()
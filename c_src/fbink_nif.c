@@ -8,12 +8,43 @@
  * SPDX-License-Identifier: MIT
  */
 
+#define _GNU_SOURCE  // syscall(), write(), close() under -std=c11
+
 #include <erl_nif.h>
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <math.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "fbink.h"
+#include "image_decode.h"
+
+// In-memory image decoding goes through an anonymous memfd (Linux >= 3.17)
+#if defined(__linux__) && defined(SYS_memfd_create)
+#define HAVE_MEMFD 1
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
 
 // ============================================================================
 // Atoms (cached on load)
@@ -147,6 +178,50 @@ static ERL_NIF_TERM atom_area;
 static ERL_NIF_TERM atom_clip;
 static ERL_NIF_TERM atom_rota;
 static ERL_NIF_TERM atom_is_full;
+static ERL_NIF_TERM atom_raw_size;
+static ERL_NIF_TERM atom_stored_size;
+static ERL_NIF_TERM atom_compressed;
+static ERL_NIF_TERM atom_tiles;
+static ERL_NIF_TERM atom_bytes;
+static ERL_NIF_TERM atom_exclusive_bytes;
+static ERL_NIF_TERM atom_tile_size;
+
+// Bulk pixel formats
+static ERL_NIF_TERM atom_y8;
+static ERL_NIF_TERM atom_rgba;
+static ERL_NIF_TERM atom_rgb;
+static ERL_NIF_TERM atom_native;
+static ERL_NIF_TERM atom_gray;
+
+// Raw data pre-pass options, resampling filters
+static ERL_NIF_TERM atom_filter;
+static ERL_NIF_TERM atom_dither;
+static ERL_NIF_TERM atom_levels;
+static ERL_NIF_TERM atom_threads;
+static ERL_NIF_TERM atom_dirty;
+static ERL_NIF_TERM atom_all;
+static ERL_NIF_TERM atom_box;
+static ERL_NIF_TERM atom_bilinear;
+static ERL_NIF_TERM atom_lanczos;
+
+// Dithering methods
+static ERL_NIF_TERM atom_bayer;
+static ERL_NIF_TERM atom_blue_noise;
+static ERL_NIF_TERM atom_floyd_steinberg;
+static ERL_NIF_TERM atom_atkinson;
+
+// Vector shape tags
+static ERL_NIF_TERM atom_line;
+static ERL_NIF_TERM atom_aa_line;
+static ERL_NIF_TERM atom_polyline;
+static ERL_NIF_TERM atom_aa_polyline;
+static ERL_NIF_TERM atom_polygon;
+static ERL_NIF_TERM atom_fill_polygon;
+static ERL_NIF_TERM atom_circle;
+static ERL_NIF_TERM atom_fill_circle;
+static ERL_NIF_TERM atom_arc;
+static ERL_NIF_TERM atom_rounded_rect;
+static ERL_NIF_TERM atom_fill_rounded_rect;
 
 // Input atoms
 static ERL_NIF_TERM atom_type;
@@ -155,22 +230,363 @@ static ERL_NIF_TERM atom_matched;
 static ERL_NIF_TERM atom_name;
 static ERL_NIF_TERM atom_path;
 
+// Async refresh notification atoms
+static ERL_NIF_TERM atom_fbink_refresh;
+static ERL_NIF_TERM atom_submitted;
+static ERL_NIF_TERM atom_complete;
+
+// Render thread / draw op atoms
+static ERL_NIF_TERM atom_fbink_done;
+static ERL_NIF_TERM atom_print;
+static ERL_NIF_TERM atom_print_ot;
+static ERL_NIF_TERM atom_fill_rect_gray;
+static ERL_NIF_TERM atom_fill_rect_rgba;
+static ERL_NIF_TERM atom_print_image;
+static ERL_NIF_TERM atom_print_raw_data;
+static ERL_NIF_TERM atom_cls;
+static ERL_NIF_TERM atom_refresh_rect;
+
+// Content-aware waveform selection
+static ERL_NIF_TERM atom_auto;
+
 // ============================================================================
 // Resource type for FBInkDump (opaque, heap-managed)
 // ============================================================================
 
 static ErlNifResourceType *dump_resource_type = NULL;
 
+// Ownership of dump.data: once exported as a resource binary, the data must
+// live as long as the resource, so explicit frees become no-ops.
+enum { DUMP_OWNED = 0, DUMP_EXPORTED, DUMP_FREED };
+
 typedef struct {
-    FBInkDump dump;
+    FBInkDump dump;             // dump.data is NULL while compressed
+    _Atomic int state;
+    ErlNifRWLock *lock;         // Readers use the pixels, writers swap storage
+    uint8_t *packed;            // RLE-compressed pixels (see compress_dump/1)
+    size_t packed_size;
+    void *map;                  // File mapping backing data/packed (load_dump/1)
+    size_t map_size;
 } DumpResource;
 
+// Release the pixel storage, whichever form it is in
+static void dump_release_storage(DumpResource *res) {
+    if (res->map) {
+        munmap(res->map, res->map_size);
+        res->map = NULL;
+        res->dump.data = NULL;
+    } else {
+        fbink_free_dump_data(&res->dump);
+        if (res->packed) enif_free(res->packed);
+    }
+    res->packed = NULL;
+    res->packed_size = 0;
+}
+
+static DumpResource *alloc_dump_resource(void) {
+    DumpResource *res = enif_alloc_resource(dump_resource_type, sizeof(DumpResource));
+    if (!res) return NULL;
+    memset(res, 0, sizeof(DumpResource));
+    atomic_init(&res->state, DUMP_OWNED);
+    res->lock = enif_rwlock_create("fbink_dump");
+    if (!res->lock) {
+        enif_release_resource(res);
+        return NULL;
+    }
+    return res;
+}
+
+// Mark the data as shared with resource binaries. False if already freed.
+static bool dump_export(DumpResource *res) {
+    int expected = DUMP_OWNED;
+    if (atomic_compare_exchange_strong(&res->state, &expected, DUMP_EXPORTED))
+        return true;
+    return expected == DUMP_EXPORTED;
+}
+
 static void dump_resource_dtor(ErlNifEnv *env, void *obj) {
     (void)env;
     DumpResource *res = (DumpResource *)obj;
+    dump_release_storage(res);
+    if (res->lock) enif_rwlock_destroy(res->lock);
+}
+
+// ============================================================================
+// Dump compression (pixel-unit RLE)
+// ============================================================================
+//
+// eInk screens are mostly long runs of a handful of gray levels, which RLE on
+// whole pixels captures almost entirely at memset/memcpy speed. Each row of
+// `stride` bytes is coded on its own, so rows (and bands of rows) can be
+// decoded sequentially without any index. A row is a sequence of tokens, each
+// a LEB128 varint `count << 1 | is_run` followed by one pixel (run) or `count`
+// pixels (literal), then the `stride % unit` tail bytes verbatim.
+
+#define RLE_MIN_RUN 3
+
+static unsigned int rle_unit(uint8_t bpp) {
+    return bpp >= 8 ? bpp / 8u : 1u;
+}
+
+static uint8_t *rle_put_varint(uint8_t *o, size_t v) {
+    while (v >= 0x80) {
+        *o++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *o++ = (uint8_t)v;
+    return o;
+}
+
+static const uint8_t *rle_get_varint(const uint8_t *p, const uint8_t *end, size_t *v) {
+    size_t r = 0;
+    for (unsigned int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        r |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = r;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Encode one row; returns the new output position or NULL if `o_end` is hit
+static inline uint8_t *rle_encode_row(const uint8_t *row, size_t stride, unsigned int unit,
+                                      uint8_t *o, const uint8_t *o_end) {
+    size_t units = stride / unit;
+    size_t i = 0, lit = 0;
+    while (i < units) {
+        size_t j = i + 1;
+        while (j < units && memcmp(row + j * unit, row + i * unit, unit) == 0)
+            j++;
+        if (j - i < RLE_MIN_RUN) {
+            i++;
+            continue;
+        }
+        if (lit < i) {
+            if ((size_t)(o_end - o) < 10 + (i - lit) * unit) return NULL;
+            o = rle_put_varint(o, (i - lit) << 1);
+            memcpy(o, row + lit * unit, (i - lit) * unit);
+            o += (i - lit) * unit;
+        }
+        if ((size_t)(o_end - o) < 10 + unit) return NULL;
+        o = rle_put_varint(o, ((j - i) << 1) | 1);
+        memcpy(o, row + i * unit, unit);
+        o += unit;
+        i = lit = j;
+    }
+    size_t tail = stride % unit;
+    if ((size_t)(o_end - o) < 10 + (units - lit) * unit + tail) return NULL;
+    if (lit < units) {
+        o = rle_put_varint(o, (units - lit) << 1);
+        memcpy(o, row + lit * unit, (units - lit) * unit);
+        o += (units - lit) * unit;
+    }
+    memcpy(o, row + units * unit, tail);
+    return o + tail;
+}
+
+// Compress `rows` rows; returns the packed size, or 0 if it would not shrink
+static size_t rle_encode(const uint8_t *data, size_t stride, size_t rows, unsigned int unit,
+                         uint8_t *out, size_t cap) {
+    uint8_t *o = out;
+    const uint8_t *o_end = out + cap;
+    for (size_t y = 0; y < rows && o; y++) {
+        const uint8_t *row = data + y * stride;
+        // Specialize the common pixel sizes so memcmp/memcpy inline
+        switch (unit) {
+        case 1:  o = rle_encode_row(row, stride, 1, o, o_end); break;
+        case 2:  o = rle_encode_row(row, stride, 2, o, o_end); break;
+        case 4:  o = rle_encode_row(row, stride, 4, o, o_end); break;
+        default: o = rle_encode_row(row, stride, unit, o, o_end); break;
+        }
+    }
+    return o ? (size_t)(o - out) : 0;
+}
+
+// Decode `rows` rows from *pp into out; returns false on malformed input
+static bool rle_decode_rows(const uint8_t **pp, const uint8_t *end, size_t stride,
+                            size_t rows, unsigned int unit, uint8_t *out) {
+    const uint8_t *p = *pp;
+    size_t units = stride / unit, tail = stride % unit;
+    for (size_t y = 0; y < rows; y++) {
+        uint8_t *row = out + y * stride;
+        size_t pos = 0;
+        while (pos < units) {
+            size_t v;
+            if (!(p = rle_get_varint(p, end, &v))) return false;
+            size_t n = v >> 1;
+            if (n == 0 || n > units - pos) return false;
+            uint8_t *dst = row + pos * unit;
+            if (v & 1) {
+                if ((size_t)(end - p) < unit) return false;
+                if (unit == 1) {
+                    memset(dst, *p, n);
+                } else {
+                    // Fill by doubling the already written pattern
+                    size_t total = n * unit, done = unit;
+                    memcpy(dst, p, unit);
+                    while (done < total) {
+                        size_t chunk = done < total - done ? done : total - done;
+                        memcpy(dst + done, dst, chunk);
+                        done += chunk;
+                    }
+                }
+                p += unit;
+            } else {
+                if ((size_t)(end - p) < n * unit) return false;
+                memcpy(dst, p, n * unit);
+                p += n * unit;
+            }
+            pos += n;
+        }
+        if ((size_t)(end - p) < tail) return false;
+        memcpy(row + units * unit, p, tail);
+        p += tail;
+    }
+    *pp = p;
+    return true;
+}
+
+// Decode a compressed dump back into its raw layout (dump.size bytes)
+static bool dump_unpack(const DumpResource *res, uint8_t *out) {
+    const FBInkDump *d = &res->dump;
+    size_t rows = d->size / d->stride, rest = d->size % d->stride;
+    const uint8_t *p = res->packed, *end = res->packed + res->packed_size;
+    if (!rle_decode_rows(&p, end, d->stride, rows, rle_unit(d->bpp), out))
+        return false;
+    if ((size_t)(end - p) != rest) return false;
+    memcpy(out + rows * d->stride, p, rest);
+    return true;
+}
+
+// ============================================================================
+// Resource type for cached images (decoded once, blitted many times)
+// ============================================================================
+//
+// The image is kept as a dump: scaled, dithered and packed to the
+// framebuffer's pixel format and orientation, so a blit is a plain
+// fbink_restore of it at a new position. See load_image for how it is made.
+
+static ErlNifResourceType *image_resource_type = NULL;
+
+typedef struct {
+    FBInkDump dump;
+    FBInkRect rect;             // Area the image was decoded at (get_last_rect space)
+    int xform;                  // Rotation from that space to the dump's, -1 if unknown
+    uint32_t screen_w;          // Screen size at load time
+    uint32_t screen_h;
+} ImageResource;
+
+static void image_resource_dtor(ErlNifEnv *env, void *obj) {
+    (void)env;
+    ImageResource *res = (ImageResource *)obj;
     fbink_free_dump_data(&res->dump);
 }
 
+// Map a rect (signed, may lie partly off-screen) through one of the four
+// rotations of a w x h screen.
+typedef struct {
+    int left, top, width, height;
+} IRect;
+
+static IRect irect_rotate(IRect r, int xform, int w, int h) {
+    IRect o = r;
+    switch (xform) {
+    case 1:
+        o = (IRect){ h - r.top - r.height, r.left, r.height, r.width };
+        break;
+    case 2:
+        o = (IRect){ w - r.left - r.width, h - r.top - r.height, r.width, r.height };
+        break;
+    case 3:
+        o = (IRect){ r.top, w - r.left - r.width, r.height, r.width };
+        break;
+    default:
+        break;
+    }
+    return o;
+}
+
+// Which rotation turns `from` into `to` on a w x h screen (-1 if none does)
+static int detect_xform(const FBInkRect *from, const FBInkRect *to, int w, int h) {
+    IRect f = { from->left, from->top, from->width, from->height };
+    for (int x = 0; x < 4; x++) {
+        IRect o = irect_rotate(f, x, w, h);
+        if (o.left == to->left && o.top == to->top &&
+            o.width == to->width && o.height == to->height)
+            return x;
+    }
+    return -1;
+}
+
+// Rotation from canonical to native coordinates on a sw x sh (canonical)
+// screen. Found by dumping the top-left pixel, as no two rotations put that
+// one in the same corner; 0 if it can't be told.
+static int screen_xform(int fbfd, int sw, int sh) {
+    FBInkRect probe = { 0, 0, 1, 1 };
+    FBInkDump d = { 0 };
+    if (fbink_rect_dump(fbfd, &probe, &d) < 0) return 0;
+    int xform = 0;
+    for (int x = 0; x < 4; x++) {
+        IRect o = irect_rotate((IRect){ 0, 0, 1, 1 }, x, sw, sh);
+        if (o.left >= d.area.left && o.left < d.area.left + d.area.width &&
+            o.top >= d.area.top && o.top < d.area.top + d.area.height) {
+            xform = x;
+            break;
+        }
+    }
+    fbink_free_dump_data(&d);
+    return xform;
+}
+
+// ============================================================================
+// Resource type for off-screen canvases
+// ============================================================================
+//
+// A full-screen copy of the framebuffer in its native pixel format and
+// orientation, drawn into without touching the screen, then committed (its
+// dirty rects copied back with fbink_restore) under a single refresh.
+
+static ErlNifResourceType *canvas_resource_type = NULL;
+
+#define CANVAS_MAX_DIRTY 32
+
+typedef struct {
+    ErlNifMutex *lock;
+    FBInkDump dump;             // Full screen, native space
+    bool invert;                // 8bpp framebuffer with inverted grayscale
+    FBInkRect dirty[CANVAS_MAX_DIRTY];
+    int ndirty;
+} CanvasResource;
+
+static void canvas_resource_dtor(ErlNifEnv *env, void *obj) {
+    (void)env;
+    CanvasResource *c = (CanvasResource *)obj;
+    fbink_free_dump_data(&c->dump);
+    if (c->lock) enif_mutex_destroy(c->lock);
+}
+
+// ============================================================================
+// Resource types for precompiled configs (immutable, zero-decode fast path)
+// ============================================================================
+
+static ErlNifResourceType *config_resource_type = NULL;
+static ErlNifResourceType *ot_config_resource_type = NULL;
+static ErlNifResourceType *rect_resource_type = NULL;
+
+typedef struct {
+    FBInkConfig cfg;
+} ConfigResource;
+
+typedef struct {
+    FBInkOTConfig cfg;
+} OTConfigResource;
+
+typedef struct {
+    FBInkRect rect;
+} RectResource;
+
 // ============================================================================
 // Helper: make atom
 // ============================================================================
@@ -190,11 +606,9 @@ static ERL_NIF_TERM make_atom(ErlNifEnv *env, const char *name) {
 static bool get_bool(ErlNifEnv *env, ERL_NIF_TERM map, ERL_NIF_TERM key, bool default_val) {
     ERL_NIF_TERM val;
     if (!enif_get_map_value(env, map, key, &val)) return default_val;
-    // Accept atom true/false or integer 1/0
-    char buf[8];
-    if (enif_get_atom(env, val, buf, sizeof(buf), ERL_NIF_LATIN1)) {
-        return strcmp(buf, "true") == 0;
-    }
+    // Accept atom true/false or integer 1/0 (atoms compare by identity)
+    if (enif_is_identical(val, atom_true)) return true;
+    if (enif_is_atom(env, val)) return false;
     int ival;
     if (enif_get_int(env, val, &ival)) return ival != 0;
     return default_val;
@@ -246,7 +660,17 @@ static double get_double(ErlNifEnv *env, ERL_NIF_TERM map, ERL_NIF_TERM key, dou
 // Convert Elixir map -> FBInkConfig
 // ============================================================================
 
+// wfm_mode value standing for `wfm_mode: :auto` (content-aware selection).
+// It is never passed to FBInk: refresh paths resolve it to a real mode first.
+#define WFM_CONTENT_AUTO 0xFF
+
 static void map_to_fbink_config(ErlNifEnv *env, ERL_NIF_TERM map, FBInkConfig *cfg) {
+    ConfigResource *res;
+    if (enif_get_resource(env, map, config_resource_type, (void **)&res)) {
+        *cfg = res->cfg;
+        return;
+    }
+
     memset(cfg, 0, sizeof(FBInkConfig));
 
     cfg->row            = (short int)get_int(env, map, atom_row, 0);
@@ -275,7 +699,11 @@ static void map_to_fbink_config(ErlNifEnv *env, ERL_NIF_TERM map, FBInkConfig *c
     cfg->valign         = (ALIGN_INDEX_T)get_uint(env, map, atom_valign, 0);
     cfg->scaled_width   = (short int)get_int(env, map, atom_scaled_width, 0);
     cfg->scaled_height  = (short int)get_int(env, map, atom_scaled_height, 0);
-    cfg->wfm_mode       = (WFM_MODE_INDEX_T)get_uint(env, map, atom_wfm_mode, 0);
+    ERL_NIF_TERM wfm;
+    if (enif_get_map_value(env, map, atom_wfm_mode, &wfm) && enif_is_identical(wfm, atom_auto))
+        cfg->wfm_mode   = WFM_CONTENT_AUTO;
+    else
+        cfg->wfm_mode   = (WFM_MODE_INDEX_T)get_uint(env, map, atom_wfm_mode, 0);
     cfg->dithering_mode = (HW_DITHER_INDEX_T)get_uint(env, map, atom_dithering_mode, 0);
     cfg->sw_dithering   = get_bool(env, map, atom_sw_dithering, false);
     cfg->cfa_mode       = (CFA_MODE_INDEX_T)get_uint(env, map, atom_cfa_mode, 0);
@@ -292,6 +720,12 @@ static void map_to_fbink_config(ErlNifEnv *env, ERL_NIF_TERM map, FBInkConfig *c
 // ============================================================================
 
 static void map_to_fbink_ot_config(ErlNifEnv *env, ERL_NIF_TERM map, FBInkOTConfig *cfg) {
+    OTConfigResource *res;
+    if (enif_get_resource(env, map, ot_config_resource_type, (void **)&res)) {
+        *cfg = res->cfg;
+        return;
+    }
+
     memset(cfg, 0, sizeof(FBInkOTConfig));
 
     // Margins sub-map
@@ -318,6 +752,12 @@ static void map_to_fbink_ot_config(ErlNifEnv *env, ERL_NIF_TERM map, FBInkOTConf
 // ============================================================================
 
 static void map_to_fbink_rect(ErlNifEnv *env, ERL_NIF_TERM map, FBInkRect *rect) {
+    RectResource *res;
+    if (enif_get_resource(env, map, rect_resource_type, (void **)&res)) {
+        *rect = res->rect;
+        return;
+    }
+
     memset(rect, 0, sizeof(FBInkRect));
     rect->left   = (unsigned short int)get_uint(env, map, atom_left, 0);
     rect->top    = (unsigned short int)get_uint(env, map, atom_top, 0);
@@ -501,754 +941,5742 @@ static ERL_NIF_TERM make_ok_or_error(ErlNifEnv *env, int rv) {
 }
 
 // ============================================================================
-// NIF: fbink_version/0
+// Content-aware waveform selection (wfm_mode: :auto)
 // ============================================================================
+//
+// The damaged region is read back with fbink_rect_dump, reduced to 8-bit
+// luminance and histogrammed. Regions of only 0x00/0xFF pixels get DU, mostly
+// white with a little antialiasing gray (text) get GL16/REAGL, anything else
+// (images, gradients) gets GC16. Panel capabilities from fbink_get_state pick
+// the eclipse (nightmode) or color variants where available.
 
-static ERL_NIF_TERM nif_fbink_version(ErlNifEnv *env, int argc,
-                                       const ERL_NIF_TERM argv[]) {
-    (void)argc; (void)argv;
-    const char *ver = fbink_version();
-    return enif_make_string(env, ver, ERL_NIF_LATIN1);
-}
+#define WFM_SAMPLE_PIXELS (256 * 1024)  // Rows are skipped beyond this many pixels
 
-// ============================================================================
-// NIF: fbink_target/0
-// ============================================================================
+static _Atomic uint64_t wfm_auto_counts[256];
 
-static ERL_NIF_TERM nif_fbink_target(ErlNifEnv *env, int argc,
-                                      const ERL_NIF_TERM argv[]) {
-    (void)argc; (void)argv;
-    return enif_make_uint(env, (unsigned int)fbink_target());
+static FBInkRect full_screen_rect(const FBInkConfig *cfg) {
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    fbink_get_state(cfg, &state);
+    FBInkRect r = { 0, 0, (unsigned short int)state.screen_width,
+                    (unsigned short int)state.screen_height };
+    return r;
 }
 
-// ============================================================================
-// NIF: fbink_features/0
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_features(ErlNifEnv *env, int argc,
-                                        const ERL_NIF_TERM argv[]) {
-    (void)argc; (void)argv;
-    return enif_make_uint(env, fbink_features());
+// Convert one dumped row to 8-bit luminance
+static void row_to_y8(const uint8_t *src, uint8_t bpp, unsigned int w, uint8_t *dst) {
+    switch (bpp) {
+    case 4:
+        for (unsigned int x = 0; x < w; x++) {
+            uint8_t v = src[x >> 1];
+            dst[x] = (uint8_t)(((x & 1) ? (v & 0x0F) : (v >> 4)) * 0x11);
+        }
+        break;
+    case 8:
+        memcpy(dst, src, w);
+        break;
+    case 16:
+        for (unsigned int x = 0; x < w; x++) {
+            uint16_t v = (uint16_t)(src[2 * x] | (src[2 * x + 1] << 8));
+            unsigned int r = (((v >> 11) & 0x1F) * 527 + 23) >> 6;
+            unsigned int g = (((v >> 5) & 0x3F) * 259 + 33) >> 6;
+            unsigned int b = ((v & 0x1F) * 527 + 23) >> 6;
+            dst[x] = (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);
+        }
+        break;
+    case 24:
+    case 32: {
+        unsigned int n = bpp / 8;
+        for (unsigned int x = 0; x < w; x++) {
+            const uint8_t *px = src + x * n;  // B, G, R(, A)
+            dst[x] = (uint8_t)((px[0] * 29 + px[1] * 150 + px[2] * 77) >> 8);
+        }
+        break;
+    }
+    default:
+        memset(dst, 0xFF, w);
+        break;
+    }
 }
 
-// ============================================================================
-// NIF: fbink_open/0
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_open(ErlNifEnv *env, int argc,
-                                    const ERL_NIF_TERM argv[]) {
-    (void)argc; (void)argv;
-    int fd = fbink_open();
-    if (fd < 0) {
-        return make_error_int(env, fd);
+// Same as row_to_y8, to RGBA quadruplets
+static void row_to_rgba(const uint8_t *src, uint8_t bpp, unsigned int w, uint8_t *dst) {
+    for (unsigned int x = 0; x < w; x++, dst += 4) {
+        switch (bpp) {
+        case 4: {
+            uint8_t v = src[x >> 1];
+            dst[0] = dst[1] = dst[2] = (uint8_t)(((x & 1) ? (v & 0x0F) : (v >> 4)) * 0x11);
+            dst[3] = 0xFF;
+            break;
+        }
+        case 8:
+            dst[0] = dst[1] = dst[2] = src[x];
+            dst[3] = 0xFF;
+            break;
+        case 16: {
+            uint16_t v = (uint16_t)(src[2 * x] | (src[2 * x + 1] << 8));
+            dst[0] = (uint8_t)((((v >> 11) & 0x1F) * 527 + 23) >> 6);
+            dst[1] = (uint8_t)((((v >> 5) & 0x3F) * 259 + 33) >> 6);
+            dst[2] = (uint8_t)(((v & 0x1F) * 527 + 23) >> 6);
+            dst[3] = 0xFF;
+            break;
+        }
+        case 24:
+        case 32: {
+            const uint8_t *px = src + x * (bpp / 8u);  // B, G, R(, A)
+            dst[0] = px[2];
+            dst[1] = px[1];
+            dst[2] = px[0];
+            dst[3] = bpp == 32 ? px[3] : 0xFF;
+            break;
+        }
+        default:
+            memset(dst, 0xFF, 4);
+            break;
+        }
     }
-    return make_ok(env, enif_make_int(env, fd));
 }
 
 // ============================================================================
-// NIF: fbink_close/1
+// Buffer packing (Y8 / RGB24 / RGBA32 to the framebuffer's pixel format)
 // ============================================================================
+//
+// Each kernel converts n pixels of sn bytes each (1 = Y8, 3 = RGB, 4 = RGBA).
+// The SIMD blocks handle 16 pixels (8 for SSE2 RGB565) per iteration; the
+// scalar loops finish the tail, and do all the work without SSE2/NEON.
+// Luma and RGB565 packing match fbink_pack_pixel_rgba.
 
-static ERL_NIF_TERM nif_fbink_close(ErlNifEnv *env, int argc,
-                                     const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
-        return enif_make_badarg(env);
+static inline uint8_t pack_luma(unsigned int r, unsigned int g, unsigned int b) {
+    return (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);
+}
 
-    int rv = fbink_close(fbfd);
-    return make_ok_or_error(env, rv);
+static inline void pack_565(unsigned int r, unsigned int g, unsigned int b, uint8_t *dst) {
+    unsigned int v = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+    dst[0] = (uint8_t)v;
+    dst[1] = (uint8_t)(v >> 8);
 }
 
-// ============================================================================
-// NIF: fbink_init/2
-// ============================================================================
+#if defined(__SSE2__)
+// Split 4 RGBA pixels into 32-bit R, G and B lanes
+static inline void sse2_split_rgba(__m128i v, __m128i *r, __m128i *g, __m128i *b) {
+    __m128i lo = _mm_set1_epi32(0xFF);
+    *r = _mm_and_si128(v, lo);
+    *g = _mm_and_si128(_mm_srli_epi32(v, 8), lo);
+    *b = _mm_and_si128(_mm_srli_epi32(v, 16), lo);
+}
 
-static ERL_NIF_TERM nif_fbink_init(ErlNifEnv *env, int argc,
-                                    const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
-        return enif_make_badarg(env);
+// Pack two vectors of 32-bit lanes holding 16-bit values, without saturating
+static inline __m128i sse2_pack_u32(__m128i a, __m128i b) {
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                           _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+#endif
+
+static void pack_to_y8(const uint8_t *src, unsigned int sn, size_t n, uint8_t *dst,
+                       bool invert) {
+    uint8_t x = invert ? 0xFF : 0x00;
+    size_t i = 0;
+#if defined(__SSE2__)
+    __m128i m = _mm_set1_epi8((char)x);
+    if (sn == 1) {
+        for (; i + 16 <= n; i += 16)
+            _mm_storeu_si128((__m128i *)(dst + i),
+                             _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), m));
+    } else if (sn == 4) {
+        __m128i kr = _mm_set1_epi16(77), kg = _mm_set1_epi16(150), kb = _mm_set1_epi16(29);
+        for (; i + 16 <= n; i += 16) {
+            __m128i y[2];
+            for (int h = 0; h < 2; h++) {
+                __m128i r0, g0, b0, r1, g1, b1;
+                const uint8_t *p = src + (i + (size_t)h * 8) * 4;
+                sse2_split_rgba(_mm_loadu_si128((const __m128i *)p), &r0, &g0, &b0);
+                sse2_split_rgba(_mm_loadu_si128((const __m128i *)(p + 16)), &r1, &g1, &b1);
+                // At most 255 * 256, so 16-bit lanes don't overflow
+                __m128i acc = _mm_mullo_epi16(_mm_packs_epi32(r0, r1), kr);
+                acc = _mm_add_epi16(acc, _mm_mullo_epi16(_mm_packs_epi32(g0, g1), kg));
+                acc = _mm_add_epi16(acc, _mm_mullo_epi16(_mm_packs_epi32(b0, b1), kb));
+                y[h] = _mm_srli_epi16(acc, 8);
+            }
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_packus_epi16(y[0], y[1]), m));
+        }
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t m = vdupq_n_u8(x);
+    if (sn == 1) {
+        for (; i + 16 <= n; i += 16)
+            vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), m));
+    } else {
+        uint8x8_t kr = vdup_n_u8(77), kg = vdup_n_u8(150), kb = vdup_n_u8(29);
+        for (; i + 16 <= n; i += 16) {
+            uint8x16_t r, g, b;
+            if (sn == 4) {
+                uint8x16x4_t p = vld4q_u8(src + i * 4);
+                r = p.val[0]; g = p.val[1]; b = p.val[2];
+            } else {
+                uint8x16x3_t p = vld3q_u8(src + i * 3);
+                r = p.val[0]; g = p.val[1]; b = p.val[2];
+            }
+            uint16x8_t lo = vmull_u8(vget_low_u8(r), kr);
+            lo = vmlal_u8(lo, vget_low_u8(g), kg);
+            lo = vmlal_u8(lo, vget_low_u8(b), kb);
+            uint16x8_t hi = vmull_u8(vget_high_u8(r), kr);
+            hi = vmlal_u8(hi, vget_high_u8(g), kg);
+            hi = vmlal_u8(hi, vget_high_u8(b), kb);
+            vst1q_u8(dst + i, veorq_u8(vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)), m));
+        }
+    }
+#endif
+    if (sn == 1) {
+        for (; i < n; i++) dst[i] = src[i] ^ x;
+    } else {
+        for (; i < n; i++) {
+            const uint8_t *p = src + i * sn;
+            dst[i] = pack_luma(p[0], p[1], p[2]) ^ x;
+        }
+    }
+}
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[1], &cfg);
+static void pack_to_565(const uint8_t *src, unsigned int sn, size_t n, uint8_t *dst) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (sn == 1) {
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            for (int h = 0; h < 2; h++) {
+                __m128i y = h ? _mm_unpackhi_epi8(v, zero) : _mm_unpacklo_epi8(v, zero);
+                __m128i rb = _mm_srli_epi16(y, 3);
+                __m128i px = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(rb, 11), rb),
+                                          _mm_slli_epi16(_mm_srli_epi16(y, 2), 5));
+                _mm_storeu_si128((__m128i *)(dst + (i + (size_t)h * 8) * 2), px);
+            }
+        }
+    } else if (sn == 4) {
+        for (; i + 8 <= n; i += 8) {
+            __m128i px[2];
+            for (int h = 0; h < 2; h++) {
+                __m128i r, g, b;
+                sse2_split_rgba(_mm_loadu_si128((const __m128i *)(src + (i + (size_t)h * 4) * 4)),
+                                &r, &g, &b);
+                px[h] = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(r, 3), 11),
+                                                  _mm_slli_epi32(_mm_srli_epi32(g, 2), 5)),
+                                     _mm_srli_epi32(b, 3));
+            }
+            _mm_storeu_si128((__m128i *)(dst + i * 2), sse2_pack_u32(px[0], px[1]));
+        }
+    }
+#elif defined(__ARM_NEON) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t r, g, b;
+        if (sn == 1) {
+            r = g = b = vld1q_u8(src + i);
+        } else if (sn == 4) {
+            uint8x16x4_t p = vld4q_u8(src + i * 4);
+            r = p.val[0]; g = p.val[1]; b = p.val[2];
+        } else {
+            uint8x16x3_t p = vld3q_u8(src + i * 3);
+            r = p.val[0]; g = p.val[1]; b = p.val[2];
+        }
+        r = vshrq_n_u8(r, 3);
+        g = vshrq_n_u8(g, 2);
+        b = vshrq_n_u8(b, 3);
+        uint16x8_t lo = vorrq_u16(vorrq_u16(vshlq_n_u16(vmovl_u8(vget_low_u8(r)), 11),
+                                            vshlq_n_u16(vmovl_u8(vget_low_u8(g)), 5)),
+                                  vmovl_u8(vget_low_u8(b)));
+        uint16x8_t hi = vorrq_u16(vorrq_u16(vshlq_n_u16(vmovl_u8(vget_high_u8(r)), 11),
+                                            vshlq_n_u16(vmovl_u8(vget_high_u8(g)), 5)),
+                                  vmovl_u8(vget_high_u8(b)));
+        vst1q_u8(dst + i * 2, vreinterpretq_u8_u16(lo));
+        vst1q_u8(dst + i * 2 + 16, vreinterpretq_u8_u16(hi));
+    }
+#endif
+    for (; i < n; i++) {
+        const uint8_t *p = src + i * sn;
+        if (sn == 1)
+            pack_565(p[0], p[0], p[0], dst + i * 2);
+        else
+            pack_565(p[0], p[1], p[2], dst + i * 2);
+    }
+}
 
-    int rv = fbink_init(fbfd, &cfg);
-    return make_ok_or_error(env, rv);
+// To BGR (dn = 3) or BGRA (dn = 4); alpha is kept from RGBA sources, opaque otherwise
+static void pack_to_bgra(const uint8_t *src, unsigned int sn, size_t n, uint8_t *dst,
+                         unsigned int dn) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (dn == 4 && sn == 1) {
+        __m128i opaque = _mm_set1_epi8((char)0xFF);
+        for (; i + 16 <= n; i += 16) {
+            __m128i y = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i yy_lo = _mm_unpacklo_epi8(y, y), ya_lo = _mm_unpacklo_epi8(y, opaque);
+            __m128i yy_hi = _mm_unpackhi_epi8(y, y), ya_hi = _mm_unpackhi_epi8(y, opaque);
+            uint8_t *o = dst + i * 4;
+            _mm_storeu_si128((__m128i *)o, _mm_unpacklo_epi16(yy_lo, ya_lo));
+            _mm_storeu_si128((__m128i *)(o + 16), _mm_unpackhi_epi16(yy_lo, ya_lo));
+            _mm_storeu_si128((__m128i *)(o + 32), _mm_unpacklo_epi16(yy_hi, ya_hi));
+            _mm_storeu_si128((__m128i *)(o + 48), _mm_unpackhi_epi16(yy_hi, ya_hi));
+        }
+    } else if (dn == 4 && sn == 4) {
+        __m128i ga = _mm_set1_epi32((int)0xFF00FF00), lo = _mm_set1_epi32(0xFF);
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+            __m128i rb = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), lo),
+                                      _mm_slli_epi32(_mm_and_si128(v, lo), 16));
+            _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(_mm_and_si128(v, ga), rb));
+        }
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t opaque = vdupq_n_u8(0xFF);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t r, g, b, a = opaque;
+        if (sn == 1) {
+            r = g = b = vld1q_u8(src + i);
+        } else if (sn == 4) {
+            uint8x16x4_t p = vld4q_u8(src + i * 4);
+            r = p.val[0]; g = p.val[1]; b = p.val[2]; a = p.val[3];
+        } else {
+            uint8x16x3_t p = vld3q_u8(src + i * 3);
+            r = p.val[0]; g = p.val[1]; b = p.val[2];
+        }
+        if (dn == 4) {
+            uint8x16x4_t o = { { b, g, r, a } };
+            vst4q_u8(dst + i * 4, o);
+        } else {
+            uint8x16x3_t o = { { b, g, r } };
+            vst3q_u8(dst + i * 3, o);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        const uint8_t *p = src + i * sn;
+        uint8_t *o = dst + i * dn;
+        if (sn == 1) {
+            o[0] = o[1] = o[2] = p[0];
+        } else {
+            o[0] = p[2];
+            o[1] = p[1];
+            o[2] = p[0];
+        }
+        if (dn == 4) o[3] = sn == 4 ? p[3] : 0xFF;
+    }
 }
 
+
 // ============================================================================
-// NIF: fbink_reinit/2
+// Dithering (Y8 to 16, 4 or 2 gray levels)
 // ============================================================================
+//
+// Ordered methods (Bayer, blue noise) compare each pixel against a tiled
+// threshold map, so pixels are independent and vectorized 16 at a time.
+// Error diffusion (Floyd-Steinberg, Atkinson) carries error from one pixel to
+// the next and stays scalar, with the pending error kept in int rows.
+//
+// Every method emits the exact levels FBInk's own quantizer uses: multiples of
+// 255 / (levels - 1), i.e. 0x11 steps for 16 levels.
 
-static ERL_NIF_TERM nif_fbink_reinit(ErlNifEnv *env, int argc,
-                                      const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
-        return enif_make_badarg(env);
+typedef enum {
+    DITHER_BAYER = 0,
+    DITHER_BLUE_NOISE,
+    DITHER_FLOYD_STEINBERG,
+    DITHER_ATKINSON,
+} DitherMethod;
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[1], &cfg);
+#define DITHER_MAP 32  // Threshold maps are DITHER_MAP x DITHER_MAP, tiled
 
-    int rv = fbink_reinit(fbfd, &cfg);
-    return make_ok_or_error(env, rv);
-}
+static uint8_t bayer_map[DITHER_MAP * DITHER_MAP];
+static uint8_t blue_noise_map[DITHER_MAP * DITHER_MAP];
 
-// ============================================================================
-// NIF: fbink_get_state/1
-// ============================================================================
+// Rank r of n to a threshold in [0, 255), centered in its bucket
+static uint8_t dither_threshold(unsigned int r, unsigned int n) {
+    return (uint8_t)(((2 * r + 1) * 255) / (2 * n));
+}
 
-static ERL_NIF_TERM nif_fbink_get_state(ErlNifEnv *env, int argc,
-                                         const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[0], &cfg);
+// Void-and-cluster helpers: energy is a toroidal Gaussian sum over set pixels
+static void vac_toggle(uint8_t *bits, const float *g, float *energy, unsigned int i) {
+    bits[i] ^= 1;
+    float s = bits[i] ? 1.0f : -1.0f;
+    unsigned int ix = i % DITHER_MAP, iy = i / DITHER_MAP;
+    for (unsigned int y = 0; y < DITHER_MAP; y++) {
+        const float *gr = g + ((y - iy) & (DITHER_MAP - 1)) * DITHER_MAP;
+        for (unsigned int x = 0; x < DITHER_MAP; x++)
+            energy[y * DITHER_MAP + x] += s * gr[(x - ix) & (DITHER_MAP - 1)];
+    }
+}
 
-    FBInkState state;
-    memset(&state, 0, sizeof(state));
-    fbink_get_state(&cfg, &state);
+// Tightest cluster (highest energy set pixel) or largest void (lowest energy
+// clear pixel)
+static unsigned int vac_find(const uint8_t *bits, const float *energy, uint8_t set) {
+    unsigned int best = 0;
+    bool found = false;
+    for (unsigned int i = 0; i < DITHER_MAP * DITHER_MAP; i++) {
+        if (bits[i] != set) continue;
+        if (!found || (set ? energy[i] > energy[best] : energy[i] < energy[best])) {
+            best = i;
+            found = true;
+        }
+    }
+    return best;
+}
 
-    return fbink_state_to_map(env, &state);
+static void vac_load(uint8_t *bits, const uint8_t *proto, const float *g, float *energy) {
+    memset(bits, 0, DITHER_MAP * DITHER_MAP);
+    memset(energy, 0, DITHER_MAP * DITHER_MAP * sizeof(float));
+    for (unsigned int i = 0; i < DITHER_MAP * DITHER_MAP; i++)
+        if (proto[i]) vac_toggle(bits, g, energy, i);
 }
 
-// ============================================================================
-// NIF: fbink_state_dump/1
-// ============================================================================
+// Bayer map from the bit-interleave formula, blue noise map from Ulichney's
+// void-and-cluster (deterministic seed, sigma 1.5). Called once from load().
+static void dither_init(void) {
+    enum { N = DITHER_MAP * DITHER_MAP };
+    for (unsigned int y = 0; y < DITHER_MAP; y++) {
+        for (unsigned int x = 0; x < DITHER_MAP; x++) {
+            unsigned int r = 0, xy = x ^ y;
+            for (unsigned int bit = 1; bit < DITHER_MAP; bit <<= 1)
+                r = (r << 2) | ((xy & bit) ? 2 : 0) | ((y & bit) ? 1 : 0);
+            bayer_map[y * DITHER_MAP + x] = dither_threshold(r, N);
+        }
+    }
 
-static ERL_NIF_TERM nif_fbink_state_dump(ErlNifEnv *env, int argc,
-                                          const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[0], &cfg);
+    static float g[N], energy[N];
+    static uint8_t proto[N], bits[N];
+    static uint16_t rank[N];
+    for (unsigned int y = 0; y < DITHER_MAP; y++) {
+        for (unsigned int x = 0; x < DITHER_MAP; x++) {
+            float dx = (float)(x < DITHER_MAP / 2 ? x : DITHER_MAP - x);
+            float dy = (float)(y < DITHER_MAP / 2 ? y : DITHER_MAP - y);
+            g[y * DITHER_MAP + x] = expf(-(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+        }
+    }
 
-    fbink_state_dump(&cfg);
-    return atom_ok;
+    // Initial pattern: 10% of the pixels, then relaxed by moving the tightest
+    // cluster into the largest void until that no longer changes anything
+    memset(proto, 0, sizeof(proto));
+    uint32_t seed = 0x2545F491u;
+    unsigned int ones = 0;
+    while (ones < N / 10) {
+        seed = seed * 1664525u + 1013904223u;
+        unsigned int i = (seed >> 16) % N;
+        if (!proto[i]) {
+            proto[i] = 1;
+            ones++;
+        }
+    }
+    vac_load(bits, proto, g, energy);
+    for (unsigned int iter = 0; iter < N; iter++) {
+        unsigned int c = vac_find(bits, energy, 1);
+        vac_toggle(bits, g, energy, c);
+        unsigned int v = vac_find(bits, energy, 0);
+        vac_toggle(bits, g, energy, v);
+        if (v == c) break;
+    }
+    memcpy(proto, bits, N);
+
+    // Rank the prototype's pixels by removing clusters, then the rest by
+    // filling voids
+    for (unsigned int r = ones; r-- > 0;) {
+        unsigned int c = vac_find(bits, energy, 1);
+        rank[c] = (uint16_t)r;
+        vac_toggle(bits, g, energy, c);
+    }
+    vac_load(bits, proto, g, energy);
+    for (unsigned int r = ones; r < N; r++) {
+        unsigned int v = vac_find(bits, energy, 0);
+        rank[v] = (uint16_t)r;
+        vac_toggle(bits, g, energy, v);
+    }
+    for (unsigned int i = 0; i < N; i++)
+        blue_noise_map[i] = dither_threshold(rank[i], N);
 }
 
-// ============================================================================
-// NIF: fbink_get_last_rect/1
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_get_last_rect(ErlNifEnv *env, int argc,
-                                              const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    int rotated;
-    if (!enif_get_int(env, argv[0], &rotated))
-        return enif_make_badarg(env);
+// One row of ordered dithering against a threshold map row:
+// q = floor((v * (levels - 1) + t) / 255), emitted as q * 255 / (levels - 1)
+static void dither_ordered_row(uint8_t *row, unsigned int w, const uint8_t *tmap,
+                               unsigned int levels) {
+    unsigned int k = levels - 1, step = 255 / k;
+    unsigned int x = 0;
+#if defined(__SSE2__)
+    __m128i vk = _mm_set1_epi16((short)k), vstep = _mm_set1_epi16((short)step);
+    __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+    for (; x + 16 <= w; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+        __m128i t = _mm_loadu_si128((const __m128i *)(tmap + (x & (DITHER_MAP - 1))));
+        __m128i q[2];
+        for (int h = 0; h < 2; h++) {
+            __m128i a = _mm_add_epi16(
+                _mm_mullo_epi16(h ? _mm_unpackhi_epi8(v, zero) : _mm_unpacklo_epi8(v, zero), vk),
+                h ? _mm_unpackhi_epi8(t, zero) : _mm_unpacklo_epi8(t, zero));
+            // a / 255 for a < 65535
+            a = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a, one), _mm_srli_epi16(a, 8)), 8);
+            q[h] = _mm_mullo_epi16(a, vstep);
+        }
+        _mm_storeu_si128((__m128i *)(row + x), _mm_packus_epi16(q[0], q[1]));
+    }
+#elif defined(__ARM_NEON)
+    uint8x8_t vk = vdup_n_u8((uint8_t)k);
+    uint16x8_t one = vdupq_n_u16(1);
+    for (; x + 16 <= w; x += 16) {
+        uint8x16_t v = vld1q_u8(row + x);
+        uint8x16_t t = vld1q_u8(tmap + (x & (DITHER_MAP - 1)));
+        uint16x8_t lo = vaddw_u8(vmull_u8(vget_low_u8(v), vk), vget_low_u8(t));
+        uint16x8_t hi = vaddw_u8(vmull_u8(vget_high_u8(v), vk), vget_high_u8(t));
+        lo = vshrq_n_u16(vaddq_u16(vaddq_u16(lo, one), vshrq_n_u16(lo, 8)), 8);
+        hi = vshrq_n_u16(vaddq_u16(vaddq_u16(hi, one), vshrq_n_u16(hi, 8)), 8);
+        vst1q_u8(row + x, vcombine_u8(vmovn_u16(vmulq_n_u16(lo, (uint16_t)step)),
+                                      vmovn_u16(vmulq_n_u16(hi, (uint16_t)step))));
+    }
+#endif
+    for (; x < w; x++)
+        row[x] = (uint8_t)(((row[x] * k + tmap[x & (DITHER_MAP - 1)]) / 255) * step);
+}
 
-    FBInkRect rect = fbink_get_last_rect(rotated != 0);
-    return fbink_rect_to_map(env, &rect);
+static inline int dither_quantize(int v, unsigned int k, unsigned int step) {
+    if (v <= 0) return 0;
+    if (v >= 255) return 255;
+    return ((v * (int)k + 127) / 255) * (int)step;
 }
 
-// ============================================================================
+// Row-at-a-time dithering state, so a buffer can be dithered in bands that
+// produce the same bytes as one pass. Error diffusion carries its pending
+// error rows from one call to the next; ordered methods only need the row index.
+typedef struct {
+    DitherMethod method;
+    unsigned int w, levels, k, step;
+    unsigned int y;             // Absolute index of the next row
+    int *err;                   // Error rows, padded by 2 on each side
+    int *rows[3];               // Current row, next, the one after
+} Ditherer;
+
+static bool ditherer_init(Ditherer *d, DitherMethod method, unsigned int w, unsigned int levels,
+                          unsigned int y0) {
+    memset(d, 0, sizeof(*d));
+    d->method = method;
+    d->w = w;
+    d->levels = levels;
+    d->k = levels - 1;
+    d->step = 255 / d->k;
+    d->y = y0;
+    if (method == DITHER_FLOYD_STEINBERG || method == DITHER_ATKINSON) {
+        size_t rw = (size_t)w + 4;
+        d->err = enif_alloc(rw * 3 * sizeof(int));
+        if (!d->err) return false;
+        memset(d->err, 0, rw * 3 * sizeof(int));
+        for (int i = 0; i < 3; i++) d->rows[i] = d->err + (size_t)i * rw + 2;
+    }
+    return true;
+}
+
+static void ditherer_free(Ditherer *d) {
+    if (d->err) enif_free(d->err);
+    d->err = NULL;
+}
+
+// Serpentine Floyd-Steinberg; errors are kept in 1/16ths
+static void dither_floyd_steinberg_row(Ditherer *d, uint8_t *row) {
+    int *cur = d->rows[0], *next = d->rows[1];
+    int w = (int)d->w, dir = (d->y & 1) ? -1 : 1;
+    memset(next - 2, 0, (d->w + 4) * sizeof(int));
+    for (int i = 0; i < w; i++) {
+        int x = dir < 0 ? w - 1 - i : i;
+        int v = row[x] + cur[x] / 16;
+        int q = dither_quantize(v, d->k, d->step);
+        int e = v - q;
+        row[x] = (uint8_t)q;
+        cur[x + dir] += e * 7;
+        next[x - dir] += e * 3;
+        next[x] += e * 5;
+        next[x + dir] += e;
+    }
+    d->rows[0] = next;
+    d->rows[1] = cur;
+}
+
+// Atkinson: 6/8 of the error goes to two pixels right, three below and one two
+// rows down; the remaining quarter is dropped, which keeps highlights clean
+static void dither_atkinson_row(Ditherer *d, uint8_t *row) {
+    int *cur = d->rows[0], *n1 = d->rows[1], *n2 = d->rows[2];
+    for (int x = 0; x < (int)d->w; x++) {
+        int v = row[x] + cur[x] / 8;
+        int q = dither_quantize(v, d->k, d->step);
+        int e = v - q;
+        row[x] = (uint8_t)q;
+        cur[x + 1] += e;
+        cur[x + 2] += e;
+        n1[x - 1] += e;
+        n1[x] += e;
+        n1[x + 1] += e;
+        n2[x] += e;
+    }
+    memset(cur - 2, 0, (d->w + 4) * sizeof(int));
+    d->rows[0] = n1;
+    d->rows[1] = n2;
+    d->rows[2] = cur;
+}
+
+// Dither the next h rows (back to back, w wide) in place
+static void ditherer_rows(Ditherer *d, uint8_t *buf, unsigned int h) {
+    for (unsigned int i = 0; i < h; i++, d->y++) {
+        uint8_t *row = buf + (size_t)i * d->w;
+        switch (d->method) {
+        case DITHER_FLOYD_STEINBERG:
+            dither_floyd_steinberg_row(d, row);
+            break;
+        case DITHER_ATKINSON:
+            dither_atkinson_row(d, row);
+            break;
+        default: {
+            const uint8_t *map = d->method == DITHER_BAYER ? bayer_map : blue_noise_map;
+            dither_ordered_row(row, d->w, map + (d->y & (DITHER_MAP - 1)) * DITHER_MAP,
+                               d->levels);
+            break;
+        }
+        }
+    }
+}
+
+// Dither a w x h Y8 buffer in place. False on allocation failure.
+static bool dither_y8(uint8_t *buf, unsigned int w, unsigned int h, DitherMethod method,
+                      unsigned int levels) {
+    Ditherer d;
+    if (!ditherer_init(&d, method, w, levels, 0)) return false;
+    ditherer_rows(&d, buf, h);
+    ditherer_free(&d);
+    return true;
+}
+
+// Dither a dump's pixels in place, through Y8. Color is dropped.
+static bool dither_dump(FBInkDump *d, DitherMethod method, unsigned int levels) {
+    unsigned int w = d->area.width, h = d->area.height;
+    if (w == 0 || h == 0) return true;
+    uint8_t *y8 = enif_alloc((size_t)w * h);
+    if (!y8) return false;
+    for (unsigned int y = 0; y < h; y++)
+        row_to_y8(d->data + (size_t)y * d->stride, d->bpp, w, y8 + (size_t)y * w);
+    if (!dither_y8(y8, w, h, method, levels)) {
+        enif_free(y8);
+        return false;
+    }
+    for (unsigned int y = 0; y < h; y++) {
+        const uint8_t *src = y8 + (size_t)y * w;
+        uint8_t *dst = d->data + (size_t)y * d->stride;
+        switch (d->bpp) {
+        case 4:
+            for (unsigned int x = 0; x < w; x++) {
+                uint8_t n = src[x] >> 4;
+                dst[x >> 1] = (x & 1) ? (uint8_t)((dst[x >> 1] & 0xF0) | n)
+                                      : (uint8_t)((dst[x >> 1] & 0x0F) | (n << 4));
+            }
+            break;
+        case 8:
+            memcpy(dst, src, w);
+            break;
+        case 16:
+            pack_to_565(src, 1, w, dst);
+            break;
+        default:
+            pack_to_bgra(src, 1, w, dst, d->bpp / 8u);
+            break;
+        }
+    }
+    enif_free(y8);
+    return true;
+}
+
+// ============================================================================
+// Worker pool (band-parallel image work)
+// ============================================================================
+//
+// A few NIF-owned threads, started in load(), run CPU-bound jobs (resampling
+// and pipeline bands) off one FIFO. Jobs live in the submitter's memory. A
+// thread waiting for its jobs runs queued ones itself in the meantime, so the
+// calling (dirty scheduler) thread counts as a worker and waits can't
+// deadlock when every pool thread is busy.
+
+#define POOL_THREADS 3          // Plus the caller: up to 4 bands at once
+
+typedef struct PoolJob {
+    struct PoolJob *next;
+    void (*fn)(void *arg);
+    void *arg;
+    bool done;
+} PoolJob;
+
+static struct {
+    ErlNifMutex *lock;
+    ErlNifCond *work;           // Jobs were queued, or the pool is stopping
+    ErlNifCond *done;           // Some job finished
+    ErlNifTid tids[POOL_THREADS];
+    unsigned int nthreads;
+    PoolJob *head;
+    PoolJob *tail;
+    bool running;
+} pool;
+
+// Called and returns with pool.lock held
+static void pool_run_locked(PoolJob *job) {
+    pool.head = job->next;
+    if (!pool.head) pool.tail = NULL;
+    enif_mutex_unlock(pool.lock);
+    job->fn(job->arg);
+    enif_mutex_lock(pool.lock);
+    job->done = true;
+    enif_cond_broadcast(pool.done);
+}
+
+static void *pool_main(void *arg) {
+    (void)arg;
+    enif_mutex_lock(pool.lock);
+    for (;;) {
+        while (!pool.head && pool.running)
+            enif_cond_wait(pool.work, pool.lock);
+        if (!pool.head) break;
+        pool_run_locked(pool.head);
+    }
+    enif_mutex_unlock(pool.lock);
+    return NULL;
+}
+
+// Number of threads that can work on one caller's jobs, the caller included
+static unsigned int pool_width(void) {
+    return pool.nthreads + 1;
+}
+
+static void pool_submit(PoolJob *job, void (*fn)(void *), void *arg) {
+    job->next = NULL;
+    job->fn = fn;
+    job->arg = arg;
+    job->done = false;
+    if (pool.nthreads == 0) {
+        fn(arg);
+        job->done = true;
+        return;
+    }
+    enif_mutex_lock(pool.lock);
+    if (pool.tail)
+        pool.tail->next = job;
+    else
+        pool.head = job;
+    pool.tail = job;
+    enif_cond_signal(pool.work);
+    enif_mutex_unlock(pool.lock);
+}
+
+static void pool_wait(PoolJob *job) {
+    if (pool.nthreads == 0) return;
+    enif_mutex_lock(pool.lock);
+    while (!job->done) {
+        if (pool.head)
+            pool_run_locked(pool.head);
+        else
+            enif_cond_wait(pool.done, pool.lock);
+    }
+    enif_mutex_unlock(pool.lock);
+}
+
+static int pool_start(void) {
+    pool.lock = enif_mutex_create("fbink_pool");
+    pool.work = enif_cond_create("fbink_pool_work");
+    pool.done = enif_cond_create("fbink_pool_done");
+    if (!pool.lock || !pool.work || !pool.done) return -1;
+    pool.head = pool.tail = NULL;
+    pool.running = true;
+
+    // No point in more workers than spare cores
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int want = ncpu > 1 ? (unsigned int)(ncpu - 1) : 0;
+    if (want > POOL_THREADS) want = POOL_THREADS;
+    pool.nthreads = 0;
+    while (pool.nthreads < want &&
+           enif_thread_create("fbink_pool", &pool.tids[pool.nthreads], pool_main, NULL,
+                              NULL) == 0)
+        pool.nthreads++;
+    return 0;
+}
+
+static void pool_stop(void) {
+    if (!pool.lock) return;
+    enif_mutex_lock(pool.lock);
+    pool.running = false;
+    enif_cond_broadcast(pool.work);
+    enif_mutex_unlock(pool.lock);
+    for (unsigned int i = 0; i < pool.nthreads; i++)
+        enif_thread_join(pool.tids[i], NULL);
+    pool.nthreads = 0;
+    enif_cond_destroy(pool.done);
+    enif_cond_destroy(pool.work);
+    enif_mutex_destroy(pool.lock);
+    pool.done = pool.work = NULL;
+    pool.lock = NULL;
+}
+
+// ============================================================================
+// Resampling (separable box / bilinear / Lanczos-3)
+// ============================================================================
+//
+// Two passes, as in Pillow: each output column (then row) is a fixed-point
+// (Q14) weighted sum of a window of taps source pixels. Windows are shifted to
+// stay inside the source, with zero weights where the filter doesn't reach,
+// so the horizontal kernels can run whole 8-tap (Y8) or 2-tap (RGBA) SIMD
+// blocks without bounds checks. When downscaling, the filter is stretched by
+// the scale factor, which makes the box filter an area average.
+//
+// Large images are split into bands of output rows run on the worker pool;
+// each band runs the horizontal pass over just the source rows it needs.
+
+typedef enum {
+    SCALE_BOX = 0,
+    SCALE_BILINEAR,
+    SCALE_LANCZOS,
+} ScaleFilter;
+
+#define SCALE_BITS 14
+#define SCALE_MAX_BANDS (POOL_THREADS + 1)
+#define SCALE_BAND_MIN_ROWS 64  // Fewer output rows per band aren't worth a thread
+
+typedef struct {
+    unsigned int taps;          // Weights per output pixel
+    unsigned int *start;        // First source pixel of each output pixel's window
+    int16_t *w;                 // out * taps weights, Q14, each window summing to 1
+} ScaleKernel;
+
+static double scale_filter_support(ScaleFilter f) {
+    return f == SCALE_BOX ? 0.5 : f == SCALE_BILINEAR ? 1.0 : 3.0;
+}
+
+static double scale_sinc(double x) {
+    if (x == 0.0) return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double scale_filter(ScaleFilter f, double x) {
+    switch (f) {
+    case SCALE_BOX:
+        return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+    case SCALE_BILINEAR:
+        x = fabs(x);
+        return x < 1.0 ? 1.0 - x : 0.0;
+    default:
+        return x > -3.0 && x < 3.0 ? scale_sinc(x) * scale_sinc(x / 3.0) : 0.0;
+    }
+}
+
+static void scale_kernel_free(ScaleKernel *k) {
+    if (k->start) enif_free(k->start);
+    if (k->w) enif_free(k->w);
+    k->start = NULL;
+    k->w = NULL;
+}
+
+// Weights mapping in source pixels to out pixels, taps rounded up to a
+// multiple of align (when the source is wide enough)
+static bool scale_kernel_init(ScaleKernel *k, unsigned int in, unsigned int out, ScaleFilter f,
+                              unsigned int align) {
+    double scale = (double)in / out;
+    double fscale = scale > 1.0 ? scale : 1.0;
+    double support = scale_filter_support(f) * fscale;
+    unsigned int taps = (unsigned int)ceil(support) * 2 + 1;
+    taps = (taps + align - 1) / align * align;
+    if (taps > in) taps = in;
+
+    k->taps = taps;
+    k->start = enif_alloc(out * sizeof(unsigned int));
+    k->w = enif_alloc((size_t)out * taps * sizeof(int16_t));
+    double *tmp = enif_alloc(taps * sizeof(double));
+    if (!k->start || !k->w || !tmp) {
+        scale_kernel_free(k);
+        if (tmp) enif_free(tmp);
+        return false;
+    }
+
+    for (unsigned int i = 0; i < out; i++) {
+        double center = (i + 0.5) * scale;
+        int lo = (int)(center - support + 0.5), hi = (int)(center + support + 0.5);
+        if (lo < 0) lo = 0;
+        if (hi > (int)in) hi = (int)in;
+        int s = lo;
+        if (s + (int)taps > (int)in) s = (int)(in - taps);
+
+        double sum = 0.0;
+        for (unsigned int t = 0; t < taps; t++) {
+            int x = s + (int)t;
+            tmp[t] = x >= lo && x < hi ? scale_filter(f, (x + 0.5 - center) / fscale) : 0.0;
+            sum += tmp[t];
+        }
+        if (sum == 0.0) {  // Can't happen with these filters, but stay safe
+            int x = (int)center < (int)in ? (int)center : (int)in - 1;
+            tmp[x - s] = sum = 1.0;
+        }
+
+        // Fold the rounding error into the largest weight so windows sum to 1
+        int16_t *w = k->w + (size_t)i * taps;
+        int total = 0;
+        unsigned int big = 0;
+        for (unsigned int t = 0; t < taps; t++) {
+            w[t] = (int16_t)lround(tmp[t] / sum * (1 << SCALE_BITS));
+            total += w[t];
+            if (abs(w[t]) > abs(w[big])) big = t;
+        }
+        w[big] = (int16_t)(w[big] + (1 << SCALE_BITS) - total);
+        k->start[i] = (unsigned int)s;
+    }
+    enif_free(tmp);
+    return true;
+}
+
+static inline uint8_t scale_clamp(int32_t acc) {
+    acc = (acc + (1 << (SCALE_BITS - 1))) >> SCALE_BITS;
+    return (uint8_t)(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+}
+
+// Horizontal pass over one row of ch-byte pixels
+static void scale_row_h(const uint8_t *src, uint8_t *dst, const ScaleKernel *k, unsigned int out,
+                        unsigned int ch) {
+    unsigned int taps = k->taps;
+    for (unsigned int i = 0; i < out; i++) {
+        const uint8_t *p = src + (size_t)k->start[i] * ch;
+        const int16_t *w = k->w + (size_t)i * taps;
+        uint8_t *o = dst + (size_t)i * ch;
+#if defined(__SSE2__)
+        if (ch == 1 && taps % 8 == 0) {
+            __m128i zero = _mm_setzero_si128(), acc = _mm_setzero_si128();
+            for (unsigned int t = 0; t < taps; t += 8) {
+                __m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + t)), zero);
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_loadu_si128((const __m128i *)(w + t))));
+            }
+            acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+            acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+            o[0] = scale_clamp(_mm_cvtsi128_si32(acc));
+            continue;
+        }
+        if (ch == 4 && taps % 2 == 0) {
+            __m128i zero = _mm_setzero_si128(), acc = _mm_set1_epi32(1 << (SCALE_BITS - 1));
+            for (unsigned int t = 0; t < taps; t += 2) {
+                // r0 g0 b0 a0 r1 g1 b1 a1 -> r0 r1 g0 g1 b0 b1 a0 a1, against w0 w1 pairs
+                __m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + t * 4)), zero);
+                px = _mm_unpacklo_epi16(px, _mm_srli_si128(px, 8));
+                __m128i wv = _mm_set1_epi32((int)((uint16_t)w[t] | ((uint32_t)(uint16_t)w[t + 1] << 16)));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(px, wv));
+            }
+            acc = _mm_srai_epi32(acc, SCALE_BITS);
+            acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), zero);
+            uint32_t v = (uint32_t)_mm_cvtsi128_si32(acc);
+            memcpy(o, &v, 4);
+            continue;
+        }
+#elif defined(__ARM_NEON)
+        if (ch == 1 && taps % 8 == 0) {
+            int32x4_t acc = vdupq_n_s32(0);
+            for (unsigned int t = 0; t < taps; t += 8) {
+                int16x8_t px = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p + t)));
+                int16x8_t wv = vld1q_s16(w + t);
+                acc = vmlal_s16(acc, vget_low_s16(px), vget_low_s16(wv));
+                acc = vmlal_s16(acc, vget_high_s16(px), vget_high_s16(wv));
+            }
+            int32x2_t s2 = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+            o[0] = scale_clamp(vget_lane_s32(vpadd_s32(s2, s2), 0));
+            continue;
+        }
+        if (ch == 4 && taps % 2 == 0) {
+            int32x4_t acc = vdupq_n_s32(0);
+            for (unsigned int t = 0; t < taps; t += 2) {
+                int16x8_t px = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p + t * 4)));
+                acc = vmlal_n_s16(acc, vget_low_s16(px), w[t]);
+                acc = vmlal_n_s16(acc, vget_high_s16(px), w[t + 1]);
+            }
+            uint16x4_t v16 = vqrshrun_n_s32(acc, SCALE_BITS);
+            uint8x8_t v8 = vqmovn_u16(vcombine_u16(v16, v16));
+            vst1_lane_u32((uint32_t *)(void *)o, vreinterpret_u32_u8(v8), 0);
+            continue;
+        }
+#endif
+        for (unsigned int c = 0; c < ch; c++) {
+            int32_t acc = 0;
+            for (unsigned int t = 0; t < taps; t++) acc += p[t * ch + c] * w[t];
+            o[c] = scale_clamp(acc);
+        }
+    }
+}
+
+typedef struct {
+    PoolJob job;
+    const uint8_t *src;
+    uint8_t *dst;
+    unsigned int src_w, dst_w, ch;
+    const ScaleKernel *kx, *ky;
+    unsigned int y0, y1;        // Output rows of this band
+    bool ok;
+} ScaleBand;
+
+static void scale_band(void *arg) {
+    ScaleBand *b = arg;
+    size_t in_row = (size_t)b->src_w * b->ch, out_row = (size_t)b->dst_w * b->ch;
+    unsigned int ys0 = b->ky->start[b->y0], ys1 = b->ky->start[b->y1 - 1] + b->ky->taps;
+    uint8_t *tmp = enif_alloc((ys1 - ys0) * out_row);
+    int32_t *acc = enif_alloc(out_row * sizeof(int32_t));
+    b->ok = tmp && acc;
+    if (b->ok) {
+        for (unsigned int y = ys0; y < ys1; y++)
+            scale_row_h(b->src + y * in_row, tmp + (y - ys0) * out_row, b->kx, b->dst_w, b->ch);
+
+        // Vertical pass: contiguous rows, left to the compiler's vectorizer
+        for (unsigned int y = b->y0; y < b->y1; y++) {
+            const int16_t *w = b->ky->w + (size_t)y * b->ky->taps;
+            const uint8_t *rows = tmp + (b->ky->start[y] - ys0) * out_row;
+            memset(acc, 0, out_row * sizeof(int32_t));
+            for (unsigned int t = 0; t < b->ky->taps; t++) {
+                if (w[t] == 0) continue;
+                const uint8_t *r = rows + t * out_row;
+                int32_t wt = w[t];
+                for (size_t x = 0; x < out_row; x++) acc[x] += r[x] * wt;
+            }
+            uint8_t *o = b->dst + (size_t)y * out_row;
+            for (size_t x = 0; x < out_row; x++) o[x] = scale_clamp(acc[x]);
+        }
+    }
+    if (tmp) enif_free(tmp);
+    if (acc) enif_free(acc);
+}
+
+// Bands for an image of h output rows spread over at most threads threads
+// (0 = the whole pool)
+static unsigned int scale_band_count(unsigned int h, unsigned int threads) {
+    unsigned int n = h / SCALE_BAND_MIN_ROWS, max = threads ? threads : pool_width();
+    if (max > SCALE_MAX_BANDS) max = SCALE_MAX_BANDS;
+    if (n > max) n = max;
+    return n ? n : 1;
+}
+
+// Resample a src_w x src_h image of ch-byte pixels into dst (dst_w x dst_h),
+// on up to threads threads (0 = the whole pool). False on allocation failure.
+static bool scale_image(const uint8_t *src, unsigned int src_w, unsigned int src_h, uint8_t *dst,
+                        unsigned int dst_w, unsigned int dst_h, unsigned int ch, ScaleFilter f,
+                        unsigned int threads) {
+    ScaleKernel kx = { 0 }, ky = { 0 };
+    if (!scale_kernel_init(&kx, src_w, dst_w, f, ch == 1 ? 8 : ch == 4 ? 2 : 1)) return false;
+    if (!scale_kernel_init(&ky, src_h, dst_h, f, 1)) {
+        scale_kernel_free(&kx);
+        return false;
+    }
+
+    unsigned int nbands = scale_band_count(dst_h, threads);
+    ScaleBand bands[SCALE_MAX_BANDS];
+    for (unsigned int i = 0; i < nbands; i++) {
+        bands[i] = (ScaleBand){ .src = src, .dst = dst, .src_w = src_w, .dst_w = dst_w,
+                                .ch = ch, .kx = &kx, .ky = &ky,
+                                .y0 = (unsigned int)((uint64_t)dst_h * i / nbands),
+                                .y1 = (unsigned int)((uint64_t)dst_h * (i + 1) / nbands) };
+    }
+    // The calling thread takes the first band itself
+    for (unsigned int i = 1; i < nbands; i++)
+        pool_submit(&bands[i].job, scale_band, &bands[i]);
+    scale_band(&bands[0]);
+
+    bool ok = bands[0].ok;
+    for (unsigned int i = 1; i < nbands; i++) {
+        pool_wait(&bands[i].job);
+        ok = ok && bands[i].ok;
+    }
+    scale_kernel_free(&kx);
+    scale_kernel_free(&ky);
+    return ok;
+}
+
+// Histogram with four interleaved sub-tables, so consecutive equal pixels
+// (the common case on eInk content) don't serialize on the same counter.
+static void histogram_y8(const uint8_t *p, size_t n, uint32_t hist[4][256]) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        hist[0][p[i]]++;
+        hist[1][p[i + 1]]++;
+        hist[2][p[i + 2]]++;
+        hist[3][p[i + 3]]++;
+    }
+    for (; i < n; i++)
+        hist[0][p[i]]++;
+}
+
+static WFM_MODE_INDEX_T wfm_classify(int fbfd, const FBInkRect *rect, const FBInkConfig *cfg) {
+    FBInkDump dump;
+    memset(&dump, 0, sizeof(dump));
+    if (fbink_rect_dump(fbfd, rect, &dump) < 0 || !dump.data)
+        return WFM_AUTO;
+
+    unsigned int w = dump.area.width, h = dump.area.height;
+    uint8_t *row = w ? enif_alloc(w) : NULL;
+    if (!row) {
+        fbink_free_dump_data(&dump);
+        return WFM_AUTO;
+    }
+
+    uint64_t px = (uint64_t)w * h;
+    unsigned int step = px > WFM_SAMPLE_PIXELS ? (unsigned int)(px / WFM_SAMPLE_PIXELS) + 1 : 1;
+
+    uint32_t sub[4][256];
+    memset(sub, 0, sizeof(sub));
+    for (unsigned int y = 0; y < h; y += step) {
+        row_to_y8(dump.data + (size_t)y * dump.stride, dump.bpp, w, row);
+        histogram_y8(row, w, sub);
+    }
+    enif_free(row);
+    fbink_free_dump_data(&dump);
+
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    fbink_get_state(cfg, &state);
+    bool eclipse = cfg->is_nightmode && state.has_eclipse_wfm;
+
+    // Only exact black and white are safe for DU; anything in between (even
+    // 0x01 or 0xFE) would be left as ghosting. Inverted panels store 0x00 for
+    // white, so the histogram is read back to front there.
+    uint64_t black = 0, white = 0, mid = 0;
+    for (int v = 0; v < 256; v++) {
+        int i = state.inverted_grayscale ? 0xFF - v : v;
+        uint64_t c = (uint64_t)sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+        if (v == 0x00) black += c;
+        else if (v == 0xFF) white += c;
+        else mid += c;
+    }
+    uint64_t total = black + white + mid;
+    if (total == 0) return WFM_AUTO;
+
+    if (mid == 0)
+        return WFM_DU;
+    if (white * 2 >= total && mid * 5 <= total) {
+        if (eclipse) return WFM_GLKW16;
+        if (state.has_color_panel) return WFM_GLRC16;
+        return (state.is_mtk || state.is_sunxi) ? WFM_REAGL : WFM_GL16;
+    }
+    if (eclipse) return WFM_GCK16;
+    return state.has_color_panel ? WFM_GCC16 : WFM_GC16;
+}
+
+// Resolve `wfm_mode: :auto` for a refresh of rect (empty = full screen)
+static void wfm_resolve(int fbfd, const FBInkRect *rect, FBInkConfig *cfg) {
+    if (cfg->wfm_mode != WFM_CONTENT_AUTO) return;
+    FBInkRect area = *rect;
+    if (area.width == 0 || area.height == 0)
+        area = full_screen_rect(cfg);
+    cfg->wfm_mode = wfm_classify(fbfd, &area, cfg);
+    atomic_fetch_add(&wfm_auto_counts[cfg->wfm_mode], 1);
+}
+
+// A draw with wfm_mode: :auto can't let FBInk refresh it, since the content
+// must be inspected first: its refresh is deferred to draw_done().
+static bool wfm_defer(FBInkConfig *cfg) {
+    if (cfg->wfm_mode != WFM_CONTENT_AUTO || cfg->no_refresh) return false;
+    cfg->no_refresh = true;
+    return true;
+}
+
+// For calls that refresh repeatedly on their own (e.g. activity bars)
+static void wfm_no_auto(FBInkConfig *cfg) {
+    if (cfg->wfm_mode == WFM_CONTENT_AUTO) cfg->wfm_mode = WFM_AUTO;
+}
+
+// ============================================================================
+// Damage rects and refresh groups (batched calls, damage accumulator)
+// ============================================================================
+//
+// Damaged areas are tracked as canonical (unrotated) rects, the space that
+// fbink_get_last_rect(false) reports and fbink_refresh_rect expects. Rects are
+// only merged with others that share a refresh key, since one EPDC update can
+// only carry a single waveform/flash/dither/nightmode combination.
+
+#define MAX_REFRESH_GROUPS 16
+
+typedef struct {
+    FBInkConfig cfg;            // Config the group's refresh is issued with
+    FBInkRect damage;           // Bounding box of everything drawn in the group
+} RefreshGroup;
+
+static bool rect_is_empty(const FBInkRect *r) {
+    return r->width == 0 || r->height == 0;
+}
+
+// Overlap of a and b into *out; false (and *out empty) if they don't overlap
+static bool rect_intersect(const FBInkRect *a, const FBInkRect *b, FBInkRect *out) {
+    unsigned int x0 = a->left > b->left ? a->left : b->left;
+    unsigned int y0 = a->top > b->top ? a->top : b->top;
+    unsigned int x1 = (unsigned int)a->left + a->width;
+    unsigned int y1 = (unsigned int)a->top + a->height;
+    unsigned int bx1 = (unsigned int)b->left + b->width;
+    unsigned int by1 = (unsigned int)b->top + b->height;
+    if (bx1 < x1) x1 = bx1;
+    if (by1 < y1) y1 = by1;
+    if (x0 >= x1 || y0 >= y1) {
+        memset(out, 0, sizeof(FBInkRect));
+        return false;
+    }
+    out->left = (unsigned short int)x0;
+    out->top = (unsigned short int)y0;
+    out->width = (unsigned short int)(x1 - x0);
+    out->height = (unsigned short int)(y1 - y0);
+    return true;
+}
+
+static void rect_union(FBInkRect *acc, const FBInkRect *r) {
+    if (rect_is_empty(r)) return;
+    if (rect_is_empty(acc)) {
+        *acc = *r;
+        return;
+    }
+    unsigned int x0 = acc->left < r->left ? acc->left : r->left;
+    unsigned int y0 = acc->top < r->top ? acc->top : r->top;
+    unsigned int x1 = (unsigned int)acc->left + acc->width;
+    unsigned int y1 = (unsigned int)acc->top + acc->height;
+    unsigned int rx1 = (unsigned int)r->left + r->width;
+    unsigned int ry1 = (unsigned int)r->top + r->height;
+    if (rx1 > x1) x1 = rx1;
+    if (ry1 > y1) y1 = ry1;
+    acc->left = (unsigned short int)x0;
+    acc->top = (unsigned short int)y0;
+    acc->width = (unsigned short int)(x1 - x0);
+    acc->height = (unsigned short int)(y1 - y0);
+}
+
+static bool same_refresh_key(const FBInkConfig *a, const FBInkConfig *b) {
+    return a->wfm_mode == b->wfm_mode && a->is_flashing == b->is_flashing &&
+           a->dithering_mode == b->dithering_mode && a->is_nightmode == b->is_nightmode;
+}
+
+// Add damage to the group matching cfg's refresh key. Returns false when all
+// group slots are taken by other keys.
+static bool refresh_groups_add(RefreshGroup *groups, int *ngroups,
+                               const FBInkConfig *cfg, const FBInkRect *damage) {
+    if (rect_is_empty(damage)) return true;
+    for (int i = 0; i < *ngroups; i++) {
+        if (same_refresh_key(&groups[i].cfg, cfg)) {
+            rect_union(&groups[i].damage, damage);
+            return true;
+        }
+    }
+    if (*ngroups == MAX_REFRESH_GROUPS) return false;
+    RefreshGroup *g = &groups[(*ngroups)++];
+    g->cfg = *cfg;
+    g->cfg.no_refresh = false;
+    g->damage = *damage;
+    return true;
+}
+
+// Refresh a single group's damage; returns the fbink_refresh_rect result
+static int refresh_group(int fbfd, RefreshGroup *g) {
+    if (rect_is_empty(&g->damage)) return 0;
+    wfm_resolve(fbfd, &g->damage, &g->cfg);
+    return fbink_refresh_rect(fbfd, &g->damage, &g->cfg);
+}
+
+// ============================================================================
+// Resource type for framebuffer handles (owned fd + render thread)
+// ============================================================================
+//
+// FBInk.open/0 returns one of these instead of a bare fd. The handle owns the
+// fd (closed by close/1 or the destructor) and lazily spawns a native render
+// thread fed through a bounded SPSC ring of draw commands. Producers (any
+// number of scheduler threads) serialize on `submit_lock`, so the ring itself
+// only ever sees a single producer and a single consumer.
+//
+// It also accumulates the damage of every no_refresh draw made through it, so
+// FBInk.flush/2 can refresh everything that changed in as few updates as
+// possible.
+
+#define RENDER_RING_SIZE 64  // Must be a power of two
+#define RENDER_RING_MASK (RENDER_RING_SIZE - 1)
+#define MAX_DAMAGE_RECTS 64  // Pending no_refresh draws kept per handle
+
+static ErlNifResourceType *fb_resource_type = NULL;
+
+// Globally unique command ids, so results from several handles never collide
+static _Atomic uint64_t render_seq = 1;
+
+typedef struct {
+    ErlNifEnv *env;     // Process-independent env owning the op term
+    ERL_NIF_TERM op;
+    ErlNifPid pid;
+    uint64_t seq;
+} RenderCmd;
+
+typedef struct {
+    int fbfd;
+    _Atomic bool closed;
+
+    ErlNifMutex *submit_lock;   // Serializes producers and thread lifecycle
+    ErlNifMutex *wake_lock;
+    ErlNifCond *wake_cond;
+    ErlNifTid tid;
+    bool thread_started;
+    _Atomic bool stopping;
+    bool drain;                 // On stop: run pending commands (true) or fail them
+
+    RenderCmd ring[RENDER_RING_SIZE];
+    _Atomic size_t head;        // Consumer position
+    _Atomic size_t tail;        // Producer position
+
+    ErlNifMutex *damage_lock;   // Guards the damage accumulator below
+    RefreshGroup damage[MAX_DAMAGE_RECTS];
+    int ndamage;
+
+    // Guarded by the refresh waiter's lock: close/1 leaves the fd open while
+    // refresh waiter jobs still need it, and the last of them closes it
+    unsigned int waiters;
+    bool close_deferred;
+} FBHandle;
+
+static bool render_ring_push(FBHandle *fb, const RenderCmd *cmd) {
+    size_t tail = atomic_load_explicit(&fb->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&fb->head, memory_order_acquire);
+    if (tail - head == RENDER_RING_SIZE) return false;
+    fb->ring[tail & RENDER_RING_MASK] = *cmd;
+    atomic_store_explicit(&fb->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static bool render_ring_pop(FBHandle *fb, RenderCmd *cmd) {
+    size_t head = atomic_load_explicit(&fb->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&fb->tail, memory_order_acquire);
+    if (head == tail) return false;
+    *cmd = fb->ring[head & RENDER_RING_MASK];
+    atomic_store_explicit(&fb->head, head + 1, memory_order_release);
+    return true;
+}
+
+// ============================================================================
+// Helper: get fbfd from a bare integer or an FBInk.open/0 handle
+// ============================================================================
+
+static bool get_fb(ErlNifEnv *env, ERL_NIF_TERM term, int *fbfd, FBHandle **handle) {
+    FBHandle *fb;
+    if (enif_get_resource(env, term, fb_resource_type, (void **)&fb)) {
+        if (atomic_load(&fb->closed)) return false;
+        *fbfd = fb->fbfd;
+        if (handle) *handle = fb;
+        return true;
+    }
+    if (handle) *handle = NULL;
+    return enif_get_int(env, term, fbfd);
+}
+
+static bool get_fbfd(ErlNifEnv *env, ERL_NIF_TERM term, int *fbfd) {
+    return get_fb(env, term, fbfd, NULL);
+}
+
+// ============================================================================
+// Helper: get a NUL-terminated filename from a charlist or iodata
+// ============================================================================
+
+static bool get_filename(ErlNifEnv *env, ERL_NIF_TERM term, char *buf, size_t size) {
+    if (enif_get_string(env, term, buf, (unsigned int)size, ERL_NIF_LATIN1) > 0)
+        return true;
+    ErlNifBinary bin;
+    if (!enif_inspect_iolist_as_binary(env, term, &bin) || bin.size >= size)
+        return false;
+    memcpy(buf, bin.data, bin.size);
+    buf[bin.size] = '\0';
+    return true;
+}
+
+// ============================================================================
+// Damage accumulator (no_refresh draws made through a handle)
+// ============================================================================
+
+static uint64_t rect_area(const FBInkRect *r) {
+    return (uint64_t)r->width * r->height;
+}
+
+static uint64_t rect_overlap_area(const FBInkRect *a, const FBInkRect *b) {
+    unsigned int x0 = a->left > b->left ? a->left : b->left;
+    unsigned int y0 = a->top > b->top ? a->top : b->top;
+    unsigned int x1 = (unsigned int)a->left + a->width;
+    unsigned int y1 = (unsigned int)a->top + a->height;
+    unsigned int bx1 = (unsigned int)b->left + b->width;
+    unsigned int by1 = (unsigned int)b->top + b->height;
+    if (bx1 < x1) x1 = bx1;
+    if (by1 < y1) y1 = by1;
+    if (x1 <= x0 || y1 <= y0) return 0;
+    return (uint64_t)(x1 - x0) * (y1 - y0);
+}
+
+// Pixels refreshed needlessly if a and b were submitted as their bounding box
+static uint64_t merge_waste(const FBInkRect *a, const FBInkRect *b) {
+    FBInkRect u = *a;
+    rect_union(&u, b);
+    uint64_t covered = rect_area(a) + rect_area(b) - rect_overlap_area(a, b);
+    return rect_area(&u) - covered;
+}
+
+// Record damage drawn with cfg. When the accumulator is full, the rect is
+// folded into the same-key entry it wastes the fewest pixels with; if no entry
+// shares its refresh key, it is refreshed right away.
+static void damage_record(FBHandle *fb, int fbfd, const FBInkConfig *cfg,
+                          const FBInkRect *rect) {
+    if (!fb || rect_is_empty(rect)) return;
+
+    bool refresh_now = false;
+    enif_mutex_lock(fb->damage_lock);
+    if (fb->ndamage < MAX_DAMAGE_RECTS) {
+        RefreshGroup *d = &fb->damage[fb->ndamage++];
+        d->cfg = *cfg;
+        d->cfg.no_refresh = false;
+        d->damage = *rect;
+    } else {
+        int best = -1;
+        uint64_t best_waste = UINT64_MAX;
+        for (int i = 0; i < fb->ndamage; i++) {
+            if (!same_refresh_key(&fb->damage[i].cfg, cfg)) continue;
+            uint64_t w = merge_waste(&fb->damage[i].damage, rect);
+            if (w < best_waste) {
+                best_waste = w;
+                best = i;
+            }
+        }
+        if (best >= 0)
+            rect_union(&fb->damage[best].damage, rect);
+        else
+            refresh_now = true;
+    }
+    enif_mutex_unlock(fb->damage_lock);
+
+    if (refresh_now) {
+        RefreshGroup g = { .cfg = *cfg, .damage = *rect };
+        g.cfg.no_refresh = false;
+        refresh_group(fbfd, &g);
+    }
+}
+
+// Post-draw hook. Refreshes what the last successful call drew if wfm_defer()
+// held its refresh back, otherwise records it as damage if it skipped its own
+// refresh.
+static void draw_done(FBHandle *fb, int fbfd, const FBInkConfig *cfg, int rv, bool deferred) {
+    if (rv < 0) return;
+    FBInkRect last = fbink_get_last_rect(false);
+    if (deferred) {
+        RefreshGroup g = { .cfg = *cfg, .damage = last };
+        g.cfg.no_refresh = false;
+        if (rect_is_empty(&g.damage))
+            g.damage = full_screen_rect(cfg);
+        refresh_group(fbfd, &g);
+        return;
+    }
+    if (fb && cfg->no_refresh)
+        damage_record(fb, fbfd, cfg, &last);
+}
+
+// Greedily merge same-key rects while doing so wastes no more than `overhead`
+// pixels, i.e. while one larger update is estimated cheaper than two.
+static int damage_merge(RefreshGroup *d, int n, uint64_t overhead) {
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                if (!same_refresh_key(&d[i].cfg, &d[j].cfg)) continue;
+                if (merge_waste(&d[i].damage, &d[j].damage) > overhead) continue;
+                rect_union(&d[i].damage, &d[j].damage);
+                d[j--] = d[--n];
+                merged = true;
+            }
+        }
+    }
+    return n;
+}
+
+// ============================================================================
+// Dump diffing
+// ============================================================================
+//
+// Two pixel buffers are compared scanline by scanline; identical rows (the
+// common case) cost one vectorized compare each. Differing rows mark fixed
+// size tiles dirty, horizontal runs of dirty tiles are stacked into rects
+// across tile rows, and those rects are finally merged with the same cost
+// model as the damage accumulator.
+
+#define MAX_DIFF_RECTS 256
+
+// True if the n bytes at a and b differ
+static bool bytes_differ(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 32 <= n; i += 32) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                    _mm_loadu_si128((const __m128i *)(b + i)));
+        __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                                    _mm_loadu_si128((const __m128i *)(b + i + 16)));
+        if (_mm_movemask_epi8(_mm_and_si128(e0, e1)) != 0xFFFF) return true;
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 32 <= n; i += 32) {
+        uint8x16_t x0 = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        uint8x16_t x1 = veorq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+        uint64x2_t x = vreinterpretq_u64_u8(vorrq_u8(x0, x1));
+        if ((vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) != 0) return true;
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y) return true;
+    }
+    for (; i < n; i++)
+        if (a[i] != b[i]) return true;
+    return false;
+}
+
+// Turn a tiles_x * tiles_y dirty map into merged rects covering every dirty
+// tile of a w x h area. On success, *out holds the rects (enif_alloc'ed,
+// offset by origin_x/origin_y) and their count is returned.
+static int tiles_to_rects(const uint8_t *dirty, unsigned int tiles_x, unsigned int tiles_y,
+                          unsigned int tile, unsigned int w, unsigned int h,
+                          unsigned int origin_x, unsigned int origin_y, uint64_t overhead,
+                          RefreshGroup **out) {
+    *out = NULL;
+    int *open_buf = enif_alloc((size_t)tiles_x * 2 * sizeof(int));
+    int cap = 16, n = 0;
+    RefreshGroup *rects = enif_alloc((size_t)cap * sizeof(RefreshGroup));
+    if (!open_buf || !rects) {
+        if (open_buf) enif_free(open_buf);
+        if (rects) enif_free(rects);
+        return -ENOMEM;
+    }
+    // open[x0]: rect ending on the previous tile row whose run starts at x0
+    int *open = open_buf, *next_open = open_buf + tiles_x;
+    for (unsigned int i = 0; i < tiles_x; i++) open[i] = -1;
+
+    for (unsigned int ty = 0; ty < tiles_y; ty++) {
+        const uint8_t *row = dirty + (size_t)ty * tiles_x;
+        unsigned int y1 = (ty + 1) * tile < h ? (ty + 1) * tile : h;
+        for (unsigned int i = 0; i < tiles_x; i++) next_open[i] = -1;
+        for (unsigned int tx = 0; tx < tiles_x;) {
+            if (!row[tx]) {
+                tx++;
+                continue;
+            }
+            unsigned int x0 = tx;
+            while (tx < tiles_x && row[tx]) tx++;
+            unsigned int px0 = x0 * tile, px1 = tx * tile < w ? tx * tile : w;
+
+            int idx = open[x0];
+            if (idx >= 0 && rects[idx].damage.width == px1 - px0) {
+                rects[idx].damage.height = (unsigned short int)(y1 - (rects[idx].damage.top - origin_y));
+            } else {
+                if (n == cap) {
+                    RefreshGroup *grown = enif_realloc(rects, (size_t)cap * 2 * sizeof(RefreshGroup));
+                    if (!grown) {
+                        enif_free(open_buf);
+                        enif_free(rects);
+                        return -ENOMEM;
+                    }
+                    rects = grown;
+                    cap *= 2;
+                }
+                idx = n++;
+                memset(&rects[idx], 0, sizeof(RefreshGroup));
+                rects[idx].damage.left = (unsigned short int)(origin_x + px0);
+                rects[idx].damage.top = (unsigned short int)(origin_y + ty * tile);
+                rects[idx].damage.width = (unsigned short int)(px1 - px0);
+                rects[idx].damage.height = (unsigned short int)(y1 - ty * tile);
+            }
+            next_open[x0] = idx;
+        }
+        int *t = open;
+        open = next_open;
+        next_open = t;
+    }
+    enif_free(open_buf);
+
+    if (n > MAX_DIFF_RECTS) {
+        // Too fragmented to be worth merging pairwise: one bounding rect
+        for (int i = 1; i < n; i++) rect_union(&rects[0].damage, &rects[i].damage);
+        n = 1;
+    } else {
+        n = damage_merge(rects, n, overhead);
+    }
+    *out = rects;
+    return n;
+}
+
+// Diff a w x h pixel area of two buffers into merged rects (see
+// tiles_to_rects). Returns the rect count, or -ENOMEM.
+static int diff_pixels(const uint8_t *a, size_t a_stride, const uint8_t *b, size_t b_stride,
+                       unsigned int w, unsigned int h, uint8_t bpp, unsigned int tile,
+                       unsigned int origin_x, unsigned int origin_y, uint64_t overhead,
+                       RefreshGroup **out) {
+    *out = NULL;
+    if (w == 0 || h == 0) return 0;
+
+    unsigned int tiles_x = (w + tile - 1) / tile, tiles_y = (h + tile - 1) / tile;
+    size_t row_bytes = ((size_t)w * bpp + 7) / 8;
+    uint8_t *dirty = enif_alloc((size_t)tiles_x * tiles_y);
+    if (!dirty) return -ENOMEM;
+    memset(dirty, 0, (size_t)tiles_x * tiles_y);
+
+    for (unsigned int ty = 0; ty < tiles_y; ty++) {
+        uint8_t *row = dirty + (size_t)ty * tiles_x;
+        unsigned int y1 = (ty + 1) * tile < h ? (ty + 1) * tile : h;
+        unsigned int ndirty = 0;
+        for (unsigned int y = ty * tile; y < y1 && ndirty < tiles_x; y++) {
+            const uint8_t *ra = a + (size_t)y * a_stride, *rb = b + (size_t)y * b_stride;
+            if (!bytes_differ(ra, rb, row_bytes)) continue;
+            for (unsigned int tx = 0; tx < tiles_x; tx++) {
+                if (row[tx]) continue;
+                size_t b0 = (size_t)tx * tile * bpp / 8;
+                size_t b1 = (size_t)(tx + 1) * tile * bpp / 8;
+                if (b1 > row_bytes) b1 = row_bytes;
+                if (bytes_differ(ra + b0, rb + b0, b1 - b0)) {
+                    row[tx] = 1;
+                    ndirty++;
+                }
+            }
+        }
+    }
+
+    int n = tiles_to_rects(dirty, tiles_x, tiles_y, tile, w, h, origin_x, origin_y,
+                           overhead, out);
+    enif_free(dirty);
+    return n;
+}
+
+// Raw pixels of a dump (read lock held): the dump's own data, or a decoded
+// copy returned through *owned for compressed dumps
+static const uint8_t *dump_pixels(const DumpResource *res, uint8_t **owned) {
+    *owned = NULL;
+    if (!res->packed) return res->dump.data;
+    *owned = enif_alloc(res->dump.size);
+    if (*owned && !dump_unpack(res, *owned)) {
+        enif_free(*owned);
+        *owned = NULL;
+    }
+    return *owned;
+}
+
+static ERL_NIF_TERM diff_rects_to_list(ErlNifEnv *env, const RefreshGroup *rects, int n) {
+    ERL_NIF_TERM list = enif_make_list(env, 0);
+    for (int i = n - 1; i >= 0; i--)
+        list = enif_make_list_cell(env, fbink_rect_to_map(env, &rects[i].damage), list);
+    return list;
+}
+
+// ============================================================================
+// Tile snapshot store (copy-on-write screen history)
+// ============================================================================
+//
+// A store cuts screen snapshots into fixed tiles and keeps every distinct tile
+// content once: a snapshot is just a grid of refcounted tile pointers, so a
+// history of similar screens only pays for the tiles that changed between
+// them (and blank areas are shared everywhere). Tiles are immutable and found
+// by content hash in a chained table guarded by the store's mutex.
+
+typedef struct SnapTile {
+    struct SnapTile *next;      // Hash chain
+    uint64_t hash;
+    uint32_t refs;              // Snapshot slots using this tile (store lock)
+    uint32_t size;
+    uint8_t data[];             // Rows packed back to back
+} SnapTile;
+
+static ErlNifResourceType *snap_store_resource_type = NULL;
+static ErlNifResourceType *snapshot_resource_type = NULL;
+
+typedef struct {
+    ErlNifMutex *lock;
+    unsigned int tile;
+    // Screen geometry, fixed by the first snapshot
+    bool has_geometry;
+    unsigned int width, height, tiles_x, tiles_y;
+    uint8_t bpp, rota;
+    SnapTile **buckets;
+    size_t nbuckets, ntiles, bytes;
+} SnapStore;
+
+typedef struct {
+    SnapStore *store;           // Kept alive while the snapshot exists
+    SnapTile **tiles;           // tiles_x * tiles_y, row-major
+    size_t ntiles;
+} Snapshot;
+
+static uint64_t snap_hash(const uint8_t *p, size_t n) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    for (; i < n; i++)
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    return h ^ (h >> 29);
+}
+
+// Pixel extent of tile (tx, ty) and its packed row length
+static void snap_tile_geometry(const SnapStore *st, unsigned int tx, unsigned int ty,
+                               FBInkRect *r, size_t *row_bytes) {
+    r->left = (unsigned short int)(tx * st->tile);
+    r->top = (unsigned short int)(ty * st->tile);
+    r->width = (unsigned short int)(st->width - r->left < st->tile ? st->width - r->left : st->tile);
+    r->height = (unsigned short int)(st->height - r->top < st->tile ? st->height - r->top : st->tile);
+    *row_bytes = ((size_t)r->width * st->bpp + 7) / 8;
+}
+
+static void snap_grow(SnapStore *st) {
+    size_t nb = st->nbuckets * 2;
+    SnapTile **buckets = enif_alloc(nb * sizeof(SnapTile *));
+    if (!buckets) return;  // Longer chains, still correct
+    memset(buckets, 0, nb * sizeof(SnapTile *));
+    for (size_t i = 0; i < st->nbuckets; i++) {
+        for (SnapTile *t = st->buckets[i], *next; t; t = next) {
+            next = t->next;
+            t->next = buckets[t->hash & (nb - 1)];
+            buckets[t->hash & (nb - 1)] = t;
+        }
+    }
+    enif_free(st->buckets);
+    st->buckets = buckets;
+    st->nbuckets = nb;
+}
+
+// Return a referenced tile with this content (store lock held)
+static SnapTile *snap_intern(SnapStore *st, const uint8_t *data, uint32_t size, uint64_t hash) {
+    SnapTile **slot = &st->buckets[hash & (st->nbuckets - 1)];
+    for (SnapTile *t = *slot; t; t = t->next) {
+        if (t->hash == hash && t->size == size && memcmp(t->data, data, size) == 0) {
+            t->refs++;
+            return t;
+        }
+    }
+    SnapTile *t = enif_alloc(sizeof(SnapTile) + size);
+    if (!t) return NULL;
+    t->hash = hash;
+    t->refs = 1;
+    t->size = size;
+    memcpy(t->data, data, size);
+    t->next = *slot;
+    *slot = t;
+    st->ntiles++;
+    st->bytes += size;
+    if (st->ntiles > st->nbuckets) snap_grow(st);
+    return t;
+}
+
+// Drop a reference, freeing the tile with the last one (store lock held)
+static void snap_unref(SnapStore *st, SnapTile *tile) {
+    if (--tile->refs > 0) return;
+    for (SnapTile **pp = &st->buckets[tile->hash & (st->nbuckets - 1)]; *pp; pp = &(*pp)->next) {
+        if (*pp == tile) {
+            *pp = tile->next;
+            break;
+        }
+    }
+    st->ntiles--;
+    st->bytes -= tile->size;
+    enif_free(tile);
+}
+
+static void snap_store_resource_dtor(ErlNifEnv *env, void *obj) {
+    (void)env;
+    SnapStore *st = (SnapStore *)obj;
+    // Every snapshot holds a reference, so no tiles are left by now
+    if (st->buckets) enif_free(st->buckets);
+    if (st->lock) enif_mutex_destroy(st->lock);
+}
+
+static void snapshot_resource_dtor(ErlNifEnv *env, void *obj) {
+    (void)env;
+    Snapshot *snap = (Snapshot *)obj;
+    if (!snap->store) return;
+    if (snap->tiles) {
+        enif_mutex_lock(snap->store->lock);
+        for (size_t i = 0; i < snap->ntiles; i++)
+            if (snap->tiles[i]) snap_unref(snap->store, snap->tiles[i]);
+        enif_mutex_unlock(snap->store->lock);
+        enif_free(snap->tiles);
+    }
+    enif_release_resource(snap->store);
+}
+
+// ============================================================================
+// Image headers (size probing, pixel budget, sequential readers)
+// ============================================================================
+//
+// fbink_print_image decodes the whole file to RGBA before drawing, so a 24 MP
+// scan needs about 100 MB: more than some readers have free. Files over
+// IMAGE_PIXEL_BUDGET are never handed to it. print_image/5 and
+// print_image_binary/5 stream PNG, JPEG and PNM files of that size instead;
+// other formats, and draw ops, get {:error, :efbig}.
+
+#define IMAGE_PIXEL_BUDGET (16u * 1024 * 1024)
+
+// Rows of a PNM file read in place, or of a PNG or JPEG through image_decode.c
+typedef struct {
+    FILE *f;
+    ImageDecoder *dec;         // NULL for PNM
+    unsigned int w, h;
+    unsigned int ch;           // 1 (gray) or 3 (RGB)
+    unsigned int maxval;
+    unsigned int bps;          // Bytes per sample: 1, or 2 when maxval > 255
+} ImageReader;
+
+// Skip whitespace and comments, return the first other character
+static int pnm_skip_space(FILE *f) {
+    int c = fgetc(f);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        if (c == '#')
+            while (c != '\n' && c != EOF) c = fgetc(f);
+        c = fgetc(f);
+    }
+    return c;
+}
+
+// A header field, and the single whitespace character after it
+static bool pnm_read_uint(FILE *f, unsigned int *out) {
+    int c = pnm_skip_space(f);
+    if (c < '0' || c > '9') return false;
+    uint64_t v = 0;
+    for (; c >= '0' && c <= '9'; c = fgetc(f)) {
+        v = v * 10 + (unsigned int)(c - '0');
+        if (v > UINT32_MAX) return false;
+    }
+    *out = (unsigned int)v;
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// NULL once the reader is positioned on the first pixel, else an error atom name
+static const char *pnm_read_header(ImageReader *r) {
+    int p = fgetc(r->f), n = fgetc(r->f);
+    if (p != 'P' || n < '1' || n > '7') return "enotsup";  // Not PNM at all
+    if (n != '5' && n != '6') return "enotsup";            // ASCII, bitmap or PAM
+    r->ch = n == '5' ? 1 : 3;
+    if (!pnm_read_uint(r->f, &r->w) || !pnm_read_uint(r->f, &r->h) ||
+        !pnm_read_uint(r->f, &r->maxval) || r->w == 0 || r->h == 0 || r->maxval == 0 ||
+        r->maxval > UINT16_MAX)
+        return "einval";
+    r->bps = r->maxval > 255 ? 2 : 1;
+    return NULL;
+}
+
+static unsigned int be16(const uint8_t *p) { return (unsigned int)p[0] << 8 | p[1]; }
+static unsigned int le16(const uint8_t *p) { return (unsigned int)p[1] << 8 | p[0]; }
+static uint32_t be32(const uint8_t *p) { return (uint32_t)be16(p) << 16 | be16(p + 2); }
+static uint32_t le32(const uint8_t *p) { return (uint32_t)le16(p + 2) << 16 | le16(p); }
+
+// Walk JPEG segments up to the first start-of-frame
+static bool jpeg_probe_size(FILE *f, unsigned int *w, unsigned int *h) {
+    for (;;) {
+        int c = fgetc(f);
+        if (c != 0xFF) return false;
+        while ((c = fgetc(f)) == 0xFF) {}
+        if (c == EOF) return false;
+        if (c == 0x01 || (c >= 0xD0 && c <= 0xD8)) continue;  // No payload
+        uint8_t seg[7];
+        if (fread(seg, 1, 2, f) != 2 || be16(seg) < 2) return false;
+        if (c >= 0xC0 && c <= 0xCF && c != 0xC4 && c != 0xC8 && c != 0xCC) {
+            if (fread(seg + 2, 1, 5, f) != 5) return false;
+            *h = be16(seg + 3);
+            *w = be16(seg + 5);
+            return true;
+        }
+        if (fseek(f, (long)be16(seg) - 2, SEEK_CUR) != 0) return false;
+    }
+}
+
+// Pixel size from the header of a PNG, JPEG, GIF, BMP or binary PNM file
+static bool image_probe_size(const char *filename, unsigned int *w, unsigned int *h) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return false;
+
+    uint8_t hdr[26];
+    size_t n = fread(hdr, 1, sizeof(hdr), f);
+    bool ok = false;
+    if (n >= 24 && memcmp(hdr, "\x89PNG\r\n\x1a\n", 8) == 0) {
+        *w = be32(hdr + 16);
+        *h = be32(hdr + 20);
+        ok = true;
+    } else if (n >= 10 && memcmp(hdr, "GIF8", 4) == 0) {
+        *w = le16(hdr + 6);
+        *h = le16(hdr + 8);
+        ok = true;
+    } else if (n >= 26 && hdr[0] == 'B' && hdr[1] == 'M') {
+        int32_t bh = (int32_t)le32(hdr + 22);  // Negative for top-down bitmaps
+        *w = le32(hdr + 18);
+        *h = bh < 0 ? (unsigned int)-(int64_t)bh : (unsigned int)bh;
+        ok = true;
+    } else if (n >= 2 && hdr[0] == 0xFF && hdr[1] == 0xD8) {
+        ok = fseek(f, 2, SEEK_SET) == 0 && jpeg_probe_size(f, w, h);
+    } else if (n >= 2 && hdr[0] == 'P') {
+        ImageReader r = { .f = f };
+        ok = fseek(f, 0, SEEK_SET) == 0 && !pnm_read_header(&r);
+        *w = r.w;
+        *h = r.h;
+    }
+    fclose(f);
+    return ok && *w && *h;
+}
+
+
+// Size FBInk scales the image to, given its native size, or false when it
+// depends on more than the config's scaled_width/scaled_height
+static bool image_scaled_size(const FBInkConfig *cfg, unsigned int iw, unsigned int ih,
+                              unsigned int *w, unsigned int *h) {
+    int sw = cfg->scaled_width, sh = cfg->scaled_height;
+    if (sw == 0 && sh == 0) {
+        *w = iw;
+        *h = ih;
+    } else if (sw > 0 && sh > 0) {
+        *w = (unsigned int)sw;
+        *h = (unsigned int)sh;
+    } else if (sw > 0 && sh == -1) {
+        *w = (unsigned int)sw;
+        *h = (unsigned int)((uint64_t)ih * (unsigned int)sw / iw);
+    } else if (sh > 0 && sw == -1) {
+        *h = (unsigned int)sh;
+        *w = (unsigned int)((uint64_t)iw * (unsigned int)sh / ih);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool image_over_budget(const char *filename) {
+    unsigned int w, h;
+    return image_probe_size(filename, &w, &h) && (uint64_t)w * h > IMAGE_PIXEL_BUDGET;
+}
+
+// NULL once the reader is positioned on the first row, else an error atom name
+static const char *image_reader_open(ImageReader *r) {
+    uint8_t sig[8];
+    size_t n = fread(sig, 1, sizeof(sig), r->f);
+    if (fseek(r->f, 0, SEEK_SET) != 0) return "eio";
+    if (!image_decoder_sniff(sig, n)) return pnm_read_header(r);
+
+    int rv = image_decoder_open(r->f, &r->dec);
+    switch (rv) {
+    case 0: break;
+    case -ENOTSUP: return "enotsup";
+    case -ENOMEM: return "enomem";
+    case -EIO: return "eio";
+    default: return "einval";
+    }
+    image_decoder_info(r->dec, &r->w, &r->h, &r->ch);
+    r->maxval = 255;
+    r->bps = 1;
+    return NULL;
+}
+
+static void image_reader_close(ImageReader *r) {
+    if (r->dec) image_decoder_free(r->dec);
+    fclose(r->f);
+}
+
+// ============================================================================
+// Draw ops (shared by the render thread and batched calls)
+// ============================================================================
+//
+// An op is a tagged tuple built by FBInk.submit/3 from the public API's
+// arguments, e.g. {:print, iodata, config} or {:fill_rect_gray, config, rect,
+// no_rota, y}. Strings are copied out so they can be NUL-terminated; binaries
+// and configs are read in place from the env that owns the op term.
+
+typedef enum {
+    DRAW_OP_PRINT,
+    DRAW_OP_PRINT_OT,
+    DRAW_OP_FILL_RECT_GRAY,
+    DRAW_OP_FILL_RECT_RGBA,
+    DRAW_OP_PRINT_IMAGE,
+    DRAW_OP_PRINT_RAW_DATA,
+    DRAW_OP_CLS,
+    DRAW_OP_REFRESH_RECT,
+} DrawOpType;
+
+typedef struct {
+    DrawOpType type;
+    FBInkConfig cfg;
+    FBInkOTConfig ot_cfg;
+    FBInkRect rect;
+    bool has_rect;
+    bool no_rota;
+    short int x_off;
+    short int y_off;
+    uint8_t color[4];
+    char *str;                  // Text or filename (enif_alloc'd, NUL-terminated)
+    ErlNifBinary data;          // Raw pixel data
+    int w;
+    int h;
+} DrawOp;
+
+static char *iolist_to_cstring(ErlNifEnv *env, ERL_NIF_TERM term) {
+    ErlNifBinary bin;
+    if (!enif_inspect_iolist_as_binary(env, term, &bin))
+        return NULL;
+    char *str = enif_alloc(bin.size + 1);
+    if (!str) return NULL;
+    memcpy(str, bin.data, bin.size);
+    str[bin.size] = '\0';
+    return str;
+}
+
+static bool get_u8(ErlNifEnv *env, ERL_NIF_TERM term, uint8_t *out) {
+    unsigned int v;
+    if (!enif_get_uint(env, term, &v)) return false;
+    *out = (uint8_t)v;
+    return true;
+}
+
+static bool get_flag(ErlNifEnv *env, ERL_NIF_TERM term, bool *out) {
+    int v;
+    if (!enif_get_int(env, term, &v)) return false;
+    *out = v != 0;
+    return true;
+}
+
+// Dithering method atom and level count (16, 4 or 2)
+static bool get_dither(ErlNifEnv *env, ERL_NIF_TERM method, ERL_NIF_TERM levels,
+                       DitherMethod *m, unsigned int *l) {
+    if (enif_is_identical(method, atom_bayer))
+        *m = DITHER_BAYER;
+    else if (enif_is_identical(method, atom_blue_noise))
+        *m = DITHER_BLUE_NOISE;
+    else if (enif_is_identical(method, atom_floyd_steinberg))
+        *m = DITHER_FLOYD_STEINBERG;
+    else if (enif_is_identical(method, atom_atkinson))
+        *m = DITHER_ATKINSON;
+    else
+        return false;
+    return enif_get_uint(env, levels, l) && (*l == 16 || *l == 4 || *l == 2);
+}
+
+static bool get_scale_filter(ERL_NIF_TERM term, ScaleFilter *f) {
+    if (enif_is_identical(term, atom_box))
+        *f = SCALE_BOX;
+    else if (enif_is_identical(term, atom_bilinear))
+        *f = SCALE_BILINEAR;
+    else if (enif_is_identical(term, atom_lanczos))
+        *f = SCALE_LANCZOS;
+    else
+        return false;
+    return true;
+}
+
+// Bytes per pixel of a Y8, YA, RGB or RGBA buffer of w x h pixels, 0 for anything else
+static unsigned int raw_source_bpp(size_t size, int w, int h) {
+    if (w <= 0 || h <= 0) return 0;
+    size_t px = (size_t)w * (size_t)h;
+    for (unsigned int n = 1; n <= 4; n++)
+        if (size == px * n) return n;
+    return 0;
+}
+
+// print_raw_data/8 pre-pass: %{width, height, filter, dither, levels, threads}
+typedef struct {
+    unsigned int width, height;  // Resample to this size first, 0 to keep the data's
+    ScaleFilter filter;
+    DitherMethod method;
+    unsigned int levels;         // Then dither to Y8 with this many levels, 0 to skip
+    unsigned int threads;        // Threads to spread bands over, 0 for the whole pool
+} RawPrepass;
+
+static bool get_raw_prepass(ErlNifEnv *env, ERL_NIF_TERM map, RawPrepass *pp) {
+    ERL_NIF_TERM val;
+    memset(pp, 0, sizeof(*pp));
+    if (!enif_is_map(env, map)) return false;
+    pp->width = get_uint(env, map, atom_width, 0);
+    pp->height = get_uint(env, map, atom_height, 0);
+    if ((pp->width == 0) != (pp->height == 0) || pp->width > UINT16_MAX ||
+        pp->height > UINT16_MAX)
+        return false;
+    pp->filter = SCALE_LANCZOS;
+    if (enif_get_map_value(env, map, atom_filter, &val) && !get_scale_filter(val, &pp->filter))
+        return false;
+    if (enif_get_map_value(env, map, atom_dither, &val) && !enif_is_identical(val, atom_nil)) {
+        ERL_NIF_TERM levels = enif_make_uint(env, 16);
+        enif_get_map_value(env, map, atom_levels, &levels);
+        if (!get_dither(env, val, levels, &pp->method, &pp->levels)) return false;
+    }
+    pp->threads = get_uint(env, map, atom_threads, 0);
+    return true;
+}
+
+static bool get_short(ErlNifEnv *env, ERL_NIF_TERM term, short int *out) {
+    int v;
+    if (!enif_get_int(env, term, &v)) return false;
+    *out = (short int)v;
+    return true;
+}
+
+static void draw_op_release(DrawOp *op) {
+    if (op->str) enif_free(op->str);
+    op->str = NULL;
+}
+
+static bool decode_draw_op(ErlNifEnv *env, ERL_NIF_TERM term, DrawOp *op) {
+    int arity;
+    const ERL_NIF_TERM *el;
+    memset(op, 0, sizeof(DrawOp));
+    if (!enif_get_tuple(env, term, &arity, &el) || arity < 1)
+        return false;
+
+    if (enif_is_identical(el[0], atom_print) && arity == 3) {
+        op->type = DRAW_OP_PRINT;
+        if (!(op->str = iolist_to_cstring(env, el[1]))) return false;
+        map_to_fbink_config(env, el[2], &op->cfg);
+        return true;
+    }
+    if (enif_is_identical(el[0], atom_print_ot) && arity == 4) {
+        op->type = DRAW_OP_PRINT_OT;
+        if (!(op->str = iolist_to_cstring(env, el[1]))) return false;
+        map_to_fbink_ot_config(env, el[2], &op->ot_cfg);
+        map_to_fbink_config(env, el[3], &op->cfg);
+        return true;
+    }
+    if (enif_is_identical(el[0], atom_fill_rect_gray) && arity == 5) {
+        op->type = DRAW_OP_FILL_RECT_GRAY;
+        map_to_fbink_config(env, el[1], &op->cfg);
+        map_to_fbink_rect(env, el[2], &op->rect);
+        op->has_rect = true;
+        return get_flag(env, el[3], &op->no_rota) && get_u8(env, el[4], &op->color[0]);
+    }
+    if (enif_is_identical(el[0], atom_fill_rect_rgba) && arity == 8) {
+        op->type = DRAW_OP_FILL_RECT_RGBA;
+        map_to_fbink_config(env, el[1], &op->cfg);
+        map_to_fbink_rect(env, el[2], &op->rect);
+        op->has_rect = true;
+        return get_flag(env, el[3], &op->no_rota) &&
+               get_u8(env, el[4], &op->color[0]) && get_u8(env, el[5], &op->color[1]) &&
+               get_u8(env, el[6], &op->color[2]) && get_u8(env, el[7], &op->color[3]);
+    }
+    if (enif_is_identical(el[0], atom_print_image) && arity == 5) {
+        op->type = DRAW_OP_PRINT_IMAGE;
+        if (!(op->str = iolist_to_cstring(env, el[1]))) return false;
+        map_to_fbink_config(env, el[4], &op->cfg);
+        return get_short(env, el[2], &op->x_off) && get_short(env, el[3], &op->y_off);
+    }
+    if (enif_is_identical(el[0], atom_print_raw_data) && arity == 7) {
+        op->type = DRAW_OP_PRINT_RAW_DATA;
+        map_to_fbink_config(env, el[6], &op->cfg);
+        return enif_inspect_binary(env, el[1], &op->data) &&
+               enif_get_int(env, el[2], &op->w) && enif_get_int(env, el[3], &op->h) &&
+               get_short(env, el[4], &op->x_off) && get_short(env, el[5], &op->y_off);
+    }
+    if (enif_is_identical(el[0], atom_cls) && arity == 4) {
+        op->type = DRAW_OP_CLS;
+        map_to_fbink_config(env, el[1], &op->cfg);
+        if (!enif_is_atom(env, el[2])) {
+            map_to_fbink_rect(env, el[2], &op->rect);
+            op->has_rect = true;
+        }
+        return get_flag(env, el[3], &op->no_rota);
+    }
+    if (enif_is_identical(el[0], atom_refresh_rect) && arity == 3) {
+        op->type = DRAW_OP_REFRESH_RECT;
+        map_to_fbink_rect(env, el[1], &op->rect);
+        op->has_rect = true;
+        map_to_fbink_config(env, el[2], &op->cfg);
+        return true;
+    }
+    return false;
+}
+
+// Whether a run_draw_op result is an {:ok, ...} tuple
+static bool draw_op_succeeded(ErlNifEnv *env, ERL_NIF_TERM result) {
+    const ERL_NIF_TERM *el;
+    int arity;
+    return enif_get_tuple(env, result, &arity, &el) && enif_is_identical(el[0], atom_ok);
+}
+
+// Run a decoded op against fbfd and build its result term in env
+static ERL_NIF_TERM run_draw_op(ErlNifEnv *env, int fbfd, DrawOp *op) {
+    int rv;
+    switch (op->type) {
+    case DRAW_OP_PRINT:
+        rv = fbink_print(fbfd, op->str, &op->cfg);
+        break;
+    case DRAW_OP_PRINT_OT: {
+        FBInkOTFit fit;
+        memset(&fit, 0, sizeof(fit));
+        rv = fbink_print_ot(fbfd, op->str, &op->ot_cfg, &op->cfg, &fit);
+        if (rv < 0)
+            return make_error_int(env, rv);
+        return enif_make_tuple3(env, atom_ok, enif_make_int(env, rv),
+                                fbink_ot_fit_to_map(env, &fit));
+    }
+    case DRAW_OP_FILL_RECT_GRAY:
+        rv = fbink_fill_rect_gray(fbfd, &op->cfg, &op->rect, op->no_rota, op->color[0]);
+        break;
+    case DRAW_OP_FILL_RECT_RGBA:
+        rv = fbink_fill_rect_rgba(fbfd, &op->cfg, &op->rect, op->no_rota,
+                                  op->color[0], op->color[1], op->color[2], op->color[3]);
+        break;
+    case DRAW_OP_PRINT_IMAGE:
+        if (image_over_budget(op->str))
+            return make_error_string(env, "efbig");
+        rv = fbink_print_image(fbfd, op->str, op->x_off, op->y_off, &op->cfg);
+        break;
+    case DRAW_OP_PRINT_RAW_DATA:
+        rv = fbink_print_raw_data(fbfd, op->data.data, op->w, op->h, op->data.size,
+                                  op->x_off, op->y_off, &op->cfg);
+        break;
+    case DRAW_OP_CLS:
+        rv = fbink_cls(fbfd, &op->cfg, op->has_rect ? &op->rect : NULL, op->no_rota);
+        break;
+    case DRAW_OP_REFRESH_RECT:
+        wfm_resolve(fbfd, &op->rect, &op->cfg);
+        rv = fbink_refresh_rect(fbfd, &op->rect, &op->cfg);
+        break;
+    default:
+        return make_error_string(env, "badarg");
+    }
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// FBInk lock
+// ============================================================================
+//
+// FBInk isn't thread-safe: fbink_get_last_rect/fbink_get_last_marker, pen
+// colors and loaded fonts are globals, yet dirty NIFs, handle render threads
+// and the refresh waiter all call into it. Anything that draws, refreshes or
+// reads back the framebuffer holds fbink_lock from the FBInk call through
+// reading the last rect or marker, so each caller records its own damage.
+// So does every other NIF that reads or writes FBInk's globals (state, pens,
+// verbosity, single pixels), which is why none of them run on a normal
+// scheduler, and close/1 and the handle destructor, since fbink_close can drop
+// the framebuffer mapping another caller is drawing into. Only waits (refresh
+// completion, input, USBMS) run without it, so they never hold up drawing.
+
+static ErlNifMutex *fbink_lock = NULL;
+
+// ============================================================================
+// Render thread
+// ============================================================================
+
+static void render_cmd_finish(FBHandle *fb, RenderCmd *cmd, bool execute) {
+    ERL_NIF_TERM result;
+    if (!execute) {
+        result = make_error_string(cmd->env, "closed");
+    } else {
+        DrawOp op;
+        if (decode_draw_op(cmd->env, cmd->op, &op)) {
+            bool deferred = op.type != DRAW_OP_REFRESH_RECT && wfm_defer(&op.cfg);
+            enif_mutex_lock(fbink_lock);
+            result = run_draw_op(cmd->env, fb->fbfd, &op);
+            if (op.type != DRAW_OP_REFRESH_RECT)
+                draw_done(fb, fb->fbfd, &op.cfg,
+                          draw_op_succeeded(cmd->env, result) ? 0 : -1, deferred);
+            enif_mutex_unlock(fbink_lock);
+        } else
+            result = make_error_string(cmd->env, "badarg");
+        draw_op_release(&op);
+    }
+
+    ERL_NIF_TERM msg = enif_make_tuple3(cmd->env, atom_fbink_done,
+        enif_make_uint64(cmd->env, cmd->seq), result);
+    enif_send(NULL, &cmd->pid, cmd->env, msg);
+    enif_free_env(cmd->env);
+}
+
+static void *render_thread_main(void *arg) {
+    FBHandle *fb = (FBHandle *)arg;
+    RenderCmd cmd;
+
+    for (;;) {
+        if (render_ring_pop(fb, &cmd)) {
+            bool stopping = atomic_load(&fb->stopping);
+            render_cmd_finish(fb, &cmd, !stopping || fb->drain);
+            continue;
+        }
+        if (atomic_load(&fb->stopping)) break;
+
+        enif_mutex_lock(fb->wake_lock);
+        while (atomic_load_explicit(&fb->head, memory_order_relaxed) ==
+                   atomic_load_explicit(&fb->tail, memory_order_acquire) &&
+               !atomic_load(&fb->stopping))
+            enif_cond_wait(fb->wake_cond, fb->wake_lock);
+        enif_mutex_unlock(fb->wake_lock);
+    }
+    return NULL;
+}
+
+// Stop the render thread. With drain, queued commands still run; otherwise
+// their callers get {:error, :closed}.
+static void render_thread_stop(FBHandle *fb, bool drain) {
+    enif_mutex_lock(fb->submit_lock);
+    bool started = fb->thread_started;
+    fb->thread_started = false;
+    fb->drain = drain;
+    atomic_store(&fb->stopping, true);
+    enif_mutex_unlock(fb->submit_lock);
+
+    if (!started) return;
+    enif_mutex_lock(fb->wake_lock);
+    enif_cond_signal(fb->wake_cond);
+    enif_mutex_unlock(fb->wake_lock);
+    enif_thread_join(fb->tid, NULL);
+}
+
+static void fb_resource_dtor(ErlNifEnv *env, void *obj) {
+    (void)env;
+    FBHandle *fb = (FBHandle *)obj;
+    if (fb->submit_lock) render_thread_stop(fb, false);
+
+    // Only after the render thread is joined: it takes fbink_lock itself
+    if (!atomic_load(&fb->closed)) {
+        atomic_store(&fb->closed, true);
+        enif_mutex_lock(fbink_lock);
+        fbink_close(fb->fbfd);
+        enif_mutex_unlock(fbink_lock);
+    }
+    if (fb->wake_cond) enif_cond_destroy(fb->wake_cond);
+    if (fb->wake_lock) enif_mutex_destroy(fb->wake_lock);
+    if (fb->submit_lock) enif_mutex_destroy(fb->submit_lock);
+    if (fb->damage_lock) enif_mutex_destroy(fb->damage_lock);
+}
+
+// ============================================================================
+// Refresh waiter thread (asynchronous completion notifications)
+// ============================================================================
+//
+// NIF-owned threads block in fbink_wait_for_submission/complete on behalf of
+// Elixir processes and report progress with enif_send, so callers can keep
+// several refreshes in flight without sleeping through waveforms. A thread is
+// started whenever more jobs are queued than threads are idle, up to
+// REFRESH_WAITER_THREADS, so a late or stale marker (which blocks until FBInk
+// times out) doesn't hold up the others as long as fewer than that many are
+// stuck at once; beyond that, jobs queue for the next free thread.
+//
+// Jobs for a handle keep its fd open: close/1 only marks it closed while any
+// are pending, and the last one to finish closes it, so a queued wait never
+// runs on an fd number that has been closed (and possibly reused).
+
+#define REFRESH_WAITER_THREADS 8
+
+typedef struct RefreshJob {
+    struct RefreshJob *next;
+    ErlNifPid pid;
+    FBHandle *fb;               // Kept alive until the job is done (or NULL)
+    int fbfd;
+    uint32_t marker;
+    ErlNifTime queued_at;
+} RefreshJob;
+
+static struct {
+    ErlNifMutex *lock;
+    ErlNifCond *cond;
+    ErlNifTid tids[REFRESH_WAITER_THREADS];
+    unsigned int nthreads;
+    unsigned int idle;          // Threads waiting for a job
+    unsigned int queued;        // Jobs no thread has taken yet
+    RefreshJob *head;
+    RefreshJob *tail;
+    bool running;
+} refresh_waiter;
+
+static void refresh_waiter_notify(ErlNifEnv *msg_env, const RefreshJob *job,
+                                  ERL_NIF_TERM status) {
+    ErlNifTime elapsed = enif_monotonic_time(ERL_NIF_USEC) - job->queued_at;
+    ERL_NIF_TERM msg = enif_make_tuple4(msg_env, atom_fbink_refresh,
+        enif_make_uint(msg_env, job->marker), status,
+        enif_make_int64(msg_env, elapsed));
+    enif_send(NULL, &job->pid, msg_env, msg);
+    enif_clear_env(msg_env);
+}
+
+// Drop a job's hold on its handle, closing the fd if close/1 was deferred
+static void refresh_waiter_release(FBHandle *fb) {
+    enif_mutex_lock(refresh_waiter.lock);
+    bool close_now = --fb->waiters == 0 && fb->close_deferred;
+    enif_mutex_unlock(refresh_waiter.lock);
+    // fbink_lock is taken before the waiter's lock elsewhere, never after it
+    if (close_now) {
+        enif_mutex_lock(fbink_lock);
+        fbink_close(fb->fbfd);
+        enif_mutex_unlock(fbink_lock);
+    }
+    enif_release_resource(fb);
+}
+
+static void *refresh_waiter_main(void *arg) {
+    (void)arg;
+    ErlNifEnv *msg_env = enif_alloc_env();
+
+    for (;;) {
+        enif_mutex_lock(refresh_waiter.lock);
+        refresh_waiter.idle++;
+        while (!refresh_waiter.head && refresh_waiter.running)
+            enif_cond_wait(refresh_waiter.cond, refresh_waiter.lock);
+        refresh_waiter.idle--;
+        if (!refresh_waiter.running) {
+            enif_mutex_unlock(refresh_waiter.lock);
+            break;
+        }
+        RefreshJob *job = refresh_waiter.head;
+        refresh_waiter.head = job->next;
+        if (!refresh_waiter.head) refresh_waiter.tail = NULL;
+        refresh_waiter.queued--;
+        enif_mutex_unlock(refresh_waiter.lock);
+
+        // -ENOSYS means the platform can't wait for submission; the ioctl that
+        // queued the update already returned, so it has been submitted.
+        int rv = fbink_wait_for_submission(job->fbfd, job->marker);
+        if (rv < 0 && rv != -ENOSYS) {
+            refresh_waiter_notify(msg_env, job, make_error_int(msg_env, rv));
+        } else {
+            refresh_waiter_notify(msg_env, job, atom_submitted);
+            rv = fbink_wait_for_complete(job->fbfd, job->marker);
+            refresh_waiter_notify(msg_env, job,
+                rv < 0 ? make_error_int(msg_env, rv) : atom_complete);
+        }
+        if (job->fb) refresh_waiter_release(job->fb);
+        enif_free(job);
+    }
+
+    enif_free_env(msg_env);
+    return NULL;
+}
+
+static int refresh_waiter_start(void) {
+    refresh_waiter.lock = enif_mutex_create("fbink_refresh_waiter");
+    refresh_waiter.cond = enif_cond_create("fbink_refresh_waiter");
+    if (!refresh_waiter.lock || !refresh_waiter.cond) return -1;
+    refresh_waiter.head = refresh_waiter.tail = NULL;
+    refresh_waiter.nthreads = refresh_waiter.idle = refresh_waiter.queued = 0;
+    refresh_waiter.running = true;
+
+    // One thread up front, so jobs are always picked up; more on demand
+    if (enif_thread_create("fbink_refresh_waiter", &refresh_waiter.tids[0],
+                           refresh_waiter_main, NULL, NULL) != 0) {
+        refresh_waiter.running = false;
+        return -1;
+    }
+    refresh_waiter.nthreads = 1;
+    return 0;
+}
+
+static void refresh_waiter_stop(void) {
+    if (!refresh_waiter.lock) return;
+
+    // Once running is false no thread is started, so the snapshot is final
+    enif_mutex_lock(refresh_waiter.lock);
+    bool was_running = refresh_waiter.running;
+    refresh_waiter.running = false;
+    unsigned int nthreads = refresh_waiter.nthreads;
+    enif_cond_broadcast(refresh_waiter.cond);
+    enif_mutex_unlock(refresh_waiter.lock);
+    if (was_running) {
+        for (unsigned int i = 0; i < nthreads; i++)
+            enif_thread_join(refresh_waiter.tids[i], NULL);
+    }
+    refresh_waiter.nthreads = 0;
+
+    while (refresh_waiter.head) {
+        RefreshJob *job = refresh_waiter.head;
+        refresh_waiter.head = job->next;
+        if (job->fb) refresh_waiter_release(job->fb);
+        enif_free(job);
+    }
+    refresh_waiter.tail = NULL;
+    enif_cond_destroy(refresh_waiter.cond);
+    enif_mutex_destroy(refresh_waiter.lock);
+    refresh_waiter.lock = NULL;
+}
+
+// Returns NULL, or the error atom's name ("enomem", or "closed" if close/1
+// got to the handle first)
+static const char *refresh_waiter_enqueue(const ErlNifPid *pid, FBHandle *fb, int fbfd,
+                                          uint32_t marker) {
+    RefreshJob *job = enif_alloc(sizeof(RefreshJob));
+    if (!job) return "enomem";
+    job->next = NULL;
+    job->pid = *pid;
+    job->fb = fb;
+    job->fbfd = fbfd;
+    job->marker = marker;
+    job->queued_at = enif_monotonic_time(ERL_NIF_USEC);
+
+    enif_mutex_lock(refresh_waiter.lock);
+    // close/1 sets closed before checking waiters under this lock, so either
+    // it sees this job or this sees it closed
+    if (fb && atomic_load(&fb->closed)) {
+        enif_mutex_unlock(refresh_waiter.lock);
+        enif_free(job);
+        return "closed";
+    }
+    if (fb) {
+        enif_keep_resource(fb);
+        fb->waiters++;
+    }
+    if (refresh_waiter.tail) refresh_waiter.tail->next = job;
+    else refresh_waiter.head = job;
+    refresh_waiter.tail = job;
+    refresh_waiter.queued++;
+    // If the thread can't be created, the job waits for a busy one
+    if (refresh_waiter.queued > refresh_waiter.idle &&
+        refresh_waiter.nthreads < REFRESH_WAITER_THREADS &&
+        enif_thread_create("fbink_refresh_waiter",
+                           &refresh_waiter.tids[refresh_waiter.nthreads],
+                           refresh_waiter_main, NULL, NULL) == 0)
+        refresh_waiter.nthreads++;
+    else
+        enif_cond_signal(refresh_waiter.cond);
+    enif_mutex_unlock(refresh_waiter.lock);
+    return NULL;
+}
+
+// ============================================================================
+// NIF: fbink_version/0
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_version(ErlNifEnv *env, int argc,
+                                       const ERL_NIF_TERM argv[]) {
+    (void)argc; (void)argv;
+    const char *ver = fbink_version();
+    return enif_make_string(env, ver, ERL_NIF_LATIN1);
+}
+
+// ============================================================================
+// NIF: fbink_target/0
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_target(ErlNifEnv *env, int argc,
+                                      const ERL_NIF_TERM argv[]) {
+    (void)argc; (void)argv;
+    return enif_make_uint(env, (unsigned int)fbink_target());
+}
+
+// ============================================================================
+// NIF: fbink_features/0
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_features(ErlNifEnv *env, int argc,
+                                        const ERL_NIF_TERM argv[]) {
+    (void)argc; (void)argv;
+    return enif_make_uint(env, fbink_features());
+}
+
+// ============================================================================
+// NIF: compile_config/1, compile_ot_config/1, compile_rect/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_compile_config(ErlNifEnv *env, int argc,
+                                               const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    if (!enif_is_map(env, argv[0]))
+        return enif_make_badarg(env);
+
+    ConfigResource *res = enif_alloc_resource(config_resource_type, sizeof(ConfigResource));
+    if (!res) return make_error_string(env, "enomem");
+    map_to_fbink_config(env, argv[0], &res->cfg);
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return res_term;
+}
+
+static ERL_NIF_TERM nif_fbink_compile_ot_config(ErlNifEnv *env, int argc,
+                                                  const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    if (!enif_is_map(env, argv[0]))
+        return enif_make_badarg(env);
+
+    OTConfigResource *res = enif_alloc_resource(ot_config_resource_type, sizeof(OTConfigResource));
+    if (!res) return make_error_string(env, "enomem");
+    map_to_fbink_ot_config(env, argv[0], &res->cfg);
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return res_term;
+}
+
+static ERL_NIF_TERM nif_fbink_compile_rect(ErlNifEnv *env, int argc,
+                                             const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    if (!enif_is_map(env, argv[0]))
+        return enif_make_badarg(env);
+
+    RectResource *res = enif_alloc_resource(rect_resource_type, sizeof(RectResource));
+    if (!res) return make_error_string(env, "enomem");
+    map_to_fbink_rect(env, argv[0], &res->rect);
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return res_term;
+}
+
+// ============================================================================
+// NIF: fbink_open/0
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_open(ErlNifEnv *env, int argc,
+                                    const ERL_NIF_TERM argv[]) {
+    (void)argc; (void)argv;
+    FBHandle *fb = enif_alloc_resource(fb_resource_type, sizeof(FBHandle));
+    if (!fb) return make_error_string(env, "enomem");
+    memset(fb, 0, sizeof(FBHandle));
+    atomic_init(&fb->closed, true);
+    atomic_init(&fb->stopping, false);
+    atomic_init(&fb->head, 0);
+    atomic_init(&fb->tail, 0);
+
+    fb->submit_lock = enif_mutex_create("fbink_fb_submit");
+    fb->wake_lock   = enif_mutex_create("fbink_fb_wake");
+    fb->wake_cond   = enif_cond_create("fbink_fb_wake");
+    fb->damage_lock = enif_mutex_create("fbink_fb_damage");
+    if (!fb->submit_lock || !fb->wake_lock || !fb->wake_cond || !fb->damage_lock) {
+        enif_release_resource(fb);
+        return make_error_string(env, "enomem");
+    }
+
+    int fd = fbink_open();
+    if (fd < 0) {
+        enif_release_resource(fb);
+        return make_error_int(env, fd);
+    }
+    fb->fbfd = fd;
+    atomic_store(&fb->closed, false);
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, fb);
+    enif_release_resource(fb);
+    return make_ok(env, res_term);
+}
+
+// ============================================================================
+// NIF: fbink_close/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_close(ErlNifEnv *env, int argc,
+                                     const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    FBHandle *fb;
+    if (enif_get_resource(env, argv[0], fb_resource_type, (void **)&fb)) {
+        // Let already queued commands run before the fd goes away
+        render_thread_stop(fb, true);
+        if (atomic_exchange(&fb->closed, true))
+            return make_error_string(env, "closed");
+        // Pending refresh notifications still wait on the fd; the last one closes it
+        enif_mutex_lock(refresh_waiter.lock);
+        bool deferred = fb->close_deferred = fb->waiters > 0;
+        enif_mutex_unlock(refresh_waiter.lock);
+        if (deferred) return make_ok_or_error(env, 0);
+        enif_mutex_lock(fbink_lock);
+        int rv = fbink_close(fb->fbfd);
+        enif_mutex_unlock(fbink_lock);
+        return make_ok_or_error(env, rv);
+    }
+
+    int fbfd;
+    if (!enif_get_int(env, argv[0], &fbfd))
+        return enif_make_badarg(env);
+
+    enif_mutex_lock(fbink_lock);
+    int rv = fbink_close(fbfd);
+    enif_mutex_unlock(fbink_lock);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_init/2
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_init(ErlNifEnv *env, int argc,
+                                    const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    if (!get_fbfd(env, argv[0], &fbfd))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[1], &cfg);
+
+    int rv = fbink_init(fbfd, &cfg);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_reinit/2
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_reinit(ErlNifEnv *env, int argc,
+                                      const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    if (!get_fbfd(env, argv[0], &fbfd))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[1], &cfg);
+
+    int rv = fbink_reinit(fbfd, &cfg);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_get_state/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_get_state(ErlNifEnv *env, int argc,
+                                         const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[0], &cfg);
+
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    fbink_get_state(&cfg, &state);
+
+    return fbink_state_to_map(env, &state);
+}
+
+// ============================================================================
+// NIF: fbink_state_dump/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_state_dump(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[0], &cfg);
+
+    fbink_state_dump(&cfg);
+    return atom_ok;
+}
+
+// ============================================================================
+// NIF: fbink_get_last_rect/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_get_last_rect(ErlNifEnv *env, int argc,
+                                              const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int rotated;
+    if (!enif_get_int(env, argv[0], &rotated))
+        return enif_make_badarg(env);
+
+    FBInkRect rect = fbink_get_last_rect(rotated != 0);
+    return fbink_rect_to_map(env, &rect);
+}
+
+// ============================================================================
 // NIF: fbink_get_last_marker/0
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_get_last_marker(ErlNifEnv *env, int argc,
-                                                const ERL_NIF_TERM argv[]) {
-    (void)argc; (void)argv;
-    return enif_make_uint(env, fbink_get_last_marker());
+static ERL_NIF_TERM nif_fbink_get_last_marker(ErlNifEnv *env, int argc,
+                                                const ERL_NIF_TERM argv[]) {
+    (void)argc; (void)argv;
+    return enif_make_uint(env, fbink_get_last_marker());
+}
+
+// ============================================================================
+// NIF: fbink_update_verbosity/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_update_verbosity(ErlNifEnv *env, int argc,
+                                                 const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[0], &cfg);
+    fbink_update_verbosity(&cfg);
+    return atom_ok;
+}
+
+// ============================================================================
+// NIF: fbink_update_pen_colors/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_update_pen_colors(ErlNifEnv *env, int argc,
+                                                  const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[0], &cfg);
+    int rv = fbink_update_pen_colors(&cfg);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_set_fg_pen_gray/3
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_set_fg_pen_gray(ErlNifEnv *env, int argc,
+                                                const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    unsigned int y;
+    int quantize, update;
+    if (!enif_get_uint(env, argv[0], &y) ||
+        !enif_get_int(env, argv[1], &quantize) ||
+        !enif_get_int(env, argv[2], &update))
+        return enif_make_badarg(env);
+
+    int rv = fbink_set_fg_pen_gray((uint8_t)y, quantize != 0, update != 0);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_set_bg_pen_gray/3
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_set_bg_pen_gray(ErlNifEnv *env, int argc,
+                                                const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    unsigned int y;
+    int quantize, update;
+    if (!enif_get_uint(env, argv[0], &y) ||
+        !enif_get_int(env, argv[1], &quantize) ||
+        !enif_get_int(env, argv[2], &update))
+        return enif_make_badarg(env);
+
+    int rv = fbink_set_bg_pen_gray((uint8_t)y, quantize != 0, update != 0);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_set_fg_pen_rgba/6
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_set_fg_pen_rgba(ErlNifEnv *env, int argc,
+                                                const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    unsigned int r, g, b, a;
+    int quantize, update;
+    if (!enif_get_uint(env, argv[0], &r) ||
+        !enif_get_uint(env, argv[1], &g) ||
+        !enif_get_uint(env, argv[2], &b) ||
+        !enif_get_uint(env, argv[3], &a) ||
+        !enif_get_int(env, argv[4], &quantize) ||
+        !enif_get_int(env, argv[5], &update))
+        return enif_make_badarg(env);
+
+    int rv = fbink_set_fg_pen_rgba((uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a,
+                                   quantize != 0, update != 0);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_set_bg_pen_rgba/6
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_set_bg_pen_rgba(ErlNifEnv *env, int argc,
+                                                const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    unsigned int r, g, b, a;
+    int quantize, update;
+    if (!enif_get_uint(env, argv[0], &r) ||
+        !enif_get_uint(env, argv[1], &g) ||
+        !enif_get_uint(env, argv[2], &b) ||
+        !enif_get_uint(env, argv[3], &a) ||
+        !enif_get_int(env, argv[4], &quantize) ||
+        !enif_get_int(env, argv[5], &update))
+        return enif_make_badarg(env);
+
+    int rv = fbink_set_bg_pen_rgba((uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a,
+                                   quantize != 0, update != 0);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_print/3
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_print(ErlNifEnv *env, int argc,
+                                     const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
+        return enif_make_badarg(env);
+
+    ErlNifBinary bin;
+    if (!enif_inspect_iolist_as_binary(env, argv[1], &bin))
+        return enif_make_badarg(env);
+
+    // Null-terminate the string
+    char *str = enif_alloc(bin.size + 1);
+    if (!str) return make_error_string(env, "enomem");
+    memcpy(str, bin.data, bin.size);
+    str[bin.size] = '\0';
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[2], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    int rv = fbink_print(fbfd, str, &cfg);
+    enif_free(str);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_add_ot_font/2
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_add_ot_font(ErlNifEnv *env, int argc,
+                                            const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    char filename[4096];
+    if (enif_get_string(env, argv[0], filename, sizeof(filename), ERL_NIF_LATIN1) <= 0) {
+        ErlNifBinary bin;
+        if (!enif_inspect_iolist_as_binary(env, argv[0], &bin) || bin.size >= sizeof(filename))
+            return enif_make_badarg(env);
+        memcpy(filename, bin.data, bin.size);
+        filename[bin.size] = '\0';
+    }
+
+    int style;
+    if (!enif_get_int(env, argv[1], &style))
+        return enif_make_badarg(env);
+
+    int rv = fbink_add_ot_font(filename, (FONT_STYLE_T)style);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_free_ot_fonts/0
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_free_ot_fonts(ErlNifEnv *env, int argc,
+                                              const ERL_NIF_TERM argv[]) {
+    (void)argc; (void)argv;
+    int rv = fbink_free_ot_fonts();
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_print_ot/4
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_print_ot(ErlNifEnv *env, int argc,
+                                         const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
+        return enif_make_badarg(env);
+
+    ErlNifBinary bin;
+    if (!enif_inspect_iolist_as_binary(env, argv[1], &bin))
+        return enif_make_badarg(env);
+
+    char *str = enif_alloc(bin.size + 1);
+    if (!str) return make_error_string(env, "enomem");
+    memcpy(str, bin.data, bin.size);
+    str[bin.size] = '\0';
+
+    FBInkOTConfig ot_cfg;
+    map_to_fbink_ot_config(env, argv[2], &ot_cfg);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[3], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    FBInkOTFit fit;
+    memset(&fit, 0, sizeof(fit));
+
+    int rv = fbink_print_ot(fbfd, str, &ot_cfg, &cfg, &fit);
+    enif_free(str);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+
+    if (rv < 0) {
+        return make_error_int(env, rv);
+    }
+
+    ERL_NIF_TERM fit_map = fbink_ot_fit_to_map(env, &fit);
+    return enif_make_tuple3(env, atom_ok, enif_make_int(env, rv), fit_map);
+}
+
+// ============================================================================
+// NIF: fbink_print_progress_bar/3
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_print_progress_bar(ErlNifEnv *env, int argc,
+                                                   const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    unsigned int percentage;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_get_uint(env, argv[1], &percentage))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[2], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    int rv = fbink_print_progress_bar(fbfd, (uint8_t)percentage, &cfg);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_print_activity_bar/3
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_print_activity_bar(ErlNifEnv *env, int argc,
+                                                   const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    unsigned int progress;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_uint(env, argv[1], &progress))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[2], &cfg);
+    wfm_no_auto(&cfg);
+
+    int rv = fbink_print_activity_bar(fbfd, (uint8_t)progress, &cfg);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// Raw data pipeline (scale -> convert -> dither -> draw, in bands)
+// ============================================================================
+//
+// print_raw_data/8's pre-pass. Output rows are split into bands: the worker
+// pool resamples each band and converts it to Y8 for dithering (ordered
+// dithering is per pixel, so it runs there too), while the calling thread
+// takes finished bands in order, runs error diffusion on them (which has to
+// see rows in sequence) and draws them with fbink_print_raw_data without a
+// refresh. The damage is refreshed once at the end. Bytes drawn are the same
+// whatever the number of threads.
+//
+// Drawing band by band assumes each band lands y0 rows below the first, which
+// only holds for plain x/y offsets with the image fully on screen. Otherwise
+// the bands are still computed in parallel, and drawn in one call at the end.
+
+#define PIPE_MIN_ROWS 32        // Smallest band worth a job
+#define PIPE_BANDS_PER_THREAD 4 // Enough bands to keep drawing overlapped with compute
+#define PIPE_MAX_BANDS 64
+
+typedef struct {
+    const uint8_t *src;
+    unsigned int src_w, src_h, sn;
+    unsigned int w, h;          // Output size
+    const RawPrepass *pp;
+    ScaleKernel kx, ky;         // When resampling
+    uint8_t *scaled;            // w x h x sn when resampling, else NULL
+    uint8_t *y8;                // w x h when dithering, else NULL
+} RawPipe;
+
+typedef struct {
+    PoolJob job;
+    RawPipe *p;
+    unsigned int y0, y1;        // Output rows of this band
+    bool queued;
+    bool ok;
+} RawBand;
+
+static bool dither_is_ordered(DitherMethod m) {
+    return m == DITHER_BAYER || m == DITHER_BLUE_NOISE;
+}
+
+static void raw_band(void *arg) {
+    RawBand *b = arg;
+    RawPipe *p = b->p;
+    b->ok = true;
+    if (p->scaled) {
+        ScaleBand sb = { .src = p->src, .dst = p->scaled, .src_w = p->src_w, .dst_w = p->w,
+                         .ch = p->sn, .kx = &p->kx, .ky = &p->ky, .y0 = b->y0, .y1 = b->y1 };
+        scale_band(&sb);
+        b->ok = sb.ok;
+    }
+    if (b->ok && p->y8) {
+        const uint8_t *in = (p->scaled ? p->scaled : p->src) + (size_t)b->y0 * p->w * p->sn;
+        uint8_t *out = p->y8 + (size_t)b->y0 * p->w;
+        pack_to_y8(in, p->sn, (size_t)(b->y1 - b->y0) * p->w, out, false);
+        if (dither_is_ordered(p->pp->method)) {
+            Ditherer d;
+            ditherer_init(&d, p->pp->method, p->w, p->pp->levels, b->y0);  // No allocation
+            ditherer_rows(&d, out, b->y1 - b->y0);
+        }
+    }
+}
+
+// Whether bands drawn y0 rows lower line up with drawing the whole w x h image
+static bool raw_pipe_can_stream(const FBInkConfig *cfg, short int x_off, short int y_off,
+                                unsigned int w, unsigned int h) {
+    if (cfg->halign || cfg->valign || cfg->scaled_width || cfg->scaled_height || cfg->row ||
+        cfg->col || x_off < 0 || y_off < 0)
+        return false;
+    FBInkRect screen = full_screen_rect(cfg);
+    return (unsigned int)x_off + w <= screen.width && (unsigned int)y_off + h <= screen.height;
+}
+
+// Refresh (or record, for no_refresh) the union of bands drawn without refresh
+static int bands_done(FBHandle *fb, int fbfd, const FBInkConfig *cfg, const FBInkRect *damage,
+                      bool deferred) {
+    if (deferred || !cfg->no_refresh) {
+        RefreshGroup g = { .cfg = *cfg, .damage = *damage };
+        g.cfg.no_refresh = false;
+        return rect_is_empty(&g.damage) ? 0 : refresh_group(fbfd, &g);
+    }
+    damage_record(fb, fbfd, cfg, damage);
+    return 0;
+}
+
+// Compute and draw the bands of an allocated pipeline
+static int raw_pipe_run(FBHandle *fb, int fbfd, RawPipe *p, RawBand *bands, unsigned int nbands,
+                        unsigned int threads, Ditherer *serial, short int x_off, short int y_off,
+                        FBInkConfig *cfg, bool deferred) {
+    for (unsigned int i = 0; i < nbands; i++) {
+        bands[i] = (RawBand){ .p = p, .y0 = (unsigned int)((uint64_t)p->h * i / nbands),
+                              .y1 = (unsigned int)((uint64_t)p->h * (i + 1) / nbands) };
+    }
+
+    const uint8_t *img = p->y8 ? p->y8 : p->scaled ? p->scaled : p->src;
+    size_t row = (size_t)p->w * (p->y8 ? 1 : p->sn);
+    bool stream = raw_pipe_can_stream(cfg, x_off, y_off, p->w, p->h);
+    FBInkConfig quiet = *cfg;
+    quiet.no_refresh = true;
+    FBInkRect damage = { 0 };
+
+    // Keep at most threads - 1 bands queued; the caller works on the rest
+    unsigned int window = threads - 1, queued = 0;
+    int rv = 0;
+    for (unsigned int i = 0; i < nbands; i++) {
+        while (queued < nbands && queued < i + 1 + window) {
+            if (queued > i) {
+                bands[queued].queued = true;
+                pool_submit(&bands[queued].job, raw_band, &bands[queued]);
+            }
+            queued++;
+        }
+        RawBand *b = &bands[i];
+        if (b->queued)
+            pool_wait(&b->job);
+        else
+            raw_band(b);
+        if (!b->ok && rv >= 0) rv = -ENOMEM;
+        if (rv < 0) continue;  // Still wait for the queued bands
+
+        unsigned int rows = b->y1 - b->y0;
+        if (serial) ditherer_rows(serial, p->y8 + (size_t)b->y0 * p->w, rows);
+        if (stream) {
+            rv = fbink_print_raw_data(fbfd, img + b->y0 * row, (int)p->w,
+                                      (int)rows, rows * row, x_off,
+                                      (short int)(y_off + (int)b->y0), &quiet);
+            FBInkRect last = fbink_get_last_rect(false);
+            if (rv >= 0) rect_union(&damage, &last);
+        }
+    }
+    if (rv < 0) return rv;
+
+    if (stream) return bands_done(fb, fbfd, cfg, &damage, deferred);
+
+    rv = fbink_print_raw_data(fbfd, img, (int)p->w, (int)p->h, row * p->h, x_off, y_off, cfg);
+    draw_done(fb, fbfd, cfg, rv, deferred);
+    return rv;
+}
+
+static int raw_pipeline(FBHandle *fb, int fbfd, const uint8_t *src, unsigned int src_w,
+                        unsigned int src_h, unsigned int sn, const RawPrepass *pp,
+                        short int x_off, short int y_off, FBInkConfig *cfg, bool deferred) {
+    RawPipe p = { .src = src, .src_w = src_w, .src_h = src_h, .sn = sn, .pp = pp,
+                  .w = pp->width ? pp->width : src_w, .h = pp->width ? pp->height : src_h };
+    bool serial_dither = pp->levels && !dither_is_ordered(pp->method);
+    Ditherer ed = { 0 };
+
+    unsigned int threads = pp->threads ? pp->threads : pool_width();
+    if (threads > POOL_THREADS + 1) threads = POOL_THREADS + 1;
+    unsigned int nbands = p.h / PIPE_MIN_ROWS;
+    if (nbands > threads * PIPE_BANDS_PER_THREAD) nbands = threads * PIPE_BANDS_PER_THREAD;
+    if (nbands > PIPE_MAX_BANDS) nbands = PIPE_MAX_BANDS;
+    if (nbands < 1) nbands = 1;
+
+    RawBand *bands = enif_alloc(nbands * sizeof(RawBand));
+    bool ok = bands != NULL;
+    if (ok && pp->width)
+        ok = scale_kernel_init(&p.kx, src_w, p.w, pp->filter, sn == 1 ? 8 : sn == 4 ? 2 : 1) &&
+             scale_kernel_init(&p.ky, src_h, p.h, pp->filter, 1) &&
+             (p.scaled = enif_alloc((size_t)p.w * p.h * sn)) != NULL;
+    if (ok && pp->levels)
+        ok = (p.y8 = enif_alloc((size_t)p.w * p.h)) != NULL;
+    if (ok && serial_dither)
+        ok = ditherer_init(&ed, pp->method, p.w, pp->levels, 0);
+
+    int rv = ok ? raw_pipe_run(fb, fbfd, &p, bands, nbands, threads, serial_dither ? &ed : NULL,
+                               x_off, y_off, cfg, deferred)
+                : -ENOMEM;
+
+    if (bands) enif_free(bands);
+    ditherer_free(&ed);
+    if (p.y8) enif_free(p.y8);
+    if (p.scaled) enif_free(p.scaled);
+    scale_kernel_free(&p.kx);
+    scale_kernel_free(&p.ky);
+    return rv;
+}
+
+// ============================================================================
+// NIF: fbink_print_raw_data/7,8
+// ============================================================================
+//
+// The optional 8th argument is a pre-pass (RawPrepass) run by raw_pipeline:
+// the data is resampled to width x height, then dithered to Y8 (from Y8, RGB
+// or RGBA).
+
+static ERL_NIF_TERM nif_fbink_print_raw_data(ErlNifEnv *env, int argc,
+                                               const ERL_NIF_TERM argv[]) {
+    int fbfd;
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
+        return enif_make_badarg(env);
+
+    ErlNifBinary bin;
+    if (!enif_inspect_binary(env, argv[1], &bin))
+        return enif_make_badarg(env);
+
+    int w, h;
+    if (!enif_get_int(env, argv[2], &w) ||
+        !enif_get_int(env, argv[3], &h))
+        return enif_make_badarg(env);
+
+    int x_off, y_off;
+    if (!enif_get_int(env, argv[4], &x_off) ||
+        !enif_get_int(env, argv[5], &y_off))
+        return enif_make_badarg(env);
+
+    RawPrepass pp = { 0 };
+    unsigned int sn = 0;
+    if (argc == 8 && (!get_raw_prepass(env, argv[7], &pp) ||
+                      (sn = raw_source_bpp(bin.size, w, h)) == 0 ||
+                      (pp.levels && sn == 2)))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[6], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    int rv;
+    if (argc == 8 && (pp.width || pp.levels)) {
+        rv = raw_pipeline(fb, fbfd, bin.data, (unsigned int)w, (unsigned int)h, sn, &pp,
+                          (short int)x_off, (short int)y_off, &cfg, deferred);
+    } else {
+        rv = fbink_print_raw_data(fbfd, bin.data, w, h, bin.size,
+                                  (short int)x_off, (short int)y_off, &cfg);
+        draw_done(fb, fbfd, &cfg, rv, deferred);
+    }
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// Streaming image decode (print_image_stream/6, large print_image/5)
+// ============================================================================
+//
+// fbink_print_image decodes the whole file before drawing, which doesn't fit
+// in RAM on low-memory readers for 20+ MP scans. PNG, baseline JPEG and
+// binary PNM (P5 gray, P6 RGB, 8 or 16 bits per sample) can be read
+// sequentially instead: each input row is box-averaged into one row of sums
+// as wide as the output, finished output rows go into a small band, and full
+// bands are converted, dithered and drawn without a refresh. The damage is
+// refreshed once at the end. PNM rows are read in chunks, so peak memory only
+// depends on the output width; PNG and JPEG rows are decoded whole, adding
+// a few rows of the input width.
+
+#define STREAM_CHUNK 4096      // Input bytes per PNM read
+#define STREAM_BAND_ROWS 16    // Output rows per fbink_print_raw_data call
+
+typedef struct {
+    ImageReader *in;
+    unsigned int w, h;         // Output size, at most the input's
+    unsigned int och;          // Output channels: 1 (Y8) or 3 (RGB)
+    uint64_t *acc;             // w x in->ch sums for the output row being built
+    uint8_t *chunk;            // chunk_px input pixels
+    unsigned int chunk_px;     // STREAM_CHUNK bytes' worth, or a whole decoded row
+    unsigned int sy, oy;       // Next input and output rows
+    uint8_t *row;              // w x in->ch averaged row, when converting to Y8
+    uint8_t *band;             // STREAM_BAND_ROWS x w x och
+    Ditherer *dither;          // NULL to draw as is
+} ImageStream;
+
+// Largest size within aw x ah, keeping the aspect ratio and never upscaling
+static void stream_fit(unsigned int iw, unsigned int ih, uint64_t aw, uint64_t ah,
+                       unsigned int *w, unsigned int *h) {
+    if (iw <= aw && ih <= ah) {
+        *w = iw;
+        *h = ih;
+    } else if ((uint64_t)iw * ah > (uint64_t)ih * aw) {
+        *w = (unsigned int)aw;
+        *h = (unsigned int)((uint64_t)ih * aw / iw);
+    } else {
+        *h = (unsigned int)ah;
+        *w = (unsigned int)((uint64_t)iw * ah / ih);
+    }
+    if (*w < 1) *w = 1;
+    if (*h < 1) *h = 1;
+}
+
+// Add one input row to the sums: input column sx falls in output column
+// ox while sx < sx_end, the first input column of ox + 1. Returns 0, -EIO
+// when the file is truncated or -EINVAL when it is corrupt.
+static int stream_accumulate_row(ImageStream *s) {
+    const ImageReader *r = s->in;
+    unsigned int px_bytes = r->ch * r->bps;
+    unsigned int ox = 0, sx = 0;
+    uint64_t sx_end = (uint64_t)r->w / s->w;
+    uint64_t *acc = s->acc;
+    while (sx < r->w) {
+        unsigned int n = r->w - sx < s->chunk_px ? r->w - sx : s->chunk_px;
+        if (r->dec) {
+            int rv = image_decoder_row(r->dec, s->chunk);
+            if (rv < 0) return rv;
+        } else if (fread(s->chunk, px_bytes, n, r->f) != n) {
+            return -EIO;
+        }
+        const uint8_t *p = s->chunk;
+        for (unsigned int i = 0; i < n; i++, sx++) {
+            while (sx >= sx_end) {
+                ox++;
+                acc += r->ch;
+                sx_end = (uint64_t)r->w * (ox + 1) / s->w;
+            }
+            for (unsigned int c = 0; c < r->ch; c++, p += r->bps)
+                acc[c] += r->bps == 1 ? p[0] : (unsigned int)(p[0] << 8 | p[1]);
+        }
+    }
+    return 0;
+}
+
+// Turn the sums over `rows` input rows into output row `dst` (in->ch channels)
+static void stream_finish_row(ImageStream *s, unsigned int rows, uint8_t *dst) {
+    const ImageReader *r = s->in;
+    uint64_t x0 = 0;
+    for (unsigned int ox = 0; ox < s->w; ox++) {
+        uint64_t x1 = (uint64_t)r->w * (ox + 1) / s->w;
+        uint64_t div = (x1 - x0) * rows * r->maxval;
+        for (unsigned int c = 0; c < r->ch; c++) {
+            uint64_t *a = &s->acc[(size_t)ox * r->ch + c];
+            *dst++ = (uint8_t)((*a * 255 + div / 2) / div);
+            *a = 0;
+        }
+        x0 = x1;
+    }
+}
+
+// Decode and downsample the input rows that make up the next output row,
+// into dst (in->ch channels)
+static int stream_next_row(ImageStream *s, uint8_t *dst) {
+    unsigned int sy0 = s->sy;
+    unsigned int sy_end = (unsigned int)((uint64_t)s->in->h * (s->oy + 1) / s->h);
+    for (; s->sy < sy_end; s->sy++) {
+        int err = stream_accumulate_row(s);
+        if (err < 0) return err;
+    }
+    stream_finish_row(s, sy_end - sy0, dst);
+    s->oy++;
+    return 0;
+}
+
+// Decode, downsample and draw every band; returns the last draw's result
+static int stream_run(ImageStream *s, int fbfd, short int x_off, short int y_off,
+                      const FBInkConfig *quiet, FBInkRect *damage) {
+    size_t band_row = (size_t)s->w * s->och;
+    unsigned int band_y0 = 0;
+    int rv = 0;
+    while (s->oy < s->h && rv >= 0) {
+        uint8_t *dst = s->band + (s->oy - band_y0) * band_row;
+        int err = stream_next_row(s, s->row ? s->row : dst);
+        if (err < 0) return err;
+        if (s->row) pack_to_y8(s->row, s->in->ch, s->w, dst, false);
+
+        unsigned int rows = s->oy - band_y0;
+        if (rows < STREAM_BAND_ROWS && s->oy < s->h) continue;
+        if (s->dither) ditherer_rows(s->dither, s->band, rows);
+        rv = fbink_print_raw_data(fbfd, s->band, (int)s->w, (int)rows, rows * band_row, x_off,
+                                  (short int)(y_off + (int)band_y0), quiet);
+        FBInkRect last = fbink_get_last_rect(false);
+        if (rv >= 0) rect_union(damage, &last);
+        band_y0 = s->oy;
+    }
+    return rv;
+}
+
+// Stream an opened image at w x h, placed at plain offsets that keep it on
+// screen (see raw_pipe_can_stream)
+static int stream_draw(FBHandle *fb, int fbfd, ImageReader *r, unsigned int w, unsigned int h,
+                       const RawPrepass *pp, short int x_off, short int y_off,
+                       const FBInkConfig *cfg, bool deferred) {
+    ImageStream s = { .in = r, .w = w, .h = h };
+    s.och = r->ch == 1 || pp->levels ? 1 : 3;
+    s.chunk_px = r->dec ? r->w : STREAM_CHUNK / (r->ch * r->bps);
+
+    Ditherer d = { 0 };
+    bool ok = (s.acc = enif_alloc((size_t)s.w * r->ch * sizeof(uint64_t))) != NULL &&
+              (s.chunk = enif_alloc((size_t)s.chunk_px * r->ch * r->bps)) != NULL &&
+              (s.band = enif_alloc((size_t)STREAM_BAND_ROWS * s.w * s.och)) != NULL;
+    if (ok && r->ch != s.och)
+        ok = (s.row = enif_alloc((size_t)s.w * r->ch)) != NULL;
+    if (ok && pp->levels && (ok = ditherer_init(&d, pp->method, s.w, pp->levels, 0)))
+        s.dither = &d;
+
+    int rv = -ENOMEM;
+    if (ok) {
+        memset(s.acc, 0, (size_t)s.w * r->ch * sizeof(uint64_t));
+        FBInkConfig quiet = *cfg;
+        quiet.no_refresh = true;
+        FBInkRect damage = { 0 };
+        rv = stream_run(&s, fbfd, x_off, y_off, &quiet, &damage);
+        if (rv >= 0) rv = bands_done(fb, fbfd, cfg, &damage, deferred);
+    }
+
+    ditherer_free(&d);
+    if (s.acc) enif_free(s.acc);
+    if (s.chunk) enif_free(s.chunk);
+    if (s.row) enif_free(s.row);
+    if (s.band) enif_free(s.band);
+    return rv;
+}
+
+// ============================================================================
+// NIF: fbink_print_image_stream/6
+// ============================================================================
+//
+// The last argument is a RawPrepass map: the output size (0 to fit the
+// screen) and the dithering. Filter and threads don't apply.
+
+static ERL_NIF_TERM nif_fbink_print_image_stream(ErlNifEnv *env, int argc,
+                                                   const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    char filename[4096];
+    int x_off, y_off;
+    RawPrepass pp;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !get_filename(env, argv[1], filename, sizeof(filename)) ||
+        !enif_get_int(env, argv[2], &x_off) ||
+        !enif_get_int(env, argv[3], &y_off) ||
+        !get_raw_prepass(env, argv[5], &pp))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[4], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    ImageReader r = { .f = fopen(filename, "rbe") };
+    if (!r.f) return make_error_int(env, -errno);
+    const char *reason = image_reader_open(&r);
+
+    unsigned int w = pp.width, h = pp.height;
+    if (!reason && !w) {
+        FBInkRect screen = full_screen_rect(&cfg);
+        uint64_t aw = screen.width > x_off ? (uint64_t)(screen.width - x_off) : 1;
+        uint64_t ah = screen.height > y_off ? (uint64_t)(screen.height - y_off) : 1;
+        stream_fit(r.w, r.h, aw, ah, &w, &h);
+    }
+    if (!reason && (w > r.w || h > r.h ||
+                    !raw_pipe_can_stream(&cfg, (short int)x_off, (short int)y_off, w, h)))
+        reason = "einval";
+    if (reason) {
+        image_reader_close(&r);
+        return make_error_string(env, reason);
+    }
+
+    int rv = stream_draw(fb, fbfd, &r, w, h, &pp, (short int)x_off, (short int)y_off, &cfg,
+                         deferred);
+    image_reader_close(&r);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_print_image/5
+// ============================================================================
+//
+// Files over IMAGE_PIXEL_BUDGET are streamed when they are PNG, JPEG or PNM.
+// scaled_width/scaled_height and halign/valign are applied here the way FBInk
+// would, except that the image is never upscaled, and is shrunk to fit the
+// screen rather than cropped. It must then land fully on screen.
+
+static ERL_NIF_TERM print_image_large(ErlNifEnv *env, FBHandle *fb, int fbfd,
+                                      const char *filename, int x_off, int y_off,
+                                      const FBInkConfig *cfg, bool deferred) {
+    ImageReader r = { .f = fopen(filename, "rbe") };
+    if (!r.f) return make_error_int(env, -errno);
+    const char *reason = image_reader_open(&r);
+    if (reason) {
+        image_reader_close(&r);
+        return make_error_string(env, strcmp(reason, "enotsup") ? reason : "efbig");
+    }
+
+    FBInkRect screen = full_screen_rect(cfg);
+    unsigned int w, h;
+    if (cfg->scaled_width == -2 || cfg->scaled_height == -2 ||
+        !image_scaled_size(cfg, r.w, r.h, &w, &h)) {
+        w = r.w;  // Fit to the screen below
+        h = r.h;
+    }
+    if (w > r.w) w = r.w;
+    if (h > r.h) h = r.h;
+    stream_fit(w, h, screen.width, screen.height, &w, &h);
+
+    if (cfg->halign == CENTER) x_off += ((int)screen.width - (int)w) / 2;
+    else if (cfg->halign == EDGE) x_off += (int)screen.width - (int)w;
+    if (cfg->valign == CENTER) y_off += ((int)screen.height - (int)h) / 2;
+    else if (cfg->valign == EDGE) y_off += (int)screen.height - (int)h;
+
+    FBInkConfig plain = *cfg;
+    plain.halign = plain.valign = 0;
+    plain.scaled_width = plain.scaled_height = 0;
+    plain.row = plain.col = 0;
+    int rv = -EINVAL;
+    if (raw_pipe_can_stream(&plain, (short int)x_off, (short int)y_off, w, h)) {
+        RawPrepass pp = { 0 };
+        rv = stream_draw(fb, fbfd, &r, w, h, &pp, (short int)x_off, (short int)y_off, &plain,
+                         deferred);
+    }
+    image_reader_close(&r);
+    return make_ok_or_error(env, rv);
+}
+
+static ERL_NIF_TERM nif_fbink_print_image(ErlNifEnv *env, int argc,
+                                            const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
+        return enif_make_badarg(env);
+
+    char filename[4096];
+    if (!get_filename(env, argv[1], filename, sizeof(filename)))
+        return enif_make_badarg(env);
+
+    int x_off, y_off;
+    if (!enif_get_int(env, argv[2], &x_off) ||
+        !enif_get_int(env, argv[3], &y_off))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[4], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    if (image_over_budget(filename))
+        return print_image_large(env, fb, fbfd, filename, x_off, y_off, &cfg, deferred);
+
+    int rv = fbink_print_image(fbfd, filename, (short int)x_off, (short int)y_off, &cfg);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: print_image_binary/5  (decode an in-memory image)
+// ============================================================================
+//
+// FBInk only decodes from a path, so the encoded data is written to a memfd
+// (anonymous, RAM-backed, never on a filesystem) and handed over as
+// /proc/self/fd/N. The binary itself is read in place.
+
+#ifdef HAVE_MEMFD
+static int memfd_from_binary(const ErlNifBinary *bin) {
+    int fd = (int)syscall(SYS_memfd_create, "fbink_image", MFD_CLOEXEC);
+    if (fd < 0) return -errno;
+
+    size_t off = 0;
+    while (off < bin->size) {
+        ssize_t n = write(fd, bin->data + off, bin->size - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int err = -errno;
+            close(fd);
+            return err;
+        }
+        off += (size_t)n;
+    }
+    return fd;
+}
+#endif
+
+static ERL_NIF_TERM nif_fbink_print_image_binary(ErlNifEnv *env, int argc,
+                                                   const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    ErlNifBinary bin;
+    int x_off, y_off;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_inspect_iolist_as_binary(env, argv[1], &bin) ||
+        !enif_get_int(env, argv[2], &x_off) ||
+        !enif_get_int(env, argv[3], &y_off))
+        return enif_make_badarg(env);
+
+#ifdef HAVE_MEMFD
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[4], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    int memfd = memfd_from_binary(&bin);
+    if (memfd < 0) return make_error_int(env, memfd);
+
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", memfd);
+    if (image_over_budget(path)) {
+        ERL_NIF_TERM res = print_image_large(env, fb, fbfd, path, x_off, y_off, &cfg, deferred);
+        close(memfd);
+        return res;
+    }
+    int rv = fbink_print_image(fbfd, path, (short int)x_off, (short int)y_off, &cfg);
+    close(memfd);
+
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+    return make_ok_or_error(env, rv);
+#else
+    return make_error_string(env, "enotsup");
+#endif
+}
+
+// ============================================================================
+// NIF: load_image/3,5  (decode an image once into an image resource)
+// ============================================================================
+//
+// With 5 arguments, the decoded pixels are dithered in place (method, levels).
+//
+// PNG, baseline JPEG and binary PNM files are decoded in memory through an
+// ImageReader, scaled, and packed to the framebuffer's pixel format and
+// orientation, without touching the screen. Transparency is blended against
+// white, and the result may be larger than the screen (blits clip it).
+//
+// Other files go through FBInk, which can only decode to the live
+// framebuffer, and crops whatever doesn't fit on screen. A decoded rect
+// spanning the whole screen width or height may be such a crop, so it is only
+// accepted when the file header says the image is exactly that size, or
+// FBInk was asked to fit it to the screen.
+
+static bool image_was_cropped(const char *filename, const FBInkConfig *cfg,
+                              const FBInkRect *rect) {
+    FBInkRect screen = full_screen_rect(cfg);
+    if (rect->width < screen.width && rect->height < screen.height)
+        return false;
+    if (cfg->scaled_width == -2 || cfg->scaled_height == -2)
+        return false;  // Fit to the screen: never larger than it
+
+    unsigned int iw, ih, w, h;
+    if (!image_probe_size(filename, &iw, &ih) || !image_scaled_size(cfg, iw, ih, &w, &h))
+        return true;  // Can't tell: assume the worst
+    return w > rect->width || h > rect->height;
+}
+
+// Pack canonical rows of sn-byte pixels, covering rect, into d in the
+// framebuffer's native pixel format and orientation. The data is malloc'd
+// like FBInk's own dumps, so fbink_free_dump_data releases it.
+static bool image_pack_native(const uint8_t *src, unsigned int sn, const FBInkRect *rect,
+                              int xform, const FBInkState *state, FBInkDump *d) {
+    unsigned int w = rect->width, h = rect->height, bpp = state->bpp;
+    IRect n = irect_rotate((IRect){ rect->left, rect->top, (int)w, (int)h }, xform,
+                           (int)state->screen_width, (int)state->screen_height);
+    size_t ps = bpp == 4 ? 1 : bpp / 8;  // Bytes per packed pixel; Y8 for 4bpp
+    size_t stride = ((size_t)n.width * bpp + 7) / 8;
+    uint8_t *data = calloc((size_t)n.height, stride);
+    uint8_t *row = enif_alloc((size_t)w * ps);
+    if (!data || !row) {
+        free(data);
+        if (row) enif_free(row);
+        return false;
+    }
+
+    for (unsigned int y = 0; y < h; y++) {
+        const uint8_t *s = src + (size_t)y * w * sn;
+        switch (bpp) {
+        case 4:
+        case 8:
+            pack_to_y8(s, sn, w, row, state->inverted_grayscale);
+            break;
+        case 16:
+            pack_to_565(s, sn, w, row);
+            break;
+        default:
+            pack_to_bgra(s, sn, w, row, bpp / 8);
+            break;
+        }
+        if (xform == 0 && bpp != 4) {
+            memcpy(data + (size_t)y * stride, row, (size_t)w * ps);
+            continue;
+        }
+        // Native position of the row's first pixel in the image, and of one step along it
+        IRect o = irect_rotate((IRect){ 0, (int)y, 1, 1 }, xform, (int)w, (int)h);
+        IRect o1 = irect_rotate((IRect){ 1, (int)y, 1, 1 }, xform, (int)w, (int)h);
+        int dx = o1.left - o.left, dy = o1.top - o.top;
+        for (unsigned int x = 0; x < w; x++) {
+            unsigned int nx = (unsigned int)(o.left + (int)x * dx);
+            uint8_t *drow = data + (size_t)(o.top + (int)x * dy) * stride;
+            if (bpp == 4) {
+                uint8_t v = row[x] >> 4;
+                drow[nx >> 1] = (nx & 1) ? (uint8_t)((drow[nx >> 1] & 0xF0) | v)
+                                         : (uint8_t)((drow[nx >> 1] & 0x0F) | (v << 4));
+            } else {
+                memcpy(drow + nx * ps, row + x * ps, ps);
+            }
+        }
+    }
+    enif_free(row);
+
+    memset(d, 0, sizeof(*d));
+    d->data = data;
+    d->stride = stride;
+    d->size = stride * (size_t)n.height;
+    d->area = (FBInkRect){ (unsigned short int)(n.left > 0 ? n.left : 0),
+                           (unsigned short int)(n.top > 0 ? n.top : 0),
+                           (unsigned short int)n.width, (unsigned short int)n.height };
+    d->rota = state->current_rota;
+    d->bpp = (uint8_t)bpp;
+    return true;
+}
+
+// Decode all of r at w x h into an enif_alloc'd buffer of r->ch-byte pixels:
+// box-averaged on the fly when shrinking, resampled after a full-size decode
+// otherwise
+static int image_decode_scaled(ImageReader *r, unsigned int w, unsigned int h, uint8_t **out) {
+    bool shrink = w <= r->w && h <= r->h;
+    ImageStream s = { .in = r, .w = shrink ? w : r->w, .h = shrink ? h : r->h };
+    s.chunk_px = r->dec ? r->w : STREAM_CHUNK / (r->ch * r->bps);
+    if (!shrink && (uint64_t)r->w * r->h > IMAGE_PIXEL_BUDGET) return -EFBIG;
+
+    size_t row = (size_t)s.w * r->ch;
+    uint8_t *pix = enif_alloc(row * s.h);
+    s.acc = enif_alloc((size_t)s.w * r->ch * sizeof(uint64_t));
+    s.chunk = enif_alloc((size_t)s.chunk_px * r->ch * r->bps);
+    int rv = pix && s.acc && s.chunk ? 0 : -ENOMEM;
+    if (rv == 0) memset(s.acc, 0, (size_t)s.w * r->ch * sizeof(uint64_t));
+    for (unsigned int y = 0; rv == 0 && y < s.h; y++)
+        rv = stream_next_row(&s, pix + y * row);
+    if (s.acc) enif_free(s.acc);
+    if (s.chunk) enif_free(s.chunk);
+
+    if (rv == 0 && !shrink) {
+        uint8_t *scaled = enif_alloc((size_t)w * h * r->ch);
+        if (scaled && scale_image(pix, r->w, r->h, scaled, w, h, r->ch, SCALE_BILINEAR, 0)) {
+            enif_free(pix);
+            pix = scaled;
+        } else {
+            if (scaled) enif_free(scaled);
+            rv = -ENOMEM;
+        }
+    }
+    if (rv < 0) {
+        if (pix) enif_free(pix);
+        return rv;
+    }
+    *out = pix;
+    return 0;
+}
+
+static ERL_NIF_TERM load_image_in_memory(ErlNifEnv *env, int fbfd, ImageReader *r,
+                                         const FBInkConfig *cfg, DitherMethod method,
+                                         unsigned int levels) {
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    fbink_get_state(cfg, &state);
+    if (state.bpp != 4 && state.bpp != 8 && state.bpp != 16 && state.bpp != 24 &&
+        state.bpp != 32)
+        return make_error_int(env, -ENOTSUP);
+    unsigned int sw = state.screen_width, sh = state.screen_height;
+
+    // Size and place it the way FBInk draws it at 0, 0
+    unsigned int w, h;
+    if (cfg->scaled_width == -2 || cfg->scaled_height == -2) {
+        if ((uint64_t)r->w * sh > (uint64_t)r->h * sw) {
+            w = sw;
+            h = (unsigned int)((uint64_t)r->h * sw / r->w);
+        } else {
+            h = sh;
+            w = (unsigned int)((uint64_t)r->w * sh / r->h);
+        }
+    } else if (!image_scaled_size(cfg, r->w, r->h, &w, &h)) {
+        w = r->w;
+        h = r->h;
+    }
+    if (w < 1) w = 1;
+    if (h < 1) h = 1;
+    if (w > UINT16_MAX || h > UINT16_MAX || (uint64_t)w * h > IMAGE_PIXEL_BUDGET)
+        return make_error_string(env, "efbig");
+
+    int x = 0, y = 0;
+    if (cfg->halign == CENTER) x = ((int)sw - (int)w) / 2;
+    else if (cfg->halign == EDGE) x = (int)sw - (int)w;
+    if (cfg->valign == CENTER) y = ((int)sh - (int)h) / 2;
+    else if (cfg->valign == EDGE) y = (int)sh - (int)h;
+    FBInkRect rect = { (unsigned short int)(x > 0 ? x : 0), (unsigned short int)(y > 0 ? y : 0),
+                       (unsigned short int)w, (unsigned short int)h };
+
+    uint8_t *pix;
+    int rv = image_decode_scaled(r, w, h, &pix);
+    if (rv < 0) return make_error_int(env, rv);
+    if (cfg->is_inverted)
+        for (size_t i = 0; i < (size_t)w * h * r->ch; i++) pix[i] = (uint8_t)~pix[i];
+    if (cfg->sw_dithering && !levels) {
+        method = DITHER_BAYER;
+        levels = 16;
+    }
+
+    ImageResource *img = enif_alloc_resource(image_resource_type, sizeof(ImageResource));
+    if (!img) {
+        enif_free(pix);
+        return make_error_string(env, "enomem");
+    }
+    memset(img, 0, sizeof(ImageResource));
+
+    int xform = screen_xform(fbfd, (int)sw, (int)sh);
+    bool ok = image_pack_native(pix, r->ch, &rect, xform, &state, &img->dump);
+    enif_free(pix);
+    if (!ok || (levels && !dither_dump(&img->dump, method, levels))) {
+        enif_release_resource(img);
+        return make_error_string(env, "enomem");
+    }
+    img->rect = rect;
+    img->xform = xform;
+    img->screen_w = sw;
+    img->screen_h = sh;
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, img);
+    enif_release_resource(img);
+    return make_ok(env, res_term);
+}
+
+// Draw it with FBInk, dump the drawn area, and put the screen back
+static ERL_NIF_TERM load_image_on_screen(ErlNifEnv *env, int fbfd, const char *filename,
+                                         const FBInkConfig *cfg, DitherMethod method,
+                                         unsigned int levels) {
+    FBInkDump saved;
+    memset(&saved, 0, sizeof(saved));
+    int rv = fbink_dump(fbfd, &saved);
+    if (rv < 0) return make_error_int(env, rv);
+
+    rv = fbink_print_image(fbfd, filename, 0, 0, cfg);
+    FBInkRect rect = fbink_get_last_rect(false);
+    if (rv >= 0 && (rect.width == 0 || rect.height == 0))
+        rv = -EINVAL;
+    if (rv < 0) {
+        fbink_restore(fbfd, cfg, &saved);
+        fbink_free_dump_data(&saved);
+        return make_error_int(env, rv);
+    }
+    if (image_was_cropped(filename, cfg, &rect)) {
+        fbink_restore(fbfd, cfg, &saved);
+        fbink_free_dump_data(&saved);
+        return make_error_string(env, "enotsup");
+    }
+
+    ImageResource *img = enif_alloc_resource(image_resource_type, sizeof(ImageResource));
+    if (!img) {
+        fbink_restore(fbfd, cfg, &saved);
+        fbink_free_dump_data(&saved);
+        return make_error_string(env, "enomem");
+    }
+    memset(img, 0, sizeof(ImageResource));
+
+    rv = fbink_rect_dump(fbfd, &rect, &img->dump);
+
+    FBInkDump view = saved;
+    if (rv >= 0) view.clip = img->dump.area;
+    fbink_restore(fbfd, cfg, &view);
+    fbink_free_dump_data(&saved);
+
+    if (rv < 0) {
+        enif_release_resource(img);
+        return make_error_int(env, rv);
+    }
+    if (levels && !dither_dump(&img->dump, method, levels)) {
+        enif_release_resource(img);
+        return make_error_string(env, "enomem");
+    }
+
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    fbink_get_state(cfg, &state);
+    img->rect = rect;
+    img->screen_w = state.screen_width;
+    img->screen_h = state.screen_height;
+    img->xform = detect_xform(&rect, &img->dump.area, (int)state.screen_width,
+                              (int)state.screen_height);
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, img);
+    enif_release_resource(img);
+    return make_ok(env, res_term);
+}
+
+static ERL_NIF_TERM nif_fbink_load_image(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
+    int fbfd;
+    char filename[4096];
+    DitherMethod method = DITHER_BAYER;
+    unsigned int levels = 0;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !get_filename(env, argv[1], filename, sizeof(filename)) ||
+        (argc == 5 && !get_dither(env, argv[3], argv[4], &method, &levels)))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[2], &cfg);
+    wfm_no_auto(&cfg);
+    cfg.no_refresh = true;
+
+    ImageReader r = { .f = fopen(filename, "rbe") };
+    if (!r.f) return make_error_int(env, -errno);
+    const char *reason = image_reader_open(&r);
+    ERL_NIF_TERM res;
+    if (!reason)
+        res = load_image_in_memory(env, fbfd, &r, &cfg, method, levels);
+    else if (strcmp(reason, "enotsup") == 0)
+        res = load_image_on_screen(env, fbfd, filename, &cfg, method, levels);
+    else
+        res = make_error_string(env, reason);
+    image_reader_close(&r);
+    return res;
+}
+
+// ============================================================================
+// NIF: blit_image/5  (draw an image resource at x, y)
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_blit_image(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd, x, y;
+    FBHandle *fb;
+    ImageResource *img;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_get_resource(env, argv[1], image_resource_type, (void **)&img) ||
+        !enif_get_int(env, argv[2], &x) ||
+        !enif_get_int(env, argv[3], &y))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[4], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    if (!img->dump.data)
+        return make_error_string(env, "no_data");
+    if (img->xform < 0 && (x != img->rect.left || y != img->rect.top))
+        return make_error_int(env, -ENOTSUP);
+
+    // Clip the target to the screen, in get_last_rect space
+    int sw = (int)img->screen_w, sh = (int)img->screen_h;
+    IRect full = { x, y, img->rect.width, img->rect.height };
+    IRect vis = full;
+    if (vis.left < 0) { vis.width += vis.left; vis.left = 0; }
+    if (vis.top < 0) { vis.height += vis.top; vis.top = 0; }
+    if (vis.left + vis.width > sw) vis.width = sw - vis.left;
+    if (vis.top + vis.height > sh) vis.height = sh - vis.top;
+    if (vis.width <= 0 || vis.height <= 0)
+        return make_ok_or_error(env, 0);
+
+    // Same rects in the dump's (native) space; offset the data to the visible part
+    int xform = img->xform < 0 ? 0 : img->xform;
+    IRect nfull = irect_rotate(full, xform, sw, sh);
+    IRect nvis = irect_rotate(vis, xform, sw, sh);
+    size_t dx = (size_t)(nvis.left - nfull.left);
+    size_t dy = (size_t)(nvis.top - nfull.top);
+    if (img->dump.bpp < 8 && (dx * img->dump.bpp) % 8 != 0)
+        return make_error_int(env, -ENOTSUP);
+
+    FBInkDump view = img->dump;
+    view.data = img->dump.data + dy * img->dump.stride + dx * img->dump.bpp / 8;
+    view.area.left = (unsigned short int)nvis.left;
+    view.area.top = (unsigned short int)nvis.top;
+    view.area.width = (unsigned short int)nvis.width;
+    view.area.height = (unsigned short int)nvis.height;
+    memset(&view.clip, 0, sizeof(view.clip));
+    view.is_full = false;
+
+    int rv = fbink_restore(fbfd, &cfg, &view);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: image_info/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_image_info(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    ImageResource *img;
+    if (!enif_get_resource(env, argv[0], image_resource_type, (void **)&img))
+        return enif_make_badarg(env);
+
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    enif_make_map_put(env, map, atom_width, enif_make_uint(env, img->rect.width), &map);
+    enif_make_map_put(env, map, atom_height, enif_make_uint(env, img->rect.height), &map);
+    enif_make_map_put(env, map, atom_size,
+        enif_make_uint64(env, (ErlNifUInt64)img->dump.size), &map);
+    enif_make_map_put(env, map, atom_bpp, enif_make_uint(env, img->dump.bpp), &map);
+    enif_make_map_put(env, map, atom_rota, enif_make_uint(env, img->dump.rota), &map);
+    return map;
+}
+
+// ============================================================================
+// NIF: fbink_cls/3
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_cls(ErlNifEnv *env, int argc,
+                                   const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    // argv[2] is optional rect (nil or map) and argv[3] is no_rota bool
+    FBInkRect rect;
+    FBInkRect *rect_ptr = NULL;
+    if (!enif_is_atom(env, argv[2])) {
+        map_to_fbink_rect(env, argv[2], &rect);
+        rect_ptr = &rect;
+    }
+
+    int no_rota;
+    if (!enif_get_int(env, argv[3], &no_rota))
+        return enif_make_badarg(env);
+
+    int rv = fbink_cls(fbfd, &cfg, rect_ptr, no_rota != 0);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_grid_clear/4
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_grid_clear(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    unsigned int cols, rows;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_get_uint(env, argv[1], &cols) ||
+        !enif_get_uint(env, argv[2], &rows))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[3], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    int rv = fbink_grid_clear(fbfd, (unsigned short int)cols,
+                              (unsigned short int)rows, &cfg);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: fbink_refresh/6
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_refresh(ErlNifEnv *env, int argc,
+                                       const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    unsigned int top, left, width, height;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_uint(env, argv[1], &top) ||
+        !enif_get_uint(env, argv[2], &left) ||
+        !enif_get_uint(env, argv[3], &width) ||
+        !enif_get_uint(env, argv[4], &height))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[5], &cfg);
+    FBInkRect area = { (unsigned short int)left, (unsigned short int)top,
+                       (unsigned short int)width, (unsigned short int)height };
+    wfm_resolve(fbfd, &area, &cfg);
+
+    int rv = fbink_refresh(fbfd, top, left, width, height, &cfg);
+    return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_update_verbosity/1
+// NIF: fbink_refresh_rect/3
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_update_verbosity(ErlNifEnv *env, int argc,
-                                                 const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_refresh_rect(ErlNifEnv *env, int argc,
+                                             const ERL_NIF_TERM argv[]) {
     (void)argc;
+    int fbfd;
+    if (!get_fbfd(env, argv[0], &fbfd))
+        return enif_make_badarg(env);
+
+    FBInkRect rect;
+    map_to_fbink_rect(env, argv[1], &rect);
+
     FBInkConfig cfg;
-    map_to_fbink_config(env, argv[0], &cfg);
-    fbink_update_verbosity(&cfg);
-    return atom_ok;
+    map_to_fbink_config(env, argv[2], &cfg);
+    wfm_resolve(fbfd, &rect, &cfg);
+
+    int rv = fbink_refresh_rect(fbfd, &rect, &cfg);
+    return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_update_pen_colors/1
+// NIF: fbink_grid_refresh/4
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_update_pen_colors(ErlNifEnv *env, int argc,
-                                                  const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_grid_refresh(ErlNifEnv *env, int argc,
+                                             const ERL_NIF_TERM argv[]) {
     (void)argc;
+    int fbfd;
+    unsigned int cols, rows;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_uint(env, argv[1], &cols) ||
+        !enif_get_uint(env, argv[2], &rows))
+        return enif_make_badarg(env);
+
     FBInkConfig cfg;
-    map_to_fbink_config(env, argv[0], &cfg);
-    int rv = fbink_update_pen_colors(&cfg);
+    map_to_fbink_config(env, argv[3], &cfg);
+    FBInkRect screen = { 0, 0, 0, 0 };
+    wfm_resolve(fbfd, &screen, &cfg);
+
+    int rv = fbink_grid_refresh(fbfd, (unsigned short int)cols,
+                                (unsigned short int)rows, &cfg);
     return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_set_fg_pen_gray/3
+// NIF: fbink_wait_for_submission/2
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_set_fg_pen_gray(ErlNifEnv *env, int argc,
-                                                const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_wait_for_submission(ErlNifEnv *env, int argc,
+                                                    const ERL_NIF_TERM argv[]) {
     (void)argc;
-    unsigned int y;
-    int quantize, update;
-    if (!enif_get_uint(env, argv[0], &y) ||
-        !enif_get_int(env, argv[1], &quantize) ||
-        !enif_get_int(env, argv[2], &update))
+    int fbfd;
+    unsigned int marker;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_uint(env, argv[1], &marker))
         return enif_make_badarg(env);
 
-    int rv = fbink_set_fg_pen_gray((uint8_t)y, quantize != 0, update != 0);
+    int rv = fbink_wait_for_submission(fbfd, marker);
     return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_set_bg_pen_gray/3
+// NIF: fbink_wait_for_complete/2
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_set_bg_pen_gray(ErlNifEnv *env, int argc,
-                                                const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_wait_for_complete(ErlNifEnv *env, int argc,
+                                                  const ERL_NIF_TERM argv[]) {
     (void)argc;
-    unsigned int y;
-    int quantize, update;
-    if (!enif_get_uint(env, argv[0], &y) ||
-        !enif_get_int(env, argv[1], &quantize) ||
-        !enif_get_int(env, argv[2], &update))
+    int fbfd;
+    unsigned int marker;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_uint(env, argv[1], &marker))
         return enif_make_badarg(env);
 
-    int rv = fbink_set_bg_pen_gray((uint8_t)y, quantize != 0, update != 0);
+    int rv = fbink_wait_for_complete(fbfd, marker);
     return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_set_fg_pen_rgba/6
+// NIF: fbink_wait_for_any_complete/1
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_set_fg_pen_rgba(ErlNifEnv *env, int argc,
-                                                const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_wait_for_any_complete(ErlNifEnv *env, int argc,
+                                                      const ERL_NIF_TERM argv[]) {
     (void)argc;
-    unsigned int r, g, b, a;
-    int quantize, update;
-    if (!enif_get_uint(env, argv[0], &r) ||
-        !enif_get_uint(env, argv[1], &g) ||
-        !enif_get_uint(env, argv[2], &b) ||
-        !enif_get_uint(env, argv[3], &a) ||
-        !enif_get_int(env, argv[4], &quantize) ||
-        !enif_get_int(env, argv[5], &update))
+    int fbfd;
+    if (!get_fbfd(env, argv[0], &fbfd))
         return enif_make_badarg(env);
 
-    int rv = fbink_set_fg_pen_rgba((uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a,
-                                   quantize != 0, update != 0);
+    int rv = fbink_wait_for_any_complete(fbfd);
     return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_set_bg_pen_rgba/6
+// NIF: refresh_async/4  (refresh_rect + completion messages to pid)
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_set_bg_pen_rgba(ErlNifEnv *env, int argc,
-                                                const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_refresh_async(ErlNifEnv *env, int argc,
+                                              const ERL_NIF_TERM argv[]) {
     (void)argc;
-    unsigned int r, g, b, a;
-    int quantize, update;
-    if (!enif_get_uint(env, argv[0], &r) ||
-        !enif_get_uint(env, argv[1], &g) ||
-        !enif_get_uint(env, argv[2], &b) ||
-        !enif_get_uint(env, argv[3], &a) ||
-        !enif_get_int(env, argv[4], &quantize) ||
-        !enif_get_int(env, argv[5], &update))
+    int fbfd;
+    FBHandle *fb;
+    ErlNifPid pid;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_get_local_pid(env, argv[3], &pid))
         return enif_make_badarg(env);
 
-    int rv = fbink_set_bg_pen_rgba((uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a,
-                                   quantize != 0, update != 0);
-    return make_ok_or_error(env, rv);
+    FBInkRect rect;
+    map_to_fbink_rect(env, argv[1], &rect);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[2], &cfg);
+    wfm_resolve(fbfd, &rect, &cfg);
+
+    int rv = fbink_refresh_rect(fbfd, &rect, &cfg);
+    if (rv < 0)
+        return make_error_int(env, rv);
+
+    uint32_t marker = fbink_get_last_marker();
+    const char *err = refresh_waiter_enqueue(&pid, fb, fbfd, marker);
+    if (err) return make_error_string(env, err);
+
+    return make_ok(env, enif_make_uint(env, marker));
+}
+
+// ============================================================================
+// NIF: notify_refresh/3  (completion messages for an already submitted marker)
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_notify_refresh(ErlNifEnv *env, int argc,
+                                               const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    unsigned int marker;
+    ErlNifPid pid;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_get_uint(env, argv[1], &marker) ||
+        !enif_get_local_pid(env, argv[2], &pid))
+        return enif_make_badarg(env);
+
+    const char *err = refresh_waiter_enqueue(&pid, fb, fbfd, marker);
+    if (err) return make_error_string(env, err);
+
+    return atom_ok;
+}
+
+// ============================================================================
+// NIF: submit/3  (queue a draw op on the handle's render thread)
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_submit(ErlNifEnv *env, int argc,
+                                      const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    FBHandle *fb;
+    ErlNifPid pid;
+    int arity;
+    const ERL_NIF_TERM *el;
+    if (!enif_get_resource(env, argv[0], fb_resource_type, (void **)&fb) ||
+        !enif_get_tuple(env, argv[1], &arity, &el) || arity < 1 ||
+        !enif_is_atom(env, el[0]) ||
+        !enif_get_local_pid(env, argv[2], &pid))
+        return enif_make_badarg(env);
+
+    RenderCmd cmd;
+    cmd.env = enif_alloc_env();
+    if (!cmd.env) return make_error_string(env, "enomem");
+    cmd.op = enif_make_copy(cmd.env, argv[1]);
+    cmd.pid = pid;
+    cmd.seq = atomic_fetch_add(&render_seq, 1);
+
+    const char *err = NULL;
+    enif_mutex_lock(fb->submit_lock);
+    if (atomic_load(&fb->closed) || atomic_load(&fb->stopping)) {
+        err = "closed";
+    } else if (!fb->thread_started) {
+        if (enif_thread_create("fbink_render", &fb->tid, render_thread_main, fb, NULL) != 0)
+            err = "enomem";
+        else
+            fb->thread_started = true;
+    }
+    if (!err && !render_ring_push(fb, &cmd))
+        err = "queue_full";
+    enif_mutex_unlock(fb->submit_lock);
+
+    if (err) {
+        enif_free_env(cmd.env);
+        return make_error_string(env, err);
+    }
+
+    enif_mutex_lock(fb->wake_lock);
+    enif_cond_signal(fb->wake_cond);
+    enif_mutex_unlock(fb->wake_lock);
+
+    return make_ok(env, enif_make_uint64(env, cmd.seq));
+}
+
+// ============================================================================
+// NIF: batch/2  (run a list of draw ops with one coalesced refresh per group)
+// ============================================================================
+//
+// Every op runs with no_refresh forced; its damage (fbink_get_last_rect) is
+// folded into the group for its refresh key. {:refresh_rect, ...} ops only add
+// damage. Ops that already asked for no_refresh are left to the handle's damage
+// accumulator. Once all ops ran, each group gets a single fbink_refresh_rect
+// over its bounding box, and its marker is reported both in the marker list
+// and as the result of every {:refresh_rect, ...} op folded into it, so
+// callers can wait on the refresh that covers a given rect.
+
+// Refresh g and return its marker (0 if there was nothing to refresh), or the
+// negative fbink_refresh_rect error
+static int64_t refresh_group_marker(int fbfd, RefreshGroup *g) {
+    if (rect_is_empty(&g->damage)) return 0;
+    int rv = refresh_group(fbfd, g);
+    if (rv < 0) return rv;
+    return fbink_get_last_marker();
+}
+
+static ERL_NIF_TERM make_marker_result(ErlNifEnv *env, int64_t marker) {
+    if (marker < 0) return make_error_int(env, (int)marker);
+    return make_ok(env, enif_make_uint(env, (uint32_t)marker));
+}
+
+static ERL_NIF_TERM nif_fbink_batch(ErlNifEnv *env, int argc,
+                                     const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    unsigned int len;
+    if (!get_fb(env, argv[0], &fbfd, &fb) || !enif_get_list_length(env, argv[1], &len))
+        return enif_make_badarg(env);
+
+    RefreshGroup groups[MAX_REFRESH_GROUPS];
+    int ngroups = 0;
+    // Per op: its result, and for refresh_rect ops folded into a group, that
+    // group's index (-1 otherwise) so the result can be filled in afterwards
+    ERL_NIF_TERM *results = enif_alloc((len + 1) * sizeof(ERL_NIF_TERM));
+    int *group_of = enif_alloc((len + 1) * sizeof(int));
+    if (!results || !group_of) {
+        if (results) enif_free(results);
+        if (group_of) enif_free(group_of);
+        return make_error_string(env, "enomem");
+    }
+
+    ERL_NIF_TERM list = argv[1], head;
+    for (unsigned int n = 0; enif_get_list_cell(env, list, &head, &list); n++) {
+        DrawOp op;
+        group_of[n] = -1;
+        if (!decode_draw_op(env, head, &op)) {
+            draw_op_release(&op);
+            results[n] = make_error_string(env, "badarg");
+            continue;
+        }
+
+        if (op.type == DRAW_OP_REFRESH_RECT) {
+            FBInkRect damage = op.rect;
+            // An empty rect means full screen to fbink_refresh_rect
+            if (rect_is_empty(&damage))
+                damage = full_screen_rect(&op.cfg);
+            if (refresh_groups_add(groups, &ngroups, &op.cfg, &damage)) {
+                for (int i = 0; i < ngroups; i++)
+                    if (same_refresh_key(&groups[i].cfg, &op.cfg)) group_of[n] = i;
+                results[n] = make_ok(env, enif_make_uint(env, 0));
+            } else {
+                RefreshGroup g = { .cfg = op.cfg, .damage = damage };
+                g.cfg.no_refresh = false;
+                results[n] = make_marker_result(env, refresh_group_marker(fbfd, &g));
+            }
+        } else {
+            bool wants_refresh = !op.cfg.no_refresh;
+            op.cfg.no_refresh = true;
+            results[n] = run_draw_op(env, fbfd, &op);
+
+            bool ok = draw_op_succeeded(env, results[n]);
+            if (ok && !wants_refresh) {
+                draw_done(fb, fbfd, &op.cfg, 0, false);
+            } else if (ok) {
+                FBInkRect damage = fbink_get_last_rect(false);
+                if (!refresh_groups_add(groups, &ngroups, &op.cfg, &damage)) {
+                    RefreshGroup g = { .cfg = op.cfg, .damage = damage };
+                    g.cfg.no_refresh = false;
+                    refresh_group(fbfd, &g);
+                }
+            }
+        }
+        draw_op_release(&op);
+    }
+
+    ERL_NIF_TERM markers[MAX_REFRESH_GROUPS];
+    ERL_NIF_TERM group_results[MAX_REFRESH_GROUPS];
+    for (int i = 0; i < ngroups; i++) {
+        int64_t marker = refresh_group_marker(fbfd, &groups[i]);
+        if (marker < 0) {
+            enif_free(results);
+            enif_free(group_of);
+            return make_error_int(env, (int)marker);
+        }
+        markers[i] = enif_make_uint(env, (uint32_t)marker);
+        group_results[i] = make_marker_result(env, marker);
+    }
+
+    for (unsigned int n = 0; n < len; n++)
+        if (group_of[n] >= 0) results[n] = group_results[group_of[n]];
+
+    ERL_NIF_TERM ordered = enif_make_list_from_array(env, results, len);
+    enif_free(results);
+    enif_free(group_of);
+    return enif_make_tuple3(env, atom_ok, ordered,
+                            enif_make_list_from_array(env, markers, (unsigned)ngroups));
+}
+
+// ============================================================================
+// NIF: flush/2  (refresh the handle's accumulated damage)
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_flush(ErlNifEnv *env, int argc,
+                                     const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    ErlNifUInt64 overhead;
+    if (!get_fb(env, argv[0], &fbfd, &fb) || !fb ||
+        !enif_get_uint64(env, argv[1], &overhead))
+        return enif_make_badarg(env);
+
+    RefreshGroup pending[MAX_DAMAGE_RECTS];
+    enif_mutex_lock(fb->damage_lock);
+    int n = fb->ndamage;
+    memcpy(pending, fb->damage, (size_t)n * sizeof(RefreshGroup));
+    fb->ndamage = 0;
+    enif_mutex_unlock(fb->damage_lock);
+
+    n = damage_merge(pending, n, overhead);
+
+    uint32_t marker = 0;
+    for (int i = 0; i < n; i++) {
+        int rv = refresh_group(fbfd, &pending[i]);
+        if (rv < 0) {
+            // Keep what wasn't refreshed (this rect included) for the next flush
+            for (int j = i; j < n; j++)
+                damage_record(fb, fbfd, &pending[j].cfg, &pending[j].damage);
+            return make_error_int(env, rv);
+        }
+        marker = fbink_get_last_marker();
+    }
+    return enif_make_tuple3(env, atom_ok, enif_make_int(env, n), enif_make_uint(env, marker));
+}
+
+// ============================================================================
+// NIF: waveform_stats/0  (modes picked for wfm_mode: :auto so far)
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_waveform_stats(ErlNifEnv *env, int argc,
+                                               const ERL_NIF_TERM argv[]) {
+    (void)argc; (void)argv;
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    for (int mode = 0; mode < 256; mode++) {
+        uint64_t n = atomic_load(&wfm_auto_counts[mode]);
+        if (n == 0) continue;
+        enif_make_map_put(env, map, enif_make_int(env, mode), enif_make_uint64(env, n), &map);
+    }
+    return map;
+}
+
+// ============================================================================
+// NIF: fbink_dump/1
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_dump(ErlNifEnv *env, int argc,
+                                    const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    if (!get_fbfd(env, argv[0], &fbfd))
+        return enif_make_badarg(env);
+
+    DumpResource *res = alloc_dump_resource();
+    if (!res) return make_error_string(env, "enomem");
+
+    int rv = fbink_dump(fbfd, &res->dump);
+    if (rv < 0) {
+        enif_release_resource(res);
+        return make_error_int(env, rv);
+    }
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return make_ok(env, res_term);
+}
+
+// ============================================================================
+// NIF: fbink_region_dump/6
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_region_dump(ErlNifEnv *env, int argc,
+                                            const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    int x_off, y_off;
+    unsigned int w, h;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_int(env, argv[1], &x_off) ||
+        !enif_get_int(env, argv[2], &y_off) ||
+        !enif_get_uint(env, argv[3], &w) ||
+        !enif_get_uint(env, argv[4], &h))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[5], &cfg);
+
+    DumpResource *res = alloc_dump_resource();
+    if (!res) return make_error_string(env, "enomem");
+
+    int rv = fbink_region_dump(fbfd, (short int)x_off, (short int)y_off,
+                               (unsigned short int)w, (unsigned short int)h,
+                               &cfg, &res->dump);
+    if (rv < 0) {
+        enif_release_resource(res);
+        return make_error_int(env, rv);
+    }
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return make_ok(env, res_term);
 }
 
 // ============================================================================
-// NIF: fbink_print/3
+// NIF: fbink_rect_dump/2
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_print(ErlNifEnv *env, int argc,
-                                     const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_rect_dump(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
-        return enif_make_badarg(env);
-
-    ErlNifBinary bin;
-    if (!enif_inspect_iolist_as_binary(env, argv[1], &bin))
+    if (!get_fbfd(env, argv[0], &fbfd))
         return enif_make_badarg(env);
 
-    // Null-terminate the string
-    char *str = enif_alloc(bin.size + 1);
-    if (!str) return make_error_string(env, "enomem");
-    memcpy(str, bin.data, bin.size);
-    str[bin.size] = '\0';
+    FBInkRect rect;
+    map_to_fbink_rect(env, argv[1], &rect);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[2], &cfg);
+    DumpResource *res = alloc_dump_resource();
+    if (!res) return make_error_string(env, "enomem");
 
-    int rv = fbink_print(fbfd, str, &cfg);
-    enif_free(str);
+    int rv = fbink_rect_dump(fbfd, &rect, &res->dump);
+    if (rv < 0) {
+        enif_release_resource(res);
+        return make_error_int(env, rv);
+    }
 
-    return make_ok_or_error(env, rv);
+    ERL_NIF_TERM res_term = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return make_ok(env, res_term);
 }
 
 // ============================================================================
-// NIF: fbink_add_ot_font/2
+// NIF: fbink_restore/2
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_add_ot_font(ErlNifEnv *env, int argc,
-                                            const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    char filename[4096];
-    if (enif_get_string(env, argv[0], filename, sizeof(filename), ERL_NIF_LATIN1) <= 0) {
-        ErlNifBinary bin;
-        if (!enif_inspect_iolist_as_binary(env, argv[0], &bin) || bin.size >= sizeof(filename))
-            return enif_make_badarg(env);
-        memcpy(filename, bin.data, bin.size);
-        filename[bin.size] = '\0';
+#define RESTORE_BAND_BYTES (256 * 1024)
+
+// Restore a compressed dump band by band through a small scratch buffer, so
+// the raw image never has to exist in memory at once. Only `clip` is written
+// (the whole area if empty), without refresh; the screen rects of the bands
+// are accumulated into `damage`.
+static int restore_packed(int fbfd, const FBInkConfig *cfg, const DumpResource *res,
+                          const FBInkRect *clip, FBInkRect *damage) {
+    const FBInkDump *d = &res->dump;
+    size_t band_rows = RESTORE_BAND_BYTES / d->stride;
+    if (band_rows == 0) band_rows = 1;
+    if (band_rows > d->area.height) band_rows = d->area.height;
+
+    uint8_t *scratch = enif_alloc(band_rows * d->stride);
+    if (!scratch) return -ENOMEM;
+
+    FBInkConfig band_cfg = *cfg;
+    band_cfg.no_refresh = true;
+    bool clipped = !rect_is_empty(clip);
+    size_t last_row = d->area.height;
+    if (clipped) {
+        size_t clip_end = (size_t)clip->top + clip->height;
+        last_row = clip_end <= d->area.top ? 0 : clip_end - d->area.top;
+        if (last_row > d->area.height) last_row = d->area.height;
     }
+    unsigned int unit = rle_unit(d->bpp);
+    const uint8_t *p = res->packed, *end = res->packed + res->packed_size;
+    int rv = 0;
+
+    // Rows have to be decoded in order, but nothing past the clip is needed
+    for (size_t y = 0; y < last_row && rv >= 0; y += band_rows) {
+        size_t rows = d->area.height - y < band_rows ? d->area.height - y : band_rows;
+        if (!rle_decode_rows(&p, end, d->stride, rows, unit, scratch)) {
+            rv = -EINVAL;
+            break;
+        }
 
-    int style;
-    if (!enif_get_int(env, argv[1], &style))
-        return enif_make_badarg(env);
+        FBInkDump band = *d;
+        band.data = scratch;
+        band.size = rows * d->stride;
+        band.is_full = false;
+        band.area.top = (unsigned short int)(d->area.top + y);
+        band.area.height = (unsigned short int)rows;
 
-    int rv = fbink_add_ot_font(filename, (FONT_STYLE_T)style);
-    return make_ok_or_error(env, rv);
-}
+        if (clipped && !rect_intersect(clip, &band.area, &band.clip))
+            continue;
 
-// ============================================================================
-// NIF: fbink_free_ot_fonts/0
-// ============================================================================
+        rv = fbink_restore(fbfd, &band_cfg, &band);
+        if (rv >= 0) {
+            FBInkRect last = fbink_get_last_rect(false);
+            rect_union(damage, &last);
+        }
+    }
 
-static ERL_NIF_TERM nif_fbink_free_ot_fonts(ErlNifEnv *env, int argc,
-                                              const ERL_NIF_TERM argv[]) {
-    (void)argc; (void)argv;
-    int rv = fbink_free_ot_fonts();
-    return make_ok_or_error(env, rv);
+    enif_free(scratch);
+    return rv;
 }
 
-// ============================================================================
-// NIF: fbink_print_ot/4
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_print_ot(ErlNifEnv *env, int argc,
-                                         const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_restore(ErlNifEnv *env, int argc,
+                                       const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
         return enif_make_badarg(env);
 
-    ErlNifBinary bin;
-    if (!enif_inspect_iolist_as_binary(env, argv[1], &bin))
-        return enif_make_badarg(env);
-
-    char *str = enif_alloc(bin.size + 1);
-    if (!str) return make_error_string(env, "enomem");
-    memcpy(str, bin.data, bin.size);
-    str[bin.size] = '\0';
-
-    FBInkOTConfig ot_cfg;
-    map_to_fbink_ot_config(env, argv[2], &ot_cfg);
-
     FBInkConfig cfg;
-    map_to_fbink_config(env, argv[3], &cfg);
-
-    FBInkOTFit fit;
-    memset(&fit, 0, sizeof(fit));
+    map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
 
-    int rv = fbink_print_ot(fbfd, str, &ot_cfg, &cfg, &fit);
-    enif_free(str);
+    DumpResource *res;
+    if (!enif_get_resource(env, argv[2], dump_resource_type, (void **)&res))
+        return enif_make_badarg(env);
 
-    if (rv < 0) {
-        return make_error_int(env, rv);
+    int rv;
+    enif_rwlock_rlock(res->lock);
+    if (res->packed) {
+        // One refresh for the union of all bands, as a raw restore would do
+        FBInkRect damage = { 0 };
+        rv = restore_packed(fbfd, &cfg, res, &res->dump.clip, &damage);
+        if (rv >= 0 && (deferred || !cfg.no_refresh)) {
+            RefreshGroup g = { .cfg = cfg, .damage = damage };
+            g.cfg.no_refresh = false;
+            rv = refresh_group(fbfd, &g);
+        } else if (rv >= 0) {
+            damage_record(fb, fbfd, &cfg, &damage);
+        }
+    } else {
+        rv = fbink_restore(fbfd, &cfg, &res->dump);
+        draw_done(fb, fbfd, &cfg, rv, deferred);
     }
-
-    ERL_NIF_TERM fit_map = fbink_ot_fit_to_map(env, &fit);
-    return enif_make_tuple3(env, atom_ok, enif_make_int(env, rv), fit_map);
+    enif_rwlock_runlock(res->lock);
+    return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_print_progress_bar/3
+// NIF: restore_rect/4  (restore only part of a dump)
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_print_progress_bar(ErlNifEnv *env, int argc,
-                                                   const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_restore_rect(ErlNifEnv *env, int argc,
+                                             const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    unsigned int percentage;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_uint(env, argv[1], &percentage))
+    FBHandle *fb;
+    DumpResource *res;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_get_resource(env, argv[1], dump_resource_type, (void **)&res))
         return enif_make_badarg(env);
 
+    FBInkRect rect;
+    map_to_fbink_rect(env, argv[2], &rect);
     FBInkConfig cfg;
-    map_to_fbink_config(env, argv[2], &cfg);
-
-    int rv = fbink_print_progress_bar(fbfd, (uint8_t)percentage, &cfg);
+    map_to_fbink_config(env, argv[3], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    enif_rwlock_rlock(res->lock);
+    const FBInkDump *d = &res->dump;
+
+    // Only what lies in the dump (and its own clip, if any) can be restored
+    FBInkRect clip;
+    bool hit = rect_intersect(&rect, &d->area, &clip) &&
+               (rect_is_empty(&d->clip) || rect_intersect(&clip, &d->clip, &clip));
+    int rv = 0;
+    if (hit && res->packed) {
+        FBInkRect damage = { 0 };
+        rv = restore_packed(fbfd, &cfg, res, &clip, &damage);
+        if (rv >= 0 && (deferred || !cfg.no_refresh)) {
+            RefreshGroup g = { .cfg = cfg, .damage = damage };
+            g.cfg.no_refresh = false;
+            rv = refresh_group(fbfd, &g);
+        } else if (rv >= 0) {
+            damage_record(fb, fbfd, &cfg, &damage);
+        }
+    } else if (hit) {
+        FBInkDump view = *d;
+        view.clip = clip;
+        rv = fbink_restore(fbfd, &cfg, &view);
+        draw_done(fb, fbfd, &cfg, rv, deferred);
+    }
+    enif_rwlock_runlock(res->lock);
     return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_print_activity_bar/3
+// NIF: compress_dump/1  (swap a dump's pixels for an RLE-compressed copy)
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_print_activity_bar(ErlNifEnv *env, int argc,
-                                                   const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_compress_dump(ErlNifEnv *env, int argc,
+                                              const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    unsigned int progress;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_uint(env, argv[1], &progress))
+    DumpResource *res;
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
         return enif_make_badarg(env);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[2], &cfg);
+    ERL_NIF_TERM result;
+    enif_rwlock_rwlock(res->lock);
+    FBInkDump *d = &res->dump;
+
+    if (atomic_load(&res->state) == DUMP_EXPORTED) {
+        // Binaries handed out by get_dump_data/1 point into the raw pixels
+        result = make_error_string(env, "exported");
+    } else if (res->packed) {
+        result = make_ok(env, enif_make_uint64(env, (ErlNifUInt64)res->packed_size));
+    } else if (!d->data || d->size == 0 || d->stride == 0) {
+        result = make_error_string(env, "no_data");
+    } else {
+        size_t rows = d->size / d->stride, rest = d->size % d->stride;
+        uint8_t *out = enif_alloc(d->size);
+        size_t n = out ? rle_encode(d->data, d->stride, rows, rle_unit(d->bpp), out,
+                                    d->size - rest)
+                       : 0;
+        if (n > 0 && n + rest < d->size) {
+            memcpy(out + n, d->data + rows * d->stride, rest);
+            res->packed_size = n + rest;
+            res->packed = enif_realloc(out, res->packed_size);
+            if (!res->packed) res->packed = out;
+            if (res->map) {
+                munmap(res->map, res->map_size);
+                res->map = NULL;
+            } else {
+                free(d->data);
+            }
+            d->data = NULL;
+            result = make_ok(env, enif_make_uint64(env, (ErlNifUInt64)res->packed_size));
+        } else {
+            // Incompressible content stays raw
+            if (out) enif_free(out);
+            result = make_ok(env, enif_make_uint64(env, (ErlNifUInt64)d->size));
+        }
+    }
 
-    int rv = fbink_print_activity_bar(fbfd, (uint8_t)progress, &cfg);
-    return make_ok_or_error(env, rv);
+    enif_rwlock_rwunlock(res->lock);
+    return result;
 }
 
 // ============================================================================
-// NIF: fbink_print_image/5
+// NIF: dump_info/1
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_print_image(ErlNifEnv *env, int argc,
-                                            const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_dump_info(ErlNifEnv *env, int argc,
+                                         const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    DumpResource *res;
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
         return enif_make_badarg(env);
 
-    char filename[4096];
-    if (enif_get_string(env, argv[1], filename, sizeof(filename), ERL_NIF_LATIN1) <= 0) {
-        ErlNifBinary bin;
-        if (!enif_inspect_iolist_as_binary(env, argv[1], &bin) || bin.size >= sizeof(filename))
-            return enif_make_badarg(env);
-        memcpy(filename, bin.data, bin.size);
-        filename[bin.size] = '\0';
-    }
-
-    int x_off, y_off;
-    if (!enif_get_int(env, argv[2], &x_off) ||
-        !enif_get_int(env, argv[3], &y_off))
-        return enif_make_badarg(env);
+    enif_rwlock_rlock(res->lock);
+    const FBInkDump *d = &res->dump;
+    bool have = res->packed || d->data;
+    size_t stored = res->packed ? res->packed_size : (d->data ? d->size : 0);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[4], &cfg);
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    enif_make_map_put(env, map, atom_raw_size,
+        enif_make_uint64(env, (ErlNifUInt64)(have ? d->size : 0)), &map);
+    enif_make_map_put(env, map, atom_stored_size,
+        enif_make_uint64(env, (ErlNifUInt64)stored), &map);
+    enif_make_map_put(env, map, atom_compressed,
+        res->packed ? atom_true : atom_false, &map);
+    enif_make_map_put(env, map, atom_bpp, enif_make_uint(env, d->bpp), &map);
+    enif_make_map_put(env, map, atom_area, fbink_rect_to_map(env, &d->area), &map);
+    enif_rwlock_runlock(res->lock);
 
-    int rv = fbink_print_image(fbfd, filename, (short int)x_off, (short int)y_off, &cfg);
-    return make_ok_or_error(env, rv);
+    return make_ok(env, map);
 }
 
 // ============================================================================
-// NIF: fbink_print_raw_data/7
+// NIF: save_dump/2  and  load_dump/1  (on-disk dumps, mapped back zero-copy)
 // ============================================================================
+//
+// A dump file is a fixed header followed by the dump's pixels exactly as held
+// in memory (raw rows, or the RLE stream of a compressed dump). Integers are
+// in host byte order, which the byte_order field records. Loading maps the
+// file read-only and points the dump straight into the mapping.
 
-static ERL_NIF_TERM nif_fbink_print_raw_data(ErlNifEnv *env, int argc,
-                                               const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
-        return enif_make_badarg(env);
+#define DUMP_FILE_MAGIC      "FBKDUMP"
+#define DUMP_FILE_VERSION    1
+#define DUMP_FILE_BYTE_ORDER 0x01020304u
+#define DUMP_FILE_FULL       (1u << 0)
+#define DUMP_FILE_PACKED     (1u << 1)
 
-    ErlNifBinary bin;
-    if (!enif_inspect_binary(env, argv[1], &bin))
-        return enif_make_badarg(env);
+typedef struct {
+    char magic[8];              // "FBKDUMP\0"
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;       // Offset of the pixel data
+    uint32_t flags;             // DUMP_FILE_*
+    uint64_t size;              // Raw pixel bytes
+    uint64_t stored_size;       // Bytes following the header
+    uint64_t stride;
+    uint16_t area[4];           // left, top, width, height
+    uint16_t clip[4];
+    uint8_t rota;
+    uint8_t bpp;
+    uint8_t reserved[14];       // Pads the pixel data to a 16-byte boundary
+} DumpFileHeader;
+
+_Static_assert(sizeof(DumpFileHeader) == 80, "dump file header layout");
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
 
-    int w, h;
-    if (!enif_get_int(env, argv[2], &w) ||
-        !enif_get_int(env, argv[3], &h))
+static ERL_NIF_TERM nif_fbink_save_dump(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    DumpResource *res;
+    char path[4096], tmp[4110];
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res) ||
+        !get_filename(env, argv[1], path, sizeof(path)))
         return enif_make_badarg(env);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
 
-    int x_off, y_off;
-    if (!enif_get_int(env, argv[4], &x_off) ||
-        !enif_get_int(env, argv[5], &y_off))
-        return enif_make_badarg(env);
+    enif_rwlock_rlock(res->lock);
+    const FBInkDump *d = &res->dump;
+    const uint8_t *payload = res->packed ? res->packed : d->data;
+    if (!payload || d->size == 0) {
+        enif_rwlock_runlock(res->lock);
+        return make_error_string(env, "no_data");
+    }
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[6], &cfg);
+    DumpFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DUMP_FILE_MAGIC, sizeof(DUMP_FILE_MAGIC));
+    h.version = DUMP_FILE_VERSION;
+    h.byte_order = DUMP_FILE_BYTE_ORDER;
+    h.header_size = sizeof(h);
+    h.flags = (d->is_full ? DUMP_FILE_FULL : 0) | (res->packed ? DUMP_FILE_PACKED : 0);
+    h.size = d->size;
+    h.stored_size = res->packed ? res->packed_size : d->size;
+    h.stride = d->stride;
+    h.area[0] = d->area.left;  h.area[1] = d->area.top;
+    h.area[2] = d->area.width; h.area[3] = d->area.height;
+    h.clip[0] = d->clip.left;  h.clip[1] = d->clip.top;
+    h.clip[2] = d->clip.width; h.clip[3] = d->clip.height;
+    h.rota = d->rota;
+    h.bpp = d->bpp;
+
+    // Write aside and rename, so a power cut never leaves a torn splash
+    int rv = 0;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        rv = -errno;
+    } else {
+        rv = write_all(fd, &h, sizeof(h));
+        if (rv == 0) rv = write_all(fd, payload, (size_t)h.stored_size);
+        if (rv == 0 && fsync(fd) < 0) rv = -errno;
+        if (close(fd) < 0 && rv == 0) rv = -errno;
+        if (rv == 0 && rename(tmp, path) < 0) rv = -errno;
+        if (rv < 0) unlink(tmp);
+    }
+    enif_rwlock_runlock(res->lock);
 
-    int rv = fbink_print_raw_data(fbfd, bin.data, w, h, bin.size,
-                                  (short int)x_off, (short int)y_off, &cfg);
-    return make_ok_or_error(env, rv);
+    return rv < 0 ? make_error_int(env, rv) : atom_ok;
 }
 
-// ============================================================================
-// NIF: fbink_cls/3
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_cls(ErlNifEnv *env, int argc,
-                                   const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_load_dump(ErlNifEnv *env, int argc,
+                                          const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    char path[4096];
+    if (!get_filename(env, argv[0], path, sizeof(path)))
         return enif_make_badarg(env);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[1], &cfg);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return make_error_int(env, -errno);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = -errno;
+        close(fd);
+        return make_error_int(env, err);
+    }
+    if ((size_t)st.st_size < sizeof(DumpFileHeader)) {
+        close(fd);
+        return make_error_string(env, "einval");
+    }
+    size_t map_size = (size_t)st.st_size;
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return make_error_int(env, -errno);
+
+    const DumpFileHeader *h = map;
+    const char *reason = NULL;
+    if (memcmp(h->magic, DUMP_FILE_MAGIC, sizeof(DUMP_FILE_MAGIC)) != 0 ||
+        h->byte_order != DUMP_FILE_BYTE_ORDER)
+        reason = "einval";
+    else if (h->version != DUMP_FILE_VERSION)
+        reason = "enotsup";
+    else if (h->header_size < sizeof(DumpFileHeader) || h->header_size > map_size ||
+             h->stored_size > map_size - h->header_size || h->stride == 0 ||
+             (h->bpp != 4 && h->bpp != 8 && h->bpp != 16 && h->bpp != 24 && h->bpp != 32) ||
+             ((size_t)h->area[2] * h->bpp + 7) / 8 > h->stride ||
+             h->size < h->stride * h->area[3] ||
+             (!(h->flags & DUMP_FILE_PACKED) && h->stored_size != h->size))
+        reason = "einval";
+
+    if (!reason) {
+        // Pixels are only meaningful in the layout they were dumped from
+        FBInkConfig cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.is_quiet = true;
+        FBInkState state;
+        // reinit/2 may change bpp or rotation underneath an unlocked read
+        enif_mutex_lock(fbink_lock);
+        fbink_get_state(&cfg, &state);
+        enif_mutex_unlock(fbink_lock);
+        if (state.bpp != h->bpp || state.current_rota != h->rota ||
+            ((h->flags & DUMP_FILE_FULL) && state.scanline_stride != h->stride))
+            reason = "mismatch";
+    }
 
-    // argv[2] is optional rect (nil or map) and argv[3] is no_rota bool
-    FBInkRect rect;
-    FBInkRect *rect_ptr = NULL;
-    if (!enif_is_atom(env, argv[2])) {
-        map_to_fbink_rect(env, argv[2], &rect);
-        rect_ptr = &rect;
+    DumpResource *res = reason ? NULL : alloc_dump_resource();
+    if (!res) {
+        munmap(map, map_size);
+        return make_error_string(env, reason ? reason : "enomem");
     }
 
-    int no_rota;
-    if (!enif_get_int(env, argv[3], &no_rota))
-        return enif_make_badarg(env);
+    uint8_t *payload = (uint8_t *)map + h->header_size;
+    FBInkDump *d = &res->dump;
+    d->stride = (size_t)h->stride;
+    d->size = (size_t)h->size;
+    d->area = (FBInkRect){ h->area[0], h->area[1], h->area[2], h->area[3] };
+    d->clip = (FBInkRect){ h->clip[0], h->clip[1], h->clip[2], h->clip[3] };
+    d->rota = h->rota;
+    d->bpp = h->bpp;
+    d->is_full = (h->flags & DUMP_FILE_FULL) != 0;
+    if (h->flags & DUMP_FILE_PACKED) {
+        res->packed = payload;
+        res->packed_size = (size_t)h->stored_size;
+    } else {
+        d->data = payload;
+    }
+    res->map = map;
+    res->map_size = map_size;
+    // The first restore usually follows right away
+    madvise(map, map_size, MADV_WILLNEED);
 
-    int rv = fbink_cls(fbfd, &cfg, rect_ptr, no_rota != 0);
-    return make_ok_or_error(env, rv);
+    ERL_NIF_TERM term = enif_make_resource(env, res);
+    enif_release_resource(res);
+    return make_ok(env, term);
 }
 
 // ============================================================================
-// NIF: fbink_grid_clear/4
+// NIF: diff_dumps/4  (changed rects between two same-sized dumps)
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_grid_clear(ErlNifEnv *env, int argc,
-                                          const ERL_NIF_TERM argv[]) {
+static bool get_diff_opts(ErlNifEnv *env, ERL_NIF_TERM tile_term, ERL_NIF_TERM overhead_term,
+                          unsigned int *tile, ErlNifUInt64 *overhead) {
+    if (!enif_get_uint(env, tile_term, tile) || !enif_get_uint64(env, overhead_term, overhead))
+        return false;
+    // Even tiles keep 4bpp tile boundaries on whole bytes
+    if (*tile < 8) *tile = 8;
+    *tile = (*tile + 1) & ~1u;
+    return true;
+}
+
+static ERL_NIF_TERM nif_fbink_diff_dumps(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    unsigned int cols, rows;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_uint(env, argv[1], &cols) ||
-        !enif_get_uint(env, argv[2], &rows))
+    DumpResource *a, *b;
+    unsigned int tile;
+    ErlNifUInt64 overhead;
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&a) ||
+        !enif_get_resource(env, argv[1], dump_resource_type, (void **)&b) ||
+        !get_diff_opts(env, argv[2], argv[3], &tile, &overhead))
         return enif_make_badarg(env);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[3], &cfg);
-
-    int rv = fbink_grid_clear(fbfd, (unsigned short int)cols,
-                              (unsigned short int)rows, &cfg);
-    return make_ok_or_error(env, rv);
+    if (a == b) return make_ok(env, enif_make_list(env, 0));
+
+    const FBInkDump *da = &a->dump, *db = &b->dump;
+    if (da->bpp != db->bpp || da->area.width != db->area.width ||
+        da->area.height != db->area.height)
+        return make_error_string(env, "einval");
+
+    enif_rwlock_rlock(a->lock);
+    enif_rwlock_rlock(b->lock);
+    uint8_t *own_a, *own_b;
+    const uint8_t *pa = dump_pixels(a, &own_a), *pb = dump_pixels(b, &own_b);
+    RefreshGroup *rects = NULL;
+    int n = (pa && pb) ? diff_pixels(pa, da->stride, pb, db->stride, da->area.width,
+                                     da->area.height, da->bpp, tile, da->area.left,
+                                     da->area.top, overhead, &rects)
+                       : 1;
+    if (own_a) enif_free(own_a);
+    if (own_b) enif_free(own_b);
+    enif_rwlock_runlock(b->lock);
+    enif_rwlock_runlock(a->lock);
+
+    if (!pa || !pb) return make_error_string(env, "no_data");
+    if (n < 0) return make_error_string(env, "enomem");
+    ERL_NIF_TERM list = diff_rects_to_list(env, rects, n);
+    if (rects) enif_free(rects);
+    return make_ok(env, list);
 }
 
 // ============================================================================
-// NIF: fbink_refresh/6
-// ============================================================================
+// NIF: diff_dump_against_screen/4  and  restore_changed/5
+// ============================================================================
+
+// Diff a dump against the current framebuffer contents. Called with the
+// dump's read lock held; *pixels receives the dump's raw pixels (decoded
+// copy in *owned for compressed dumps) for a subsequent restore.
+static int diff_against_screen(int fbfd, const DumpResource *res, unsigned int tile,
+                               uint64_t overhead, RefreshGroup **rects,
+                               const uint8_t **pixels, uint8_t **owned) {
+    const FBInkDump *d = &res->dump;
+    *rects = NULL;
+    *owned = NULL;
+    if (!(*pixels = dump_pixels(res, owned)))
+        return res->packed ? -ENOMEM : -ENODATA;
+
+    FBInkDump screen = { 0 };
+    int rv = fbink_dump(fbfd, &screen);
+    if (rv < 0) return rv;
+
+    // The dump must come from this framebuffer layout, aligned on whole bytes
+    if (screen.bpp != d->bpp || screen.rota != d->rota ||
+        (unsigned int)d->area.left + d->area.width > screen.area.width ||
+        (unsigned int)d->area.top + d->area.height > screen.area.height ||
+        ((size_t)d->area.left * d->bpp) % 8 != 0) {
+        fbink_free_dump_data(&screen);
+        return -EINVAL;
+    }
 
-static ERL_NIF_TERM nif_fbink_refresh(ErlNifEnv *env, int argc,
-                                       const ERL_NIF_TERM argv[]) {
+    const uint8_t *on_screen = screen.data + (size_t)d->area.top * screen.stride +
+                               (size_t)d->area.left * d->bpp / 8;
+    rv = diff_pixels(*pixels, d->stride, on_screen, screen.stride, d->area.width,
+                     d->area.height, d->bpp, tile, d->area.left, d->area.top,
+                     overhead, rects);
+    fbink_free_dump_data(&screen);
+    return rv;
+}
+
+static ERL_NIF_TERM nif_fbink_diff_dump_against_screen(ErlNifEnv *env, int argc,
+                                                         const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    unsigned int top, left, width, height;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_uint(env, argv[1], &top) ||
-        !enif_get_uint(env, argv[2], &left) ||
-        !enif_get_uint(env, argv[3], &width) ||
-        !enif_get_uint(env, argv[4], &height))
+    DumpResource *res;
+    unsigned int tile;
+    ErlNifUInt64 overhead;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_resource(env, argv[1], dump_resource_type, (void **)&res) ||
+        !get_diff_opts(env, argv[2], argv[3], &tile, &overhead))
         return enif_make_badarg(env);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[5], &cfg);
-
-    int rv = fbink_refresh(fbfd, top, left, width, height, &cfg);
-    return make_ok_or_error(env, rv);
+    enif_rwlock_rlock(res->lock);
+    RefreshGroup *rects;
+    const uint8_t *pixels;
+    uint8_t *owned;
+    int n = diff_against_screen(fbfd, res, tile, overhead, &rects, &pixels, &owned);
+    if (owned) enif_free(owned);
+    enif_rwlock_runlock(res->lock);
+
+    if (n < 0) return make_error_int(env, n);
+    ERL_NIF_TERM list = diff_rects_to_list(env, rects, n);
+    if (rects) enif_free(rects);
+    return make_ok(env, list);
 }
 
-// ============================================================================
-// NIF: fbink_refresh_rect/3
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_refresh_rect(ErlNifEnv *env, int argc,
-                                             const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_restore_changed(ErlNifEnv *env, int argc,
+                                                const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    DumpResource *res;
+    unsigned int tile;
+    ErlNifUInt64 overhead;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_resource(env, argv[2], dump_resource_type, (void **)&res) ||
+        !get_diff_opts(env, argv[3], argv[4], &tile, &overhead))
         return enif_make_badarg(env);
 
-    FBInkRect rect;
-    map_to_fbink_rect(env, argv[1], &rect);
-
     FBInkConfig cfg;
-    map_to_fbink_config(env, argv[2], &cfg);
+    map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
+    bool want_refresh = deferred || !cfg.no_refresh;
+
+    enif_rwlock_rlock(res->lock);
+    RefreshGroup *rects;
+    const uint8_t *pixels;
+    uint8_t *owned;
+    int n = diff_against_screen(fbfd, res, tile, overhead, &rects, &pixels, &owned);
+
+    // Restore each changed rect alone, then refresh only what was redrawn
+    FBInkConfig quiet = cfg;
+    quiet.no_refresh = true;
+    int rv = n;
+    for (int i = 0; i < n && rv >= 0; i++) {
+        FBInkDump view = res->dump;
+        view.data = (unsigned char *)pixels;
+        view.clip = rects[i].damage;
+        rv = fbink_restore(fbfd, &quiet, &view);
+        if (rv < 0) break;
+        if (want_refresh) {
+            RefreshGroup g = { .cfg = cfg, .damage = fbink_get_last_rect(false) };
+            g.cfg.no_refresh = false;
+            rv = refresh_group(fbfd, &g);
+        }
+    }
+    if (owned) enif_free(owned);
+    enif_rwlock_runlock(res->lock);
 
-    int rv = fbink_refresh_rect(fbfd, &rect, &cfg);
-    return make_ok_or_error(env, rv);
+    ERL_NIF_TERM result = rv < 0 ? make_error_int(env, rv)
+                                 : make_ok(env, diff_rects_to_list(env, rects, n));
+    if (rects) enif_free(rects);
+    return result;
 }
 
 // ============================================================================
-// NIF: fbink_grid_refresh/4
+// NIF: snapshot_store/1
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_grid_refresh(ErlNifEnv *env, int argc,
-                                             const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_snapshot_store(ErlNifEnv *env, int argc,
+                                               const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    unsigned int cols, rows;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_uint(env, argv[1], &cols) ||
-        !enif_get_uint(env, argv[2], &rows))
+    unsigned int tile;
+    if (!enif_get_uint(env, argv[0], &tile) || tile < 8 || tile > 1024)
         return enif_make_badarg(env);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[3], &cfg);
+    SnapStore *st = enif_alloc_resource(snap_store_resource_type, sizeof(SnapStore));
+    if (!st) return make_error_string(env, "enomem");
+    memset(st, 0, sizeof(SnapStore));
+    // Even tiles keep 4bpp tile boundaries on whole bytes
+    st->tile = (tile + 1) & ~1u;
+    st->nbuckets = 256;
+    st->buckets = enif_alloc(st->nbuckets * sizeof(SnapTile *));
+    st->lock = enif_mutex_create("fbink_snap_store");
+    if (!st->buckets || !st->lock) {
+        enif_release_resource(st);
+        return make_error_string(env, "enomem");
+    }
+    memset(st->buckets, 0, st->nbuckets * sizeof(SnapTile *));
 
-    int rv = fbink_grid_refresh(fbfd, (unsigned short int)cols,
-                                (unsigned short int)rows, &cfg);
-    return make_ok_or_error(env, rv);
+    ERL_NIF_TERM term = enif_make_resource(env, st);
+    enif_release_resource(st);
+    return make_ok(env, term);
 }
 
 // ============================================================================
-// NIF: fbink_wait_for_submission/2
+// NIF: snapshot/2  (tile the current screen into a store)
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_wait_for_submission(ErlNifEnv *env, int argc,
-                                                    const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_snapshot(ErlNifEnv *env, int argc,
+                                         const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    unsigned int marker;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_uint(env, argv[1], &marker))
+    SnapStore *st;
+    if (!get_fbfd(env, argv[0], &fbfd) ||
+        !enif_get_resource(env, argv[1], snap_store_resource_type, (void **)&st))
         return enif_make_badarg(env);
 
-    int rv = fbink_wait_for_submission(fbfd, marker);
-    return make_ok_or_error(env, rv);
+    FBInkDump screen = { 0 };
+    int rv = fbink_dump(fbfd, &screen);
+    if (rv < 0) return make_error_int(env, rv);
+
+    enif_mutex_lock(st->lock);
+    if (!st->has_geometry) {
+        st->width = screen.area.width;
+        st->height = screen.area.height;
+        st->bpp = screen.bpp;
+        st->rota = screen.rota;
+        st->tiles_x = (st->width + st->tile - 1) / st->tile;
+        st->tiles_y = (st->height + st->tile - 1) / st->tile;
+        st->has_geometry = true;
+    }
+    bool same = st->width == screen.area.width && st->height == screen.area.height &&
+                st->bpp == screen.bpp && st->rota == screen.rota;
+    enif_mutex_unlock(st->lock);
+    if (!same) {
+        // Tiles are only comparable within one framebuffer layout
+        fbink_free_dump_data(&screen);
+        return make_error_int(env, -EINVAL);
+    }
+
+    Snapshot *snap = enif_alloc_resource(snapshot_resource_type, sizeof(Snapshot));
+    size_t ntiles = (size_t)st->tiles_x * st->tiles_y;
+    uint8_t *scratch = enif_alloc(((size_t)st->tile * st->bpp + 7) / 8 * st->tile);
+    if (snap) {
+        memset(snap, 0, sizeof(Snapshot));
+        snap->tiles = enif_alloc(ntiles * sizeof(SnapTile *));
+        if (snap->tiles) memset(snap->tiles, 0, ntiles * sizeof(SnapTile *));
+        snap->store = st;
+        snap->ntiles = ntiles;
+        enif_keep_resource(st);
+    }
+    rv = (snap && snap->tiles && scratch) ? 0 : -ENOMEM;
+
+    for (unsigned int ty = 0; ty < st->tiles_y && rv == 0; ty++) {
+        for (unsigned int tx = 0; tx < st->tiles_x && rv == 0; tx++) {
+            FBInkRect r;
+            size_t row_bytes;
+            snap_tile_geometry(st, tx, ty, &r, &row_bytes);
+            const uint8_t *src = screen.data + (size_t)r.top * screen.stride +
+                                 (size_t)r.left * st->bpp / 8;
+            for (unsigned int y = 0; y < r.height; y++)
+                memcpy(scratch + y * row_bytes, src + (size_t)y * screen.stride, row_bytes);
+
+            uint32_t size = (uint32_t)(row_bytes * r.height);
+            uint64_t hash = snap_hash(scratch, size);
+            enif_mutex_lock(st->lock);
+            SnapTile *t = snap_intern(st, scratch, size, hash);
+            enif_mutex_unlock(st->lock);
+            if (!t) rv = -ENOMEM;
+            snap->tiles[(size_t)ty * st->tiles_x + tx] = t;
+        }
+    }
+    if (scratch) enif_free(scratch);
+    fbink_free_dump_data(&screen);
+
+    if (rv < 0) {
+        // The dtor drops whatever tiles were interned so far
+        if (snap) enif_release_resource(snap);
+        return make_error_int(env, rv);
+    }
+    ERL_NIF_TERM term = enif_make_resource(env, snap);
+    enif_release_resource(snap);
+    return make_ok(env, term);
 }
 
 // ============================================================================
-// NIF: fbink_wait_for_complete/2
+// NIF: restore_snapshot/4  (write and refresh only the tiles that differ)
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_wait_for_complete(ErlNifEnv *env, int argc,
-                                                  const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_restore_snapshot(ErlNifEnv *env, int argc,
+                                                 const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    unsigned int marker;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_uint(env, argv[1], &marker))
+    FBHandle *fb;
+    Snapshot *snap;
+    ErlNifUInt64 overhead;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_get_resource(env, argv[2], snapshot_resource_type, (void **)&snap) ||
+        !enif_get_uint64(env, argv[3], &overhead))
         return enif_make_badarg(env);
 
-    int rv = fbink_wait_for_complete(fbfd, marker);
-    return make_ok_or_error(env, rv);
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
+    bool want_refresh = deferred || !cfg.no_refresh;
+    const SnapStore *st = snap->store;
+
+    FBInkDump screen = { 0 };
+    int rv = fbink_dump(fbfd, &screen);
+    if (rv < 0) return make_error_int(env, rv);
+    if (screen.area.width != st->width || screen.area.height != st->height ||
+        screen.bpp != st->bpp || screen.rota != st->rota) {
+        fbink_free_dump_data(&screen);
+        return make_error_int(env, -EINVAL);
+    }
+
+    // Tiles are immutable and pinned by the snapshot: no lock needed to read
+    uint8_t *dirty = enif_alloc(snap->ntiles);
+    if (!dirty) {
+        fbink_free_dump_data(&screen);
+        return make_error_string(env, "enomem");
+    }
+    for (unsigned int ty = 0; ty < st->tiles_y; ty++) {
+        for (unsigned int tx = 0; tx < st->tiles_x; tx++) {
+            size_t i = (size_t)ty * st->tiles_x + tx;
+            FBInkRect r;
+            size_t row_bytes;
+            snap_tile_geometry(st, tx, ty, &r, &row_bytes);
+            const uint8_t *src = screen.data + (size_t)r.top * screen.stride +
+                                 (size_t)r.left * st->bpp / 8;
+            dirty[i] = 0;
+            for (unsigned int y = 0; y < r.height && !dirty[i]; y++)
+                dirty[i] = bytes_differ(snap->tiles[i]->data + y * row_bytes,
+                                        src + (size_t)y * screen.stride, row_bytes);
+        }
+    }
+    FBInkDump layout = screen;
+    fbink_free_dump_data(&screen);
+
+    RefreshGroup *rects;
+    int n = tiles_to_rects(dirty, st->tiles_x, st->tiles_y, st->tile, st->width, st->height,
+                           0, 0, overhead, &rects);
+    rv = n;
+
+    // Restore the dirty tiles of each rect, then refresh that rect once
+    FBInkConfig quiet = cfg;
+    quiet.no_refresh = true;
+    for (int k = 0; k < n && rv >= 0; k++) {
+        const FBInkRect *R = &rects[k].damage;
+        FBInkRect damage = { 0 };
+        for (unsigned int ty = R->top / st->tile; ty * st->tile < (unsigned int)R->top + R->height && rv >= 0; ty++) {
+            for (unsigned int tx = R->left / st->tile; tx * st->tile < (unsigned int)R->left + R->width; tx++) {
+                size_t i = (size_t)ty * st->tiles_x + tx;
+                if (!dirty[i]) continue;
+                dirty[i] = 0;
+                FBInkRect r;
+                size_t row_bytes;
+                snap_tile_geometry(st, tx, ty, &r, &row_bytes);
+
+                FBInkDump view = layout;
+                view.data = snap->tiles[i]->data;
+                view.stride = row_bytes;
+                view.size = snap->tiles[i]->size;
+                view.area = r;
+                memset(&view.clip, 0, sizeof(FBInkRect));
+                view.is_full = false;
+                rv = fbink_restore(fbfd, &quiet, &view);
+                if (rv < 0) break;
+                FBInkRect last = fbink_get_last_rect(false);
+                rect_union(&damage, &last);
+            }
+        }
+        if (rv >= 0 && want_refresh) {
+            RefreshGroup g = { .cfg = cfg, .damage = damage };
+            g.cfg.no_refresh = false;
+            rv = refresh_group(fbfd, &g);
+        } else if (rv >= 0) {
+            damage_record(fb, fbfd, &cfg, &damage);
+        }
+    }
+    enif_free(dirty);
+
+    ERL_NIF_TERM result = rv < 0 ? make_error_int(env, rv)
+                                 : make_ok(env, diff_rects_to_list(env, rects, n));
+    if (rects) enif_free(rects);
+    return result;
 }
 
 // ============================================================================
-// NIF: fbink_wait_for_any_complete/1
+// NIF: snapshot_info/1  (memory used by a snapshot or a whole store)
 // ============================================================================
 
-static ERL_NIF_TERM nif_fbink_wait_for_any_complete(ErlNifEnv *env, int argc,
-                                                      const ERL_NIF_TERM argv[]) {
+static int tile_ptr_order(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t)*(SnapTile *const *)a, pb = (uintptr_t)*(SnapTile *const *)b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+static ERL_NIF_TERM nif_fbink_snapshot_info(ErlNifEnv *env, int argc,
+                                              const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    SnapStore *st;
+    Snapshot *snap;
+    ERL_NIF_TERM map = enif_make_new_map(env);
+
+    if (enif_get_resource(env, argv[0], snap_store_resource_type, (void **)&st)) {
+        enif_mutex_lock(st->lock);
+        size_t ntiles = st->ntiles, bytes = st->bytes;
+        enif_mutex_unlock(st->lock);
+        enif_make_map_put(env, map, atom_tiles, enif_make_uint64(env, ntiles), &map);
+        enif_make_map_put(env, map, atom_bytes, enif_make_uint64(env, bytes), &map);
+        enif_make_map_put(env, map, atom_tile_size, enif_make_uint(env, st->tile), &map);
+        return make_ok(env, map);
+    }
+    if (!enif_get_resource(env, argv[0], snapshot_resource_type, (void **)&snap))
         return enif_make_badarg(env);
 
-    int rv = fbink_wait_for_any_complete(fbfd);
-    return make_ok_or_error(env, rv);
+    // Sorted, so the slots sharing a tile are adjacent
+    SnapTile **sorted = enif_alloc(snap->ntiles * sizeof(SnapTile *));
+    if (!sorted) return make_error_string(env, "enomem");
+    memcpy(sorted, snap->tiles, snap->ntiles * sizeof(SnapTile *));
+    qsort(sorted, snap->ntiles, sizeof(SnapTile *), tile_ptr_order);
+
+    // Shared tiles are charged to each slot in proportion. Tiles whose every
+    // slot belongs to this snapshot (refs counts slots, not snapshots) are
+    // exclusive: what dropping it would give back
+    uint64_t bytes = 0, exclusive = 0;
+    enif_mutex_lock(snap->store->lock);
+    for (size_t i = 0, run; i < snap->ntiles; i += run) {
+        const SnapTile *t = sorted[i];
+        for (run = 1; i + run < snap->ntiles && sorted[i + run] == t; run++) {}
+        bytes += (uint64_t)t->size * run / t->refs;
+        if (t->refs == run) exclusive += t->size;
+    }
+    enif_mutex_unlock(snap->store->lock);
+    enif_free(sorted);
+
+    enif_make_map_put(env, map, atom_tiles, enif_make_uint64(env, snap->ntiles), &map);
+    enif_make_map_put(env, map, atom_bytes, enif_make_uint64(env, bytes), &map);
+    enif_make_map_put(env, map, atom_exclusive_bytes, enif_make_uint64(env, exclusive), &map);
+    return make_ok(env, map);
 }
 
 // ============================================================================
-// NIF: fbink_dump/1
+// NIF: canvas/1, canvas_fill/3, canvas_put_pixels/4, canvas_blit/4,
+//      commit/4, canvas_info/1  (off-screen canvases)
 // ============================================================================
+//
+// Canvas coordinates are native, like dumps and get_pixels/3. Fills, pixel
+// data and blits are written straight into the canvas; FBInk's own renderer
+// (text, image files) only draws on the framebuffer, so it has no way in.
+// Every write marks its area dirty; commit/4 restores the dirty rects and
+// refreshes their union once.
 
-static ERL_NIF_TERM nif_fbink_dump(ErlNifEnv *env, int argc,
-                                    const ERL_NIF_TERM argv[]) {
+static bool get_canvas(ErlNifEnv *env, ERL_NIF_TERM term, CanvasResource **c) {
+    return enif_get_resource(env, term, canvas_resource_type, (void **)c);
+}
+
+// Whether the framebuffer still has the layout the canvas was copied from
+static bool canvas_matches(const CanvasResource *c) {
+    FBInkConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.is_quiet = true;
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    fbink_get_state(&cfg, &state);
+    return state.bpp == c->dump.bpp && state.current_rota == c->dump.rota;
+}
+
+// Clip a rect to the canvas; false if nothing is left
+static bool canvas_clip(const CanvasResource *c, IRect r, IRect *out) {
+    int w = c->dump.area.width, h = c->dump.area.height;
+    if (r.left < 0) { r.width += r.left; r.left = 0; }
+    if (r.top < 0) { r.height += r.top; r.top = 0; }
+    if (r.left + r.width > w) r.width = w - r.left;
+    if (r.top + r.height > h) r.height = h - r.top;
+    *out = r;
+    return r.width > 0 && r.height > 0;
+}
+
+// Area to restore for r: 4bpp rects are widened to whole bytes
+static FBInkRect canvas_restore_rect(const CanvasResource *c, IRect r) {
+    if (c->dump.bpp == 4) {
+        int right = (r.left + r.width + 1) & ~1;
+        if (right > c->dump.area.width) right = c->dump.area.width;
+        r.left &= ~1;
+        r.width = right - r.left;
+    }
+    return (FBInkRect){ (unsigned short int)r.left, (unsigned short int)r.top,
+                        (unsigned short int)r.width, (unsigned short int)r.height };
+}
+
+// Add r to the dirty rects (lock held). It is folded into the rect it wastes
+// the fewest pixels with when that wastes none, or when the list is full.
+static void canvas_mark(CanvasResource *c, IRect r) {
+    FBInkRect fr = canvas_restore_rect(c, r);
+    int best = -1;
+    uint64_t best_waste = UINT64_MAX;
+    for (int i = 0; i < c->ndirty; i++) {
+        uint64_t w = merge_waste(&c->dirty[i], &fr);
+        if (w < best_waste) {
+            best_waste = w;
+            best = i;
+        }
+    }
+    if (best >= 0 && (best_waste == 0 || c->ndirty == CANVAS_MAX_DIRTY))
+        rect_union(&c->dirty[best], &fr);
+    else
+        c->dirty[c->ndirty++] = fr;
+}
+
+static inline uint8_t nibble_get(const uint8_t *row, unsigned int x) {
+    uint8_t b = row[x >> 1];
+    return (x & 1) ? (b & 0x0F) : (b >> 4);
+}
+
+static inline void nibble_put(uint8_t *row, unsigned int x, uint8_t v) {
+    uint8_t *b = &row[x >> 1];
+    *b = (x & 1) ? (uint8_t)((*b & 0xF0) | v) : (uint8_t)((*b & 0x0F) | (v << 4));
+}
+
+// Copy native pixels into dst, starting from pixel sx of each src row
+static void canvas_copy(CanvasResource *c, IRect dst, const uint8_t *src, size_t stride,
+                        unsigned int sx) {
+    unsigned int bpp = c->dump.bpp;
+    for (int j = 0; j < dst.height; j++) {
+        const uint8_t *s = src + (size_t)j * stride;
+        uint8_t *d = c->dump.data + (size_t)(dst.top + j) * c->dump.stride;
+        if (bpp != 4) {
+            memcpy(d + (size_t)dst.left * (bpp / 8), s + (size_t)sx * (bpp / 8),
+                   (size_t)dst.width * (bpp / 8));
+        } else if (!(dst.left & 1) && !(sx & 1)) {
+            memcpy(d + dst.left / 2, s + sx / 2, (size_t)dst.width / 2);
+            if (dst.width & 1)
+                nibble_put(d, (unsigned int)(dst.left + dst.width - 1),
+                           nibble_get(s, sx + (unsigned int)dst.width - 1));
+        } else {
+            for (int i = 0; i < dst.width; i++)
+                nibble_put(d, (unsigned int)(dst.left + i), nibble_get(s, sx + (unsigned int)i));
+        }
+    }
+}
+
+// Convert n Y8, RGB or RGBA pixels into canvas row y from x (4bpp goes
+// through Y8 in scratch, n bytes)
+static void canvas_pack_row(CanvasResource *c, const uint8_t *src, unsigned int sn, int x, int y,
+                            unsigned int n, uint8_t *scratch) {
+    uint8_t *row = c->dump.data + (size_t)y * c->dump.stride;
+    switch (c->dump.bpp) {
+    case 4:
+        pack_to_y8(src, sn, n, scratch, c->invert);
+        for (unsigned int i = 0; i < n; i++)
+            nibble_put(row, (unsigned int)x + i, scratch[i] >> 4);
+        break;
+    case 8:
+        pack_to_y8(src, sn, n, row + x, c->invert);
+        break;
+    case 16:
+        pack_to_565(src, sn, n, row + (size_t)x * 2);
+        break;
+    default:
+        pack_to_bgra(src, sn, n, row + (size_t)x * (c->dump.bpp / 8), c->dump.bpp / 8);
+        break;
+    }
+}
+
+static ERL_NIF_TERM nif_fbink_canvas(ErlNifEnv *env, int argc,
+                                      const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    if (!get_fbfd(env, argv[0], &fbfd))
         return enif_make_badarg(env);
 
-    DumpResource *res = enif_alloc_resource(dump_resource_type, sizeof(DumpResource));
-    if (!res) return make_error_string(env, "enomem");
-    memset(&res->dump, 0, sizeof(FBInkDump));
+    CanvasResource *c = enif_alloc_resource(canvas_resource_type, sizeof(CanvasResource));
+    if (!c) return make_error_string(env, "enomem");
+    memset(c, 0, sizeof(CanvasResource));
+    c->lock = enif_mutex_create("fbink_canvas");
 
-    int rv = fbink_dump(fbfd, &res->dump);
+    int rv = c->lock ? fbink_dump(fbfd, &c->dump) : -ENOMEM;
+    if (rv >= 0 && c->dump.bpp != 4 && c->dump.bpp != 8 && c->dump.bpp != 16 &&
+        c->dump.bpp != 24 && c->dump.bpp != 32)
+        rv = -ENOTSUP;
     if (rv < 0) {
-        enif_release_resource(res);
+        enif_release_resource(c);
         return make_error_int(env, rv);
     }
 
-    ERL_NIF_TERM res_term = enif_make_resource(env, res);
-    enif_release_resource(res);
+    FBInkConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.is_quiet = true;
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    fbink_get_state(&cfg, &state);
+    c->invert = state.inverted_grayscale;
+
+    ERL_NIF_TERM res_term = enif_make_resource(env, c);
+    enif_release_resource(c);
     return make_ok(env, res_term);
 }
 
-// ============================================================================
-// NIF: fbink_region_dump/6
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_region_dump(ErlNifEnv *env, int argc,
-                                            const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_canvas_fill(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    int x_off, y_off;
-    unsigned int w, h;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
-        !enif_get_int(env, argv[1], &x_off) ||
-        !enif_get_int(env, argv[2], &y_off) ||
-        !enif_get_uint(env, argv[3], &w) ||
-        !enif_get_uint(env, argv[4], &h))
+    CanvasResource *c;
+    if (!get_canvas(env, argv[0], &c))
         return enif_make_badarg(env);
 
-    FBInkConfig cfg;
-    map_to_fbink_config(env, argv[5], &cfg);
+    FBInkRect rect;
+    map_to_fbink_rect(env, argv[1], &rect);
 
-    DumpResource *res = enif_alloc_resource(dump_resource_type, sizeof(DumpResource));
-    if (!res) return make_error_string(env, "enomem");
-    memset(&res->dump, 0, sizeof(FBInkDump));
+    // A gray level, or an {r, g, b, a} tuple
+    uint8_t px[4];
+    unsigned int sn = 1;
+    const ERL_NIF_TERM *el;
+    int arity;
+    if (!get_u8(env, argv[2], &px[0])) {
+        sn = 4;
+        if (!enif_get_tuple(env, argv[2], &arity, &el) || arity != 4 ||
+            !get_u8(env, el[0], &px[0]) || !get_u8(env, el[1], &px[1]) ||
+            !get_u8(env, el[2], &px[2]) || !get_u8(env, el[3], &px[3]))
+            return enif_make_badarg(env);
+    }
 
-    int rv = fbink_region_dump(fbfd, (short int)x_off, (short int)y_off,
-                               (unsigned short int)w, (unsigned short int)h,
-                               &cfg, &res->dump);
-    if (rv < 0) {
-        enif_release_resource(res);
-        return make_error_int(env, rv);
+    // An empty rect means the whole canvas
+    IRect r = { rect.left, rect.top, rect.width, rect.height };
+    if (rect_is_empty(&rect))
+        r = (IRect){ 0, 0, c->dump.area.width, c->dump.area.height };
+    if (!canvas_clip(c, r, &r))
+        return atom_ok;
+
+    // One source row of the color, converted once and copied down (4bpp
+    // rows may start mid-byte, so they are each converted)
+    uint8_t *src = enif_alloc((size_t)r.width * (sn + 1));
+    if (!src) return make_error_string(env, "enomem");
+    uint8_t *scratch = src + (size_t)r.width * sn;
+    for (int i = 0; i < r.width; i++)
+        memcpy(src + (size_t)i * sn, px, sn);
+
+    enif_mutex_lock(c->lock);
+    size_t row_bytes = (size_t)r.width * c->dump.bpp / 8;
+    const uint8_t *first = c->dump.data + (size_t)r.top * c->dump.stride +
+                           (size_t)r.left * c->dump.bpp / 8;
+    for (int y = r.top; y < r.top + r.height; y++) {
+        if (y == r.top || c->dump.bpp == 4)
+            canvas_pack_row(c, src, sn, r.left, y, (unsigned int)r.width, scratch);
+        else
+            memcpy(c->dump.data + (size_t)y * c->dump.stride + (size_t)r.left * c->dump.bpp / 8,
+                   first, row_bytes);
     }
+    canvas_mark(c, r);
+    enif_mutex_unlock(c->lock);
 
-    ERL_NIF_TERM res_term = enif_make_resource(env, res);
-    enif_release_resource(res);
-    return make_ok(env, res_term);
+    enif_free(src);
+    return atom_ok;
 }
 
-// ============================================================================
-// NIF: fbink_rect_dump/2
-// ============================================================================
-
-static ERL_NIF_TERM nif_fbink_rect_dump(ErlNifEnv *env, int argc,
-                                          const ERL_NIF_TERM argv[]) {
+static ERL_NIF_TERM nif_fbink_canvas_put_pixels(ErlNifEnv *env, int argc,
+                                                 const ERL_NIF_TERM argv[]) {
     (void)argc;
-    int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    CanvasResource *c;
+    ErlNifBinary bin;
+    if (!get_canvas(env, argv[0], &c) ||
+        !enif_inspect_binary(env, argv[2], &bin))
         return enif_make_badarg(env);
 
     FBInkRect rect;
     map_to_fbink_rect(env, argv[1], &rect);
+    unsigned int sn;
+    if (enif_is_identical(argv[3], atom_y8))
+        sn = 1;
+    else if (enif_is_identical(argv[3], atom_rgb))
+        sn = 3;
+    else if (enif_is_identical(argv[3], atom_rgba))
+        sn = 4;
+    else if (enif_is_identical(argv[3], atom_native))
+        sn = 0;
+    else
+        return enif_make_badarg(env);
 
-    DumpResource *res = enif_alloc_resource(dump_resource_type, sizeof(DumpResource));
-    if (!res) return make_error_string(env, "enomem");
-    memset(&res->dump, 0, sizeof(FBInkDump));
-
-    int rv = fbink_rect_dump(fbfd, &rect, &res->dump);
-    if (rv < 0) {
-        enif_release_resource(res);
-        return make_error_int(env, rv);
+    // The rect must lie in the canvas and match the data
+    IRect r = { rect.left, rect.top, rect.width, rect.height }, in;
+    size_t row_in = sn ? (size_t)rect.width * sn : ((size_t)rect.width * c->dump.bpp + 7) / 8;
+    if (!canvas_clip(c, r, &in) || in.width != r.width || in.height != r.height ||
+        bin.size != row_in * rect.height)
+        return make_error_string(env, "einval");
+
+    uint8_t *scratch = NULL;
+    if (sn && c->dump.bpp == 4 && !(scratch = enif_alloc(rect.width)))
+        return make_error_string(env, "enomem");
+
+    enif_mutex_lock(c->lock);
+    if (!sn) {
+        canvas_copy(c, r, bin.data, row_in, 0);
+    } else {
+        for (int j = 0; j < r.height; j++)
+            canvas_pack_row(c, bin.data + (size_t)j * row_in, sn, r.left, r.top + j,
+                            (unsigned int)r.width, scratch);
     }
+    canvas_mark(c, r);
+    enif_mutex_unlock(c->lock);
 
-    ERL_NIF_TERM res_term = enif_make_resource(env, res);
-    enif_release_resource(res);
-    return make_ok(env, res_term);
+    if (scratch) enif_free(scratch);
+    return atom_ok;
 }
 
-// ============================================================================
-// NIF: fbink_restore/2
-// ============================================================================
+static ERL_NIF_TERM nif_fbink_canvas_blit(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    CanvasResource *c;
+    ImageResource *img;
+    DumpResource *res = NULL;
+    int x, y;
+    if (!get_canvas(env, argv[0], &c) ||
+        !enif_get_int(env, argv[2], &x) ||
+        !enif_get_int(env, argv[3], &y))
+        return enif_make_badarg(env);
 
-static ERL_NIF_TERM nif_fbink_restore(ErlNifEnv *env, int argc,
-                                       const ERL_NIF_TERM argv[]) {
+    // An image resource, or a dump (unpacked first if compressed)
+    const FBInkDump *d;
+    const uint8_t *pixels;
+    uint8_t *owned = NULL;
+    if (enif_get_resource(env, argv[1], image_resource_type, (void **)&img)) {
+        d = &img->dump;
+        pixels = d->data;
+    } else if (enif_get_resource(env, argv[1], dump_resource_type, (void **)&res)) {
+        enif_rwlock_rlock(res->lock);
+        d = &res->dump;
+        pixels = dump_pixels(res, &owned);
+    } else {
+        return enif_make_badarg(env);
+    }
+
+    const char *reason = NULL;
+    IRect r;
+    if (!pixels)
+        reason = res && res->packed ? "enomem" : "no_data";
+    else if (d->bpp != c->dump.bpp)
+        reason = "mismatch";
+    else if (canvas_clip(c, (IRect){ x, y, d->area.width, d->area.height }, &r)) {
+        enif_mutex_lock(c->lock);
+        canvas_copy(c, r, pixels + (size_t)(r.top - y) * d->stride, d->stride,
+                    (unsigned int)(r.left - x));
+        canvas_mark(c, r);
+        enif_mutex_unlock(c->lock);
+    }
+
+    if (owned) enif_free(owned);
+    if (res) enif_rwlock_runlock(res->lock);
+    return reason ? make_error_string(env, reason) : atom_ok;
+}
+
+// The last argument is :dirty, :all or a rect (native space)
+static ERL_NIF_TERM nif_fbink_commit(ErlNifEnv *env, int argc,
+                                      const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    FBHandle *fb;
+    CanvasResource *c;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !get_canvas(env, argv[1], &c))
         return enif_make_badarg(env);
 
     FBInkConfig cfg;
-    map_to_fbink_config(env, argv[1], &cfg);
+    map_to_fbink_config(env, argv[2], &cfg);
+    bool deferred = wfm_defer(&cfg);
+    bool dirty = enif_is_identical(argv[3], atom_dirty);
+    bool all = enif_is_identical(argv[3], atom_all);
+    FBInkRect area = { 0 };
+    if (!dirty && !all)
+        map_to_fbink_rect(env, argv[3], &area);
+    if (!canvas_matches(c))
+        return make_error_string(env, "mismatch");
+
+    FBInkConfig quiet = cfg;
+    quiet.no_refresh = true;
+
+    enif_mutex_lock(c->lock);
+    FBInkRect rects[CANVAS_MAX_DIRTY];
+    int n = 0;
+    IRect r;
+    if (dirty) {
+        n = c->ndirty;
+        memcpy(rects, c->dirty, (size_t)n * sizeof(FBInkRect));
+    } else if (all) {
+        rects[n++] = (FBInkRect){ 0, 0, c->dump.area.width, c->dump.area.height };
+    } else if (canvas_clip(c, (IRect){ area.left, area.top, area.width, area.height }, &r)) {
+        rects[n++] = canvas_restore_rect(c, r);
+    }
 
-    DumpResource *res;
-    if (!enif_get_resource(env, argv[2], dump_resource_type, (void **)&res))
-        return enif_make_badarg(env);
+    int rv = 0;
+    FBInkRect damage = { 0 };
+    for (int i = 0; i < n && rv >= 0; i++) {
+        FBInkDump view = c->dump;
+        view.clip = rects[i];
+        rv = fbink_restore(fbfd, &quiet, &view);
+        FBInkRect last = fbink_get_last_rect(false);
+        if (rv >= 0) rect_union(&damage, &last);
+    }
+
+    // Forget the dirty rects that are on screen now
+    if (rv >= 0 && (dirty || all)) {
+        c->ndirty = 0;
+    } else if (rv >= 0 && n) {
+        for (int i = 0; i < c->ndirty; i++) {
+            FBInkRect in;
+            if (rect_intersect(&c->dirty[i], &rects[0], &in) &&
+                in.width == c->dirty[i].width && in.height == c->dirty[i].height)
+                c->dirty[i--] = c->dirty[--c->ndirty];
+        }
+    }
+    enif_mutex_unlock(c->lock);
 
-    int rv = fbink_restore(fbfd, &cfg, &res->dump);
+    if (rv >= 0) rv = bands_done(fb, fbfd, &cfg, &damage, deferred);
     return make_ok_or_error(env, rv);
 }
 
+static ERL_NIF_TERM nif_fbink_canvas_info(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    CanvasResource *c;
+    if (!get_canvas(env, argv[0], &c))
+        return enif_make_badarg(env);
+
+    enif_mutex_lock(c->lock);
+    ERL_NIF_TERM dirty = enif_make_list(env, 0);
+    for (int i = c->ndirty - 1; i >= 0; i--)
+        dirty = enif_make_list_cell(env, fbink_rect_to_map(env, &c->dirty[i]), dirty);
+    enif_mutex_unlock(c->lock);
+
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    enif_make_map_put(env, map, atom_area, fbink_rect_to_map(env, &c->dump.area), &map);
+    enif_make_map_put(env, map, atom_bpp, enif_make_uint(env, c->dump.bpp), &map);
+    enif_make_map_put(env, map, atom_dirty, dirty, &map);
+    return make_ok(env, map);
+}
+
 // ============================================================================
 // NIF: fbink_free_dump_data/1
 // ============================================================================
@@ -1260,30 +6688,54 @@ static ERL_NIF_TERM nif_fbink_free_dump_data(ErlNifEnv *env, int argc,
     if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
         return enif_make_badarg(env);
 
-    fbink_free_dump_data(&res->dump);
+    // Data handed out as resource binaries stays alive until the resource goes
+    enif_rwlock_rwlock(res->lock);
+    int expected = DUMP_OWNED;
+    if (atomic_compare_exchange_strong(&res->state, &expected, DUMP_FREED))
+        dump_release_storage(res);
+    enif_rwlock_rwunlock(res->lock);
     return atom_ok;
 }
 
 // ============================================================================
 // NIF: fbink_get_dump_data/1  (return dump pixel data as binary to Elixir)
 // ============================================================================
+//
+// Raw dumps are handed out zero-copy on the normal scheduler. Compressed ones
+// have to be decoded first (several MB for a full screen), so the call is
+// rescheduled on a dirty CPU scheduler when the dump is packed. The same goes
+// for get_dump_rect_data/2.
+
+static bool dump_is_packed(DumpResource *res) {
+    enif_rwlock_rlock(res->lock);
+    bool packed = res->packed != NULL;
+    enif_rwlock_runlock(res->lock);
+    return packed;
+}
 
-static ERL_NIF_TERM nif_fbink_get_dump_data(ErlNifEnv *env, int argc,
-                                              const ERL_NIF_TERM argv[]) {
-    (void)argc;
-    DumpResource *res;
-    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
-        return enif_make_badarg(env);
-
-    if (!res->dump.data || res->dump.size == 0)
-        return make_error_string(env, "no_data");
+static ERL_NIF_TERM dump_data(ErlNifEnv *env, DumpResource *res) {
+    ERL_NIF_TERM data_bin;
+    enif_rwlock_rlock(res->lock);
+    if (res->packed) {
+        // Compressed dumps hand out a decoded copy and stay compressed
+        ErlNifBinary bin;
+        bool ok = enif_alloc_binary(res->dump.size, &bin);
+        if (ok && !dump_unpack(res, bin.data)) {
+            enif_release_binary(&bin);
+            ok = false;
+        }
+        enif_rwlock_runlock(res->lock);
+        if (!ok) return make_error_string(env, "enomem");
+        data_bin = enif_make_binary(env, &bin);
+    } else {
+        bool ok = dump_export(res) && res->dump.data && res->dump.size > 0;
+        enif_rwlock_runlock(res->lock);
+        if (!ok) return make_error_string(env, "no_data");
+        // Zero-copy: the binary points into the dump and keeps the resource alive
+        data_bin = enif_make_resource_binary(env, res, res->dump.data, res->dump.size);
+    }
 
     ERL_NIF_TERM map = enif_make_new_map(env);
-
-    // Copy pixel data into an Erlang binary
-    ERL_NIF_TERM data_bin;
-    unsigned char *buf = enif_make_new_binary(env, res->dump.size, &data_bin);
-    memcpy(buf, res->dump.data, res->dump.size);
     enif_make_map_put(env, map, atom_data, data_bin, &map);
 
     enif_make_map_put(env, map, atom_stride,
@@ -1301,7 +6753,103 @@ static ERL_NIF_TERM nif_fbink_get_dump_data(ErlNifEnv *env, int argc,
     enif_make_map_put(env, map, atom_is_full,
         res->dump.is_full ? atom_true : atom_false, &map);
 
-    return make_ok(env, map);
+    return make_ok(env, map);
+}
+
+static ERL_NIF_TERM nif_fbink_get_dump_data_dirty(ErlNifEnv *env, int argc,
+                                                    const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    DumpResource *res;
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
+        return enif_make_badarg(env);
+    return dump_data(env, res);
+}
+
+static ERL_NIF_TERM nif_fbink_get_dump_data(ErlNifEnv *env, int argc,
+                                              const ERL_NIF_TERM argv[]) {
+    DumpResource *res;
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
+        return enif_make_badarg(env);
+    if (dump_is_packed(res))
+        return enif_schedule_nif(env, "nif_get_dump_data", ERL_NIF_DIRTY_JOB_CPU_BOUND,
+                                 nif_fbink_get_dump_data_dirty, argc, argv);
+    return dump_data(env, res);
+}
+
+// ============================================================================
+// NIF: get_dump_rect_data/2  (rows of a rect inside a dump, zero-copy)
+// ============================================================================
+
+static ERL_NIF_TERM dump_rect_data(ErlNifEnv *env, DumpResource *res, ERL_NIF_TERM rect_term) {
+    // Rect is relative to the dump's area, in its (native) orientation
+    FBInkRect rect;
+    map_to_fbink_rect(env, rect_term, &rect);
+
+    const FBInkDump *d = &res->dump;
+    if ((unsigned int)rect.left + rect.width > d->area.width ||
+        (unsigned int)rect.top + rect.height > d->area.height ||
+        ((size_t)rect.left * d->bpp) % 8 != 0 || ((size_t)rect.width * d->bpp) % 8 != 0)
+        return make_error_string(env, "einval");
+
+    size_t x_off = (size_t)rect.left * d->bpp / 8;
+    size_t row_len = (size_t)rect.width * d->bpp / 8;
+
+    enif_rwlock_rlock(res->lock);
+    if (res->packed) {
+        // Decode the rows up to the rect into one fresh binary and slice that
+        size_t rows = (size_t)rect.top + rect.height;
+        ErlNifBinary bin;
+        const uint8_t *p = res->packed;
+        bool ok = enif_alloc_binary(rows * d->stride, &bin);
+        if (ok && !rle_decode_rows(&p, res->packed + res->packed_size, d->stride, rows,
+                                   rle_unit(d->bpp), bin.data)) {
+            enif_release_binary(&bin);
+            ok = false;
+        }
+        enif_rwlock_runlock(res->lock);
+        if (!ok) return make_error_string(env, "enomem");
+
+        ERL_NIF_TERM whole = enif_make_binary(env, &bin);
+        ERL_NIF_TERM list = enif_make_list(env, 0);
+        for (int y = (int)rows - 1; y >= (int)rect.top; y--)
+            list = enif_make_list_cell(env, enif_make_sub_binary(env, whole,
+                (size_t)y * d->stride + x_off, row_len), list);
+        return make_ok(env, list);
+    }
+
+    bool ok = dump_export(res) && d->data && d->size > 0;
+    enif_rwlock_runlock(res->lock);
+    if (!ok) return make_error_string(env, "no_data");
+
+    ERL_NIF_TERM whole = enif_make_resource_binary(env, res, d->data, d->size);
+
+    ERL_NIF_TERM rows = enif_make_list(env, 0);
+    for (int y = (int)rect.top + rect.height - 1; y >= (int)rect.top; y--) {
+        ERL_NIF_TERM row = enif_make_sub_binary(env, whole,
+            (size_t)y * d->stride + x_off, row_len);
+        rows = enif_make_list_cell(env, row, rows);
+    }
+    return make_ok(env, rows);
+}
+
+static ERL_NIF_TERM nif_fbink_get_dump_rect_data_dirty(ErlNifEnv *env, int argc,
+                                                         const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    DumpResource *res;
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
+        return enif_make_badarg(env);
+    return dump_rect_data(env, res, argv[1]);
+}
+
+static ERL_NIF_TERM nif_fbink_get_dump_rect_data(ErlNifEnv *env, int argc,
+                                                   const ERL_NIF_TERM argv[]) {
+    DumpResource *res;
+    if (!enif_get_resource(env, argv[0], dump_resource_type, (void **)&res))
+        return enif_make_badarg(env);
+    if (dump_is_packed(res))
+        return enif_schedule_nif(env, "nif_get_dump_rect_data", ERL_NIF_DIRTY_JOB_CPU_BOUND,
+                                 nif_fbink_get_dump_rect_data_dirty, argc, argv);
+    return dump_rect_data(env, res, argv[1]);
 }
 
 // ============================================================================
@@ -1312,25 +6860,32 @@ static ERL_NIF_TERM nif_fbink_invert_screen(ErlNifEnv *env, int argc,
                                               const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    if (!get_fbfd(env, argv[0], &fbfd))
         return enif_make_badarg(env);
 
     FBInkConfig cfg;
     map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
 
     int rv = fbink_invert_screen(fbfd, &cfg);
+    if (deferred && rv >= 0) {
+        RefreshGroup g = { .cfg = cfg, .damage = full_screen_rect(&cfg) };
+        g.cfg.no_refresh = false;
+        refresh_group(fbfd, &g);
+    }
     return make_ok_or_error(env, rv);
 }
 
 // ============================================================================
-// NIF: fbink_invert_rect/3
+// NIF: fbink_invert_rect/4
 // ============================================================================
 
 static ERL_NIF_TERM nif_fbink_invert_rect(ErlNifEnv *env, int argc,
                                             const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
         return enif_make_badarg(env);
 
     FBInkRect rect;
@@ -1340,7 +6895,17 @@ static ERL_NIF_TERM nif_fbink_invert_rect(ErlNifEnv *env, int argc,
     if (!enif_get_int(env, argv[2], &no_rota))
         return enif_make_badarg(env);
 
+    // Only used to key the damage: invert_rect itself never refreshes
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[3], &cfg);
+
     int rv = fbink_invert_rect(fbfd, &rect, no_rota != 0);
+    if (rv >= 0) {
+        // The rect FBInk actually inverted, in canonical space even if the
+        // caller's was native (no_rota)
+        FBInkRect last = fbink_get_last_rect(false);
+        damage_record(fb, fbfd, &cfg, &last);
+    }
     return make_ok_or_error(env, rv);
 }
 
@@ -1383,7 +6948,7 @@ static ERL_NIF_TERM nif_fbink_set_fb_info(ErlNifEnv *env, int argc,
     (void)argc;
     int fbfd;
     unsigned int rota, bpp_val, grayscale;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_uint(env, argv[1], &rota) ||
         !enif_get_uint(env, argv[2], &bpp_val) ||
         !enif_get_uint(env, argv[3], &grayscale))
@@ -1391,6 +6956,7 @@ static ERL_NIF_TERM nif_fbink_set_fb_info(ErlNifEnv *env, int argc,
 
     FBInkConfig cfg;
     map_to_fbink_config(env, argv[4], &cfg);
+    wfm_no_auto(&cfg);
 
     int rv = fbink_set_fb_info(fbfd, rota, (uint8_t)bpp_val, (uint8_t)grayscale, &cfg);
     return make_ok_or_error(env, rv);
@@ -1404,11 +6970,13 @@ static ERL_NIF_TERM nif_fbink_fill_rect_gray(ErlNifEnv *env, int argc,
                                                const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
         return enif_make_badarg(env);
 
     FBInkConfig cfg;
     map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
 
     FBInkRect rect;
     map_to_fbink_rect(env, argv[2], &rect);
@@ -1420,6 +6988,7 @@ static ERL_NIF_TERM nif_fbink_fill_rect_gray(ErlNifEnv *env, int argc,
         return enif_make_badarg(env);
 
     int rv = fbink_fill_rect_gray(fbfd, &cfg, &rect, no_rota != 0, (uint8_t)y);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
     return make_ok_or_error(env, rv);
 }
 
@@ -1431,11 +7000,13 @@ static ERL_NIF_TERM nif_fbink_fill_rect_rgba(ErlNifEnv *env, int argc,
                                                const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    FBHandle *fb;
+    if (!get_fb(env, argv[0], &fbfd, &fb))
         return enif_make_badarg(env);
 
     FBInkConfig cfg;
     map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
 
     FBInkRect rect;
     map_to_fbink_rect(env, argv[2], &rect);
@@ -1451,9 +7022,136 @@ static ERL_NIF_TERM nif_fbink_fill_rect_rgba(ErlNifEnv *env, int argc,
 
     int rv = fbink_fill_rect_rgba(fbfd, &cfg, &rect, no_rota != 0,
                                   (uint8_t)r, (uint8_t)g, (uint8_t)b, (uint8_t)a);
+    draw_done(fb, fbfd, &cfg, rv, deferred);
     return make_ok_or_error(env, rv);
 }
 
+// ============================================================================
+// NIF: fill_rects/6  (many fills, one refresh)
+// ============================================================================
+
+typedef struct {
+    FBInkRect rect;
+    uint8_t color[4];
+    bool rgba;
+} RectFill;
+
+// Fills are painted in list order, so later ones win where they overlap;
+// only their damage is sorted, so refreshes go out top to bottom
+static int damage_order(const void *a, const void *b) {
+    const FBInkRect *ra = &((const RefreshGroup *)a)->damage;
+    const FBInkRect *rb = &((const RefreshGroup *)b)->damage;
+    if (ra->top != rb->top) return ra->top < rb->top ? -1 : 1;
+    return ra->left < rb->left ? -1 : ra->left > rb->left;
+}
+
+static bool decode_fill(ErlNifEnv *env, ERL_NIF_TERM term, RectFill *f) {
+    int arity;
+    const ERL_NIF_TERM *el, *c;
+    if (!enif_get_tuple(env, term, &arity, &el) || arity != 2)
+        return false;
+    map_to_fbink_rect(env, el[0], &f->rect);
+    if (get_u8(env, el[1], &f->color[0])) {
+        f->rgba = false;
+        return true;
+    }
+    f->rgba = true;
+    return enif_get_tuple(env, el[1], &arity, &c) && arity == 4 &&
+           get_u8(env, c[0], &f->color[0]) && get_u8(env, c[1], &f->color[1]) &&
+           get_u8(env, c[2], &f->color[2]) && get_u8(env, c[3], &f->color[3]);
+}
+
+static ERL_NIF_TERM nif_fbink_fill_rects(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    bool no_rota, merge;
+    ErlNifUInt64 overhead;
+    if (!get_fb(env, argv[0], &fbfd, &fb) || !get_flag(env, argv[3], &no_rota) ||
+        !get_flag(env, argv[4], &merge) || !enif_get_uint64(env, argv[5], &overhead))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[1], &cfg);
+    bool deferred = wfm_defer(&cfg);
+    bool want_refresh = deferred || !cfg.no_refresh;
+
+    // Fills come as a list of {rect, color}, or packed 9-byte
+    // <<x::16, y::16, w::16, h::16, gray::8>> records
+    ErlNifBinary bin;
+    unsigned int n;
+    bool packed = enif_inspect_binary(env, argv[2], &bin);
+    if (packed) {
+        if (bin.size % 9 != 0) return enif_make_badarg(env);
+        n = (unsigned int)(bin.size / 9);
+    } else if (!enif_get_list_length(env, argv[2], &n)) {
+        return enif_make_badarg(env);
+    }
+    if (n == 0) return make_ok(env, enif_make_int(env, 0));
+
+    RectFill *fills = enif_alloc(n * sizeof(RectFill));
+    RefreshGroup *damage = enif_alloc(n * sizeof(RefreshGroup));
+    if (!fills || !damage) {
+        if (fills) enif_free(fills);
+        if (damage) enif_free(damage);
+        return make_error_string(env, "enomem");
+    }
+    ERL_NIF_TERM list = argv[2], head;
+    for (unsigned int i = 0; i < n; i++) {
+        RectFill *f = &fills[i];
+        if (packed) {
+            const uint8_t *p = bin.data + (size_t)i * 9;
+            f->rect.left = (unsigned short int)(p[0] << 8 | p[1]);
+            f->rect.top = (unsigned short int)(p[2] << 8 | p[3]);
+            f->rect.width = (unsigned short int)(p[4] << 8 | p[5]);
+            f->rect.height = (unsigned short int)(p[6] << 8 | p[7]);
+            f->color[0] = p[8];
+            f->rgba = false;
+        } else if (!enif_get_list_cell(env, list, &head, &list) || !decode_fill(env, head, f)) {
+            enif_free(fills);
+            enif_free(damage);
+            return enif_make_badarg(env);
+        }
+    }
+
+    FBInkConfig quiet = cfg;
+    quiet.no_refresh = true;
+    int rv = 0, nd = 0;
+    for (unsigned int i = 0; i < n && rv >= 0; i++) {
+        const RectFill *f = &fills[i];
+        if (rect_is_empty(&f->rect)) continue;
+        rv = f->rgba ? fbink_fill_rect_rgba(fbfd, &quiet, &f->rect, no_rota, f->color[0],
+                                            f->color[1], f->color[2], f->color[3])
+                     : fbink_fill_rect_gray(fbfd, &quiet, &f->rect, no_rota, f->color[0]);
+        if (rv < 0) break;
+        memset(&damage[nd], 0, sizeof(RefreshGroup));
+        damage[nd].cfg = cfg;
+        damage[nd].cfg.no_refresh = false;
+        damage[nd].damage = fbink_get_last_rect(false);
+        nd++;
+    }
+    enif_free(fills);
+
+    if (rv >= 0 && nd > 0) {
+        if (merge && nd <= MAX_DIFF_RECTS) {
+            nd = damage_merge(damage, nd, overhead);
+        } else {
+            for (int i = 1; i < nd; i++) rect_union(&damage[0].damage, &damage[i].damage);
+            nd = 1;
+        }
+        qsort(damage, (size_t)nd, sizeof(RefreshGroup), damage_order);
+        for (int i = 0; i < nd && rv >= 0; i++) {
+            if (want_refresh)
+                rv = refresh_group(fbfd, &damage[i]);
+            else if (fb)
+                damage_record(fb, fbfd, &cfg, &damage[i].damage);
+        }
+    }
+    enif_free(damage);
+    return make_ok_or_error(env, rv < 0 ? rv : nd);
+}
+
 // ============================================================================
 // NIF: fbink_put_pixel_gray/3
 // ============================================================================
@@ -1463,7 +7161,7 @@ static ERL_NIF_TERM nif_fbink_put_pixel_gray(ErlNifEnv *env, int argc,
     (void)argc;
     int fbfd;
     unsigned int x, y, v;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_uint(env, argv[1], &x) ||
         !enif_get_uint(env, argv[2], &y) ||
         !enif_get_uint(env, argv[3], &v))
@@ -1482,7 +7180,7 @@ static ERL_NIF_TERM nif_fbink_put_pixel_rgba(ErlNifEnv *env, int argc,
     (void)argc;
     int fbfd;
     unsigned int x, y, r, g, b, a;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_uint(env, argv[1], &x) ||
         !enif_get_uint(env, argv[2], &y) ||
         !enif_get_uint(env, argv[3], &r) ||
@@ -1496,6 +7194,643 @@ static ERL_NIF_TERM nif_fbink_put_pixel_rgba(ErlNifEnv *env, int argc,
     return make_ok_or_error(env, rv);
 }
 
+// ============================================================================
+// Vector shapes
+// ============================================================================
+//
+// Shapes are rasterized into an 8-bit coverage mask over their combined
+// bounding box, which is then drawn in one go as a gray + alpha buffer through
+// fbink_print_raw_data. FBInk's alpha blending leaves uncovered pixels alone
+// and smooths anti-aliased edges, and its raw data path already deals with
+// rotation, pixel formats, is_inverted and night mode.
+
+typedef enum {
+    SHAPE_LINE,
+    SHAPE_AA_LINE,
+    SHAPE_POLYLINE,
+    SHAPE_AA_POLYLINE,
+    SHAPE_POLYGON,
+    SHAPE_FILL_POLYGON,
+    SHAPE_CIRCLE,
+    SHAPE_FILL_CIRCLE,
+    SHAPE_ARC,
+    SHAPE_ROUNDED_RECT,
+    SHAPE_FILL_ROUNDED_RECT,
+} ShapeType;
+
+typedef struct {
+    ShapeType type;
+    int v[5];                   // Coordinates, sizes, radius, angles
+    const uint8_t *pts;         // Packed <<x::16, y::16>> points
+    size_t npts;
+} Shape;
+
+typedef struct {
+    int left, top, width, height;
+    uint8_t *cov;
+} CoverageMask;
+
+static bool decode_shape(ErlNifEnv *env, ERL_NIF_TERM term, Shape *sh) {
+    static const struct {
+        ERL_NIF_TERM *tag;
+        ShapeType type;
+        int nints;              // Integer arguments, or -1 for a points binary
+    } kinds[] = {
+        { &atom_line,              SHAPE_LINE,              4 },
+        { &atom_aa_line,           SHAPE_AA_LINE,           4 },
+        { &atom_polyline,          SHAPE_POLYLINE,          -1 },
+        { &atom_aa_polyline,       SHAPE_AA_POLYLINE,       -1 },
+        { &atom_polygon,           SHAPE_POLYGON,           -1 },
+        { &atom_fill_polygon,      SHAPE_FILL_POLYGON,      -1 },
+        { &atom_circle,            SHAPE_CIRCLE,            3 },
+        { &atom_fill_circle,       SHAPE_FILL_CIRCLE,       3 },
+        { &atom_arc,               SHAPE_ARC,               5 },
+        { &atom_rounded_rect,      SHAPE_ROUNDED_RECT,      5 },
+        { &atom_fill_rounded_rect, SHAPE_FILL_ROUNDED_RECT, 5 },
+    };
+    int arity;
+    const ERL_NIF_TERM *el;
+    memset(sh, 0, sizeof(Shape));
+    if (!enif_get_tuple(env, term, &arity, &el) || arity < 2)
+        return false;
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        if (!enif_is_identical(el[0], *kinds[k].tag)) continue;
+        sh->type = kinds[k].type;
+        if (kinds[k].nints < 0) {
+            ErlNifBinary bin;
+            if (arity != 2 || !enif_inspect_binary(env, el[1], &bin) ||
+                bin.size == 0 || bin.size % 4 != 0)
+                return false;
+            sh->pts = bin.data;
+            sh->npts = bin.size / 4;
+            return true;
+        }
+        if (arity != kinds[k].nints + 1) return false;
+        for (int i = 0; i < kinds[k].nints; i++) {
+            if (!enif_get_int(env, el[i + 1], &sh->v[i]) ||
+                sh->v[i] < SHRT_MIN || sh->v[i] > SHRT_MAX)
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+static inline void shape_point(const Shape *sh, size_t i, int *x, int *y) {
+    const uint8_t *p = sh->pts + i * 4;
+    *x = p[0] << 8 | p[1];
+    *y = p[2] << 8 | p[3];
+}
+
+// Inclusive pixel bounds of a shape; false if it covers nothing
+static bool shape_bounds(const Shape *sh, int *x0, int *y0, int *x1, int *y1) {
+    const int *v = sh->v;
+    switch (sh->type) {
+    case SHAPE_LINE:
+    case SHAPE_AA_LINE:
+        *x0 = v[0] < v[2] ? v[0] : v[2];
+        *x1 = v[0] < v[2] ? v[2] : v[0];
+        *y0 = v[1] < v[3] ? v[1] : v[3];
+        *y1 = v[1] < v[3] ? v[3] : v[1];
+        return true;
+    case SHAPE_CIRCLE:
+    case SHAPE_FILL_CIRCLE:
+    case SHAPE_ARC:
+        if (v[2] < 0) return false;
+        *x0 = v[0] - v[2];
+        *x1 = v[0] + v[2];
+        *y0 = v[1] - v[2];
+        *y1 = v[1] + v[2];
+        return true;
+    case SHAPE_ROUNDED_RECT:
+    case SHAPE_FILL_ROUNDED_RECT:
+        if (v[2] <= 0 || v[3] <= 0) return false;
+        *x0 = v[0];
+        *y0 = v[1];
+        *x1 = v[0] + v[2] - 1;
+        *y1 = v[1] + v[3] - 1;
+        return true;
+    default:
+        *x0 = *y0 = INT_MAX;
+        *x1 = *y1 = INT_MIN;
+        for (size_t i = 0; i < sh->npts; i++) {
+            int x, y;
+            shape_point(sh, i, &x, &y);
+            if (x < *x0) *x0 = x;
+            if (x > *x1) *x1 = x;
+            if (y < *y0) *y0 = y;
+            if (y > *y1) *y1 = y;
+        }
+        return true;
+    }
+}
+
+static inline void mask_plot(CoverageMask *m, int x, int y, unsigned int c) {
+    x -= m->left;
+    y -= m->top;
+    if ((unsigned int)x >= (unsigned int)m->width || (unsigned int)y >= (unsigned int)m->height)
+        return;
+    uint8_t *p = &m->cov[(size_t)y * m->width + x];
+    if (c > *p) *p = (uint8_t)c;
+}
+
+// Fully cover pixels x0..x1 (inclusive) of row y
+static void mask_span(CoverageMask *m, int x0, int x1, int y) {
+    y -= m->top;
+    if ((unsigned int)y >= (unsigned int)m->height) return;
+    x0 -= m->left;
+    x1 -= m->left;
+    if (x0 < 0) x0 = 0;
+    if (x1 >= m->width) x1 = m->width - 1;
+    if (x0 > x1) return;
+    memset(&m->cov[(size_t)y * m->width + x0], 0xFF, (size_t)(x1 - x0 + 1));
+}
+
+// Bresenham
+static void raster_line(CoverageMask *m, int x0, int y0, int x1, int y1) {
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    for (;;) {
+        mask_plot(m, x0, y0, 0xFF);
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+// Xiaolin Wu: coverage split between the two pixels straddling the line
+static void raster_aa_line(CoverageMask *m, int x0, int y0, int x1, int y1) {
+    bool steep = abs(y1 - y0) > abs(x1 - x0);
+    int t;
+    if (steep) {
+        t = x0; x0 = y0; y0 = t;
+        t = x1; x1 = y1; y1 = t;
+    }
+    if (x0 > x1) {
+        t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+    double grad = x1 == x0 ? 0.0 : (double)(y1 - y0) / (x1 - x0);
+    double y = y0;
+    for (int x = x0; x <= x1; x++, y += grad) {
+        int yi = (int)floor(y);
+        double f = y - yi;
+        unsigned int c0 = (unsigned int)((1.0 - f) * 255.0 + 0.5);
+        unsigned int c1 = 255 - c0;
+        if (steep) {
+            mask_plot(m, yi, x, c0);
+            mask_plot(m, yi + 1, x, c1);
+        } else {
+            mask_plot(m, x, yi, c0);
+            mask_plot(m, x, yi + 1, c1);
+        }
+    }
+}
+
+static void raster_polyline(CoverageMask *m, const Shape *sh, bool aa, bool closed) {
+    int px, py, x, y;
+    shape_point(sh, 0, &px, &py);
+    if (sh->npts == 1) mask_plot(m, px, py, 0xFF);
+    for (size_t i = 1; i <= sh->npts; i++) {
+        if (i == sh->npts && !closed) break;
+        shape_point(sh, i % sh->npts, &x, &y);
+        if (aa)
+            raster_aa_line(m, px, py, x, y);
+        else
+            raster_line(m, px, py, x, y);
+        px = x;
+        py = y;
+    }
+}
+
+// Midpoint circle of radius rad split around four corner centers (l, t) to
+// (r, b): a plain circle when they coincide, a rounded rect outline otherwise.
+// With an arc range, only points within [start, start + sweep] degrees
+// (counter-clockwise from 3 o'clock) are kept.
+static void raster_round_outline(CoverageMask *m, int l, int t, int r, int b, int rad,
+                                 double start, double sweep) {
+    int x = rad, y = 0, err = 1 - rad;
+    while (x >= y) {
+        const int pts[8][2] = {
+            { r + x, b + y }, { r + y, b + x }, { l - y, b + x }, { l - x, b + y },
+            { l - x, t - y }, { l - y, t - x }, { r + y, t - x }, { r + x, t - y },
+        };
+        for (int i = 0; i < 8; i++) {
+            if (sweep < 360.0) {
+                double a = atan2(-(double)(pts[i][1] - t), (double)(pts[i][0] - l)) * 180.0 / M_PI;
+                double d = fmod(a - start + 720.0, 360.0);
+                if (d > sweep) continue;
+            }
+            mask_plot(m, pts[i][0], pts[i][1], 0xFF);
+        }
+        y++;
+        if (err < 0) {
+            err += 2 * y + 1;
+        } else {
+            x--;
+            err += 2 * (y - x) + 1;
+        }
+    }
+    if (sweep < 360.0) return;
+    // Straight edges between the corners
+    for (int i = l + 1; i < r; i++) {
+        mask_plot(m, i, t - rad, 0xFF);
+        mask_plot(m, i, b + rad, 0xFF);
+    }
+    for (int i = t + 1; i < b; i++) {
+        mask_plot(m, l - rad, i, 0xFF);
+        mask_plot(m, r + rad, i, 0xFF);
+    }
+}
+
+// Filled counterpart of raster_round_outline
+static void raster_round_fill(CoverageMask *m, int l, int t, int r, int b, int rad) {
+    for (int dy = 0; dy <= rad; dy++) {
+        int dx = (int)floor(sqrt((double)rad * rad - (double)dy * dy) + 0.5);
+        mask_span(m, l - dx, r + dx, t - dy);
+        mask_span(m, l - dx, r + dx, b + dy);
+    }
+    for (int y = t + 1; y < b; y++)
+        mask_span(m, l - rad, r + rad, y);
+}
+
+// Even-odd scanline fill, sampling at pixel centers
+static bool raster_fill_polygon(CoverageMask *m, const Shape *sh) {
+    double *xs = enif_alloc(sh->npts * sizeof(double));
+    if (!xs) return false;
+    for (int y = m->top; y < m->top + m->height; y++) {
+        double sy = y + 0.5;
+        size_t k = 0;
+        for (size_t i = 0; i < sh->npts; i++) {
+            int xi, yi, xj, yj;
+            shape_point(sh, i, &xi, &yi);
+            shape_point(sh, (i + 1) % sh->npts, &xj, &yj);
+            if ((yi <= sy) == (yj <= sy)) continue;
+            double x = xi + (sy - yi) * (xj - xi) / (yj - yi);
+            size_t j = k++;
+            for (; j > 0 && xs[j - 1] > x; j--) xs[j] = xs[j - 1];
+            xs[j] = x;
+        }
+        for (size_t i = 0; i + 1 < k; i += 2)
+            mask_span(m, (int)ceil(xs[i] - 0.5), (int)floor(xs[i + 1] - 0.5), y);
+    }
+    enif_free(xs);
+    return true;
+}
+
+static bool raster_shape(CoverageMask *m, const Shape *sh) {
+    const int *v = sh->v;
+    switch (sh->type) {
+    case SHAPE_LINE:
+        raster_line(m, v[0], v[1], v[2], v[3]);
+        break;
+    case SHAPE_AA_LINE:
+        raster_aa_line(m, v[0], v[1], v[2], v[3]);
+        break;
+    case SHAPE_POLYLINE:
+    case SHAPE_AA_POLYLINE:
+    case SHAPE_POLYGON:
+        raster_polyline(m, sh, sh->type == SHAPE_AA_POLYLINE, sh->type == SHAPE_POLYGON);
+        break;
+    case SHAPE_FILL_POLYGON:
+        return raster_fill_polygon(m, sh);
+    case SHAPE_CIRCLE:
+        raster_round_outline(m, v[0], v[1], v[0], v[1], v[2], 0.0, 360.0);
+        break;
+    case SHAPE_FILL_CIRCLE:
+        raster_round_fill(m, v[0], v[1], v[0], v[1], v[2]);
+        break;
+    case SHAPE_ARC: {
+        double sweep = v[4] - v[3];
+        if (sweep < 360.0) sweep = fmod(sweep + 360.0 * 8, 360.0);
+        raster_round_outline(m, v[0], v[1], v[0], v[1], v[2], fmod(v[3] + 360.0 * 8, 360.0),
+                             sweep);
+        break;
+    }
+    case SHAPE_ROUNDED_RECT:
+    case SHAPE_FILL_ROUNDED_RECT: {
+        // Radius is capped so the corners never overlap
+        int rad = v[4] < 0 ? 0 : v[4];
+        if (rad > (v[2] - 1) / 2) rad = (v[2] - 1) / 2;
+        if (rad > (v[3] - 1) / 2) rad = (v[3] - 1) / 2;
+        int l = v[0] + rad, t = v[1] + rad;
+        int r = v[0] + v[2] - 1 - rad, b = v[1] + v[3] - 1 - rad;
+        if (sh->type == SHAPE_ROUNDED_RECT)
+            raster_round_outline(m, l, t, r, b, rad, 0.0, 360.0);
+        else
+            raster_round_fill(m, l, t, r, b, rad);
+        break;
+    }
+    }
+    return true;
+}
+
+// ============================================================================
+// NIF: draw_shapes/3
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_draw_shapes(ErlNifEnv *env, int argc,
+                                            const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    unsigned int n;
+    if (!get_fb(env, argv[0], &fbfd, &fb) || !enif_get_list_length(env, argv[1], &n))
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[2], &cfg);
+    bool deferred = wfm_defer(&cfg);
+    if (n == 0) return make_ok(env, enif_make_int(env, 0));
+
+    Shape *shapes = enif_alloc(n * sizeof(Shape));
+    if (!shapes) return make_error_string(env, "enomem");
+    ERL_NIF_TERM list = argv[1], head;
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    for (unsigned int i = 0; enif_get_list_cell(env, list, &head, &list); i++) {
+        int sx0, sy0, sx1, sy1;
+        if (!decode_shape(env, head, &shapes[i])) {
+            enif_free(shapes);
+            return enif_make_badarg(env);
+        }
+        if (!shape_bounds(&shapes[i], &sx0, &sy0, &sx1, &sy1)) continue;
+        if (sx0 < x0) x0 = sx0;
+        if (sy0 < y0) y0 = sy0;
+        if (sx1 > x1) x1 = sx1;
+        if (sy1 > y1) y1 = sy1;
+    }
+
+    // Only the on-screen part of the bounding box is rasterized
+    FBInkRect screen = full_screen_rect(&cfg);
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 >= screen.width) x1 = screen.width - 1;
+    if (y1 >= screen.height) y1 = screen.height - 1;
+    if (x0 > x1 || y0 > y1) {
+        enif_free(shapes);
+        return make_ok(env, enif_make_int(env, 0));
+    }
+
+    CoverageMask m = { x0, y0, x1 - x0 + 1, y1 - y0 + 1, NULL };
+    size_t px = (size_t)m.width * m.height;
+    m.cov = enif_alloc(px);
+    uint8_t *ya = enif_alloc(px * 2);
+    bool ok = m.cov && ya;
+    if (ok) memset(m.cov, 0, px);
+    for (unsigned int i = 0; i < n && ok; i++)
+        ok = raster_shape(&m, &shapes[i]);
+    enif_free(shapes);
+
+    int rv = -ENOMEM;
+    if (ok) {
+        // Foreground palette index to gray (FG_BLACK = 0 ... FG_WHITE = 15)
+        uint8_t fg = (uint8_t)((cfg.fg_color > 15 ? 15 : cfg.fg_color) * 0x11);
+        for (size_t i = 0; i < px; i++) {
+            ya[2 * i] = fg;
+            ya[2 * i + 1] = m.cov[i];
+        }
+        // Position comes from the bounding box alone; alpha must be honored
+        FBInkConfig draw = cfg;
+        draw.row = draw.col = 0;
+        draw.hoffset = draw.voffset = 0;
+        draw.halign = draw.valign = 0;
+        draw.scaled_width = draw.scaled_height = 0;
+        draw.ignore_alpha = false;
+        rv = fbink_print_raw_data(fbfd, ya, m.width, m.height, px * 2,
+                                  (short int)m.left, (short int)m.top, &draw);
+        draw_done(fb, fbfd, &draw, rv, deferred);
+    }
+    if (m.cov) enif_free(m.cov);
+    if (ya) enif_free(ya);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: get_pixels/3  (a whole rect in one call, converted in C)
+// ============================================================================
+//
+// Dumps are always in the framebuffer's native orientation. :y8 and :rgba
+// rows are rotated back into the canonical orientation the rect was given in,
+// so they round-trip through put_pixels/5; :native rows are left as dumped.
+
+// Copy native rows (ps bytes per pixel, nw wide) into canonical rows,
+// covering canonical area c
+static void rotate_to_canonical(const uint8_t *src, unsigned int nw, const FBInkRect *native,
+                                const IRect *c, int xform, int sw, int sh, size_t ps,
+                                uint8_t *dst) {
+    // Native offset of the area's first pixel, and of one step in x and in y
+    IRect o = irect_rotate((IRect){ c->left, c->top, 1, 1 }, xform, sw, sh);
+    IRect ox = irect_rotate((IRect){ c->left + 1, c->top, 1, 1 }, xform, sw, sh);
+    IRect oy = irect_rotate((IRect){ c->left, c->top + 1, 1, 1 }, xform, sw, sh);
+    ptrdiff_t row = (ptrdiff_t)nw * (ptrdiff_t)ps;
+    ptrdiff_t base = (ptrdiff_t)(o.top - native->top) * row + (ptrdiff_t)(o.left - native->left) * (ptrdiff_t)ps;
+    ptrdiff_t dx = (ptrdiff_t)(ox.top - o.top) * row + (ptrdiff_t)(ox.left - o.left) * (ptrdiff_t)ps;
+    ptrdiff_t dy = (ptrdiff_t)(oy.top - o.top) * row + (ptrdiff_t)(oy.left - o.left) * (ptrdiff_t)ps;
+
+    for (int y = 0; y < c->height; y++) {
+        const uint8_t *s = src + base + y * dy;
+        for (int x = 0; x < c->width; x++, s += dx, dst += ps)
+            memcpy(dst, s, ps);
+    }
+}
+
+static ERL_NIF_TERM nif_fbink_get_pixels(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    if (!get_fbfd(env, argv[0], &fbfd))
+        return enif_make_badarg(env);
+
+    FBInkRect rect;
+    map_to_fbink_rect(env, argv[1], &rect);
+    ERL_NIF_TERM fmt = argv[2];
+    if (!enif_is_identical(fmt, atom_y8) && !enif_is_identical(fmt, atom_rgba) &&
+        !enif_is_identical(fmt, atom_native))
+        return enif_make_badarg(env);
+
+    FBInkDump dump = { 0 };
+    int rv = fbink_rect_dump(fbfd, &rect, &dump);
+    if (rv < 0) return make_error_int(env, rv);
+
+    bool native = enif_is_identical(fmt, atom_native);
+    int xform = 0, sw = 0, sh = 0;
+    if (!native) {
+        FBInkConfig cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.is_quiet = true;
+        FBInkState state;
+        memset(&state, 0, sizeof(state));
+        fbink_get_state(&cfg, &state);
+        sw = (int)state.screen_width;
+        sh = (int)state.screen_height;
+        xform = screen_xform(fbfd, sw, sh);
+    }
+
+    unsigned int w = dump.area.width, h = dump.area.height;
+    size_t ps = enif_is_identical(fmt, atom_y8) ? 1 : 4;
+    size_t row_out = native ? ((size_t)w * dump.bpp + 7) / 8 : (size_t)w * ps;
+    ErlNifBinary bin;
+    if (!enif_alloc_binary(row_out * h, &bin)) {
+        fbink_free_dump_data(&dump);
+        return make_error_string(env, "enomem");
+    }
+    // Converted in native order first, then rotated in a second buffer
+    uint8_t *conv = xform ? enif_alloc(bin.size) : bin.data;
+    if (!conv) {
+        enif_release_binary(&bin);
+        fbink_free_dump_data(&dump);
+        return make_error_string(env, "enomem");
+    }
+    for (unsigned int y = 0; y < h; y++) {
+        const uint8_t *src = dump.data + (size_t)y * dump.stride;
+        uint8_t *dst = conv + (size_t)y * row_out;
+        if (native)
+            memcpy(dst, src, row_out);
+        else if (ps == 1)
+            row_to_y8(src, dump.bpp, w, dst);
+        else
+            row_to_rgba(src, dump.bpp, w, dst);
+    }
+
+    // The canonical area the native one came from
+    FBInkRect area = dump.area;
+    if (xform) {
+        int inv = (4 - xform) % 4;
+        IRect n = { area.left, area.top, area.width, area.height };
+        IRect c = irect_rotate(n, inv, xform % 2 ? sh : sw, xform % 2 ? sw : sh);
+        rotate_to_canonical(conv, w, &dump.area, &c, xform, sw, sh, ps, bin.data);
+        enif_free(conv);
+        area = (FBInkRect){ (unsigned short int)c.left, (unsigned short int)c.top,
+                            (unsigned short int)c.width, (unsigned short int)c.height };
+        w = area.width;
+        h = area.height;
+    }
+    fbink_free_dump_data(&dump);
+
+    ERL_NIF_TERM map = enif_make_new_map(env);
+    enif_make_map_put(env, map, atom_data, enif_make_binary(env, &bin), &map);
+    enif_make_map_put(env, map, atom_width, enif_make_uint(env, w), &map);
+    enif_make_map_put(env, map, atom_height, enif_make_uint(env, h), &map);
+    enif_make_map_put(env, map, atom_area, fbink_rect_to_map(env, &area), &map);
+    return make_ok(env, map);
+}
+
+// ============================================================================
+// NIF: put_pixels/5
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_put_pixels(ErlNifEnv *env, int argc,
+                                           const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    ErlNifBinary bin;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_inspect_binary(env, argv[2], &bin))
+        return enif_make_badarg(env);
+
+    FBInkRect rect;
+    map_to_fbink_rect(env, argv[1], &rect);
+    ERL_NIF_TERM fmt = argv[3];
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[4], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    size_t px = (size_t)rect.width * rect.height;
+    int rv;
+    if (enif_is_identical(fmt, atom_y8) || enif_is_identical(fmt, atom_rgba)) {
+        // FBInk converts (and rotates) Y8/RGBA buffers itself
+        if (bin.size != px * (enif_is_identical(fmt, atom_y8) ? 1 : 4))
+            return make_error_string(env, "einval");
+        rv = fbink_print_raw_data(fbfd, bin.data, rect.width, rect.height, bin.size,
+                                  (short int)rect.left, (short int)rect.top, &cfg);
+    } else if (enif_is_identical(fmt, atom_native)) {
+        // Native rows go straight in, at the native area get_pixels/3 reported
+        FBInkState state;
+        fbink_get_state(&cfg, &state);
+        size_t row_bytes = ((size_t)rect.width * state.bpp + 7) / 8;
+        if (state.bpp == 0 || bin.size != row_bytes * rect.height)
+            return make_error_string(env, "einval");
+        FBInkDump view = { 0 };
+        view.data = bin.data;
+        view.stride = row_bytes;
+        view.size = bin.size;
+        view.area = rect;
+        view.rota = state.current_rota;
+        view.bpp = (uint8_t)state.bpp;
+        rv = fbink_restore(fbfd, &cfg, &view);
+    } else {
+        return enif_make_badarg(env);
+    }
+    draw_done(fb, fbfd, &cfg, rv, deferred);
+    return make_ok_or_error(env, rv);
+}
+
+// ============================================================================
+// NIF: put_pixels_scatter/4  (packed {x, y, value} points)
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_put_pixels_scatter(ErlNifEnv *env, int argc,
+                                                   const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    int fbfd;
+    FBHandle *fb;
+    ErlNifBinary bin;
+    if (!get_fb(env, argv[0], &fbfd, &fb) ||
+        !enif_inspect_binary(env, argv[1], &bin))
+        return enif_make_badarg(env);
+
+    bool rgba;
+    if (enif_is_identical(argv[2], atom_gray))
+        rgba = false;
+    else if (enif_is_identical(argv[2], atom_rgba))
+        rgba = true;
+    else
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    map_to_fbink_config(env, argv[3], &cfg);
+    bool deferred = wfm_defer(&cfg);
+
+    // Big-endian 16-bit x and y, then one gray byte or four RGBA bytes
+    size_t rec = rgba ? 8 : 5;
+    if (bin.size % rec != 0)
+        return make_error_string(env, "einval");
+
+    FBInkRect bbox = { 0 };
+    int rv = 0;
+    for (const uint8_t *p = bin.data, *end = bin.data + bin.size; p < end; p += rec) {
+        uint16_t x = (uint16_t)(p[0] << 8 | p[1]);
+        uint16_t y = (uint16_t)(p[2] << 8 | p[3]);
+        rv = rgba ? fbink_put_pixel_rgba(fbfd, x, y, p[4], p[5], p[6], p[7])
+                  : fbink_put_pixel_gray(fbfd, x, y, p[4]);
+        if (rv < 0) break;
+        FBInkRect dot = { x, y, 1, 1 };
+        rect_union(&bbox, &dot);
+    }
+
+    // Pixels are plotted without refresh: refresh (or record) the bounding box
+    if (rv >= 0 && !rect_is_empty(&bbox)) {
+        if (deferred || !cfg.no_refresh) {
+            RefreshGroup g = { .cfg = cfg, .damage = bbox };
+            g.cfg.no_refresh = false;
+            rv = refresh_group(fbfd, &g);
+        } else if (fb) {
+            damage_record(fb, fbfd, &cfg, &bbox);
+        }
+    }
+    return make_ok_or_error(env, rv);
+}
+
 // ============================================================================
 // NIF: fbink_get_pixel/3
 // ============================================================================
@@ -1505,7 +7840,7 @@ static ERL_NIF_TERM nif_fbink_get_pixel(ErlNifEnv *env, int argc,
     (void)argc;
     int fbfd;
     unsigned int x, y;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_uint(env, argv[1], &x) ||
         !enif_get_uint(env, argv[2], &y))
         return enif_make_badarg(env);
@@ -1542,7 +7877,7 @@ static ERL_NIF_TERM nif_fbink_sunxi_toggle_ntx_pen_mode(ErlNifEnv *env, int argc
                                                            const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd, toggle;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_int(env, argv[1], &toggle))
         return enif_make_badarg(env);
 
@@ -1558,12 +7893,13 @@ static ERL_NIF_TERM nif_fbink_sunxi_ntx_enforce_rota(ErlNifEnv *env, int argc,
                                                         const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd, mode;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_int(env, argv[1], &mode))
         return enif_make_badarg(env);
 
     FBInkConfig cfg;
     map_to_fbink_config(env, argv[2], &cfg);
+    wfm_no_auto(&cfg);
 
     int rv = fbink_sunxi_ntx_enforce_rota(fbfd, (SUNXI_FORCE_ROTA_INDEX_T)mode, &cfg);
     return make_ok_or_error(env, rv);
@@ -1594,7 +7930,7 @@ static ERL_NIF_TERM nif_fbink_mtk_set_halftone(ErlNifEnv *env, int argc,
                                                   const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd;
-    if (!enif_get_int(env, argv[0], &fbfd))
+    if (!get_fbfd(env, argv[0], &fbfd))
         return enif_make_badarg(env);
 
     // Exclude regions: list of two rect maps (or nil)
@@ -1629,7 +7965,7 @@ static ERL_NIF_TERM nif_fbink_mtk_toggle_auto_reagl(ErlNifEnv *env, int argc,
                                                        const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd, toggle;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_int(env, argv[1], &toggle))
         return enif_make_badarg(env);
 
@@ -1645,7 +7981,7 @@ static ERL_NIF_TERM nif_fbink_mtk_toggle_pen_mode(ErlNifEnv *env, int argc,
                                                      const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd, toggle;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_int(env, argv[1], &toggle))
         return enif_make_badarg(env);
 
@@ -1756,7 +8092,7 @@ static ERL_NIF_TERM nif_fbink_button_scan(ErlNifEnv *env, int argc,
                                             const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd, press_button, nosleep;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_int(env, argv[1], &press_button) ||
         !enif_get_int(env, argv[2], &nosleep))
         return enif_make_badarg(env);
@@ -1773,7 +8109,7 @@ static ERL_NIF_TERM nif_fbink_wait_for_usbms_processing(ErlNifEnv *env, int argc
                                                            const ERL_NIF_TERM argv[]) {
     (void)argc;
     int fbfd, force_unplug;
-    if (!enif_get_int(env, argv[0], &fbfd) ||
+    if (!get_fbfd(env, argv[0], &fbfd) ||
         !enif_get_int(env, argv[1], &force_unplug))
         return enif_make_badarg(env);
 
@@ -1833,6 +8169,138 @@ static ERL_NIF_TERM nif_fbink_pack_pixel_rgba(ErlNifEnv *env, int argc,
     return make_ok(env, enif_make_uint(env, px));
 }
 
+// ============================================================================
+// NIF: pack_buffer/2
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_pack_buffer(ErlNifEnv *env, int argc,
+                                            const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    ErlNifBinary src;
+    unsigned int sn;
+    if (!enif_inspect_binary(env, argv[0], &src))
+        return enif_make_badarg(env);
+    if (enif_is_identical(argv[1], atom_y8))
+        sn = 1;
+    else if (enif_is_identical(argv[1], atom_rgb))
+        sn = 3;
+    else if (enif_is_identical(argv[1], atom_rgba))
+        sn = 4;
+    else
+        return enif_make_badarg(env);
+    if (src.size % sn != 0)
+        return enif_make_badarg(env);
+
+    FBInkConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.is_quiet = true;
+    FBInkState state;
+    memset(&state, 0, sizeof(state));
+    // Only the state read needs the lock; packing works on our own buffers
+    enif_mutex_lock(fbink_lock);
+    fbink_get_state(&cfg, &state);
+    enif_mutex_unlock(fbink_lock);
+
+    // 4bpp packs two pixels per byte, which needs the row width: not supported here
+    unsigned int dn = state.bpp / 8;
+    if (state.bpp != 8 && state.bpp != 16 && state.bpp != 24 && state.bpp != 32)
+        return make_error_string(env, "enotsup");
+
+    size_t n = src.size / sn;
+    ERL_NIF_TERM out_term;
+    uint8_t *out = enif_make_new_binary(env, n * dn, &out_term);
+    if (!out)
+        return make_error_string(env, "enomem");
+
+    switch (dn) {
+    case 1:
+        pack_to_y8(src.data, sn, n, out, state.inverted_grayscale);
+        break;
+    case 2:
+        pack_to_565(src.data, sn, n, out);
+        break;
+    default:
+        pack_to_bgra(src.data, sn, n, out, dn);
+        break;
+    }
+
+    return make_ok(env, out_term);
+}
+
+// ============================================================================
+// NIF: dither/5
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_dither(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    ErlNifBinary src;
+    int w;
+    unsigned int sn, levels;
+    DitherMethod method;
+    if (!enif_inspect_binary(env, argv[0], &src) || !enif_get_int(env, argv[1], &w) || w <= 0 ||
+        !get_dither(env, argv[3], argv[4], &method, &levels))
+        return enif_make_badarg(env);
+    if (enif_is_identical(argv[2], atom_y8))
+        sn = 1;
+    else if (enif_is_identical(argv[2], atom_rgb))
+        sn = 3;
+    else if (enif_is_identical(argv[2], atom_rgba))
+        sn = 4;
+    else
+        return enif_make_badarg(env);
+    size_t row = (size_t)w * sn;
+    if (src.size % row != 0)
+        return enif_make_badarg(env);
+
+    size_t h = src.size / row;
+    ErlNifBinary out;
+    if (!enif_alloc_binary((size_t)w * h, &out))
+        return make_error_string(env, "enomem");
+    pack_to_y8(src.data, sn, (size_t)w * h, out.data, false);
+    if (!dither_y8(out.data, (unsigned int)w, (unsigned int)h, method, levels)) {
+        enif_release_binary(&out);
+        return make_error_string(env, "enomem");
+    }
+    return make_ok(env, enif_make_binary(env, &out));
+}
+
+// ============================================================================
+// NIF: scale_buffer/7
+// ============================================================================
+
+static ERL_NIF_TERM nif_fbink_scale_buffer(ErlNifEnv *env, int argc,
+                                             const ERL_NIF_TERM argv[]) {
+    (void)argc;
+    ErlNifBinary src;
+    unsigned int w, dw, dh, ch, threads;
+    ScaleFilter filter;
+    if (!enif_inspect_binary(env, argv[0], &src) || !enif_get_uint(env, argv[1], &w) ||
+        !enif_get_uint(env, argv[2], &dw) || !enif_get_uint(env, argv[3], &dh) ||
+        !get_scale_filter(argv[5], &filter) || !enif_get_uint(env, argv[6], &threads) ||
+        w == 0 || dw == 0 || dh == 0 ||
+        dw > UINT16_MAX || dh > UINT16_MAX)
+        return enif_make_badarg(env);
+    if (enif_is_identical(argv[4], atom_y8))
+        ch = 1;
+    else if (enif_is_identical(argv[4], atom_rgba))
+        ch = 4;
+    else
+        return enif_make_badarg(env);
+    size_t row = (size_t)w * ch;
+    if (src.size == 0 || src.size % row != 0 || src.size / row > UINT16_MAX)
+        return enif_make_badarg(env);
+
+    ErlNifBinary out;
+    if (!enif_alloc_binary((size_t)dw * dh * ch, &out))
+        return make_error_string(env, "enomem");
+    if (!scale_image(src.data, w, (unsigned int)(src.size / row), out.data, dw, dh, ch, filter,
+                     threads)) {
+        enif_release_binary(&out);
+        return make_error_string(env, "enomem");
+    }
+    return make_ok(env, enif_make_binary(env, &out));
+}
+
 // ============================================================================
 // NIF Load callback
 // ============================================================================
@@ -1846,6 +8314,39 @@ static int load(ErlNifEnv *env, void **priv_data, ERL_NIF_TERM load_info) {
         dump_resource_dtor, ERL_NIF_RT_CREATE, NULL);
     if (!dump_resource_type) return -1;
 
+    // Create resource type for cached images
+    image_resource_type = enif_open_resource_type(env, NULL, "fbink_image",
+        image_resource_dtor, ERL_NIF_RT_CREATE, NULL);
+    if (!image_resource_type) return -1;
+
+    // Create resource type for off-screen canvases
+    canvas_resource_type = enif_open_resource_type(env, NULL, "fbink_canvas",
+        canvas_resource_dtor, ERL_NIF_RT_CREATE, NULL);
+    if (!canvas_resource_type) return -1;
+
+    // Create resource type for framebuffer handles
+    fb_resource_type = enif_open_resource_type(env, NULL, "fbink_fb",
+        fb_resource_dtor, ERL_NIF_RT_CREATE, NULL);
+    if (!fb_resource_type) return -1;
+
+    // Create resource types for precompiled configs (plain structs, no dtor)
+    config_resource_type = enif_open_resource_type(env, NULL, "fbink_config",
+        NULL, ERL_NIF_RT_CREATE, NULL);
+    ot_config_resource_type = enif_open_resource_type(env, NULL, "fbink_ot_config",
+        NULL, ERL_NIF_RT_CREATE, NULL);
+    rect_resource_type = enif_open_resource_type(env, NULL, "fbink_rect",
+        NULL, ERL_NIF_RT_CREATE, NULL);
+    if (!config_resource_type || !ot_config_resource_type || !rect_resource_type)
+        return -1;
+
+    // Create resource types for tile snapshot stores and their snapshots
+    snap_store_resource_type = enif_open_resource_type(env, NULL, "fbink_snap_store",
+        snap_store_resource_dtor, ERL_NIF_RT_CREATE, NULL);
+    snapshot_resource_type = enif_open_resource_type(env, NULL, "fbink_snapshot",
+        snapshot_resource_dtor, ERL_NIF_RT_CREATE, NULL);
+    if (!snap_store_resource_type || !snapshot_resource_type)
+        return -1;
+
     // Cache atoms
     atom_ok        = make_atom(env, "ok");
     atom_error     = make_atom(env, "error");
@@ -1975,6 +8476,42 @@ static int load(ErlNifEnv *env, void **priv_data, ERL_NIF_TERM load_info) {
     atom_clip    = make_atom(env, "clip");
     atom_rota    = make_atom(env, "rota");
     atom_is_full = make_atom(env, "is_full");
+    atom_raw_size = make_atom(env, "raw_size");
+    atom_stored_size = make_atom(env, "stored_size");
+    atom_compressed = make_atom(env, "compressed");
+    atom_tiles = make_atom(env, "tiles");
+    atom_bytes = make_atom(env, "bytes");
+    atom_exclusive_bytes = make_atom(env, "exclusive_bytes");
+    atom_tile_size = make_atom(env, "tile_size");
+    atom_y8 = make_atom(env, "y8");
+    atom_rgba = make_atom(env, "rgba");
+    atom_rgb = make_atom(env, "rgb");
+    atom_native = make_atom(env, "native");
+    atom_gray = make_atom(env, "gray");
+    atom_filter = make_atom(env, "filter");
+    atom_dither = make_atom(env, "dither");
+    atom_levels = make_atom(env, "levels");
+    atom_threads = make_atom(env, "threads");
+    atom_dirty = make_atom(env, "dirty");
+    atom_all = make_atom(env, "all");
+    atom_box = make_atom(env, "box");
+    atom_bilinear = make_atom(env, "bilinear");
+    atom_lanczos = make_atom(env, "lanczos");
+    atom_bayer = make_atom(env, "bayer");
+    atom_blue_noise = make_atom(env, "blue_noise");
+    atom_floyd_steinberg = make_atom(env, "floyd_steinberg");
+    atom_atkinson = make_atom(env, "atkinson");
+    atom_line = make_atom(env, "line");
+    atom_aa_line = make_atom(env, "aa_line");
+    atom_polyline = make_atom(env, "polyline");
+    atom_aa_polyline = make_atom(env, "aa_polyline");
+    atom_polygon = make_atom(env, "polygon");
+    atom_fill_polygon = make_atom(env, "fill_polygon");
+    atom_circle = make_atom(env, "circle");
+    atom_fill_circle = make_atom(env, "fill_circle");
+    atom_arc = make_atom(env, "arc");
+    atom_rounded_rect = make_atom(env, "rounded_rect");
+    atom_fill_rounded_rect = make_atom(env, "fill_rounded_rect");
 
     // Input atoms
     atom_type    = make_atom(env, "type");
@@ -1983,114 +8520,283 @@ static int load(ErlNifEnv *env, void **priv_data, ERL_NIF_TERM load_info) {
     atom_name    = make_atom(env, "name");
     atom_path    = make_atom(env, "path");
 
+    // Async refresh notification atoms
+    atom_fbink_refresh = make_atom(env, "fbink_refresh");
+    atom_submitted     = make_atom(env, "submitted");
+    atom_complete      = make_atom(env, "complete");
+
+    // Render thread / draw op atoms
+    atom_fbink_done     = make_atom(env, "fbink_done");
+    atom_print          = make_atom(env, "print");
+    atom_print_ot       = make_atom(env, "print_ot");
+    atom_fill_rect_gray = make_atom(env, "fill_rect_gray");
+    atom_fill_rect_rgba = make_atom(env, "fill_rect_rgba");
+    atom_print_image    = make_atom(env, "print_image");
+    atom_print_raw_data = make_atom(env, "print_raw_data");
+    atom_cls            = make_atom(env, "cls");
+    atom_refresh_rect   = make_atom(env, "refresh_rect");
+
+    // Content-aware waveform selection
+    atom_auto = make_atom(env, "auto");
+
+    dither_init();
+
+    fbink_lock = enif_mutex_create("fbink");
+    if (!fbink_lock) return -1;
+    if (pool_start() != 0) return -1;
+    if (refresh_waiter_start() != 0) return -1;
+
     return 0;
 }
 
+// ============================================================================
+// NIF Unload callback
+// ============================================================================
+
+static void unload(ErlNifEnv *env, void *priv_data) {
+    (void)env;
+    (void)priv_data;
+    refresh_waiter_stop();
+    pool_stop();
+    if (fbink_lock) enif_mutex_destroy(fbink_lock);
+}
+
 // ============================================================================
 // NIF Function Table
 // ============================================================================
 
+// Scheduler classification (see "Scheduling" in README.md):
+//   0          - bounded, sub-millisecond work; safe on a normal scheduler
+//   DIRTY_IO   - ioctl waits, EPDC submissions, sysfs/evdev/font file access
+//   DIRTY_CPU  - rasterization, image decode/scaling, full-buffer memcpys
+#define DIRTY_IO  ERL_NIF_DIRTY_JOB_IO_BOUND
+#define DIRTY_CPU ERL_NIF_DIRTY_JOB_CPU_BOUND
+
+// Dirty NIFs that call into FBInk run under fbink_lock (see "FBInk lock")
+#define FBINK_LOCKED(fn)                                                          \
+    static ERL_NIF_TERM fn##_locked(ErlNifEnv *env, int argc,                    \
+                                    const ERL_NIF_TERM argv[]) {                 \
+        enif_mutex_lock(fbink_lock);                                              \
+        ERL_NIF_TERM ret = fn(env, argc, argv);                                   \
+        enif_mutex_unlock(fbink_lock);                                            \
+        return ret;                                                               \
+    }
+
+FBINK_LOCKED(nif_fbink_batch)
+FBINK_LOCKED(nif_fbink_flush)
+FBINK_LOCKED(nif_fbink_init)
+FBINK_LOCKED(nif_fbink_reinit)
+FBINK_LOCKED(nif_fbink_state_dump)
+FBINK_LOCKED(nif_fbink_print)
+FBINK_LOCKED(nif_fbink_add_ot_font)
+FBINK_LOCKED(nif_fbink_free_ot_fonts)
+FBINK_LOCKED(nif_fbink_print_ot)
+FBINK_LOCKED(nif_fbink_print_progress_bar)
+FBINK_LOCKED(nif_fbink_print_activity_bar)
+FBINK_LOCKED(nif_fbink_print_image)
+FBINK_LOCKED(nif_fbink_print_raw_data)
+FBINK_LOCKED(nif_fbink_print_image_binary)
+FBINK_LOCKED(nif_fbink_print_image_stream)
+FBINK_LOCKED(nif_fbink_load_image)
+FBINK_LOCKED(nif_fbink_blit_image)
+FBINK_LOCKED(nif_fbink_cls)
+FBINK_LOCKED(nif_fbink_grid_clear)
+FBINK_LOCKED(nif_fbink_refresh)
+FBINK_LOCKED(nif_fbink_refresh_rect)
+FBINK_LOCKED(nif_fbink_grid_refresh)
+FBINK_LOCKED(nif_fbink_refresh_async)
+FBINK_LOCKED(nif_fbink_dump)
+FBINK_LOCKED(nif_fbink_region_dump)
+FBINK_LOCKED(nif_fbink_rect_dump)
+FBINK_LOCKED(nif_fbink_restore)
+FBINK_LOCKED(nif_fbink_restore_rect)
+FBINK_LOCKED(nif_fbink_diff_dump_against_screen)
+FBINK_LOCKED(nif_fbink_restore_changed)
+FBINK_LOCKED(nif_fbink_snapshot)
+FBINK_LOCKED(nif_fbink_restore_snapshot)
+FBINK_LOCKED(nif_fbink_canvas)
+FBINK_LOCKED(nif_fbink_commit)
+FBINK_LOCKED(nif_fbink_invert_screen)
+FBINK_LOCKED(nif_fbink_invert_rect)
+FBINK_LOCKED(nif_fbink_set_fb_info)
+FBINK_LOCKED(nif_fbink_fill_rect_gray)
+FBINK_LOCKED(nif_fbink_fill_rect_rgba)
+FBINK_LOCKED(nif_fbink_get_pixels)
+FBINK_LOCKED(nif_fbink_put_pixels)
+FBINK_LOCKED(nif_fbink_put_pixels_scatter)
+FBINK_LOCKED(nif_fbink_draw_shapes)
+FBINK_LOCKED(nif_fbink_fill_rects)
+FBINK_LOCKED(nif_fbink_wakeup_epdc)
+FBINK_LOCKED(nif_fbink_sunxi_toggle_ntx_pen_mode)
+FBINK_LOCKED(nif_fbink_sunxi_ntx_enforce_rota)
+FBINK_LOCKED(nif_fbink_mtk_set_halftone)
+FBINK_LOCKED(nif_fbink_mtk_toggle_auto_reagl)
+FBINK_LOCKED(nif_fbink_mtk_toggle_pen_mode)
+FBINK_LOCKED(nif_fbink_get_state)
+FBINK_LOCKED(nif_fbink_get_last_rect)
+FBINK_LOCKED(nif_fbink_get_last_marker)
+FBINK_LOCKED(nif_fbink_is_fb_quirky)
+FBINK_LOCKED(nif_fbink_update_verbosity)
+FBINK_LOCKED(nif_fbink_update_pen_colors)
+FBINK_LOCKED(nif_fbink_set_fg_pen_gray)
+FBINK_LOCKED(nif_fbink_set_bg_pen_gray)
+FBINK_LOCKED(nif_fbink_set_fg_pen_rgba)
+FBINK_LOCKED(nif_fbink_set_bg_pen_rgba)
+FBINK_LOCKED(nif_fbink_rota_native_to_canonical)
+FBINK_LOCKED(nif_fbink_rota_canonical_to_native)
+FBINK_LOCKED(nif_fbink_mtk_set_swipe_data)
+FBINK_LOCKED(nif_fbink_put_pixel_gray)
+FBINK_LOCKED(nif_fbink_put_pixel_rgba)
+FBINK_LOCKED(nif_fbink_get_pixel)
+FBINK_LOCKED(nif_fbink_pack_pixel_gray)
+FBINK_LOCKED(nif_fbink_pack_pixel_rgba)
+
 static ErlNifFunc nif_funcs[] = {
     // Info
     {"nif_version",                     0, nif_fbink_version,                     0},
     {"nif_target",                      0, nif_fbink_target,                      0},
     {"nif_features",                    0, nif_fbink_features,                    0},
 
+    // Precompiled configs
+    {"nif_compile_config",              1, nif_fbink_compile_config,              0},
+    {"nif_compile_ot_config",           1, nif_fbink_compile_ot_config,           0},
+    {"nif_compile_rect",                1, nif_fbink_compile_rect,                0},
+
     // Lifecycle
     {"nif_open",                        0, nif_fbink_open,                        0},
-    {"nif_close",                       1, nif_fbink_close,                       0},
-    {"nif_init",                        2, nif_fbink_init,                        0},
-    {"nif_reinit",                      2, nif_fbink_reinit,                      0},
+    {"nif_close",                       1, nif_fbink_close,                       DIRTY_IO},
+    {"nif_submit",                      3, nif_fbink_submit,                      0},
+    {"nif_batch",                       2, nif_fbink_batch_locked,                DIRTY_CPU},
+    {"nif_flush",                       2, nif_fbink_flush_locked,                DIRTY_IO},
+    {"nif_waveform_stats",              0, nif_fbink_waveform_stats,              0},
+    {"nif_init",                        2, nif_fbink_init_locked,                 DIRTY_IO},
+    {"nif_reinit",                      2, nif_fbink_reinit_locked,               DIRTY_IO},
 
     // State
-    {"nif_get_state",                   1, nif_fbink_get_state,                   0},
-    {"nif_state_dump",                  1, nif_fbink_state_dump,                  0},
-    {"nif_get_last_rect",              1, nif_fbink_get_last_rect,              0},
-    {"nif_get_last_marker",            0, nif_fbink_get_last_marker,            0},
-    {"nif_is_fb_quirky",               0, nif_fbink_is_fb_quirky,               0},
+    {"nif_get_state",                   1, nif_fbink_get_state_locked,            DIRTY_IO},
+    {"nif_state_dump",                  1, nif_fbink_state_dump_locked,           DIRTY_IO},
+    {"nif_get_last_rect",              1, nif_fbink_get_last_rect_locked,       DIRTY_IO},
+    {"nif_get_last_marker",            0, nif_fbink_get_last_marker_locked,     DIRTY_IO},
+    {"nif_is_fb_quirky",               0, nif_fbink_is_fb_quirky_locked,        DIRTY_IO},
 
     // Config updates
-    {"nif_update_verbosity",           1, nif_fbink_update_verbosity,           0},
-    {"nif_update_pen_colors",          1, nif_fbink_update_pen_colors,          0},
-    {"nif_set_fg_pen_gray",            3, nif_fbink_set_fg_pen_gray,            0},
-    {"nif_set_bg_pen_gray",            3, nif_fbink_set_bg_pen_gray,            0},
-    {"nif_set_fg_pen_rgba",            6, nif_fbink_set_fg_pen_rgba,            0},
-    {"nif_set_bg_pen_rgba",            6, nif_fbink_set_bg_pen_rgba,            0},
+    {"nif_update_verbosity",           1, nif_fbink_update_verbosity_locked,    DIRTY_IO},
+    {"nif_update_pen_colors",          1, nif_fbink_update_pen_colors_locked,   DIRTY_IO},
+    {"nif_set_fg_pen_gray",            3, nif_fbink_set_fg_pen_gray_locked,     DIRTY_IO},
+    {"nif_set_bg_pen_gray",            3, nif_fbink_set_bg_pen_gray_locked,     DIRTY_IO},
+    {"nif_set_fg_pen_rgba",            6, nif_fbink_set_fg_pen_rgba_locked,     DIRTY_IO},
+    {"nif_set_bg_pen_rgba",            6, nif_fbink_set_bg_pen_rgba_locked,     DIRTY_IO},
 
     // Text printing
-    {"nif_print",                      3, nif_fbink_print,                      0},
-    {"nif_add_ot_font",                2, nif_fbink_add_ot_font,                0},
-    {"nif_free_ot_fonts",              0, nif_fbink_free_ot_fonts,              0},
-    {"nif_print_ot",                   4, nif_fbink_print_ot,                   0},
+    {"nif_print",                      3, nif_fbink_print_locked,               DIRTY_CPU},
+    {"nif_add_ot_font",                2, nif_fbink_add_ot_font_locked,         DIRTY_IO},
+    {"nif_free_ot_fonts",              0, nif_fbink_free_ot_fonts_locked,       DIRTY_IO},
+    {"nif_print_ot",                   4, nif_fbink_print_ot_locked,            DIRTY_CPU},
 
     // Progress/Activity bars
-    {"nif_print_progress_bar",         3, nif_fbink_print_progress_bar,         0},
-    {"nif_print_activity_bar",         3, nif_fbink_print_activity_bar,         0},
+    {"nif_print_progress_bar",         3, nif_fbink_print_progress_bar_locked,  DIRTY_CPU},
+    {"nif_print_activity_bar",         3, nif_fbink_print_activity_bar_locked,  DIRTY_CPU},
 
     // Image rendering
-    {"nif_print_image",                5, nif_fbink_print_image,                0},
-    {"nif_print_raw_data",             7, nif_fbink_print_raw_data,             0},
+    {"nif_print_image",                5, nif_fbink_print_image_locked,         DIRTY_CPU},
+    {"nif_print_raw_data",             7, nif_fbink_print_raw_data_locked,      DIRTY_CPU},
+    {"nif_print_raw_data",             8, nif_fbink_print_raw_data_locked,      DIRTY_CPU},
+    {"nif_print_image_binary",         5, nif_fbink_print_image_binary_locked,  DIRTY_CPU},
+    {"nif_print_image_stream",         6, nif_fbink_print_image_stream_locked,  DIRTY_CPU},
+    {"nif_load_image",                 3, nif_fbink_load_image_locked,          DIRTY_CPU},
+    {"nif_load_image",                 5, nif_fbink_load_image_locked,          DIRTY_CPU},
+    {"nif_blit_image",                 5, nif_fbink_blit_image_locked,          DIRTY_CPU},
+    {"nif_image_info",                 1, nif_fbink_image_info,                 0},
 
     // Screen clear
-    {"nif_cls",                        4, nif_fbink_cls,                        0},
-    {"nif_grid_clear",                 4, nif_fbink_grid_clear,                 0},
+    {"nif_cls",                        4, nif_fbink_cls_locked,                 DIRTY_CPU},
+    {"nif_grid_clear",                 4, nif_fbink_grid_clear_locked,          DIRTY_CPU},
 
     // Refresh
-    {"nif_refresh",                    6, nif_fbink_refresh,                    0},
-    {"nif_refresh_rect",               3, nif_fbink_refresh_rect,               0},
-    {"nif_grid_refresh",               4, nif_fbink_grid_refresh,               0},
-    {"nif_wait_for_submission",        2, nif_fbink_wait_for_submission,        0},
-    {"nif_wait_for_complete",          2, nif_fbink_wait_for_complete,          0},
-    {"nif_wait_for_any_complete",      1, nif_fbink_wait_for_any_complete,      0},
+    {"nif_refresh",                    6, nif_fbink_refresh_locked,             DIRTY_IO},
+    {"nif_refresh_rect",               3, nif_fbink_refresh_rect_locked,        DIRTY_IO},
+    {"nif_grid_refresh",               4, nif_fbink_grid_refresh_locked,        DIRTY_IO},
+    {"nif_wait_for_submission",        2, nif_fbink_wait_for_submission,        DIRTY_IO},
+    {"nif_wait_for_complete",          2, nif_fbink_wait_for_complete,          DIRTY_IO},
+    {"nif_wait_for_any_complete",      1, nif_fbink_wait_for_any_complete,      DIRTY_IO},
+    {"nif_refresh_async",              4, nif_fbink_refresh_async_locked,       DIRTY_IO},
+    {"nif_notify_refresh",             3, nif_fbink_notify_refresh,             0},
 
     // Dump/Restore
-    {"nif_dump",                       1, nif_fbink_dump,                       0},
-    {"nif_region_dump",                6, nif_fbink_region_dump,                0},
-    {"nif_rect_dump",                  2, nif_fbink_rect_dump,                  0},
-    {"nif_restore",                    3, nif_fbink_restore,                    0},
+    {"nif_dump",                       1, nif_fbink_dump_locked,                DIRTY_CPU},
+    {"nif_region_dump",                6, nif_fbink_region_dump_locked,         DIRTY_CPU},
+    {"nif_rect_dump",                  2, nif_fbink_rect_dump_locked,           DIRTY_CPU},
+    {"nif_restore",                    3, nif_fbink_restore_locked,             DIRTY_CPU},
+    {"nif_restore_rect",               4, nif_fbink_restore_rect_locked,        DIRTY_CPU},
     {"nif_free_dump_data",             1, nif_fbink_free_dump_data,             0},
     {"nif_get_dump_data",              1, nif_fbink_get_dump_data,              0},
+    {"nif_get_dump_rect_data",         2, nif_fbink_get_dump_rect_data,         0},
+    {"nif_compress_dump",              1, nif_fbink_compress_dump,              DIRTY_CPU},
+    {"nif_dump_info",                  1, nif_fbink_dump_info,                  0},
+    {"nif_save_dump",                  2, nif_fbink_save_dump,                  DIRTY_IO},
+    {"nif_load_dump",                  1, nif_fbink_load_dump,                  DIRTY_IO},
+    {"nif_diff_dumps",                 4, nif_fbink_diff_dumps,                 DIRTY_CPU},
+    {"nif_diff_dump_against_screen",   4, nif_fbink_diff_dump_against_screen_locked, DIRTY_CPU},
+    {"nif_restore_changed",            5, nif_fbink_restore_changed_locked,     DIRTY_CPU},
+    {"nif_snapshot_store",             1, nif_fbink_snapshot_store,             0},
+    {"nif_snapshot",                   2, nif_fbink_snapshot_locked,            DIRTY_CPU},
+    {"nif_restore_snapshot",           4, nif_fbink_restore_snapshot_locked,    DIRTY_CPU},
+    {"nif_snapshot_info",              1, nif_fbink_snapshot_info,              0},
+    {"nif_canvas",                     1, nif_fbink_canvas_locked,              DIRTY_CPU},
+    {"nif_canvas_fill",                3, nif_fbink_canvas_fill,                DIRTY_CPU},
+    {"nif_canvas_put_pixels",          4, nif_fbink_canvas_put_pixels,          DIRTY_CPU},
+    {"nif_canvas_blit",                4, nif_fbink_canvas_blit,                DIRTY_CPU},
+    {"nif_commit",                     4, nif_fbink_commit_locked,              DIRTY_CPU},
+    {"nif_canvas_info",                1, nif_fbink_canvas_info,                0},
 
     // Screen inversion
-    {"nif_invert_screen",              2, nif_fbink_invert_screen,              0},
-    {"nif_invert_rect",                3, nif_fbink_invert_rect,                0},
+    {"nif_invert_screen",              2, nif_fbink_invert_screen_locked,       DIRTY_CPU},
+    {"nif_invert_rect",                4, nif_fbink_invert_rect_locked,         DIRTY_CPU},
 
     // Rotation helpers
-    {"nif_rota_native_to_canonical",   1, nif_fbink_rota_native_to_canonical,   0},
-    {"nif_rota_canonical_to_native",   1, nif_fbink_rota_canonical_to_native,   0},
+    {"nif_rota_native_to_canonical",   1, nif_fbink_rota_native_to_canonical_locked, DIRTY_IO},
+    {"nif_rota_canonical_to_native",   1, nif_fbink_rota_canonical_to_native_locked, DIRTY_IO},
 
     // Framebuffer info
-    {"nif_set_fb_info",                5, nif_fbink_set_fb_info,                0},
+    {"nif_set_fb_info",                5, nif_fbink_set_fb_info_locked,         DIRTY_IO},
 
     // Drawing primitives
-    {"nif_fill_rect_gray",            5, nif_fbink_fill_rect_gray,             0},
-    {"nif_fill_rect_rgba",            8, nif_fbink_fill_rect_rgba,             0},
-    {"nif_put_pixel_gray",            4, nif_fbink_put_pixel_gray,             0},
-    {"nif_put_pixel_rgba",            7, nif_fbink_put_pixel_rgba,             0},
-    {"nif_get_pixel",                  3, nif_fbink_get_pixel,                  0},
-    {"nif_pack_pixel_gray",           1, nif_fbink_pack_pixel_gray,            0},
-    {"nif_pack_pixel_rgba",           4, nif_fbink_pack_pixel_rgba,            0},
+    {"nif_fill_rect_gray",            5, nif_fbink_fill_rect_gray_locked,      DIRTY_CPU},
+    {"nif_fill_rect_rgba",            8, nif_fbink_fill_rect_rgba_locked,      DIRTY_CPU},
+    {"nif_put_pixel_gray",            4, nif_fbink_put_pixel_gray_locked,      DIRTY_CPU},
+    {"nif_put_pixel_rgba",            7, nif_fbink_put_pixel_rgba_locked,      DIRTY_CPU},
+    {"nif_get_pixel",                  3, nif_fbink_get_pixel_locked,           DIRTY_CPU},
+    {"nif_get_pixels",                 3, nif_fbink_get_pixels_locked,          DIRTY_CPU},
+    {"nif_put_pixels",                 5, nif_fbink_put_pixels_locked,          DIRTY_CPU},
+    {"nif_put_pixels_scatter",         4, nif_fbink_put_pixels_scatter_locked,  DIRTY_CPU},
+    {"nif_draw_shapes",                3, nif_fbink_draw_shapes_locked,         DIRTY_CPU},
+    {"nif_fill_rects",                 6, nif_fbink_fill_rects_locked,          DIRTY_CPU},
+    {"nif_pack_pixel_gray",           1, nif_fbink_pack_pixel_gray_locked,     DIRTY_CPU},
+    {"nif_pack_pixel_rgba",           4, nif_fbink_pack_pixel_rgba_locked,     DIRTY_CPU},
+    {"nif_pack_buffer",               2, nif_fbink_pack_buffer,                DIRTY_CPU},
+    {"nif_dither",                    5, nif_fbink_dither,                     DIRTY_CPU},
+    {"nif_scale_buffer",              7, nif_fbink_scale_buffer,               DIRTY_CPU},
 
     // EPDC wakeup
-    {"nif_wakeup_epdc",               0, nif_fbink_wakeup_epdc,                0},
+    {"nif_wakeup_epdc",               0, nif_fbink_wakeup_epdc_locked,         DIRTY_IO},
 
     // Sunxi-specific
-    {"nif_sunxi_toggle_ntx_pen_mode", 2, nif_fbink_sunxi_toggle_ntx_pen_mode, 0},
-    {"nif_sunxi_ntx_enforce_rota",    3, nif_fbink_sunxi_ntx_enforce_rota,    0},
+    {"nif_sunxi_toggle_ntx_pen_mode", 2, nif_fbink_sunxi_toggle_ntx_pen_mode_locked, DIRTY_IO},
+    {"nif_sunxi_ntx_enforce_rota",    3, nif_fbink_sunxi_ntx_enforce_rota_locked, DIRTY_IO},
 
     // MTK-specific
-    {"nif_mtk_set_swipe_data",        2, nif_fbink_mtk_set_swipe_data,        0},
-    {"nif_mtk_set_halftone",          3, nif_fbink_mtk_set_halftone,          0},
-    {"nif_mtk_toggle_auto_reagl",     2, nif_fbink_mtk_toggle_auto_reagl,     0},
-    {"nif_mtk_toggle_pen_mode",       2, nif_fbink_mtk_toggle_pen_mode,       0},
+    {"nif_mtk_set_swipe_data",        2, nif_fbink_mtk_set_swipe_data_locked, DIRTY_IO},
+    {"nif_mtk_set_halftone",          3, nif_fbink_mtk_set_halftone_locked,   DIRTY_IO},
+    {"nif_mtk_toggle_auto_reagl",     2, nif_fbink_mtk_toggle_auto_reagl_locked, DIRTY_IO},
+    {"nif_mtk_toggle_pen_mode",       2, nif_fbink_mtk_toggle_pen_mode_locked, DIRTY_IO},
 
     // Input scanning
-    {"nif_input_scan",                3, nif_fbink_input_scan,                 0},
-    {"nif_input_check",               4, nif_fbink_input_check,                0},
+    {"nif_input_scan",                3, nif_fbink_input_scan,                 DIRTY_IO},
+    {"nif_input_check",               4, nif_fbink_input_check,                DIRTY_IO},
 
     // Button scan (deprecated)
-    {"nif_button_scan",               3, nif_fbink_button_scan,                0},
-    {"nif_wait_for_usbms_processing", 2, nif_fbink_wait_for_usbms_processing, 0},
+    {"nif_button_scan",               3, nif_fbink_button_scan,                DIRTY_IO},
+    {"nif_wait_for_usbms_processing", 2, nif_fbink_wait_for_usbms_processing, DIRTY_IO},
 };
 
-ERL_NIF_INIT(Elixir.FBInk.NIF, nif_funcs, load, NULL, NULL, NULL)
+ERL_NIF_INIT(Elixir.FBInk.NIF, nif_funcs, load, NULL, NULL, unload)
@@ -0,0 +1,1083 @@
+/**
+ * image_decode.c - Row-by-row PNG and baseline JPEG decoding
+ *
+ * FBInk (through stb_image) decodes a whole image into memory before drawing
+ * it, which doesn't fit on low-memory readers for 20+ MP scans. These
+ * decoders hand out one row at a time instead, reading the file sequentially:
+ * PNG keeps two scanlines and the 32 KiB inflate window, baseline JPEG one row
+ * of MCUs. Used by print_image_stream/6, and by print_image/5 for images over
+ * its pixel budget.
+ *
+ * Copyright (c) 2026 Marc Lainez
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <erl_nif.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_decode.h"
+
+#define IN_BUF 4096             // Bytes per fread
+#define MAX_WIDTH (1U << 24)    // Keeps row sizes well within size_t on 32-bit
+
+struct ImageDecoder {
+    unsigned int w, h, ch;
+    int (*row)(ImageDecoder *d, uint8_t *out);
+    void (*free)(ImageDecoder *d);
+};
+
+// ============================================================================
+// Buffered input
+// ============================================================================
+
+typedef struct {
+    FILE *f;
+    size_t pos, len;
+    uint8_t buf[IN_BUF];
+} ByteReader;
+
+// Next byte, or -1 at the end of the file
+static int br_byte(ByteReader *r) {
+    if (r->pos == r->len) {
+        r->len = fread(r->buf, 1, IN_BUF, r->f);
+        r->pos = 0;
+        if (r->len == 0) return -1;
+    }
+    return r->buf[r->pos++];
+}
+
+static bool br_read(ByteReader *r, uint8_t *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        int c = br_byte(r);
+        if (c < 0) return false;
+        dst[i] = (uint8_t)c;
+    }
+    return true;
+}
+
+static bool br_skip(ByteReader *r, size_t n) {
+    while (n) {
+        if (r->pos == r->len && br_byte(r) >= 0) r->pos--;  // Refill
+        if (r->pos == r->len) return false;
+        size_t k = r->len - r->pos < n ? r->len - r->pos : n;
+        r->pos += k;
+        n -= k;
+    }
+    return true;
+}
+
+static unsigned int get_be16(const uint8_t *p) { return (unsigned int)p[0] << 8 | p[1]; }
+static uint32_t get_be32(const uint8_t *p) { return (uint32_t)get_be16(p) << 16 | get_be16(p + 2); }
+
+// Blend a sample with alpha a against white
+static uint8_t over_white(unsigned int c, unsigned int a) {
+    return (uint8_t)((c * a + 255 * (255 - a) + 127) / 255);
+}
+
+// ============================================================================
+// Inflate (RFC 1951), pulled one output byte range at a time
+// ============================================================================
+//
+// Codes up to ZFAST_BITS long resolve with one table lookup; longer ones fall
+// back to walking the canonical code one bit at a time.
+
+#define ZFAST_BITS 9
+#define ZWINDOW 32768
+
+typedef struct {
+    uint16_t fast[1 << ZFAST_BITS];  // symbol << 4 | length, 0 for the slow path
+    uint16_t count[16];              // Codes of each length
+    uint16_t symbol[288];            // Symbols ordered by code
+} ZHuff;
+
+typedef enum { Z_HEADER, Z_STORED, Z_CODES, Z_DONE } ZState;
+
+typedef struct {
+    int (*next)(void *ctx);          // Next compressed byte, or -1
+    void *ctx;
+    uint64_t bits;
+    unsigned int nbits;
+    unsigned int pad;                // Zero bytes fed past the end of the input
+    ZState state;
+    bool last;
+    unsigned int stored_left;
+    unsigned int copy_len, copy_dist;
+    uint64_t total;                  // Bytes output so far
+    ZHuff lit, dist;
+    uint8_t window[ZWINDOW];
+} Inflate;
+
+static const uint16_t z_len_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195,
+                                         227, 258 };
+static const uint8_t z_len_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t z_dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                          193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+                                          4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t z_dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                          6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Make sure n bits are buffered; past the end of the input, zeros are fed so
+// that lookahead works, and reading them is caught by z_truncated
+static void z_need(Inflate *z, unsigned int n) {
+    while (z->nbits < n) {
+        int c = z->next(z->ctx);
+        if (c < 0) {
+            c = 0;
+            z->pad++;
+        }
+        z->bits |= (uint64_t)c << z->nbits;
+        z->nbits += 8;
+    }
+}
+
+static bool z_truncated(const Inflate *z) {
+    return z->pad * 8 > z->nbits;
+}
+
+static unsigned int z_bits(Inflate *z, unsigned int n) {
+    if (n == 0) return 0;
+    z_need(z, n);
+    unsigned int v = (unsigned int)(z->bits & ((1U << n) - 1));
+    z->bits >>= n;
+    z->nbits -= n;
+    return v;
+}
+
+static bool z_build(ZHuff *h, const uint8_t *lengths, unsigned int n) {
+    memset(h, 0, sizeof(*h));
+    for (unsigned int i = 0; i < n; i++) h->count[lengths[i]]++;
+    h->count[0] = 0;
+
+    int left = 1;  // Codes left of the current length
+    for (unsigned int len = 1; len < 16; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0) return false;  // Over-subscribed
+    }
+
+    uint16_t offs[16];
+    offs[1] = 0;
+    for (unsigned int len = 1; len < 15; len++) offs[len + 1] = offs[len] + h->count[len];
+    for (unsigned int i = 0; i < n; i++)
+        if (lengths[i]) h->symbol[offs[lengths[i]]++] = (uint16_t)i;
+
+    // Canonical codes are read bit-reversed, least significant bit first
+    unsigned int code = 0, k = 0;
+    for (unsigned int len = 1; len <= ZFAST_BITS; len++) {
+        for (unsigned int i = 0; i < h->count[len]; i++, k++, code++) {
+            unsigned int rev = 0;
+            for (unsigned int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+            for (unsigned int j = rev; j < (1U << ZFAST_BITS); j += 1U << len)
+                h->fast[j] = (uint16_t)(h->symbol[k] << 4 | len);
+        }
+        code <<= 1;
+    }
+    return true;
+}
+
+static int z_decode(Inflate *z, const ZHuff *h) {
+    z_need(z, ZFAST_BITS);
+    uint16_t e = h->fast[z->bits & ((1U << ZFAST_BITS) - 1)];
+    if (e) {
+        z->bits >>= e & 15;
+        z->nbits -= e & 15;
+        return e >> 4;
+    }
+
+    int code = 0, first = 0, index = 0;
+    for (unsigned int len = 1; len < 16; len++) {
+        code |= (int)z_bits(z, 1);
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static bool z_fixed(Inflate *z) {
+    uint8_t lengths[288 + 30];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    memset(lengths + 288, 5, 30);
+    return z_build(&z->lit, lengths, 288) && z_build(&z->dist, lengths + 288, 30);
+}
+
+static bool z_dynamic(Inflate *z) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5,
+                                       11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    unsigned int nlit = z_bits(z, 5) + 257, ndist = z_bits(z, 5) + 1, ncode = z_bits(z, 4) + 4;
+    if (nlit > 286 || ndist > 30) return false;
+
+    uint8_t lengths[286 + 30];
+    memset(lengths, 0, 19);
+    for (unsigned int i = 0; i < ncode; i++) lengths[order[i]] = (uint8_t)z_bits(z, 3);
+    if (!z_build(&z->lit, lengths, 19)) return false;
+
+    for (unsigned int i = 0; i < nlit + ndist;) {
+        int sym = z_decode(z, &z->lit);
+        if (sym < 0) return false;
+        if (sym < 16) {
+            lengths[i++] = (uint8_t)sym;
+            continue;
+        }
+        unsigned int rep;
+        uint8_t v = 0;
+        if (sym == 16) {
+            if (i == 0) return false;
+            v = lengths[i - 1];
+            rep = 3 + z_bits(z, 2);
+        } else if (sym == 17) {
+            rep = 3 + z_bits(z, 3);
+        } else {
+            rep = 11 + z_bits(z, 7);
+        }
+        if (i + rep > nlit + ndist) return false;
+        memset(lengths + i, v, rep);
+        i += rep;
+    }
+    if (lengths[256] == 0) return false;  // No end-of-block code
+    return z_build(&z->lit, lengths, nlit) && z_build(&z->dist, lengths + nlit, ndist);
+}
+
+static void z_emit(Inflate *z, uint8_t *out, uint8_t b) {
+    *out = b;
+    z->window[z->total++ & (ZWINDOW - 1)] = b;
+}
+
+// Exactly n more bytes of output, or -EIO/-EINVAL
+static int inflate_read(Inflate *z, uint8_t *out, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        if (z_truncated(z)) return -EIO;
+        if (z->copy_len) {
+            for (; z->copy_len && got < n; z->copy_len--, got++)
+                z_emit(z, out + got, z->window[(z->total - z->copy_dist) & (ZWINDOW - 1)]);
+            continue;
+        }
+
+        switch (z->state) {
+        case Z_HEADER: {
+            if (z->last) {
+                z->state = Z_DONE;
+                continue;
+            }
+            z->last = z_bits(z, 1);
+            unsigned int type = z_bits(z, 2);
+            if (type == 0) {
+                z_bits(z, z->nbits & 7);  // To a byte boundary
+                unsigned int len = z_bits(z, 16), nlen = z_bits(z, 16);
+                if ((len ^ 0xFFFF) != nlen) return -EINVAL;
+                z->stored_left = len;
+                z->state = Z_STORED;
+            } else if (type == 1 || type == 2) {
+                if (!(type == 1 ? z_fixed(z) : z_dynamic(z)))
+                    return z_truncated(z) ? -EIO : -EINVAL;
+                z->state = Z_CODES;
+            } else {
+                return -EINVAL;
+            }
+            break;
+        }
+        case Z_STORED:
+            for (; z->stored_left && got < n; z->stored_left--, got++)
+                z_emit(z, out + got, (uint8_t)z_bits(z, 8));
+            if (!z->stored_left) z->state = Z_HEADER;
+            break;
+        case Z_CODES: {
+            int sym = z_decode(z, &z->lit);
+            if (sym < 0 || sym > 285) return z_truncated(z) ? -EIO : -EINVAL;
+            if (sym < 256) {
+                z_emit(z, out + got++, (uint8_t)sym);
+                break;
+            }
+            if (sym == 256) {
+                z->state = Z_HEADER;
+                break;
+            }
+            sym -= 257;
+            unsigned int len = z_len_base[sym] + z_bits(z, z_len_extra[sym]);
+            int dsym = z_decode(z, &z->dist);
+            if (dsym < 0 || dsym > 29) return z_truncated(z) ? -EIO : -EINVAL;
+            unsigned int dist = z_dist_base[dsym] + z_bits(z, z_dist_extra[dsym]);
+            if (dist > z->total || dist > ZWINDOW) return -EINVAL;
+            z->copy_len = len;
+            z->copy_dist = dist;
+            break;
+        }
+        case Z_DONE:
+            return -EIO;  // Stream ended early
+        }
+    }
+    return z_truncated(z) ? -EIO : 0;
+}
+
+// ============================================================================
+// PNG
+// ============================================================================
+
+typedef struct {
+    ImageDecoder base;
+    ByteReader in;
+    uint32_t idat_left;          // Bytes left in the current IDAT chunk
+    bool idat_done;
+    unsigned int depth, color;
+    unsigned int samples;        // Per pixel, in the file
+    unsigned int filter_bpp;     // Bytes per pixel for filtering, at least 1
+    size_t stride;               // Scanline bytes, without the filter type
+    uint8_t *prev, *cur;
+    uint8_t palette[256][4];
+    Inflate z;
+} PngDecoder;
+
+static int png_idat_byte(void *ctx) {
+    PngDecoder *p = ctx;
+    while (p->idat_left == 0) {
+        uint8_t hdr[8];
+        if (p->idat_done || !br_skip(&p->in, 4) || !br_read(&p->in, hdr, 8) ||
+            memcmp(hdr + 4, "IDAT", 4) != 0) {
+            p->idat_done = true;
+            return -1;
+        }
+        p->idat_left = get_be32(hdr);
+    }
+    p->idat_left--;
+    return br_byte(&p->in);
+}
+
+static uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return (uint8_t)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+static bool png_unfilter(PngDecoder *p, unsigned int type) {
+    uint8_t *cur = p->cur;
+    const uint8_t *prev = p->prev;
+    size_t n = p->stride, bpp = p->filter_bpp;
+    switch (type) {
+    case 0:
+        break;
+    case 1:
+        for (size_t i = bpp; i < n; i++) cur[i] = (uint8_t)(cur[i] + cur[i - bpp]);
+        break;
+    case 2:
+        for (size_t i = 0; i < n; i++) cur[i] = (uint8_t)(cur[i] + prev[i]);
+        break;
+    case 3:
+        for (size_t i = 0; i < n; i++)
+            cur[i] = (uint8_t)(cur[i] + (((i >= bpp ? cur[i - bpp] : 0) + prev[i]) >> 1));
+        break;
+    case 4:
+        for (size_t i = 0; i < n; i++)
+            cur[i] = (uint8_t)(cur[i] + paeth(i >= bpp ? cur[i - bpp] : 0, prev[i],
+                                              i >= bpp ? prev[i - bpp] : 0));
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Sample i of the scanline, scaled to 8 bits (palette indexes as they are)
+static unsigned int png_sample(const PngDecoder *p, size_t i) {
+    switch (p->depth) {
+    case 16:
+        return p->cur[i * 2];
+    case 8:
+        return p->cur[i];
+    default: {
+        unsigned int per_byte = 8 / p->depth, max = (1U << p->depth) - 1;
+        unsigned int shift = 8 - p->depth * (unsigned int)(i % per_byte + 1);
+        unsigned int v = (p->cur[i / per_byte] >> shift) & max;
+        return p->color == 3 ? v : v * 255 / max;
+    }
+    }
+}
+
+static int png_row(ImageDecoder *d, uint8_t *out) {
+    PngDecoder *p = (PngDecoder *)d;
+    uint8_t type;
+    int rv = inflate_read(&p->z, &type, 1);
+    if (rv == 0) rv = inflate_read(&p->z, p->cur, p->stride);
+    if (rv < 0) return rv;
+    if (!png_unfilter(p, type)) return -EINVAL;
+
+    size_t s = 0;
+    for (unsigned int x = 0; x < d->w; x++, s += p->samples) {
+        switch (p->color) {
+        case 0:
+            *out++ = (uint8_t)png_sample(p, s);
+            break;
+        case 4:
+            *out++ = over_white(png_sample(p, s), png_sample(p, s + 1));
+            break;
+        case 2:
+        case 6: {
+            unsigned int a = p->color == 6 ? png_sample(p, s + 3) : 255;
+            for (unsigned int c = 0; c < 3; c++) *out++ = over_white(png_sample(p, s + c), a);
+            break;
+        }
+        case 3: {
+            const uint8_t *e = p->palette[png_sample(p, s)];
+            for (unsigned int c = 0; c < 3; c++) *out++ = over_white(e[c], e[3]);
+            break;
+        }
+        }
+    }
+
+    uint8_t *t = p->prev;
+    p->prev = p->cur;
+    p->cur = t;
+    return 0;
+}
+
+static void png_free(ImageDecoder *d) {
+    PngDecoder *p = (PngDecoder *)d;
+    if (p->prev) enif_free(p->prev);
+    if (p->cur) enif_free(p->cur);
+    enif_free(p);
+}
+
+static bool png_valid_depth(unsigned int color, unsigned int depth) {
+    switch (color) {
+    case 0: return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+    case 3: return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+    case 2: case 4: case 6: return depth == 8 || depth == 16;
+    default: return false;
+    }
+}
+
+// Read the chunks up to the first IDAT, and the zlib header
+static int png_open(PngDecoder *p) {
+    static const unsigned int samples[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    uint8_t hdr[13];
+    bool have_ihdr = false;
+    unsigned int npal = 0;
+    for (;;) {
+        if (!br_read(&p->in, hdr, 8)) return -EIO;
+        uint32_t len = get_be32(hdr);
+        const uint8_t *type = hdr + 4;
+        if (!have_ihdr && memcmp(type, "IHDR", 4) != 0) return -EINVAL;
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (have_ihdr || len != 13) return -EINVAL;
+            if (!br_read(&p->in, hdr, 13)) return -EIO;
+            p->base.w = get_be32(hdr);
+            p->base.h = get_be32(hdr + 4);
+            p->depth = hdr[8];
+            p->color = hdr[9];
+            if (p->base.w == 0 || p->base.h == 0 || p->base.w > MAX_WIDTH ||
+                !png_valid_depth(p->color, p->depth) || hdr[10] != 0 || hdr[11] != 0)
+                return -EINVAL;
+            if (hdr[12] != 0) return -ENOTSUP;  // Adam7 needs the whole image
+            have_ihdr = true;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            if (len % 3 != 0 || len > 256 * 3) return -EINVAL;
+            npal = len / 3;
+            for (unsigned int i = 0; i < npal; i++) {
+                if (!br_read(&p->in, p->palette[i], 3)) return -EIO;
+                p->palette[i][3] = 255;
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0 && p->color == 3) {
+            if (len > npal) return -EINVAL;
+            for (unsigned int i = 0; i < len; i++) {
+                int a = br_byte(&p->in);
+                if (a < 0) return -EIO;
+                p->palette[i][3] = (uint8_t)a;
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            if (p->color == 3 && npal == 0) return -EINVAL;
+            p->idat_left = len;
+            break;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            return -EINVAL;
+        } else {
+            if (!br_skip(&p->in, len)) return -EIO;
+        }
+        if (!br_skip(&p->in, 4)) return -EIO;  // CRC
+    }
+
+    p->samples = samples[p->color];
+    p->base.ch = p->color == 0 || p->color == 4 ? 1 : 3;
+    unsigned int bits = p->samples * p->depth;
+    p->filter_bpp = bits < 8 ? 1 : bits / 8;
+    p->stride = (size_t)(((uint64_t)p->base.w * bits + 7) / 8);
+
+    p->z.next = png_idat_byte;
+    p->z.ctx = p;
+    unsigned int cmf = z_bits(&p->z, 8), flg = z_bits(&p->z, 8);
+    if (z_truncated(&p->z)) return -EIO;
+    if ((cmf & 15) != 8 || (cmf << 8 | flg) % 31 != 0 || (flg & 0x20)) return -EINVAL;
+
+    p->prev = enif_alloc(p->stride);
+    p->cur = enif_alloc(p->stride);
+    if (!p->prev || !p->cur) return -ENOMEM;
+    memset(p->prev, 0, p->stride);
+    return 0;
+}
+
+// ============================================================================
+// Baseline JPEG
+// ============================================================================
+//
+// Huffman-coded, 8-bit, sequential, one interleaved scan of 1 (gray) or 3
+// (YCbCr, or RGB per the Adobe marker) components, as written by cameras,
+// scanners and libjpeg's defaults. Chroma is upsampled by replication and the
+// IDCT is the AAN floating-point one.
+
+#define JFAST_BITS 9
+
+typedef struct {
+    uint16_t fast[1 << JFAST_BITS];  // length << 8 | value, 0 for the slow path
+    int32_t maxcode[18];             // Largest code of each length, -1 for none
+    int32_t valptr[17];              // First value index, less the first code
+    uint8_t values[256];
+    bool defined;
+} JHuff;
+
+typedef struct {
+    unsigned int id, h, v, tq;
+    unsigned int td, ta;             // Huffman tables of the scan
+    int dc_pred;
+    unsigned int pw;                 // Plane width: blocks per MCU row x 8
+    uint8_t *plane;                  // pw x v * 8 samples of the current MCU row
+} JComponent;
+
+typedef struct {
+    ImageDecoder base;
+    ByteReader in;
+    uint32_t bits;                   // Left-aligned
+    unsigned int nbits;
+    int marker;                      // Marker hit in the entropy-coded data, or -1
+    unsigned int pad;
+    JHuff dc[4], ac[4];
+    float qt[4][64];                 // Natural order, AAN scaled
+    bool qt_defined[4];
+    unsigned int ncomp;
+    JComponent comp[3];
+    unsigned int hmax, vmax;
+    unsigned int mcus_x, mcu_rows;
+    unsigned int restart_interval, mcus_to_restart;
+    bool rgb;                        // 3 components that aren't YCbCr
+    unsigned int mcu_row;            // MCU rows decoded
+    unsigned int row_in_mcu, rows_in_mcu;
+} JpegDecoder;
+
+static const uint8_t zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static bool j_build(JHuff *h, const uint8_t counts[16]) {
+    memset(h->fast, 0, sizeof(h->fast));
+    int code = 0, k = 0;
+    for (unsigned int len = 1; len <= 16; len++) {
+        h->valptr[len] = k - code;
+        if (counts[len - 1] == 0) {
+            h->maxcode[len] = -1;
+        } else {
+            for (unsigned int i = 0; i < counts[len - 1]; i++, k++, code++) {
+                if (len <= JFAST_BITS) {
+                    unsigned int first = (unsigned int)code << (JFAST_BITS - len);
+                    for (unsigned int j = 0; j < 1U << (JFAST_BITS - len); j++)
+                        h->fast[first + j] = (uint16_t)(len << 8 | h->values[k]);
+                }
+            }
+            h->maxcode[len] = code - 1;
+        }
+        if (code > (1 << len)) return false;  // Over-subscribed
+        code <<= 1;
+    }
+    h->maxcode[17] = INT32_MAX;
+    h->defined = true;
+    return true;
+}
+
+// Fill the bit buffer to at least 25 bits. A marker ends the data: from there
+// on zeros are fed, and reading them is caught by j_truncated.
+static void j_fill(JpegDecoder *j) {
+    while (j->nbits <= 24) {
+        int c = 0;
+        if (j->marker < 0) {
+            c = br_byte(&j->in);
+            if (c == 0xFF) {
+                int m = br_byte(&j->in);
+                while (m == 0xFF) m = br_byte(&j->in);
+                if (m != 0) {
+                    j->marker = m < 0 ? 0 : m;
+                    c = 0;
+                }
+            }
+            if (c < 0) {
+                j->marker = 0;
+                c = 0;
+            }
+        }
+        if (j->marker >= 0) j->pad++;
+        j->bits |= (uint32_t)c << (24 - j->nbits);
+        j->nbits += 8;
+    }
+}
+
+static bool j_truncated(const JpegDecoder *j) {
+    return j->pad * 8 > j->nbits;
+}
+
+static unsigned int j_bits(JpegDecoder *j, unsigned int n) {
+    if (n == 0) return 0;
+    j_fill(j);
+    unsigned int v = j->bits >> (32 - n);
+    j->bits <<= n;
+    j->nbits -= n;
+    return v;
+}
+
+static int j_decode(JpegDecoder *j, const JHuff *h) {
+    j_fill(j);
+    uint16_t e = h->fast[j->bits >> (32 - JFAST_BITS)];
+    if (e) {
+        j->bits <<= e >> 8;
+        j->nbits -= e >> 8;
+        return e & 0xFF;
+    }
+    int code = 0;
+    for (unsigned int len = 1; len <= 16; len++) {
+        code = code << 1 | (int)j_bits(j, 1);
+        if (code <= h->maxcode[len]) return h->values[h->valptr[len] + code];
+    }
+    return -1;
+}
+
+static int j_extend(unsigned int v, unsigned int s) {
+    return v < (1U << (s - 1)) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+static uint8_t j_clamp(float v) {
+    return v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint8_t)(v + 0.5f);
+}
+
+// AAN inverse DCT of dequantized coefficients, level-shifted into dst
+static void j_idct(float *c, uint8_t *dst, unsigned int stride) {
+    for (unsigned int pass = 0; pass < 2; pass++) {
+        for (unsigned int i = 0; i < 8; i++) {
+            // Columns first, then rows
+            float *p = pass == 0 ? c + i : c + i * 8;
+            unsigned int s = pass == 0 ? 8 : 1;
+            float t0 = p[0], t1 = p[2 * s], t2 = p[4 * s], t3 = p[6 * s];
+            float t10 = t0 + t2, t11 = t0 - t2;
+            float t13 = t1 + t3, t12 = (t1 - t3) * 1.414213562f - t13;
+            t0 = t10 + t13;
+            t3 = t10 - t13;
+            t1 = t11 + t12;
+            t2 = t11 - t12;
+
+            float t4 = p[1 * s], t5 = p[3 * s], t6 = p[5 * s], t7 = p[7 * s];
+            float z13 = t6 + t5, z10 = t6 - t5, z11 = t4 + t7, z12 = t4 - t7;
+            t7 = z11 + z13;
+            t11 = (z11 - z13) * 1.414213562f;
+            float z5 = (z10 + z12) * 1.847759065f;
+            t10 = 1.082392200f * z12 - z5;
+            t12 = -2.613125930f * z10 + z5;
+            t6 = t12 - t7;
+            t5 = t11 - t6;
+            t4 = t10 + t5;
+
+            if (pass == 0) {
+                p[0] = t0 + t7;
+                p[7 * s] = t0 - t7;
+                p[1 * s] = t1 + t6;
+                p[6 * s] = t1 - t6;
+                p[2 * s] = t2 + t5;
+                p[5 * s] = t2 - t5;
+                p[4 * s] = t3 + t4;
+                p[3 * s] = t3 - t4;
+            } else {
+                uint8_t *o = dst + i * stride;
+                o[0] = j_clamp((t0 + t7) / 8 + 128);
+                o[7] = j_clamp((t0 - t7) / 8 + 128);
+                o[1] = j_clamp((t1 + t6) / 8 + 128);
+                o[6] = j_clamp((t1 - t6) / 8 + 128);
+                o[2] = j_clamp((t2 + t5) / 8 + 128);
+                o[5] = j_clamp((t2 - t5) / 8 + 128);
+                o[4] = j_clamp((t3 + t4) / 8 + 128);
+                o[3] = j_clamp((t3 - t4) / 8 + 128);
+            }
+        }
+    }
+}
+
+static int j_block(JpegDecoder *j, JComponent *cp, uint8_t *dst) {
+    const float *q = j->qt[cp->tq];
+    float c[64];
+    memset(c, 0, sizeof(c));
+
+    int t = j_decode(j, &j->dc[cp->td]);
+    if (t < 0 || t > 11) return -EINVAL;
+    cp->dc_pred += t ? j_extend(j_bits(j, (unsigned int)t), (unsigned int)t) : 0;
+    c[0] = (float)cp->dc_pred * q[0];
+
+    for (unsigned int k = 1; k < 64;) {
+        int rs = j_decode(j, &j->ac[cp->ta]);
+        if (rs < 0) return -EINVAL;
+        unsigned int r = (unsigned int)rs >> 4, s = (unsigned int)rs & 15;
+        if (s == 0) {
+            if (r != 15) break;  // End of block
+            k += 16;
+            continue;
+        }
+        k += r;
+        if (k > 63) return -EINVAL;
+        unsigned int n = zigzag[k++];
+        c[n] = (float)j_extend(j_bits(j, s), s) * q[n];
+    }
+    j_idct(c, dst, cp->pw);
+    return 0;
+}
+
+// Skip to the RSTn marker due after restart_interval MCUs, and start over
+static int j_restart(JpegDecoder *j) {
+    j->bits = 0;
+    j->nbits = 0;
+    if (j->marker < 0) {
+        int c = br_byte(&j->in);
+        while (c >= 0) {
+            if (c == 0xFF) {
+                c = br_byte(&j->in);
+                if (c != 0 && c != 0xFF) break;
+                if (c == 0xFF) continue;
+            }
+            c = br_byte(&j->in);
+        }
+        j->marker = c < 0 ? 0 : c;
+    }
+    if (j->marker < 0xD0 || j->marker > 0xD7) return j->marker == 0 ? -EIO : -EINVAL;
+    j->marker = -1;
+    j->pad = 0;
+    for (unsigned int i = 0; i < j->ncomp; i++) j->comp[i].dc_pred = 0;
+    j->mcus_to_restart = j->restart_interval;
+    return 0;
+}
+
+static int j_mcu_row(JpegDecoder *j) {
+    for (unsigned int mx = 0; mx < j->mcus_x; mx++) {
+        if (j->restart_interval) {
+            if (j->mcus_to_restart == 0) {
+                int rv = j_restart(j);
+                if (rv < 0) return rv;
+            }
+            j->mcus_to_restart--;
+        }
+        for (unsigned int i = 0; i < j->ncomp; i++) {
+            JComponent *cp = &j->comp[i];
+            for (unsigned int by = 0; by < cp->v; by++) {
+                for (unsigned int bx = 0; bx < cp->h; bx++) {
+                    uint8_t *dst = cp->plane + (size_t)by * 8 * cp->pw + (mx * cp->h + bx) * 8;
+                    int rv = j_block(j, cp, dst);
+                    if (rv < 0) return j_truncated(j) ? -EIO : rv;
+                }
+            }
+        }
+    }
+    if (j_truncated(j)) return -EIO;
+
+    unsigned int mcu_h = j->vmax * 8;
+    j->rows_in_mcu = j->base.h - j->mcu_row * mcu_h < mcu_h ? j->base.h - j->mcu_row * mcu_h
+                                                            : mcu_h;
+    j->row_in_mcu = 0;
+    j->mcu_row++;
+    return 0;
+}
+
+static int jpeg_row(ImageDecoder *d, uint8_t *out) {
+    JpegDecoder *j = (JpegDecoder *)d;
+    if (j->row_in_mcu == j->rows_in_mcu) {
+        if (j->mcu_row == j->mcu_rows) return -EIO;
+        int rv = j_mcu_row(j);
+        if (rv < 0) return rv;
+    }
+
+    unsigned int y = j->row_in_mcu++;
+    const JComponent *c = j->comp;
+    const uint8_t *p0 = c[0].plane + (size_t)(y * c[0].v / j->vmax) * c[0].pw;
+    if (j->ncomp == 1) {
+        memcpy(out, p0, d->w);
+        return 0;
+    }
+
+    const uint8_t *p1 = c[1].plane + (size_t)(y * c[1].v / j->vmax) * c[1].pw;
+    const uint8_t *p2 = c[2].plane + (size_t)(y * c[2].v / j->vmax) * c[2].pw;
+    for (unsigned int x = 0; x < d->w; x++) {
+        uint8_t s0 = p0[x * c[0].h / j->hmax];
+        uint8_t s1 = p1[x * c[1].h / j->hmax];
+        uint8_t s2 = p2[x * c[2].h / j->hmax];
+        if (j->rgb) {
+            *out++ = s0;
+            *out++ = s1;
+            *out++ = s2;
+        } else {
+            float y = s0, cb = s1 - 128.0f, cr = s2 - 128.0f;
+            *out++ = j_clamp(y + 1.402f * cr);
+            *out++ = j_clamp(y - 0.344136f * cb - 0.714136f * cr);
+            *out++ = j_clamp(y + 1.772f * cb);
+        }
+    }
+    return 0;
+}
+
+static void jpeg_free(ImageDecoder *d) {
+    JpegDecoder *j = (JpegDecoder *)d;
+    for (unsigned int i = 0; i < 3; i++)
+        if (j->comp[i].plane) enif_free(j->comp[i].plane);
+    enif_free(j);
+}
+
+static int j_segment_dqt(JpegDecoder *j, const uint8_t *s, unsigned int len) {
+    static const float aan[8] = { 1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+                                  1.0f, 0.785694958f, 0.541196100f, 0.275899379f };
+    while (len) {
+        unsigned int pq = s[0] >> 4, tq = s[0] & 15, n = pq ? 129 : 65;
+        if (tq > 3 || pq > 1 || len < n) return -EINVAL;
+        for (unsigned int k = 0; k < 64; k++) {
+            unsigned int q = pq ? get_be16(s + 1 + 2 * k) : s[1 + k];
+            unsigned int z = zigzag[k];
+            j->qt[tq][z] = (float)q * aan[z / 8] * aan[z % 8];
+        }
+        j->qt_defined[tq] = true;
+        s += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int j_segment_dht(JpegDecoder *j, const uint8_t *s, unsigned int len) {
+    while (len) {
+        if (len < 17) return -EINVAL;
+        unsigned int tc = s[0] >> 4, th = s[0] & 15, total = 0;
+        if (tc > 1 || th > 3) return -EINVAL;
+        for (unsigned int i = 0; i < 16; i++) total += s[1 + i];
+        if (total > 256 || len < 17 + total) return -EINVAL;
+        JHuff *h = tc ? &j->ac[th] : &j->dc[th];
+        memcpy(h->values, s + 17, total);
+        if (!j_build(h, s + 1)) return -EINVAL;
+        s += 17 + total;
+        len -= 17 + total;
+    }
+    return 0;
+}
+
+static int j_segment_sof(JpegDecoder *j, const uint8_t *s, unsigned int len) {
+    if (len < 6) return -EINVAL;
+    if (s[0] != 8) return -ENOTSUP;  // 12-bit
+    j->base.h = get_be16(s + 1);
+    j->base.w = get_be16(s + 3);
+    j->ncomp = s[5];
+    if (j->base.h == 0) return -ENOTSUP;  // Height in a DNL marker
+    if (j->base.w == 0) return -EINVAL;
+    if (j->ncomp != 1 && j->ncomp != 3) return -ENOTSUP;  // CMYK
+    if (len < 6 + 3 * j->ncomp) return -EINVAL;
+
+    j->hmax = j->vmax = 1;
+    for (unsigned int i = 0; i < j->ncomp; i++) {
+        JComponent *cp = &j->comp[i];
+        cp->id = s[6 + 3 * i];
+        cp->h = s[7 + 3 * i] >> 4;
+        cp->v = s[7 + 3 * i] & 15;
+        cp->tq = s[8 + 3 * i];
+        if (cp->h < 1 || cp->h > 4 || cp->v < 1 || cp->v > 4 || cp->tq > 3) return -EINVAL;
+        if (cp->h > j->hmax) j->hmax = cp->h;
+        if (cp->v > j->vmax) j->vmax = cp->v;
+    }
+    // A single component is coded block by block, whatever its sampling factors
+    if (j->ncomp == 1) j->comp[0].h = j->comp[0].v = j->hmax = j->vmax = 1;
+    for (unsigned int i = 0; i < j->ncomp; i++)
+        if (j->hmax % j->comp[i].h || j->vmax % j->comp[i].v) return -ENOTSUP;
+    return 0;
+}
+
+static int j_segment_sos(JpegDecoder *j, const uint8_t *s, unsigned int len) {
+    if (len < 1 || s[0] != j->ncomp) return -ENOTSUP;  // Non-interleaved scans
+    if (len < 4 + 2 * j->ncomp) return -EINVAL;
+    for (unsigned int i = 0; i < j->ncomp; i++) {
+        JComponent *cp = &j->comp[i];
+        if (s[1 + 2 * i] != cp->id) return -ENOTSUP;
+        cp->td = s[2 + 2 * i] >> 4;
+        cp->ta = s[2 + 2 * i] & 15;
+        if (cp->td > 3 || cp->ta > 3 || !j->dc[cp->td].defined || !j->ac[cp->ta].defined ||
+            !j->qt_defined[cp->tq])
+            return -EINVAL;
+    }
+    return 0;
+}
+
+// Read the segments up to the start of the scan
+static int jpeg_open(JpegDecoder *j) {
+    uint8_t soi[2];
+    if (!br_read(&j->in, soi, 2)) return -EIO;
+    bool have_sof = false, adobe = false;
+    unsigned int adobe_transform = 1;
+    uint8_t *seg = NULL;
+
+    int rv = 0;
+    for (;;) {
+        int c = br_byte(&j->in);
+        if (c != 0xFF) {
+            rv = c < 0 ? -EIO : -EINVAL;
+            break;
+        }
+        while ((c = br_byte(&j->in)) == 0xFF) {}
+        if (c < 0) {
+            rv = -EIO;
+            break;
+        }
+        if (c == 0x01 || (c >= 0xD0 && c <= 0xD7)) continue;  // No payload
+        if (c == 0xD9) {
+            rv = -EINVAL;  // End of image before the scan
+            break;
+        }
+
+        uint8_t lb[2];
+        if (!br_read(&j->in, lb, 2)) {
+            rv = -EIO;
+            break;
+        }
+        unsigned int len = get_be16(lb);
+        if (len < 2) {
+            rv = -EINVAL;
+            break;
+        }
+        len -= 2;
+
+        bool wanted = c == 0xC0 || c == 0xC1 || c == 0xC4 || c == 0xDB || c == 0xDD ||
+                      c == 0xDA || c == 0xEE;
+        if (c >= 0xC2 && c <= 0xCF && c != 0xC4 && c != 0xC8 && c != 0xCC) {
+            rv = -ENOTSUP;  // Progressive, lossless, hierarchical or arithmetic-coded
+            break;
+        }
+        if (!wanted) {
+            if (!br_skip(&j->in, len)) {
+                rv = -EIO;
+                break;
+            }
+            continue;
+        }
+
+        if (seg) enif_free(seg);
+        seg = enif_alloc(len ? len : 1);
+        if (!seg) {
+            rv = -ENOMEM;
+            break;
+        }
+        if (!br_read(&j->in, seg, len)) {
+            rv = -EIO;
+            break;
+        }
+
+        if (c == 0xDB) {
+            rv = j_segment_dqt(j, seg, len);
+        } else if (c == 0xC4) {
+            rv = j_segment_dht(j, seg, len);
+        } else if (c == 0xDD) {
+            rv = len >= 2 ? 0 : -EINVAL;
+            if (rv == 0) j->restart_interval = get_be16(seg);
+        } else if (c == 0xEE) {
+            if (len >= 12 && memcmp(seg, "Adobe", 5) == 0) {
+                adobe = true;
+                adobe_transform = seg[11];
+            }
+        } else if (c == 0xC0 || c == 0xC1) {
+            rv = have_sof ? -EINVAL : j_segment_sof(j, seg, len);
+            have_sof = true;
+        } else {
+            rv = have_sof ? j_segment_sos(j, seg, len) : -EINVAL;
+            break;
+        }
+        if (rv < 0) break;
+    }
+    if (seg) enif_free(seg);
+    if (rv < 0) return rv;
+
+    j->base.ch = j->ncomp;
+    if (j->ncomp == 3)
+        j->rgb = adobe ? adobe_transform == 0
+                       : j->comp[0].id == 'R' && j->comp[1].id == 'G' && j->comp[2].id == 'B';
+    j->mcus_x = (j->base.w + j->hmax * 8 - 1) / (j->hmax * 8);
+    j->mcu_rows = (j->base.h + j->vmax * 8 - 1) / (j->vmax * 8);
+    for (unsigned int i = 0; i < j->ncomp; i++) {
+        JComponent *cp = &j->comp[i];
+        cp->pw = j->mcus_x * cp->h * 8;
+        cp->plane = enif_alloc((size_t)cp->pw * cp->v * 8);
+        if (!cp->plane) return -ENOMEM;
+    }
+    j->marker = -1;
+    j->mcus_to_restart = j->restart_interval;
+    return 0;
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+bool image_decoder_sniff(const uint8_t *hdr, size_t n) {
+    return (n >= 8 && memcmp(hdr, "\x89PNG\r\n\x1a\n", 8) == 0) ||
+           (n >= 3 && hdr[0] == 0xFF && hdr[1] == 0xD8 && hdr[2] == 0xFF);
+}
+
+int image_decoder_open(FILE *f, ImageDecoder **out) {
+    uint8_t sig[8];
+    size_t n = fread(sig, 1, sizeof(sig), f);
+    if (!image_decoder_sniff(sig, n)) return n < 3 ? -EIO : -ENOTSUP;
+    bool png = sig[0] == 0x89;
+
+    size_t size = png ? sizeof(PngDecoder) : sizeof(JpegDecoder);
+    ImageDecoder *d = enif_alloc(size);
+    if (!d) return -ENOMEM;
+    memset(d, 0, size);
+
+    int rv;
+    if (png) {
+        PngDecoder *p = (PngDecoder *)d;
+        d->row = png_row;
+        d->free = png_free;
+        p->in.f = f;
+        rv = png_open(p);
+    } else {
+        JpegDecoder *j = (JpegDecoder *)d;
+        d->row = jpeg_row;
+        d->free = jpeg_free;
+        j->in.f = f;
+        // The signature's first bytes are SOI plus the next marker's 0xFF
+        memcpy(j->in.buf, sig, n);
+        j->in.len = n;
+        rv = jpeg_open(j);
+    }
+    if (rv < 0) {
+        d->free(d);
+        return rv;
+    }
+    *out = d;
+    return 0;
+}
+
+void image_decoder_info(const ImageDecoder *d, unsigned int *w, unsigned int *h,
+                        unsigned int *ch) {
+    *w = d->w;
+    *h = d->h;
+    *ch = d->ch;
+}
+
+int image_decoder_row(ImageDecoder *d, uint8_t *row) {
+    return d->row(d, row);
+}
+
+void image_decoder_free(ImageDecoder *d) {
+    if (d) d->free(d);
+}
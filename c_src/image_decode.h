@@ -0,0 +1,39 @@
+/**
+ * image_decode.h - Row-by-row PNG and baseline JPEG decoding
+ *
+ * Copyright (c) 2026 Marc Lainez
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef FBINK_NIF_IMAGE_DECODE_H
+#define FBINK_NIF_IMAGE_DECODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct ImageDecoder ImageDecoder;
+
+// Whether a file starting with these bytes is a PNG or a JPEG
+bool image_decoder_sniff(const uint8_t *hdr, size_t n);
+
+// Start decoding the PNG or JPEG file f, positioned on its first byte, which
+// is then read sequentially (f stays the caller's). Returns 0, -ENOTSUP for
+// other formats and for interlaced PNGs or progressive, arithmetic-coded,
+// 12-bit or CMYK JPEGs, -EINVAL for a corrupt header, -EIO when truncated, or
+// -ENOMEM. Memory use depends on the image width only.
+int image_decoder_open(FILE *f, ImageDecoder **out);
+
+// Image size, and samples per pixel of decoded rows: 1 (gray) or 3 (RGB)
+void image_decoder_info(const ImageDecoder *d, unsigned int *w, unsigned int *h,
+                        unsigned int *ch);
+
+// Decode the next row, top to bottom, into row (w x ch bytes). Transparent
+// pixels are blended against white. Returns 0, -EIO when the file is
+// truncated, or -EINVAL when it is corrupt.
+int image_decoder_row(ImageDecoder *d, uint8_t *row);
+
+void image_decoder_free(ImageDecoder *d);
+
+#endif
@@ -47,39 +47,115 @@ defmodule FBInk do
   All FBInk functions that accept configuration take an `FBInk.Config` struct
   (or any map with matching keys). See `FBInk.Config` for the full list of
   options. Zero-initialization (the default struct) provides sane defaults.
+
+  Configs, OpenType configs and rects used on hot paths can be precompiled
+  with `FBInk.Config.compile/1`, `FBInk.OTConfig.compile/1` and
+  `FBInk.Rect.compile/1`. The resulting references are accepted anywhere the
+  struct form is, and skip map decoding on every call.
+
+  ## Scheduling
+
+  Calls that may block (EPDC waits, refresh submission, input scanning, font
+  loading) run on dirty I/O schedulers; rendering, image decoding and dump/restore
+  run on dirty CPU schedulers. So do getters, pen updates and single-pixel
+  operations, as they share FBInk's global state under one lock. Only calls that
+  never enter FBInk stay on the caller's normal scheduler. The full table is in
+  the README.
   """
 
   alias FBInk.NIF
 
+  # Pixels one extra EPDC update is assumed to cost, see flush/2
+  @default_merge_overhead 32_768
+
   # ---------------------------------------------------------------------------
   # Type definitions
   # ---------------------------------------------------------------------------
 
-  @type fbfd :: integer()
-  @type config :: FBInk.Config.t() | map()
-  @type ot_config :: FBInk.OTConfig.t() | map()
-  @type rect :: FBInk.Rect.t() | map()
+  @type fb :: reference()
+  @type fbfd :: integer() | fb()
+  @type config :: FBInk.Config.t() | map() | reference()
+  @type ot_config :: FBInk.OTConfig.t() | map() | reference()
+  @type rect :: FBInk.Rect.t() | map() | reference()
   @type dump_ref :: reference()
+  @type image :: reference()
+  @type snapshot_store :: reference()
+  @type snapshot :: reference()
+  @type canvas :: reference()
   @type ok_int :: {:ok, integer()} | {:error, integer()}
 
+  @type draw_op ::
+          {:print, iodata(), config()}
+          | {:print_ot, iodata(), ot_config(), config()}
+          | {:fill_rect_gray, config(), rect(), boolean(), non_neg_integer()}
+          | {:fill_rect_rgba, config(), rect(), boolean(), non_neg_integer(), non_neg_integer(),
+             non_neg_integer(), non_neg_integer()}
+          | {:print_image, String.t(), integer(), integer(), config()}
+          | {:print_raw_data, binary(), integer(), integer(), integer(), integer(), config()}
+          | {:cls, config(), rect() | nil, boolean()}
+          | {:refresh_rect, rect(), config()}
+
+  @typedoc "Packed `<<x::16, y::16>>` points"
+  @type points :: binary()
+
+  @type shape ::
+          {:line | :aa_line, integer(), integer(), integer(), integer()}
+          | {:polyline | :aa_polyline | :polygon | :fill_polygon, points()}
+          | {:circle | :fill_circle, integer(), integer(), non_neg_integer()}
+          | {:arc, integer(), integer(), non_neg_integer(), integer(), integer()}
+          | {:rounded_rect | :fill_rounded_rect, integer(), integer(), pos_integer(),
+             pos_integer(), non_neg_integer()}
+
   # ---------------------------------------------------------------------------
   # Helpers
   # ---------------------------------------------------------------------------
 
   defp to_config_map(%FBInk.Config{} = c), do: Map.from_struct(c)
   defp to_config_map(%{} = m), do: m
+  defp to_config_map(ref) when is_reference(ref), do: ref
 
   defp to_ot_config_map(%FBInk.OTConfig{} = c), do: Map.from_struct(c)
   defp to_ot_config_map(%{} = m), do: m
+  defp to_ot_config_map(ref) when is_reference(ref), do: ref
 
   defp to_rect_map(%FBInk.Rect{} = r), do: Map.from_struct(r)
   defp to_rect_map(%{} = m), do: m
+  defp to_rect_map(ref) when is_reference(ref), do: ref
   defp to_rect_map(nil), do: nil
 
+  defp diff_opts(opts) do
+    {Keyword.get(opts, :tile, 32), Keyword.get(opts, :merge_overhead, @default_merge_overhead)}
+  end
+
   defp bool_to_int(true), do: 1
   defp bool_to_int(false), do: 0
   defp bool_to_int(val) when is_integer(val), do: val
 
+  defp to_native_op({:print, string, config}),
+    do: {:print, string, to_config_map(config)}
+
+  defp to_native_op({:print_ot, string, ot_config, config}),
+    do: {:print_ot, string, to_ot_config_map(ot_config), to_config_map(config)}
+
+  defp to_native_op({:fill_rect_gray, config, rect, no_rota, y}),
+    do: {:fill_rect_gray, to_config_map(config), to_rect_map(rect), bool_to_int(no_rota), y}
+
+  defp to_native_op({:fill_rect_rgba, config, rect, no_rota, r, g, b, a}) do
+    {:fill_rect_rgba, to_config_map(config), to_rect_map(rect), bool_to_int(no_rota), r, g, b, a}
+  end
+
+  defp to_native_op({:print_image, filename, x_off, y_off, config}),
+    do: {:print_image, filename, x_off, y_off, to_config_map(config)}
+
+  defp to_native_op({:print_raw_data, data, w, h, x_off, y_off, config}),
+    do: {:print_raw_data, data, w, h, x_off, y_off, to_config_map(config)}
+
+  defp to_native_op({:cls, config, rect, no_rota}),
+    do: {:cls, to_config_map(config), to_rect_map(rect), bool_to_int(no_rota)}
+
+  defp to_native_op({:refresh_rect, rect, config}),
+    do: {:refresh_rect, to_rect_map(rect), to_config_map(config)}
+
   # ---------------------------------------------------------------------------
   # Info Functions
   # ---------------------------------------------------------------------------
@@ -121,24 +197,145 @@ defmodule FBInk do
   # ---------------------------------------------------------------------------
 
   @doc """
-  Open the framebuffer device and return a file descriptor.
+  Open the framebuffer device and return a handle.
+
+  Returns `{:ok, fb}` on success, where `fb` is a NIF resource owning the
+  framebuffer fd. Pass it to subsequent FBInk calls wherever an fd is
+  expected. The fd is closed by `close/1`, or automatically when the handle
+  is garbage collected.
 
-  Returns `{:ok, fd}` on success. The fd should be passed to subsequent
-  FBInk calls and closed with `close/1` when done.
+  The handle also owns a native render thread, started on first use by
+  `submit/3`.
 
   ## Example
 
-      {:ok, fd} = FBInk.open()
+      {:ok, fb} = FBInk.open()
   """
-  @spec open() :: {:ok, fbfd()} | {:error, integer()}
+  @spec open() :: {:ok, fb()} | {:error, integer() | atom()}
   def open, do: NIF.nif_open()
 
   @doc """
-  Close a previously opened framebuffer file descriptor.
+  Close a framebuffer handle (or a bare fd).
+
+  For a handle, commands already queued with `submit/3` are run first. Any
+  later use of the handle raises `ArgumentError`; closing it twice returns
+  `{:error, :closed}`. If `refresh_async/4` or `notify_refresh/3` messages
+  are still pending, the fd itself stays open until they have been sent.
   """
-  @spec close(fbfd()) :: ok_int()
+  @spec close(fbfd()) :: ok_int() | {:error, :closed}
   def close(fbfd), do: NIF.nif_close(fbfd)
 
+  @doc """
+  Queue a drawing command on the handle's render thread and return at once.
+
+  `op` mirrors the arguments of the corresponding synchronous function:
+
+    * `{:print, string, config}`
+    * `{:print_ot, string, ot_config, config}`
+    * `{:fill_rect_gray, config, rect, no_rota, y}`
+    * `{:fill_rect_rgba, config, rect, no_rota, r, g, b, a}`
+    * `{:print_image, filename, x_off, y_off, config}`
+    * `{:print_raw_data, data, w, h, x_off, y_off, config}`
+    * `{:cls, config, rect | nil, no_rota}`
+    * `{:refresh_rect, rect, config}`
+
+  Returns `{:ok, id}`. Commands run in submission order, and when each one is
+  done `pid` (default: the caller) receives `{:fbink_done, id, result}`, where
+  `result` is what the synchronous call would have returned (`{:error, :badarg}`
+  for a malformed op, `{:error, :closed}` if the handle was dropped before the
+  command ran).
+
+  The queue is bounded; `{:error, :queue_full}` is returned when it is full.
+  Commands are not ordered relative to direct calls made on the same handle.
+
+  ## Example
+
+      {:ok, id} = FBInk.submit(fb, {:print, "Hello", %FBInk.Config{row: 2}})
+
+      receive do
+        {:fbink_done, ^id, {:ok, _rows}} -> :ok
+      end
+  """
+  @spec submit(fb(), draw_op(), pid()) ::
+          {:ok, non_neg_integer()} | {:error, :queue_full | :closed | :enomem}
+  def submit(fb, op, pid \\ self()) do
+    NIF.nif_submit(fb, to_native_op(op), pid)
+  end
+
+  @doc """
+  Run a list of draw ops in a single NIF call, with coalesced refreshes.
+
+  `ops` use the same tuples as `submit/3`. Every op is drawn with `no_refresh`
+  forced; the areas they touch are accumulated and, once all ops have run,
+  refreshed with one `fbink_refresh_rect` per distinct combination of
+  `wfm_mode`, `is_flashing`, `dithering_mode` and `is_nightmode`.
+  `{:refresh_rect, rect, config}` ops only add their rect to that damage, and
+  ops whose config already sets `no_refresh` are drawn but not refreshed.
+
+  Returns `{:ok, results, markers}`, where `results` holds each op's own result
+  in order and `markers` holds the update marker of each coalesced refresh, in
+  the order their groups were first drawn to (empty if nothing needed
+  refreshing). A `{:refresh_rect, rect, config}` op's result is
+  `{:ok, marker}` for the refresh that covers `rect`. Returns
+  `{:error, code}` if a refresh fails.
+
+  ## Example
+
+      {:ok, [_, _, _], markers} =
+        FBInk.batch(fd, [
+          {:cls, config, nil, false},
+          {:print, "Title", %FBInk.Config{row: 1}},
+          {:fill_rect_gray, config, %FBInk.Rect{top: 40, width: 600, height: 2}, false, 0}
+        ])
+
+      for marker <- markers, do: {:ok, _} = FBInk.wait_for_complete(fd, marker)
+  """
+  @spec batch(fbfd(), [draw_op()]) ::
+          {:ok, [term()], [non_neg_integer()]} | {:error, integer()}
+  def batch(fbfd, ops) when is_list(ops) do
+    NIF.nif_batch(fbfd, Enum.map(ops, &to_native_op/1))
+  end
+
+  @doc """
+  Refresh everything drawn through `fb` with `no_refresh` set since the last flush.
+
+  Handles returned by `open/0` record the area of every successful `print/3`,
+  `print_ot/4`, `print_progress_bar/3`, `fill_rect_gray/5`, `fill_rect_rgba/8`,
+  `print_raw_data/7`, `print_image/5`, `cls/4` and `grid_clear/4` call (direct,
+  submitted or batched) whose config sets `no_refresh`, as well as every
+  `invert_rect/4` call. This lets callers
+  draw freely and refresh once.
+
+  Pending rects are merged before refreshing, but only with rects drawn with
+  the same `wfm_mode`, `is_flashing`, `dithering_mode` and `is_nightmode`, so
+  e.g. an A2 region is never promoted into a GC16 update. Each refresh is issued
+  with the config of the draw that produced it.
+
+  ## Options
+
+    * `:merge_overhead` - Estimated cost of one extra refresh, in pixels. Two
+      rects are merged when their bounding box refreshes at most this many
+      pixels that neither of them covers (default #{@default_merge_overhead}).
+      `0` only merges overlapping or exactly adjacent rects.
+
+  Returns `{:ok, refreshes, marker}` with the number of refreshes issued and
+  the marker of the last one (0 if there was nothing to flush). If a refresh
+  fails, `{:error, code}` is returned and the rects not yet refreshed stay
+  pending for the next flush.
+
+  ## Example
+
+      cfg = %FBInk.Config{no_refresh: true}
+      {:ok, _} = FBInk.print(fb, "Title", %{cfg | row: 1})
+      {:ok, _} = FBInk.print(fb, "Subtitle", %{cfg | row: 2})
+      {:ok, 1, marker} = FBInk.flush(fb)
+  """
+  @spec flush(fb(), keyword()) ::
+          {:ok, non_neg_integer(), non_neg_integer()} | {:error, integer()}
+  def flush(fb, opts \\ []) do
+    NIF.nif_flush(fb, Keyword.get(opts, :merge_overhead, @default_merge_overhead))
+  end
+
   @doc """
   Initialize FBInk for the given framebuffer fd.
 
@@ -400,6 +597,15 @@ defmodule FBInk do
   `halign`/`valign` fields for alignment, and `scaled_width`/`scaled_height`
   for scaling.
 
+  FBInk decodes the whole image into memory first. Past 16 MP, PNG, baseline
+  JPEG and binary PNM files are streamed instead, as with
+  `print_image_stream/6`: alignment and scaling still apply, but the image is
+  never upscaled and is shrunk to fit the screen rather than cropped, and it
+  must then land fully on screen (`{:error, :einval}` otherwise). Other
+  formats, interlaced PNGs and progressive JPEGs of that size return
+  `{:error, :efbig}`, as does a `:print_image` op passed to `submit/2` or
+  `batch/2`.
+
   ## Example
 
       FBInk.print_image(fd, "/mnt/onboard/cover.png", 0, 0, %FBInk.Config{
@@ -407,23 +613,197 @@ defmodule FBInk do
         valign: FBInk.Constants.Align.center()
       })
   """
-  @spec print_image(fbfd(), String.t(), integer(), integer(), config()) :: ok_int()
+  @spec print_image(fbfd(), String.t(), integer(), integer(), config()) ::
+          ok_int() | {:error, :efbig | :einval}
   def print_image(fbfd, filename, x_off, y_off, config) do
     NIF.nif_print_image(fbfd, filename, x_off, y_off, to_config_map(config))
   end
 
+  @doc """
+  Print an encoded image (PNG, JPEG, BMP, TGA, GIF, PNM) held in memory.
+
+  Same as `print_image/5`, including the `halign`/`valign`, `scaled_*` and
+  `sw_dithering` config fields and the streaming past 16 MP, but `data` is the
+  image file's contents rather than a path. The data is handed to FBInk
+  through an anonymous in-memory file, so nothing is written to disk. Linux
+  only; returns `{:error, :enotsup}` elsewhere.
+
+  ## Example
+
+      {:ok, %{body: png}} = Req.get(url)
+      FBInk.print_image_binary(fd, png, 0, 0, config)
+  """
+  @spec print_image_binary(fbfd(), iodata(), integer(), integer(), config()) ::
+          ok_int() | {:error, :enotsup | :efbig | :einval}
+  def print_image_binary(fbfd, data, x_off, y_off, config) do
+    NIF.nif_print_image_binary(fbfd, data, x_off, y_off, to_config_map(config))
+  end
+
+  @doc """
+  Print a PNG, baseline JPEG or binary PNM image (P5 gray or P6 RGB, 8 or 16
+  bits) without decoding it into memory first.
+
+  The file is read sequentially and box-downsampled on the fly, and the result
+  is drawn in bands of 16 rows, then refreshed once. PNM rows are read in
+  small chunks, so peak memory only depends on the output width. PNG rows are
+  decoded one at a time and JPEG rows one block row (8 or 16 rows) at a time,
+  which adds a few rows of the input width. Either way, scans far larger than
+  RAM can be shown. Interlaced PNGs and progressive, arithmetic-coded, 12-bit or CMYK
+  JPEGs are not supported. The path can also be a FIFO.
+
+  By default the image is shrunk to fit the screen past `x_off`/`y_off`,
+  keeping its aspect ratio and never upscaling.
+
+  ## Options
+
+    * `:size` - Output `{width, height}`, at most the image's own size.
+    * `:dither` - Dither to Y8 while drawing, with one of the `dither/3`
+      methods (default: no dithering). Error diffusion carries over from one
+      band to the next, so the result is the same as dithering in one pass.
+    * `:levels` - Gray levels to dither to: 16, 4 or 2 (default 16).
+
+  The image is placed at plain offsets, so the `halign`/`valign`, `scaled_*`
+  and `row`/`col` config fields must be unset and the image must fit on
+  screen; otherwise `{:error, :einval}` is returned. Other image formats
+  return `{:error, :enotsup}`, a truncated file `{:error, -5}` and a corrupt
+  one `{:error, -22}`.
+  """
+  @spec print_image_stream(fbfd(), String.t(), integer(), integer(), config(), keyword()) ::
+          ok_int() | {:error, :einval | :enotsup}
+  def print_image_stream(fbfd, filename, x_off, y_off, config, opts \\ []) do
+    {width, height} = Keyword.get(opts, :size, {0, 0})
+
+    prepass = %{
+      width: width,
+      height: height,
+      dither: Keyword.get(opts, :dither),
+      levels: Keyword.get(opts, :levels, 16)
+    }
+
+    NIF.nif_print_image_stream(fbfd, filename, x_off, y_off, to_config_map(config), prepass)
+  end
+
   @doc """
   Print raw pixel data to the framebuffer.
 
   `data` is a binary containing the raw pixel data. `w` and `h` are the
   dimensions. The pixel format must match the framebuffer's current format.
+
+  ## Options
+
+    * `:scale` - `{width, height}` to resample `data` to natively before drawing
+      (default: drawn at `w` x `h`).
+    * `:filter` - Resampling filter for `:scale`, as in `scale_buffer/4`
+      (default `:lanczos`).
+    * `:dither` - Dither Y8, RGB or RGBA `data` to gray natively before drawing
+      (after scaling), with one of the `dither/3` methods (default: no dithering).
+    * `:levels` - Gray levels to dither to: 16, 4 or 2 (default 16).
+    * `:threads` - Most threads to spread the scaling and dithering bands over,
+      the caller's included (default: the whole worker pool).
+
+  With `:scale` or `:dither`, bands are drawn as they are ready and the damage
+  is refreshed once, unless `halign`/`valign`, `scaled_*`, `row`/`col` or
+  negative or off-screen offsets require drawing the whole image in one call.
   """
-  @spec print_raw_data(fbfd(), binary(), integer(), integer(), integer(), integer(), config()) ::
-          ok_int()
-  def print_raw_data(fbfd, data, w, h, x_off, y_off, config) do
+  @spec print_raw_data(
+          fbfd(),
+          binary(),
+          integer(),
+          integer(),
+          integer(),
+          integer(),
+          config(),
+          keyword()
+        ) :: ok_int()
+  def print_raw_data(fbfd, data, w, h, x_off, y_off, config, opts \\ [])
+
+  def print_raw_data(fbfd, data, w, h, x_off, y_off, config, []) do
     NIF.nif_print_raw_data(fbfd, data, w, h, x_off, y_off, to_config_map(config))
   end
 
+  def print_raw_data(fbfd, data, w, h, x_off, y_off, config, opts) do
+    {scale_w, scale_h} = Keyword.get(opts, :scale, {0, 0})
+
+    prepass = %{
+      width: scale_w,
+      height: scale_h,
+      filter: Keyword.get(opts, :filter, :lanczos),
+      dither: Keyword.get(opts, :dither),
+      levels: Keyword.get(opts, :levels, 16),
+      threads: Keyword.get(opts, :threads, 0)
+    }
+
+    NIF.nif_print_raw_data(fbfd, data, w, h, x_off, y_off, to_config_map(config), prepass)
+  end
+
+  @doc """
+  Decode an image file once into an image resource for `blit_image/5`.
+
+  The config's `scaled_width`/`scaled_height`, `halign`/`valign`,
+  `sw_dithering` and other rendering fields are applied at load time; the
+  result is stored already packed in the framebuffer's pixel format, so each
+  blit is a memcpy rather than a decode.
+
+  PNG, baseline JPEG and binary PNM files are decoded in memory, off-screen:
+  the framebuffer is never drawn to. Transparent pixels are blended against
+  white, and the image may be larger than the screen (blits clip it), up to
+  16 MP after scaling (`{:error, :efbig}` past that).
+
+  Other formats (BMP, TGA, GIF), interlaced PNGs and progressive JPEGs can
+  only be decoded by FBInk, which draws straight to the framebuffer: loading
+  them draws the image once with `no_refresh` and puts the previous screen
+  contents back before returning. Nothing is refreshed, and no other FBInk
+  call from this VM runs in the meantime, but another OS process drawing to
+  or refreshing the same area may catch it. Those images would also come back
+  cropped when they don't fit on screen, so they return `{:error, :enotsup}`
+  instead. A decoded image spanning the full screen width or height is only
+  accepted if its file header confirms it wasn't cropped, or if
+  `scaled_width`/`scaled_height` is `-2` (fit to screen).
+
+  The resource is tied to the framebuffer's rotation and bit depth at load
+  time. `FBInk.ImageCache` keeps loaded images in a memory-bounded LRU.
+
+  With the `:dither` and `:levels` options of `print_raw_data/8`, the decoded
+  pixels are dithered to gray once, at load time, so every blit reuses them.
+
+  ## Example
+
+      {:ok, icon} = FBInk.load_image(fd, "/usr/share/icons/wifi.png")
+      {:ok, _} = FBInk.blit_image(fd, icon, 10, 10, config)
+  """
+  @spec load_image(fbfd(), String.t(), config(), keyword()) ::
+          {:ok, image()} | {:error, integer() | atom()}
+  def load_image(fbfd, filename, config \\ %FBInk.Config{}, opts \\ []) do
+    case Keyword.get(opts, :dither) do
+      nil ->
+        NIF.nif_load_image(fbfd, filename, to_config_map(config))
+
+      method ->
+        levels = Keyword.get(opts, :levels, 16)
+        NIF.nif_load_image(fbfd, filename, to_config_map(config), method, levels)
+    end
+  end
+
+  @doc """
+  Draw an image loaded with `load_image/3` with its top-left corner at `x`, `y`.
+
+  Parts falling outside the screen are clipped. The config controls the
+  refresh (`no_refresh`, `wfm_mode`, ...), as with `print_image/5`.
+  """
+  @spec blit_image(fbfd(), image(), integer(), integer(), config()) :: ok_int()
+  def blit_image(fbfd, image, x, y, config) do
+    NIF.nif_blit_image(fbfd, image, x, y, to_config_map(config))
+  end
+
+  @doc """
+  Return `%{width: w, height: h, size: bytes, bpp: bpp, rota: rota}` for a
+  loaded image.
+  """
+  @spec image_info(image()) :: map()
+  def image_info(image) do
+    NIF.nif_image_info(image)
+  end
+
   # ---------------------------------------------------------------------------
   # Screen Clear
   # ---------------------------------------------------------------------------
@@ -524,6 +904,62 @@ defmodule FBInk do
     NIF.nif_wait_for_any_complete(fbfd)
   end
 
+  @doc """
+  Trigger an eInk refresh for a rectangle without waiting for it.
+
+  Returns `{:ok, marker}` as soon as the update is queued. A native waiter
+  thread then tracks the update and sends `pid` (default: the caller):
+
+    * `{:fbink_refresh, marker, :submitted, duration_us}` once the EPDC
+      accepted the update
+    * `{:fbink_refresh, marker, :complete, duration_us}` once it finished
+      rendering
+
+  `duration_us` is measured from the moment the refresh was queued. Markers
+  are waited on concurrently, so a slow or stale one doesn't delay messages
+  for the others; messages for different markers may arrive in any order. If
+  a wait fails, `{:fbink_refresh, marker, {:error, code}, duration_us}` is sent
+  instead and no further messages follow for that marker.
+
+  ## Example
+
+      {:ok, marker} = FBInk.refresh_async(fd, rect, config)
+
+      receive do
+        {:fbink_refresh, ^marker, :complete, us} -> IO.puts("done in \#{us}us")
+      end
+  """
+  @spec refresh_async(fbfd(), rect(), config(), pid()) ::
+          {:ok, non_neg_integer()} | {:error, integer() | atom()}
+  def refresh_async(fbfd, rect, config, pid \\ self()) do
+    NIF.nif_refresh_async(fbfd, to_rect_map(rect), to_config_map(config), pid)
+  end
+
+  @doc """
+  Watch an already submitted update (e.g. `get_last_marker/0` after a `print/3`)
+  and send `pid` the same `{:fbink_refresh, ...}` messages as `refresh_async/4`.
+  """
+  @spec notify_refresh(fbfd(), non_neg_integer(), pid()) :: :ok | {:error, atom()}
+  def notify_refresh(fbfd, marker, pid \\ self()) do
+    NIF.nif_notify_refresh(fbfd, marker, pid)
+  end
+
+  @doc """
+  Count of refreshes per waveform mode chosen for `wfm_mode: :auto` configs.
+
+  Returns a map of waveform mode (see `FBInk.Constants.WaveformMode`) to the
+  number of refreshes it was picked for since the NIF was loaded.
+
+  ## Example
+
+      FBInk.waveform_stats()
+      #=> %{1 => 412, 2 => 9, 5 => 130}
+  """
+  @spec waveform_stats() :: %{non_neg_integer() => non_neg_integer()}
+  def waveform_stats do
+    NIF.nif_waveform_stats()
+  end
+
   # ---------------------------------------------------------------------------
   # Dump & Restore
   # ---------------------------------------------------------------------------
@@ -534,9 +970,22 @@ defmodule FBInk do
   Returns `{:ok, dump_ref}` where `dump_ref` is a NIF resource that
   holds the pixel data. Use `restore/3` to restore it, or
   `get_dump_data/1` to extract the raw pixels.
+
+  ## Options
+
+    * `:compress` - Compress the pixels right away (see `compress_dump/1`).
+      Useful for dumps kept around as screen-state stacks (default `false`).
   """
-  @spec dump(fbfd()) :: {:ok, dump_ref()} | {:error, integer()}
-  def dump(fbfd), do: NIF.nif_dump(fbfd)
+  @spec dump(fbfd(), keyword()) :: {:ok, dump_ref()} | {:error, integer() | atom()}
+  def dump(fbfd, opts \\ []) do
+    with {:ok, dump_ref} <- NIF.nif_dump(fbfd) do
+      if Keyword.get(opts, :compress, false) do
+        with {:ok, _size} <- compress_dump(dump_ref), do: {:ok, dump_ref}
+      else
+        {:ok, dump_ref}
+      end
+    end
+  end
 
   @doc """
   Dump a rectangular region of the framebuffer.
@@ -563,17 +1012,36 @@ defmodule FBInk do
 
   @doc """
   Restore a previously dumped framebuffer region.
+
+  Compressed dumps are decoded in bands straight onto the framebuffer, with a
+  single refresh of the whole restored area at the end.
   """
   @spec restore(fbfd(), config(), dump_ref()) :: ok_int()
   def restore(fbfd, config, dump_ref) do
     NIF.nif_restore(fbfd, to_config_map(config), dump_ref)
   end
 
+  @doc """
+  Restore only the part of a dump that lies within `rect`.
+
+  `rect` is in framebuffer coordinates, like the dump's `:area`. Only its
+  intersection with the dump's area (and clip, if set) is written and
+  refreshed, e.g. to remove a toast from a saved page without repainting the
+  whole page. Nothing is done if they don't overlap. With `no_refresh`, the
+  restored area is recorded for `flush/2` on handles returned by `open/0`.
+  """
+  @spec restore_rect(fbfd(), dump_ref(), rect(), config()) :: ok_int()
+  def restore_rect(fbfd, dump_ref, rect, config) do
+    NIF.nif_restore_rect(fbfd, dump_ref, to_rect_map(rect), to_config_map(config))
+  end
+
   @doc """
   Free the pixel data held by a dump resource.
 
   This is called automatically when the resource is garbage collected,
-  but you can call it explicitly to free memory sooner.
+  but you can call it explicitly to free memory sooner. Once the data has been
+  handed out by `get_dump_data/1` or `get_dump_rect_data/2`, those binaries
+  share it, so it is only released with the resource and this is a no-op.
   """
   @spec free_dump_data(dump_ref()) :: :ok
   def free_dump_data(dump_ref), do: NIF.nif_free_dump_data(dump_ref)
@@ -582,7 +1050,9 @@ defmodule FBInk do
   Extract the dump data as an Elixir map with a binary pixel payload.
 
   Returns `{:ok, dump_info}` where `dump_info` contains:
-  - `:data` - Raw pixel data as a binary
+  - `:data` - Raw pixel data as a binary. It points straight into the dump
+    (no copy) and keeps it alive as long as it is referenced. For compressed
+    dumps it is a decoded copy instead, made on a dirty CPU scheduler.
   - `:stride` - Scanline stride in bytes
   - `:size` - Total data size in bytes
   - `:area` - Dumped region as `%{left:, top:, width:, height:}`
@@ -594,6 +1064,264 @@ defmodule FBInk do
   @spec get_dump_data(dump_ref()) :: {:ok, map()} | {:error, atom()}
   def get_dump_data(dump_ref), do: NIF.nif_get_dump_data(dump_ref)
 
+  @doc """
+  Extract the pixels of a rectangle inside a dump, without copying.
+
+  `rect` is relative to the dump's `:area`, in the dump's (native) orientation.
+  Returns `{:ok, rows}` where `rows` is a list with one binary per scanline,
+  each a slice of the dump's data (of a decoded copy for compressed dumps); it
+  can be used as iodata directly. Returns
+  `{:error, :einval}` if the rect falls outside the dump or does not start and
+  end on a byte boundary (4bpp dumps).
+  """
+  @spec get_dump_rect_data(dump_ref(), rect()) :: {:ok, [binary()]} | {:error, atom()}
+  def get_dump_rect_data(dump_ref, rect) do
+    NIF.nif_get_dump_rect_data(dump_ref, to_rect_map(rect))
+  end
+
+  @doc """
+  Compress a dump's pixels in place, releasing the raw copy.
+
+  Uses run-length coding over whole pixels, which typically shrinks eInk
+  screen contents (text, UI) by an order of magnitude. The dump remains usable
+  with `restore/3`, `get_dump_data/1` and `get_dump_rect_data/2`. Content
+  that would not shrink is left raw.
+
+  Returns `{:ok, stored_size}`, `{:error, :exported}` if the raw pixels were
+  already handed out by `get_dump_data/1` or `get_dump_rect_data/2`, or
+  `{:error, :no_data}` once freed.
+  """
+  @spec compress_dump(dump_ref()) :: {:ok, non_neg_integer()} | {:error, atom()}
+  def compress_dump(dump_ref), do: NIF.nif_compress_dump(dump_ref)
+
+  @doc """
+  Return the storage details of a dump.
+
+  Returns `{:ok, info}` where `info` contains `:raw_size`, `:stored_size`,
+  `:compressed`, `:bpp` and `:area`. Both sizes are 0 once freed.
+  """
+  @spec dump_info(dump_ref()) :: {:ok, map()}
+  def dump_info(dump_ref), do: NIF.nif_dump_info(dump_ref)
+
+  @doc """
+  Save a dump to `path`, so it can be restored after a reboot.
+
+  The file holds the dump's geometry (`area`, `clip`, `rota`, `bpp`, stride)
+  and its pixels as held in memory, so compressed dumps stay compressed on
+  disk. It is written to a temporary file and renamed into place.
+  """
+  @spec save_dump(dump_ref(), Path.t()) :: :ok | {:error, integer() | atom()}
+  def save_dump(dump_ref, path), do: NIF.nif_save_dump(dump_ref, path)
+
+  @doc """
+  Load a dump saved by `save_dump/2`.
+
+  The file is memory-mapped and the dump points straight into the mapping,
+  so nothing is copied or decoded before `restore/3`: this is the fastest
+  way to put a cached boot splash on screen after `init/2`.
+
+  Returns `{:error, :mismatch}` if the dump's depth, rotation or (full
+  dumps) stride differ from the framebuffer FBInk was initialized on,
+  `{:error, :enotsup}` for files from a newer format version, and
+  `{:error, :einval}` for anything that is not a valid dump file.
+  """
+  @spec load_dump(Path.t()) :: {:ok, dump_ref()} | {:error, integer() | atom()}
+  def load_dump(path), do: NIF.nif_load_dump(path)
+
+  @doc """
+  Compute the regions that differ between two dumps of the same size.
+
+  Rows are compared with vector instructions where available; changed pixels
+  mark fixed-size tiles dirty, and those are coalesced into as few rects as
+  the merge cost allows. Rects are in framebuffer coordinates, positioned by
+  `a`'s area.
+
+  ## Options
+
+    * `:tile` - Tile size in pixels (default 32, minimum 8).
+    * `:merge_overhead` - Pixels worth redrawing needlessly to save one rect,
+      as in `flush/2` (default #{@default_merge_overhead}).
+
+  Returns `{:ok, rects}`, or `{:error, :einval}` if the dumps differ in size
+  or depth.
+  """
+  @spec diff_dumps(dump_ref(), dump_ref(), keyword()) :: {:ok, [map()]} | {:error, atom()}
+  def diff_dumps(a, b, opts \\ []) do
+    {tile, overhead} = diff_opts(opts)
+    NIF.nif_diff_dumps(a, b, tile, overhead)
+  end
+
+  @doc """
+  Compute the regions where the framebuffer no longer matches `dump_ref`.
+
+  Takes the same options as `diff_dumps/3`. Returns `{:error, code}` if the
+  dump was taken with another depth or rotation.
+  """
+  @spec diff_dump_against_screen(fbfd(), dump_ref(), keyword()) ::
+          {:ok, [map()]} | {:error, integer()}
+  def diff_dump_against_screen(fbfd, dump_ref, opts \\ []) do
+    {tile, overhead} = diff_opts(opts)
+    NIF.nif_diff_dump_against_screen(fbfd, dump_ref, tile, overhead)
+  end
+
+  @doc """
+  Restore only the parts of the screen that differ from `dump_ref`.
+
+  Each changed region is restored and refreshed on its own (unless `config`
+  sets `no_refresh`), which is much cheaper than a full-screen restore when
+  a small dialog or menu is being dismissed. Takes the same options as
+  `diff_dumps/3` and returns `{:ok, rects}` with the restored regions.
+  """
+  @spec restore_changed(fbfd(), config(), dump_ref(), keyword()) ::
+          {:ok, [map()]} | {:error, integer()}
+  def restore_changed(fbfd, config, dump_ref, opts \\ []) do
+    {tile, overhead} = diff_opts(opts)
+    NIF.nif_restore_changed(fbfd, to_config_map(config), dump_ref, tile, overhead)
+  end
+
+  # ---------------------------------------------------------------------------
+  # Snapshots
+  # ---------------------------------------------------------------------------
+
+  @doc """
+  Create a tile store for screen snapshots.
+
+  Snapshots taken into the same store share identical tiles, so keeping a
+  long undo history of similar screens only costs memory for the tiles that
+  changed between them. Keep snapshots in a list to use it as an undo stack;
+  tiles are freed once no snapshot references them anymore.
+
+  ## Options
+
+    * `:tile` - Tile size in pixels (default 64). Smaller tiles share more
+      but cost more per-tile bookkeeping.
+  """
+  @spec snapshot_store(keyword()) :: {:ok, snapshot_store()} | {:error, atom()}
+  def snapshot_store(opts \\ []) do
+    NIF.nif_snapshot_store(Keyword.get(opts, :tile, 64))
+  end
+
+  @doc """
+  Snapshot the current screen into `store`.
+
+  All snapshots in a store must share the framebuffer layout (size, depth
+  and rotation) of the first one; others are rejected with `{:error, code}`.
+  """
+  @spec snapshot(fbfd(), snapshot_store()) :: {:ok, snapshot()} | {:error, integer()}
+  def snapshot(fbfd, store), do: NIF.nif_snapshot(fbfd, store)
+
+  @doc """
+  Bring the screen back to `snapshot`.
+
+  Only tiles that differ from the current screen are written, and they are
+  refreshed as a few merged regions. If `config` sets `no_refresh`, those
+  regions are recorded for `flush/2` instead (on handles returned by
+  `open/0`). Accepts `:merge_overhead` as in `flush/2`. Returns `{:ok, rects}` with the
+  regions that were restored.
+  """
+  @spec restore_snapshot(fbfd(), config(), snapshot(), keyword()) ::
+          {:ok, [map()]} | {:error, integer()}
+  def restore_snapshot(fbfd, config, snapshot, opts \\ []) do
+    overhead = Keyword.get(opts, :merge_overhead, @default_merge_overhead)
+    NIF.nif_restore_snapshot(fbfd, to_config_map(config), snapshot, overhead)
+  end
+
+  @doc """
+  Report the memory used by a snapshot or a whole store.
+
+  For a snapshot, returns `%{tiles:, bytes:, exclusive_bytes:}`. `:bytes`
+  charges each shared tile in proportion to its users, and
+  `:exclusive_bytes` is what dropping the snapshot would give back. For a
+  store, returns `%{tiles:, bytes:, tile_size:}` over all distinct tiles.
+  """
+  @spec snapshot_info(snapshot() | snapshot_store()) :: {:ok, map()}
+  def snapshot_info(ref), do: NIF.nif_snapshot_info(ref)
+
+  # ---------------------------------------------------------------------------
+  # Off-screen Canvas
+  # ---------------------------------------------------------------------------
+
+  @doc """
+  Create an off-screen canvas, starting as a copy of the current screen.
+
+  A canvas holds a full screen in the framebuffer's pixel format. Draw into it
+  with `canvas_fill/3`, `canvas_put_pixels/4` and `canvas_blit/4`; nothing
+  shows until `commit/4` copies it to the screen under a single refresh. The
+  next screen can be composed while the previous refresh is still running.
+  FBInk's text and image renderers only draw on the framebuffer, so they
+  can't target a canvas: load images with `load_image/4` (decoded off-screen)
+  and `canvas_blit/4` them, or render text to pixels yourself and use
+  `canvas_put_pixels/4`.
+
+  Canvas coordinates are the framebuffer's native ones, like dumps and
+  `get_pixels/3`; they only differ from screen coordinates on rotated
+  framebuffers.
+
+  ## Example
+
+      {:ok, canvas} = FBInk.canvas(fd)
+      :ok = FBInk.canvas_fill(canvas, %FBInk.Rect{}, 0xFF)
+      :ok = FBInk.canvas_blit(canvas, icon, 10, 60)
+      {:ok, _} = FBInk.commit(fd, canvas, config)
+  """
+  @spec canvas(fbfd()) :: {:ok, canvas()} | {:error, integer()}
+  def canvas(fbfd), do: NIF.nif_canvas(fbfd)
+
+  @doc """
+  Fill `rect` of the canvas with a gray level or an `{r, g, b, a}` color.
+
+  An empty rect (the `%FBInk.Rect{}` default) fills the whole canvas.
+  """
+  @spec canvas_fill(canvas(), rect(), 0..255 | {0..255, 0..255, 0..255, 0..255}) ::
+          :ok | {:error, :enomem}
+  def canvas_fill(canvas, rect, color) do
+    NIF.nif_canvas_fill(canvas, to_rect_map(rect), color)
+  end
+
+  @doc """
+  Write a rect of pixels into the canvas.
+
+  Same `format`s and data layout as `put_pixels/5` (plus `:rgb`), but `rect`
+  must lie inside the canvas, otherwise `{:error, :einval}` is returned.
+  """
+  @spec canvas_put_pixels(canvas(), rect(), binary(), :y8 | :rgb | :rgba | :native) ::
+          :ok | {:error, atom()}
+  def canvas_put_pixels(canvas, rect, data, format) do
+    NIF.nif_canvas_put_pixels(canvas, to_rect_map(rect), data, format)
+  end
+
+  @doc """
+  Copy an image from `load_image/4`, or a dump, into the canvas at `x`, `y`.
+
+  The pixels are copied as they are, clipped to the canvas. Returns
+  `{:error, :mismatch}` if they don't have the canvas' pixel format.
+  """
+  @spec canvas_blit(canvas(), image() | dump_ref(), integer(), integer()) ::
+          :ok | {:error, atom()}
+  def canvas_blit(canvas, source, x, y), do: NIF.nif_canvas_blit(canvas, source, x, y)
+
+  @doc """
+  Copy the canvas to the screen and refresh what changed in one update.
+
+  `area` is `:dirty` (the default) for the areas drawn since the last
+  commit, `:all` for the whole canvas, or a rect. Each area is copied with
+  `no_refresh`, then their union is refreshed once with `config` (or
+  recorded for `flush/2` if `config` sets `no_refresh`).
+  """
+  @spec commit(fbfd(), canvas(), config(), :dirty | :all | rect()) ::
+          ok_int() | {:error, :mismatch}
+  def commit(fbfd, canvas, config, area \\ :dirty) do
+    area = if area in [:dirty, :all], do: area, else: to_rect_map(area)
+    NIF.nif_commit(fbfd, canvas, to_config_map(config), area)
+  end
+
+  @doc """
+  Return `%{area:, bpp:, dirty:}` for a canvas, `dirty` being the rects
+  the next `commit/4` would copy.
+  """
+  @spec canvas_info(canvas()) :: {:ok, map()}
+  def canvas_info(canvas), do: NIF.nif_canvas_info(canvas)
+
   # ---------------------------------------------------------------------------
   # Screen Inversion
   # ---------------------------------------------------------------------------
@@ -608,10 +1336,14 @@ defmodule FBInk do
 
   @doc """
   Invert the pixels in a rectangular region.
+
+  The region is never refreshed. On handles returned by `open/0` it is recorded
+  for `flush/2`, refreshed with `config`'s `wfm_mode`, `is_flashing`,
+  `dithering_mode` and `is_nightmode`.
   """
-  @spec invert_rect(fbfd(), rect(), boolean()) :: ok_int()
-  def invert_rect(fbfd, rect, no_rota \\ false) do
-    NIF.nif_invert_rect(fbfd, to_rect_map(rect), bool_to_int(no_rota))
+  @spec invert_rect(fbfd(), rect(), boolean(), config()) :: ok_int()
+  def invert_rect(fbfd, rect, no_rota \\ false, config \\ %FBInk.Config{}) do
+    NIF.nif_invert_rect(fbfd, to_rect_map(rect), bool_to_int(no_rota), to_config_map(config))
   end
 
   # ---------------------------------------------------------------------------
@@ -693,6 +1425,49 @@ defmodule FBInk do
     )
   end
 
+  @doc """
+  Fill many rectangles in one call, with a single refresh.
+
+  `rects` is either a list of `{rect, color}` tuples, where `color` is a
+  grayscale value (0-255) or an `{r, g, b, a}` tuple, or a binary of packed
+  grayscale fills, `<<x::16, y::16, w::16, h::16, y8::8>>` each.
+
+  Fills are drawn natively in list order without refreshing, so later fills
+  paint over earlier ones where they overlap. The damage is then refreshed
+  once with `config` (or recorded for `flush/2` with `no_refresh: true`).
+
+  ## Options
+
+    * `:no_rota` - Skip rotation handling, as in `fill_rect_gray/5` (default `false`).
+    * `:refresh` - `:union` refreshes the bounding box of all fills (default);
+      `:merged` refreshes merged damage rects instead, as `flush/2` does.
+    * `:merge_overhead` - Pixels two rects may waste when merged with
+      `refresh: :merged` (default #{@default_merge_overhead}).
+
+  Returns `{:ok, refreshes}`.
+  """
+  @spec fill_rects(
+          fbfd(),
+          config(),
+          [{rect(), non_neg_integer() | tuple()}] | binary(),
+          keyword()
+        ) :: ok_int()
+  def fill_rects(fbfd, config, rects, opts \\ []) do
+    rects =
+      if is_binary(rects),
+        do: rects,
+        else: Enum.map(rects, fn {rect, color} -> {to_rect_map(rect), color} end)
+
+    NIF.nif_fill_rects(
+      fbfd,
+      to_config_map(config),
+      rects,
+      bool_to_int(Keyword.get(opts, :no_rota, false)),
+      bool_to_int(Keyword.get(opts, :refresh, :union) == :merged),
+      Keyword.get(opts, :merge_overhead, @default_merge_overhead)
+    )
+  end
+
   @doc """
   Set a single pixel to a grayscale value.
   """
@@ -730,6 +1505,82 @@ defmodule FBInk do
     NIF.nif_get_pixel(fbfd, x, y)
   end
 
+  @doc """
+  Draw vector shapes in one call.
+
+  All shapes are rasterized natively into a coverage mask over their common
+  bounding box, which is drawn with the config's foreground color (honoring
+  `is_inverted` and night mode) and refreshed as a single rect, or recorded
+  for `flush/2` with `no_refresh: true`. Uncovered pixels are left untouched.
+
+  Shapes:
+
+    * `{:line, x0, y0, x1, y1}` - Bresenham line
+    * `{:aa_line, x0, y0, x1, y1}` - Anti-aliased line
+    * `{:polyline, points}` / `{:aa_polyline, points}` - Connected segments
+    * `{:polygon, points}` / `{:fill_polygon, points}` - Closed outline, or
+      even-odd fill
+    * `{:circle, cx, cy, r}` / `{:fill_circle, cx, cy, r}`
+    * `{:arc, cx, cy, r, start, stop}` - Degrees, counter-clockwise from
+      3 o'clock
+    * `{:rounded_rect, x, y, w, h, r}` / `{:fill_rounded_rect, x, y, w, h, r}`
+
+  `points` is a binary of packed `<<x::16, y::16>>` pairs, e.g.
+  `for {x, y} <- samples, into: <<>>, do: <<x::16, y::16>>`.
+  """
+  @spec draw_shapes(fbfd(), [shape()], config()) :: ok_int() | {:error, atom()}
+  def draw_shapes(fbfd, shapes, config \\ %FBInk.Config{}) when is_list(shapes) do
+    NIF.nif_draw_shapes(fbfd, shapes, to_config_map(config))
+  end
+
+  @doc """
+  Read all pixels of a rect in one call.
+
+  `format` is `:y8` (one luma byte per pixel), `:rgba` (four bytes per pixel)
+  or `:native` (the framebuffer's own pixel format). Rows are returned back to
+  back without padding. `:y8` and `:rgba` rows are in the same (canonical)
+  orientation as `rect`, so they can be written back with `put_pixels/5`;
+  `:native` rows are in the framebuffer's native orientation, like dumps.
+
+  Returns `{:ok, %{data:, width:, height:, area:}}`, where `:area` is the
+  rect that was read: canonical for `:y8` and `:rgba`, native for `:native`.
+  """
+  @spec get_pixels(fbfd(), rect(), :y8 | :rgba | :native) ::
+          {:ok, map()} | {:error, integer() | atom()}
+  def get_pixels(fbfd, rect, format) do
+    NIF.nif_get_pixels(fbfd, to_rect_map(rect), format)
+  end
+
+  @doc """
+  Write a whole rect of pixels in one call.
+
+  `data` holds `rect.width * rect.height` pixels in `format`: `:y8` or
+  `:rgba` buffers are converted by FBInk (as with `print_raw_data/7`), while
+  `:native` rows are copied as-is and `rect` is then a native area, such as
+  the `:area` returned by `get_pixels/3`.
+
+  Returns `{:error, :einval}` if `data` has the wrong size.
+  """
+  @spec put_pixels(fbfd(), rect(), binary(), :y8 | :rgba | :native, config()) ::
+          {:ok, integer()} | {:error, integer() | atom()}
+  def put_pixels(fbfd, rect, data, format, config \\ %FBInk.Config{}) do
+    NIF.nif_put_pixels(fbfd, to_rect_map(rect), data, format, to_config_map(config))
+  end
+
+  @doc """
+  Plot many individual pixels in one call.
+
+  `points` is a binary of packed records: `<<x::16, y::16, v::8>>` for
+  `:gray`, or `<<x::16, y::16, r::8, g::8, b::8, a::8>>` for `:rgba`. The
+  bounding box of all points is refreshed once (or recorded for `flush/2`
+  with `no_refresh: true`).
+  """
+  @spec put_pixels_scatter(fbfd(), binary(), :gray | :rgba, config()) ::
+          {:ok, integer()} | {:error, integer() | atom()}
+  def put_pixels_scatter(fbfd, points, format, config \\ %FBInk.Config{}) do
+    NIF.nif_put_pixels_scatter(fbfd, points, format, to_config_map(config))
+  end
+
   @doc """
   Pack a grayscale value into a native pixel value for the current fb format.
   """
@@ -747,6 +1598,81 @@ defmodule FBInk do
         ) :: {:ok, non_neg_integer()} | {:error, integer()}
   def pack_pixel_rgba(r, g, b, a), do: NIF.nif_pack_pixel_rgba(r, g, b, a)
 
+  @doc """
+  Pack a whole buffer into the current fb format in one call.
+
+  `src_format` is `:y8`, `:rgb` (RGB24) or `:rgba` (RGBA32). Every pixel is
+  packed as `pack_pixel_gray/1` / `pack_pixel_rgba/4` would, into Y8 (inverted
+  on `inverted_grayscale` framebuffers), RGB565, BGR24 or BGRA32, using SSE2
+  or NEON where available. Alpha is kept on 32bpp from `:rgba` sources.
+
+  Returns `{:ok, binary}`, or `{:error, :enotsup}` on 4bpp framebuffers.
+  """
+  @spec pack_buffer(binary(), :y8 | :rgb | :rgba) :: {:ok, binary()} | {:error, atom()}
+  def pack_buffer(data, src_format) when is_binary(data) do
+    NIF.nif_pack_buffer(data, src_format)
+  end
+
+  @doc """
+  Resample a Y8 or RGBA buffer `width` pixels wide to `{dst_width, dst_height}`.
+
+  Filters are separable and run natively, with SIMD horizontal passes and
+  large outputs split into row bands over the native worker pool:
+
+    * `:box` - Area average when downscaling (nearest-like when upscaling).
+    * `:bilinear` - Triangle filter, stretched when downscaling.
+    * `:lanczos` - Lanczos-3, sharpest (default).
+
+  ## Options
+
+    * `:format` - `:y8` (default) or `:rgba`.
+    * `:filter` - See above.
+    * `:threads` - Most threads to use, the caller's included (default: the
+      whole pool). The output doesn't depend on it.
+
+  `print_raw_data/8` takes the same filters with its `:scale` option.
+  """
+  @spec scale_buffer(binary(), pos_integer(), {pos_integer(), pos_integer()}, keyword()) ::
+          {:ok, binary()} | {:error, atom()}
+  def scale_buffer(data, width, {dst_width, dst_height}, opts \\ []) when is_binary(data) do
+    NIF.nif_scale_buffer(
+      data,
+      width,
+      dst_width,
+      dst_height,
+      Keyword.get(opts, :format, :y8),
+      Keyword.get(opts, :filter, :lanczos),
+      Keyword.get(opts, :threads, 0)
+    )
+  end
+
+  @doc """
+  Dither a Y8, RGB or RGBA buffer `width` pixels wide to a Y8 buffer of gray levels.
+
+  The output only holds multiples of `255 / (levels - 1)`, which FBInk passes
+  through its own quantization unchanged. Use it to prepare data for
+  `print_raw_data/8` ahead of time; that function and `load_image/4` can
+  also dither natively on the way with their `:dither` option.
+
+  ## Options
+
+    * `:format` - `:y8` (default), `:rgb` or `:rgba`.
+    * `:method` - `:floyd_steinberg` (default), `:atkinson`, `:bayer` or
+      `:blue_noise`. The ordered methods (`:bayer`, `:blue_noise`) are
+      vectorized and much faster; error diffusion looks better on photos.
+    * `:levels` - 16 (default), 4 or 2.
+  """
+  @spec dither(binary(), pos_integer(), keyword()) :: {:ok, binary()} | {:error, atom()}
+  def dither(data, width, opts \\ []) when is_binary(data) do
+    NIF.nif_dither(
+      data,
+      width,
+      Keyword.get(opts, :format, :y8),
+      Keyword.get(opts, :method, :floyd_steinberg),
+      Keyword.get(opts, :levels, 16)
+    )
+  end
+
   # ---------------------------------------------------------------------------
   # EPDC Wakeup
   # ---------------------------------------------------------------------------
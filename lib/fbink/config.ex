@@ -33,7 +33,10 @@ defmodule FBInk.Config do
     * `:valign` - Vertical alignment for images/dumps (see `FBInk.Align`).
     * `:scaled_width` - Scale image to this width (0 = no scale, -1 = viewport width).
     * `:scaled_height` - Scale image to this height (0 = no scale, -1 = viewport height).
-    * `:wfm_mode` - Waveform mode (see `FBInk.WaveformMode`).
+    * `:wfm_mode` - Waveform mode (see `FBInk.WaveformMode`), or `:auto` to
+      pick one from the refreshed content: DU for pure black/white, GL16/REAGL
+      for text, GC16 for images (eclipse or color variants where the panel
+      has them). See `FBInk.waveform_stats/0`.
     * `:dithering_mode` - Hardware dithering mode (see `FBInk.DitheringMode`).
     * `:sw_dithering` - Use software ordered dithering for images.
     * `:cfa_mode` - CFA post-processing mode for color panels.
@@ -72,7 +75,7 @@ defmodule FBInk.Config do
           valign: non_neg_integer(),
           scaled_width: integer(),
           scaled_height: integer(),
-          wfm_mode: non_neg_integer(),
+          wfm_mode: non_neg_integer() | :auto,
           dithering_mode: non_neg_integer(),
           sw_dithering: boolean(),
           cfa_mode: non_neg_integer(),
@@ -128,4 +131,18 @@ defmodule FBInk.Config do
   def to_map(%__MODULE__{} = config) do
     Map.from_struct(config)
   end
+
+  @doc """
+  Precompile a config into an immutable NIF resource.
+
+  The returned reference holds a ready-made `FBInkConfig` and can be passed
+  anywhere a config is accepted, skipping per-call map decoding. Useful for
+  configs reused on hot paths (e.g. widgets redrawn many times per second).
+
+      cfg = FBInk.Config.compile(%FBInk.Config{no_refresh: true})
+      {:ok, _} = FBInk.print(fd, "Hello", cfg)
+  """
+  @spec compile(t() | map()) :: reference()
+  def compile(%__MODULE__{} = config), do: config |> to_map() |> compile()
+  def compile(%{} = config), do: FBInk.NIF.nif_compile_config(config)
 end
@@ -0,0 +1,195 @@
+defmodule FBInk.ImageCache do
+  @moduledoc """
+  Memory-bounded LRU cache of decoded images.
+
+  Images are loaded with `FBInk.load_image/3` on first use and kept until the
+  total size of cached images exceeds `:max_bytes`, at which point the least
+  recently used ones are dropped. Entries are keyed by path, the file's
+  mtime, size and inode, the config fields that affect decoding (scaling,
+  alignment, dithering, ...) and the framebuffer's current rotation and bit
+  depth, so edited files and rotations are picked up automatically. The file
+  is `stat`ed in the calling process, so a slow filesystem never holds up the
+  cache for other callers. mtimes have 1-second resolution: a file rewritten
+  in place with the same size within the second it was cached goes unnoticed,
+  while one replaced through a rename (a new inode) is always picked up.
+
+  ## Example
+
+      {:ok, cache} = FBInk.ImageCache.start_link(fb: fd, max_bytes: 8 * 1024 * 1024)
+      {:ok, _} = FBInk.ImageCache.blit(cache, "/usr/share/icons/wifi.png", 10, 10, config)
+  """
+
+  use GenServer
+
+  @default_max_bytes 16 * 1024 * 1024
+
+  # Config fields that change the decoded pixels
+  @decode_keys [
+    :scaled_width,
+    :scaled_height,
+    :halign,
+    :valign,
+    :sw_dithering,
+    :ignore_alpha,
+    :is_inverted,
+    :saturation_boost,
+    :cfa_mode
+  ]
+
+  # ---------------------------------------------------------------------------
+  # Public API
+  # ---------------------------------------------------------------------------
+
+  @doc """
+  Start a cache.
+
+  ## Options
+
+    * `:fb` - Framebuffer handle or fd used for decoding (required).
+    * `:max_bytes` - Upper bound on the size of cached images (default 16 MiB).
+    * `:name` - Optional process name.
+  """
+  @spec start_link(keyword()) :: GenServer.on_start()
+  def start_link(opts) do
+    {name, opts} = Keyword.pop(opts, :name)
+    GenServer.start_link(__MODULE__, opts, if(name, do: [name: name], else: []))
+  end
+
+  @doc """
+  Return the cached image for `path` decoded with `config`, loading it on a miss.
+  """
+  @spec fetch(GenServer.server(), String.t(), FBInk.config()) ::
+          {:ok, FBInk.image()} | {:error, term()}
+  def fetch(cache, path, config \\ %FBInk.Config{}) do
+    with {:ok, stat} <- File.stat(path, time: :posix) do
+      version = {stat.mtime, stat.size, stat.inode}
+      GenServer.call(cache, {:fetch, path, version, config}, :infinity)
+    end
+  end
+
+  @doc """
+  Fetch `path` and blit it at `x`, `y` with `config` (see `FBInk.blit_image/5`).
+  """
+  @spec blit(GenServer.server(), String.t(), integer(), integer(), FBInk.config()) ::
+          FBInk.ok_int() | {:error, term()}
+  def blit(cache, path, x, y, config) do
+    with {:ok, image} <- fetch(cache, path, config) do
+      FBInk.blit_image(GenServer.call(cache, :fb), image, x, y, config)
+    end
+  end
+
+  @doc """
+  Return `%{entries: n, bytes: n, hits: n, misses: n, evictions: n}`.
+  """
+  @spec stats(GenServer.server()) :: map()
+  def stats(cache) do
+    GenServer.call(cache, :stats)
+  end
+
+  @doc """
+  Drop every cached image.
+  """
+  @spec clear(GenServer.server()) :: :ok
+  def clear(cache) do
+    GenServer.call(cache, :clear)
+  end
+
+  # ---------------------------------------------------------------------------
+  # GenServer callbacks
+  # ---------------------------------------------------------------------------
+
+  @impl true
+  def init(opts) do
+    state = %{
+      fb: Keyword.fetch!(opts, :fb),
+      max_bytes: Keyword.get(opts, :max_bytes, @default_max_bytes),
+      # key => {image, bytes, last_used}
+      entries: %{},
+      bytes: 0,
+      tick: 0,
+      stats: %{hits: 0, misses: 0, evictions: 0}
+    }
+
+    {:ok, state}
+  end
+
+  @impl true
+  def handle_call({:fetch, path, version, config}, _from, state) do
+    lookup(state, cache_key(path, version, config), path, config)
+  end
+
+  def handle_call(:fb, _from, state) do
+    {:reply, state.fb, state}
+  end
+
+  def handle_call(:stats, _from, state) do
+    stats = Map.merge(state.stats, %{entries: map_size(state.entries), bytes: state.bytes})
+    {:reply, stats, state}
+  end
+
+  def handle_call(:clear, _from, state) do
+    {:reply, :ok, %{state | entries: %{}, bytes: 0}}
+  end
+
+  # ---------------------------------------------------------------------------
+  # Internals
+  # ---------------------------------------------------------------------------
+
+  defp lookup(state, key, path, config) do
+    state = %{state | tick: state.tick + 1}
+
+    case Map.fetch(state.entries, key) do
+      {:ok, {image, bytes, _}} ->
+        state = put_in(state.entries[key], {image, bytes, state.tick})
+        {:reply, {:ok, image}, bump(state, :hits)}
+
+      :error ->
+        state = bump(state, :misses)
+
+        case FBInk.load_image(state.fb, path, config) do
+          {:ok, image} ->
+            bytes = FBInk.image_info(image).size
+
+            state =
+              %{state | entries: Map.put(state.entries, key, {image, bytes, state.tick})}
+              |> Map.update!(:bytes, &(&1 + bytes))
+              |> evict(key)
+
+            {:reply, {:ok, image}, state}
+
+          error ->
+            {:reply, error, state}
+        end
+    end
+  end
+
+  # Drop least recently used entries (never `keep`) until under max_bytes
+  defp evict(%{bytes: bytes, max_bytes: max} = state, _keep) when bytes <= max, do: state
+
+  defp evict(state, keep) do
+    candidates = Map.delete(state.entries, keep)
+
+    if map_size(candidates) == 0 do
+      state
+    else
+      {key, {_image, bytes, _}} = Enum.min_by(candidates, fn {_k, {_i, _b, used}} -> used end)
+
+      %{state | entries: Map.delete(state.entries, key), bytes: state.bytes - bytes}
+      |> bump(:evictions)
+      |> evict(keep)
+    end
+  end
+
+  defp cache_key(path, version, config) do
+    fb_state = FBInk.get_state(config)
+    {path, version, decode_params(config), fb_state.current_rota, fb_state.bpp}
+  end
+
+  defp decode_params(%FBInk.Config{} = config), do: decode_params(Map.from_struct(config))
+  defp decode_params(%{} = config), do: Map.take(config, @decode_keys)
+  defp decode_params(ref) when is_reference(ref), do: ref
+
+  defp bump(state, key) do
+    update_in(state, [:stats, key], &(&1 + 1))
+  end
+end
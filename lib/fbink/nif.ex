@@ -12,9 +12,18 @@ defmodule FBInk.NIF do
   def nif_target, do: :erlang.nif_error(:not_loaded)
   def nif_features, do: :erlang.nif_error(:not_loaded)
 
+  # Precompiled configs
+  def nif_compile_config(_config), do: :erlang.nif_error(:not_loaded)
+  def nif_compile_ot_config(_config), do: :erlang.nif_error(:not_loaded)
+  def nif_compile_rect(_rect), do: :erlang.nif_error(:not_loaded)
+
   # Lifecycle
   def nif_open, do: :erlang.nif_error(:not_loaded)
   def nif_close(_fbfd), do: :erlang.nif_error(:not_loaded)
+  def nif_submit(_fb, _op, _pid), do: :erlang.nif_error(:not_loaded)
+  def nif_batch(_fbfd, _ops), do: :erlang.nif_error(:not_loaded)
+  def nif_flush(_fb, _merge_overhead), do: :erlang.nif_error(:not_loaded)
+  def nif_waveform_stats, do: :erlang.nif_error(:not_loaded)
   def nif_init(_fbfd, _config), do: :erlang.nif_error(:not_loaded)
   def nif_reinit(_fbfd, _config), do: :erlang.nif_error(:not_loaded)
 
@@ -54,6 +63,22 @@ defmodule FBInk.NIF do
   def nif_print_raw_data(_fbfd, _data, _w, _h, _x_off, _y_off, _config),
     do: :erlang.nif_error(:not_loaded)
 
+  def nif_print_raw_data(_fbfd, _data, _w, _h, _x_off, _y_off, _config, _prepass),
+    do: :erlang.nif_error(:not_loaded)
+
+  def nif_print_image_binary(_fbfd, _data, _x_off, _y_off, _config),
+    do: :erlang.nif_error(:not_loaded)
+
+  def nif_print_image_stream(_fbfd, _filename, _x_off, _y_off, _config, _prepass),
+    do: :erlang.nif_error(:not_loaded)
+
+  def nif_load_image(_fbfd, _filename, _config), do: :erlang.nif_error(:not_loaded)
+
+  def nif_load_image(_fbfd, _filename, _config, _dither, _levels),
+    do: :erlang.nif_error(:not_loaded)
+  def nif_blit_image(_fbfd, _image, _x, _y, _config), do: :erlang.nif_error(:not_loaded)
+  def nif_image_info(_image), do: :erlang.nif_error(:not_loaded)
+
   # Screen clear
   def nif_cls(_fbfd, _config, _rect, _no_rota), do: :erlang.nif_error(:not_loaded)
   def nif_grid_clear(_fbfd, _cols, _rows, _config), do: :erlang.nif_error(:not_loaded)
@@ -67,6 +92,8 @@ defmodule FBInk.NIF do
   def nif_wait_for_submission(_fbfd, _marker), do: :erlang.nif_error(:not_loaded)
   def nif_wait_for_complete(_fbfd, _marker), do: :erlang.nif_error(:not_loaded)
   def nif_wait_for_any_complete(_fbfd), do: :erlang.nif_error(:not_loaded)
+  def nif_refresh_async(_fbfd, _rect, _config, _pid), do: :erlang.nif_error(:not_loaded)
+  def nif_notify_refresh(_fbfd, _marker, _pid), do: :erlang.nif_error(:not_loaded)
 
   # Dump/Restore
   def nif_dump(_fbfd), do: :erlang.nif_error(:not_loaded)
@@ -76,12 +103,42 @@ defmodule FBInk.NIF do
 
   def nif_rect_dump(_fbfd, _rect), do: :erlang.nif_error(:not_loaded)
   def nif_restore(_fbfd, _config, _dump), do: :erlang.nif_error(:not_loaded)
+  def nif_restore_rect(_fbfd, _dump, _rect, _config), do: :erlang.nif_error(:not_loaded)
   def nif_free_dump_data(_dump), do: :erlang.nif_error(:not_loaded)
   def nif_get_dump_data(_dump), do: :erlang.nif_error(:not_loaded)
+  def nif_get_dump_rect_data(_dump, _rect), do: :erlang.nif_error(:not_loaded)
+  def nif_compress_dump(_dump), do: :erlang.nif_error(:not_loaded)
+  def nif_dump_info(_dump), do: :erlang.nif_error(:not_loaded)
+  def nif_save_dump(_dump, _path), do: :erlang.nif_error(:not_loaded)
+  def nif_load_dump(_path), do: :erlang.nif_error(:not_loaded)
+  def nif_diff_dumps(_a, _b, _tile, _merge_overhead), do: :erlang.nif_error(:not_loaded)
+
+  def nif_diff_dump_against_screen(_fbfd, _dump, _tile, _merge_overhead),
+    do: :erlang.nif_error(:not_loaded)
+
+  def nif_restore_changed(_fbfd, _config, _dump, _tile, _merge_overhead),
+    do: :erlang.nif_error(:not_loaded)
+
+  # Snapshots
+  def nif_snapshot_store(_tile), do: :erlang.nif_error(:not_loaded)
+  def nif_snapshot(_fbfd, _store), do: :erlang.nif_error(:not_loaded)
+
+  def nif_restore_snapshot(_fbfd, _config, _snapshot, _merge_overhead),
+    do: :erlang.nif_error(:not_loaded)
+
+  def nif_snapshot_info(_ref), do: :erlang.nif_error(:not_loaded)
+
+  # Off-screen canvases
+  def nif_canvas(_fbfd), do: :erlang.nif_error(:not_loaded)
+  def nif_canvas_fill(_canvas, _rect, _color), do: :erlang.nif_error(:not_loaded)
+  def nif_canvas_put_pixels(_canvas, _rect, _data, _format), do: :erlang.nif_error(:not_loaded)
+  def nif_canvas_blit(_canvas, _source, _x, _y), do: :erlang.nif_error(:not_loaded)
+  def nif_commit(_fbfd, _canvas, _config, _area), do: :erlang.nif_error(:not_loaded)
+  def nif_canvas_info(_canvas), do: :erlang.nif_error(:not_loaded)
 
   # Screen inversion
   def nif_invert_screen(_fbfd, _config), do: :erlang.nif_error(:not_loaded)
-  def nif_invert_rect(_fbfd, _rect, _no_rota), do: :erlang.nif_error(:not_loaded)
+  def nif_invert_rect(_fbfd, _rect, _no_rota, _config), do: :erlang.nif_error(:not_loaded)
 
   # Rotation helpers
   def nif_rota_native_to_canonical(_rotate), do: :erlang.nif_error(:not_loaded)
@@ -98,14 +155,30 @@ defmodule FBInk.NIF do
   def nif_fill_rect_rgba(_fbfd, _config, _rect, _no_rota, _r, _g, _b, _a),
     do: :erlang.nif_error(:not_loaded)
 
+  def nif_fill_rects(_fbfd, _config, _rects, _no_rota, _merge, _overhead),
+    do: :erlang.nif_error(:not_loaded)
+
   def nif_put_pixel_gray(_fbfd, _x, _y, _v), do: :erlang.nif_error(:not_loaded)
 
   def nif_put_pixel_rgba(_fbfd, _x, _y, _r, _g, _b, _a),
     do: :erlang.nif_error(:not_loaded)
 
   def nif_get_pixel(_fbfd, _x, _y), do: :erlang.nif_error(:not_loaded)
+  def nif_get_pixels(_fbfd, _rect, _format), do: :erlang.nif_error(:not_loaded)
+  def nif_put_pixels(_fbfd, _rect, _data, _format, _config), do: :erlang.nif_error(:not_loaded)
+
+  def nif_put_pixels_scatter(_fbfd, _points, _format, _config),
+    do: :erlang.nif_error(:not_loaded)
+
+  def nif_draw_shapes(_fbfd, _shapes, _config), do: :erlang.nif_error(:not_loaded)
+
   def nif_pack_pixel_gray(_y), do: :erlang.nif_error(:not_loaded)
   def nif_pack_pixel_rgba(_r, _g, _b, _a), do: :erlang.nif_error(:not_loaded)
+  def nif_pack_buffer(_data, _src_format), do: :erlang.nif_error(:not_loaded)
+  def nif_dither(_data, _width, _format, _method, _levels), do: :erlang.nif_error(:not_loaded)
+
+  def nif_scale_buffer(_data, _width, _dst_width, _dst_height, _format, _filter, _threads),
+    do: :erlang.nif_error(:not_loaded)
 
   # EPDC wakeup
   def nif_wakeup_epdc, do: :erlang.nif_error(:not_loaded)
@@ -43,4 +43,13 @@ defmodule FBInk.OTConfig do
   def to_map(%__MODULE__{} = config) do
     Map.from_struct(config)
   end
+
+  @doc """
+  Precompile an OpenType config into an immutable NIF resource.
+
+  See `FBInk.Config.compile/1`.
+  """
+  @spec compile(t() | map()) :: reference()
+  def compile(%__MODULE__{} = config), do: config |> to_map() |> compile()
+  def compile(%{} = config), do: FBInk.NIF.nif_compile_ot_config(config)
 end
@@ -18,4 +18,13 @@ defmodule FBInk.Rect do
   def to_map(%__MODULE__{} = rect) do
     Map.from_struct(rect)
   end
+
+  @doc """
+  Precompile a rectangle into an immutable NIF resource.
+
+  See `FBInk.Config.compile/1`.
+  """
+  @spec compile(t() | map()) :: reference()
+  def compile(%__MODULE__{} = rect), do: rect |> to_map() |> compile()
+  def compile(%{} = rect), do: FBInk.NIF.nif_compile_rect(rect)
 end
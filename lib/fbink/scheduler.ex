@@ -0,0 +1,261 @@
+defmodule FBInk.Scheduler do
+  @moduledoc """
+  Frame-paced refresh scheduler with latest-wins coalescing.
+
+  Fast-changing content (sensor readouts, timers, progress) can easily be
+  produced faster than an eInk panel refreshes. Instead of drawing and
+  refreshing on every change, callers post updates to a named *region* slot:
+
+    * Each region holds at most one pending update. Posting again before the
+      pending one was drawn replaces it (the replaced update is counted as
+      *dropped*).
+    * A region is not redrawn while its previous refresh is still in flight,
+      nor before the minimum interval for its waveform mode has elapsed since
+      its last dispatch.
+    * All regions that are due at the same time are drawn in a single
+      `FBInk.batch/2` call, so their refreshes are coalesced per waveform
+      (every region sharing a refresh with an earlier one is counted as
+      *merged*).
+    * If that call fails, its updates stay pending and are retried once the
+      minimum interval has elapsed; they are not counted as *dispatched*.
+
+  Completion of each region's own refresh is tracked with
+  `FBInk.notify_refresh/3`, so latency stays bounded by roughly one refresh
+  plus the configured interval, whatever the update rate.
+
+  ## Example
+
+      {:ok, sched} = FBInk.Scheduler.start_link(fb: fd, min_interval: %{4 => 50})
+
+      cfg = %FBInk.Config{row: 3, wfm_mode: FBInk.Constants.WaveformMode.a2()}
+      rect = %FBInk.Rect{top: 96, width: 600, height: 32}
+
+      FBInk.Scheduler.update(sched, :clock, rect, [{:print, "12:00:01", cfg}], cfg)
+  """
+
+  use GenServer
+
+  @type region :: term()
+  @type stats :: %{
+          dispatched: non_neg_integer(),
+          dropped: non_neg_integer(),
+          merged: non_neg_integer()
+        }
+
+  @default_interval 100
+
+  # ---------------------------------------------------------------------------
+  # Public API
+  # ---------------------------------------------------------------------------
+
+  @doc """
+  Start a scheduler.
+
+  ## Options
+
+    * `:fb` - Framebuffer handle or fd to draw on (required).
+    * `:min_interval` - Map of waveform mode to minimum milliseconds between
+      two dispatches of the same region (e.g. `%{4 => 50, 2 => 500}`). Use
+      the key `:auto` for configs with `wfm_mode: :auto`.
+    * `:default_interval` - Minimum interval for waveform modes not listed in
+      `:min_interval`, and for compiled configs (default #{@default_interval}).
+    * `:name` - Optional process name.
+  """
+  @spec start_link(keyword()) :: GenServer.on_start()
+  def start_link(opts) do
+    {name, opts} = Keyword.pop(opts, :name)
+    GenServer.start_link(__MODULE__, opts, if(name, do: [name: name], else: []))
+  end
+
+  @doc """
+  Post an update for `region`.
+
+  `ops` are draw ops as accepted by `FBInk.batch/2`, drawn when the region is
+  next dispatched; `rect` is the area refreshed afterwards with `config`.
+  Any update still pending for the same region is discarded.
+  """
+  @spec update(GenServer.server(), region(), FBInk.rect(), [FBInk.draw_op()], FBInk.config()) ::
+          :ok
+  def update(server, region, rect, ops, config) when is_list(ops) do
+    GenServer.cast(server, {:update, region, rect, ops, config})
+  end
+
+  @doc """
+  Return the scheduler counters.
+  """
+  @spec stats(GenServer.server()) :: stats()
+  def stats(server) do
+    GenServer.call(server, :stats)
+  end
+
+  # ---------------------------------------------------------------------------
+  # GenServer callbacks
+  # ---------------------------------------------------------------------------
+
+  @impl true
+  def init(opts) do
+    state = %{
+      fb: Keyword.fetch!(opts, :fb),
+      min_interval: Keyword.get(opts, :min_interval, %{}),
+      default_interval: Keyword.get(opts, :default_interval, @default_interval),
+      # region => %{pending: nil | {rect, ops, config}, in_flight: marker | nil, last: ms}
+      slots: %{},
+      # marker => [region]
+      in_flight: %{},
+      timer: nil,
+      stats: %{dispatched: 0, dropped: 0, merged: 0}
+    }
+
+    {:ok, state}
+  end
+
+  @impl true
+  def handle_cast({:update, region, rect, ops, config}, state) do
+    slot = Map.get(state.slots, region, %{pending: nil, in_flight: nil, last: nil})
+    state = if slot.pending, do: bump(state, :dropped, 1), else: state
+    slot = %{slot | pending: {rect, ops, config}}
+
+    {:noreply, state |> put_in([:slots, region], slot) |> dispatch()}
+  end
+
+  @impl true
+  def handle_call(:stats, _from, state) do
+    {:reply, state.stats, state}
+  end
+
+  @impl true
+  def handle_info(:tick, state) do
+    {:noreply, dispatch(%{state | timer: nil})}
+  end
+
+  def handle_info({:fbink_refresh, _marker, :submitted, _us}, state) do
+    {:noreply, state}
+  end
+
+  def handle_info({:fbink_refresh, marker, _status, _us}, state) do
+    {regions, in_flight} = Map.pop(state.in_flight, marker, [])
+
+    slots =
+      Enum.reduce(regions, state.slots, fn region, slots ->
+        Map.update!(slots, region, &%{&1 | in_flight: nil})
+      end)
+
+    {:noreply, dispatch(%{state | slots: slots, in_flight: in_flight})}
+  end
+
+  def handle_info(_msg, state) do
+    {:noreply, state}
+  end
+
+  # ---------------------------------------------------------------------------
+  # Internals
+  # ---------------------------------------------------------------------------
+
+  defp dispatch(state) do
+    now = System.monotonic_time(:millisecond)
+
+    {due, waiting} =
+      state.slots
+      |> Enum.filter(fn {_region, slot} -> slot.pending && is_nil(slot.in_flight) end)
+      |> Enum.split_with(fn {_region, slot} -> ready_at(state, slot) <= now end)
+
+    state = run(state, due, now)
+
+    next =
+      waiting
+      |> Enum.map(fn {_region, slot} -> ready_at(state, slot) end)
+      |> Enum.min(fn -> nil end)
+
+    schedule(state, next && max(next - now, 0))
+  end
+
+  defp run(state, [], _now), do: state
+
+  defp run(state, due, now) do
+    # Each region's ops end with its refresh_rect, whose result carries the
+    # marker of the refresh covering the region
+    batches =
+      Enum.map(due, fn {region, %{pending: {rect, ops, config}}} ->
+        {region, ops ++ [{:refresh_rect, rect, config}]}
+      end)
+
+    case FBInk.batch(state.fb, Enum.flat_map(batches, &elem(&1, 1))) do
+      {:ok, results, _markers} -> dispatched(state, batches, results, now)
+      {:error, _} -> retry_later(state, due, now)
+    end
+  end
+
+  defp dispatched(state, batches, results, now) do
+    {markers, []} =
+      Enum.map_reduce(batches, results, fn {region, ops}, results ->
+        {own, rest} = Enum.split(results, length(ops))
+        {{region, region_marker(List.last(own))}, rest}
+      end)
+
+    refreshes = for {_region, marker} <- markers, marker > 0, uniq: true, do: marker
+
+    # Markers the waiter can't track (or no refresh at all) leave nothing in flight
+    tracked =
+      refreshes
+      |> Enum.filter(&(FBInk.notify_refresh(state.fb, &1) == :ok))
+      |> MapSet.new()
+
+    {slots, in_flight} =
+      Enum.reduce(markers, {state.slots, state.in_flight}, fn {region, marker}, {slots, flight} ->
+        tracked? = MapSet.member?(tracked, marker)
+        slot = %{slots[region] | pending: nil, in_flight: if(tracked?, do: marker), last: now}
+
+        flight =
+          if tracked?, do: Map.update(flight, marker, [region], &[region | &1]), else: flight
+
+        {Map.put(slots, region, slot), flight}
+      end)
+
+    merged = Enum.count(markers, fn {_region, marker} -> marker > 0 end) - length(refreshes)
+
+    %{state | slots: slots, in_flight: in_flight}
+    |> bump(:dispatched, length(markers))
+    |> bump(:merged, merged)
+  end
+
+  defp region_marker({:ok, marker}) when is_integer(marker), do: marker
+  defp region_marker(_result), do: 0
+
+  # Keep the updates pending, due again once their interval has elapsed
+  defp retry_later(state, due, now) do
+    slots =
+      Enum.reduce(due, state.slots, fn {region, _slot}, slots ->
+        Map.update!(slots, region, &%{&1 | last: now})
+      end)
+
+    %{state | slots: slots}
+  end
+
+  defp ready_at(_state, %{last: nil}), do: 0
+
+  defp ready_at(state, %{last: last, pending: {_rect, _ops, config}}) do
+    last + interval(state, config)
+  end
+
+  defp interval(state, %{wfm_mode: mode}) do
+    Map.get(state.min_interval, mode, state.default_interval)
+  end
+
+  defp interval(state, _config), do: state.default_interval
+
+  defp schedule(%{timer: nil} = state, nil), do: state
+
+  defp schedule(%{timer: timer} = state, nil) do
+    Process.cancel_timer(timer)
+    %{state | timer: nil}
+  end
+
+  defp schedule(state, delay) do
+    if state.timer, do: Process.cancel_timer(state.timer)
+    %{state | timer: Process.send_after(self(), :tick, delay)}
+  end
+
+  defp bump(state, key, n) do
+    update_in(state, [:stats, key], &(&1 + n))
+  end
+end
@@ -61,6 +61,9 @@ defmodule FBInk.MixProject do
         Map.put(env, "FBINK_DIR", fbink_dir)
       end
 
-    env
+    # Host test builds link an in-memory stand-in for libfbink, so `mix test`
+    # runs without a framebuffer. FBINK_STUB=0 links the real library.
+    stub_default = if Mix.env() == :test and !System.get_env("CROSSCOMPILE"), do: "1", else: "0"
+    Map.put(env, "FBINK_STUB", System.get_env("FBINK_STUB", stub_default))
   end
 end
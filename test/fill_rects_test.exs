@@ -0,0 +1,51 @@
+defmodule FBInk.FillRectsTest do
+  use ExUnit.Case, async: false
+
+  @moduletag :device
+
+  @quiet %FBInk.Config{is_quiet: true, no_refresh: true}
+
+  setup do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, @quiet)
+    {:ok, saved} = FBInk.dump(fb)
+
+    on_exit(fn ->
+      FBInk.restore(fb, @quiet, saved)
+      FBInk.close(fb)
+    end)
+
+    %{fb: fb}
+  end
+
+  # The second fill lies above and left of the first, so drawing fills in
+  # scanline order instead of list order would let the first one win
+  @under %FBInk.Rect{left: 20, top: 20, width: 40, height: 40}
+  @over %FBInk.Rect{left: 0, top: 0, width: 40, height: 40}
+
+  test "later fills paint over earlier ones", %{fb: fb} do
+    assert {:ok, _} = FBInk.fill_rects(fb, @quiet, [{@under, 0x00}, {@over, 0xFF}])
+
+    assert gray(fb, 30, 30) == 0xFF
+    assert gray(fb, 50, 50) == 0x00
+  end
+
+  test "packed fills keep list order too", %{fb: fb} do
+    packed =
+      for {r, y8} <- [{@under, 0xFF}, {@over, 0x00}], into: <<>> do
+        <<r.left::16, r.top::16, r.width::16, r.height::16, y8::8>>
+      end
+
+    assert {:ok, _} = FBInk.fill_rects(fb, @quiet, packed)
+
+    assert gray(fb, 30, 30) == 0x00
+    assert gray(fb, 50, 50) == 0xFF
+  end
+
+  # 4bpp framebuffers may widen the rect read to whole bytes
+  defp gray(fb, x, y) do
+    rect = %FBInk.Rect{left: x, top: y, width: 1, height: 1}
+    {:ok, %{data: data, width: w, area: area}} = FBInk.get_pixels(fb, rect, :y8)
+    :binary.at(data, (y - area.top) * w + (x - area.left))
+  end
+end
@@ -0,0 +1,66 @@
+defmodule FBInk.LoadImageTest do
+  use ExUnit.Case, async: false
+
+  @moduletag :tmp_dir
+
+  @quiet %FBInk.Config{is_quiet: true, no_refresh: true}
+  @area %FBInk.Rect{left: 0, top: 0, width: 200, height: 200}
+
+  setup %{tmp_dir: dir} do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, @quiet)
+    {:ok, saved} = FBInk.dump(fb)
+
+    on_exit(fn ->
+      FBInk.restore(fb, @quiet, saved)
+      FBInk.close(fb)
+    end)
+
+    {:ok, _} = FBInk.fill_rect_gray(fb, @quiet, @area, false, 0xFF)
+    %{fb: fb, path: write_black_png(Path.join(dir, "black.png"), 40, 30)}
+  end
+
+  test "PNGs are decoded without drawing to the screen", %{fb: fb, path: path} do
+    assert {:ok, image} = FBInk.load_image(fb, path, @quiet)
+    assert %{width: 40, height: 30} = FBInk.image_info(image)
+    assert gray(fb, 10, 10) == 0xFF
+
+    assert {:ok, _} = FBInk.blit_image(fb, image, 100, 100, @quiet)
+    assert gray(fb, 110, 110) == 0x00
+    assert gray(fb, 99, 99) == 0xFF
+    assert gray(fb, 140, 130) == 0xFF
+  end
+
+  test "scaling is applied at load time", %{fb: fb, path: path} do
+    config = %{@quiet | scaled_width: 80, scaled_height: -1}
+
+    assert {:ok, image} = FBInk.load_image(fb, path, config)
+    assert %{width: 80, height: 60} = FBInk.image_info(image)
+    assert gray(fb, 10, 10) == 0xFF
+  end
+
+  # 8-bit gray, all zero
+  defp write_black_png(path, w, h) do
+    rows = :binary.copy(<<0, 0::size(w)-unit(8)>>, h)
+
+    File.write!(path, [
+      <<137, "PNG\r\n", 26, "\n">>,
+      png_chunk("IHDR", <<w::32, h::32, 8, 0, 0, 0, 0>>),
+      png_chunk("IDAT", :zlib.compress(rows)),
+      png_chunk("IEND", <<>>)
+    ])
+
+    path
+  end
+
+  defp png_chunk(type, data) do
+    <<byte_size(data)::32, type::binary, data::binary, :erlang.crc32([type, data])::32>>
+  end
+
+  # 4bpp framebuffers may widen the rect read to whole bytes
+  defp gray(fb, x, y) do
+    rect = %FBInk.Rect{left: x, top: y, width: 1, height: 1}
+    {:ok, %{data: data, width: w, area: area}} = FBInk.get_pixels(fb, rect, :y8)
+    :binary.at(data, (y - area.top) * w + (x - area.left))
+  end
+end
@@ -0,0 +1,140 @@
+defmodule FBInk.PrintImageStreamTest do
+  use ExUnit.Case, async: false
+
+  @moduletag :tmp_dir
+
+  # 24 MP: decoded whole, that is 72 MB of RGB, and more than the pixel
+  # budget past which print_image/5 streams
+  @width 6000
+  @height 4000
+  @rss_ceiling 8 * 1024 * 1024
+
+  @quiet %FBInk.Config{is_quiet: true, no_refresh: true}
+
+  setup do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, @quiet)
+    {:ok, saved} = FBInk.dump(fb)
+
+    on_exit(fn ->
+      FBInk.restore(fb, @quiet, saved)
+      FBInk.close(fb)
+    end)
+
+    %{fb: fb}
+  end
+
+  test "streams a large P6 image within a fixed RSS ceiling", %{fb: fb, tmp_dir: dir} do
+    path = write_p6(Path.join(dir, "large.ppm"))
+    assert_peak_rss(fn -> FBInk.print_image_stream(fb, path, 0, 0, @quiet) end)
+  end
+
+  test "streams a large PNG within a fixed RSS ceiling", %{fb: fb, tmp_dir: dir} do
+    path = write_png(Path.join(dir, "large.png"))
+    assert_peak_rss(fn -> FBInk.print_image_stream(fb, path, 0, 0, @quiet) end)
+  end
+
+  test "streams a large JPEG within a fixed RSS ceiling", %{fb: fb, tmp_dir: dir} do
+    path = write_jpeg(Path.join(dir, "large.jpg"))
+    assert_peak_rss(fn -> FBInk.print_image_stream(fb, path, 0, 0, @quiet) end)
+  end
+
+  test "print_image streams PNG and JPEG over the pixel budget", %{fb: fb, tmp_dir: dir} do
+    png = write_png(Path.join(dir, "large.png"))
+    jpeg = write_jpeg(Path.join(dir, "large.jpg"))
+    config = %{@quiet | halign: FBInk.Constants.Align.center(), scaled_width: -2}
+
+    assert_peak_rss(fn -> FBInk.print_image(fb, png, 0, 0, config) end)
+    assert_peak_rss(fn -> FBInk.print_image(fb, jpeg, 0, 0, config) end)
+  end
+
+  test "print_image rejects other formats over the pixel budget", %{fb: fb, tmp_dir: dir} do
+    # Only the header is read before giving up
+    path = Path.join(dir, "large.gif")
+    File.write!(path, <<"GIF89a", @width::little-16, @height::little-16, 0, 0, 0>>)
+
+    assert {:error, :efbig} = FBInk.print_image(fb, path, 0, 0, @quiet)
+  end
+
+  defp assert_peak_rss(fun) do
+    :erlang.garbage_collect()
+    before = rss_bytes("VmRSS")
+    # Reset VmHWM (the peak RSS) to the current RSS
+    :ok = File.write("/proc/self/clear_refs", "5")
+
+    assert {:ok, _} = fun.()
+
+    growth = rss_bytes("VmHWM") - before
+    assert growth < @rss_ceiling, "peak RSS grew by #{div(growth, 1024)} KiB"
+  end
+
+  # Written row by row, so the test itself stays small too
+  defp write_p6(path) do
+    row = rgb_row()
+
+    File.open!(path, [:write, :binary], fn io ->
+      IO.binwrite(io, "P6\n#{@width} #{@height}\n255\n")
+      for _ <- 1..@height, do: IO.binwrite(io, row)
+    end)
+
+    path
+  end
+
+  # 8-bit RGB, deflated a row at a time into one IDAT chunk per row
+  defp write_png(path) do
+    row = [0, rgb_row()]
+    z = :zlib.open()
+    :ok = :zlib.deflateInit(z)
+
+    File.open!(path, [:write, :binary], fn io ->
+      IO.binwrite(io, <<137, "PNG\r\n", 26, "\n">>)
+      IO.binwrite(io, png_chunk("IHDR", <<@width::32, @height::32, 8, 2, 0, 0, 0>>))
+      for _ <- 1..@height, do: IO.binwrite(io, png_chunk("IDAT", :zlib.deflate(z, row)))
+      IO.binwrite(io, png_chunk("IDAT", :zlib.deflate(z, [], :finish)))
+      IO.binwrite(io, png_chunk("IEND", <<>>))
+    end)
+
+    :zlib.close(z)
+    path
+  end
+
+  defp png_chunk(type, data) do
+    data = IO.iodata_to_binary(data)
+    <<byte_size(data)::32, type::binary, data::binary, :erlang.crc32([type, data])::32>>
+  end
+
+  # Baseline gray with a quantizer of 1 and one-code Huffman tables: each
+  # 8x8 block is DC 0 then end-of-block, two zero bits, so the scan is all
+  # zero bytes and decodes to mid-gray
+  defp write_jpeg(path) do
+    one_code = <<1, 0::8*15, 0>>
+    scan_bytes = div(div(@width, 8) * div(@height, 8), 4)
+
+    File.open!(path, [:write, :binary], fn io ->
+      IO.binwrite(io, <<0xFF, 0xD8>>)
+      IO.binwrite(io, jpeg_segment(0xDB, [0, :binary.copy(<<1>>, 64)]))
+      IO.binwrite(io, jpeg_segment(0xC0, <<8, @height::16, @width::16, 1, 1, 0x11, 0>>))
+      IO.binwrite(io, jpeg_segment(0xC4, [0x00, one_code]))
+      IO.binwrite(io, jpeg_segment(0xC4, [0x10, one_code]))
+      IO.binwrite(io, jpeg_segment(0xDA, <<1, 1, 0x00, 0, 63, 0>>))
+      IO.binwrite(io, :binary.copy(<<0>>, scan_bytes))
+      IO.binwrite(io, <<0xFF, 0xD9>>)
+    end)
+
+    path
+  end
+
+  defp jpeg_segment(marker, data) do
+    data = IO.iodata_to_binary(data)
+    <<0xFF, marker, byte_size(data) + 2::16, data::binary>>
+  end
+
+  defp rgb_row do
+    for x <- 0..(@width - 1), into: <<>>, do: <<rem(x, 256), 128, 255 - rem(x, 256)>>
+  end
+
+  defp rss_bytes(field) do
+    [_, kib] = Regex.run(~r/#{field}:\s+(\d+) kB/, File.read!("/proc/self/status"))
+    String.to_integer(kib) * 1024
+  end
+end
@@ -0,0 +1,56 @@
+defmodule FBInk.SchedulerTest do
+  use ExUnit.Case, async: false
+
+  alias FBInk.Constants.WaveformMode
+
+  @quiet %FBInk.Config{is_quiet: true}
+  @a2 %{@quiet | wfm_mode: WaveformMode.a2()}
+  @gc16 %{@quiet | wfm_mode: WaveformMode.gc16()}
+  @top %FBInk.Rect{left: 0, top: 0, width: 100, height: 20}
+  @bottom %FBInk.Rect{left: 0, top: 40, width: 100, height: 20}
+
+  setup do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, @quiet)
+    on_exit(fn -> FBInk.close(fb) end)
+    %{fb: fb}
+  end
+
+  test "batch reports one marker per refresh group", %{fb: fb} do
+    assert {:ok, [{:ok, a}, {:ok, b}, {:ok, c}], markers} =
+             FBInk.batch(fb, [
+               {:refresh_rect, @top, @a2},
+               {:refresh_rect, @bottom, @gc16},
+               {:refresh_rect, @bottom, @a2}
+             ])
+
+    assert markers == [a, b]
+    assert a == c
+    assert a != b
+  end
+
+  test "regions on different waveforms complete on their own markers", %{fb: fb} do
+    {:ok, sched} = FBInk.Scheduler.start_link(fb: fb, default_interval: 0)
+
+    FBInk.Scheduler.update(sched, :clock, @top, [], @a2)
+    FBInk.Scheduler.update(sched, :status, @bottom, [], @gc16)
+    assert_stats(sched, %{dispatched: 2, merged: 0})
+
+    # Both slots were freed by their own completion, so both go out again
+    FBInk.Scheduler.update(sched, :clock, @top, [], @a2)
+    FBInk.Scheduler.update(sched, :status, @bottom, [], @gc16)
+    assert_stats(sched, %{dispatched: 4, merged: 0})
+  end
+
+  defp assert_stats(sched, expected, tries \\ 100) do
+    stats = Map.take(FBInk.Scheduler.stats(sched), Map.keys(expected))
+
+    cond do
+      stats == expected -> :ok
+      tries == 0 -> flunk("stats stuck at #{inspect(stats)}, expected #{inspect(expected)}")
+      true ->
+        Process.sleep(10)
+        assert_stats(sched, expected, tries - 1)
+    end
+  end
+end
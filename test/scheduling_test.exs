@@ -0,0 +1,98 @@
+defmodule FBInk.SchedulingTest do
+  use ExUnit.Case, async: true
+
+  # Entries of the nif_funcs table: {name, arity, c_function, flags}
+  @nif_source Path.expand("../c_src/fbink_nif.c", __DIR__)
+  @nif_funcs ~r/\{"(nif_\w+)",\s*(\d+),\s*(\w+),\s*(\w+)\}/
+             |> Regex.scan(File.read!(@nif_source), capture: :all_but_first)
+             |> Enum.map(fn [name, arity, fun, flags] ->
+               {name, String.to_integer(arity), fun, flags}
+             end)
+
+  # Bounded, sub-millisecond NIFs allowed on a normal scheduler. Anything
+  # new that may block belongs on a dirty one instead.
+  @normal ~w(
+    nif_version nif_target nif_features nif_compile_config nif_compile_ot_config
+    nif_compile_rect nif_open nif_submit nif_waveform_stats nif_image_info
+    nif_notify_refresh nif_free_dump_data nif_get_dump_data nif_get_dump_rect_data
+    nif_dump_info nif_snapshot_store nif_snapshot_info nif_canvas_info
+  )
+
+  # Calls that wait on the EPDC or input devices, read files or decode images
+  @blocking ~w(
+    nif_wait_for_submission nif_wait_for_complete nif_wait_for_any_complete
+    nif_print_image nif_print_image_binary nif_print_image_stream nif_load_image
+    nif_print_ot nif_add_ot_font nif_dump nif_input_scan nif_input_check
+    nif_button_scan nif_save_dump nif_load_dump nif_refresh nif_refresh_rect
+  )
+
+  test "the nif_funcs table parses" do
+    assert length(@nif_funcs) > 50
+    assert Enum.all?(@nif_funcs, fn {_, _, _, flags} -> flags in ~w(0 DIRTY_IO DIRTY_CPU) end)
+  end
+
+  test "only known-fast NIFs run on a normal scheduler" do
+    normal = for {name, _, _, "0"} <- @nif_funcs, uniq: true, do: name
+    assert Enum.sort(normal) == Enum.sort(@normal)
+  end
+
+  test "blocking NIFs run on dirty schedulers" do
+    for name <- @blocking do
+      entries = for {^name, _, _, flags} <- @nif_funcs, do: flags
+      assert entries != [], "#{name} missing from nif_funcs"
+      assert Enum.all?(entries, &(&1 != "0")), "#{name} runs on a normal scheduler"
+    end
+  end
+
+  test "NIFs holding the FBInk lock never run on a normal scheduler" do
+    for {name, _, fun, flags} <- @nif_funcs, String.ends_with?(fun, "_locked") do
+      assert flags != "0", "#{name} takes the FBInk lock on a normal scheduler"
+    end
+  end
+
+  # Runs against test/support/fbink_stub.c on the host (see "Testing" in the
+  # README) and against the real libfbink with FBINK_STUB=0 on the device.
+  describe "normal-scheduler latency" do
+    @runs 1_000
+
+    setup do
+      {:ok, fb} = FBInk.open()
+      {:ok, _} = FBInk.init(fb, %FBInk.Config{is_quiet: true})
+      {:ok, dump} = FBInk.rect_dump(fb, %FBInk.Rect{width: 64, height: 64})
+      on_exit(fn -> FBInk.close(fb) end)
+      %{fb: fb, dump: dump}
+    end
+
+    test "calls stay under 1 ms while dirty NIFs hold the FBInk lock", %{fb: fb, dump: dump} do
+      # Normal-scheduler NIFs never take fbink_lock, so full-screen dumps
+      # running alongside must not show up in their latency.
+      contender =
+        spawn_link(fn ->
+          Stream.repeatedly(fn -> FBInk.dump(fb) end) |> Stream.run()
+        end)
+
+      rect = %FBInk.Rect{width: 16, height: 16}
+
+      calls = [
+        version: fn -> FBInk.version() end,
+        features: fn -> FBInk.features() end,
+        waveform_stats: fn -> FBInk.waveform_stats() end,
+        compile_config: fn -> FBInk.Config.compile(%FBInk.Config{}) end,
+        compile_rect: fn -> FBInk.Rect.compile(rect) end,
+        dump_info: fn -> FBInk.dump_info(dump) end,
+        get_dump_data: fn -> FBInk.get_dump_data(dump) end,
+        get_dump_rect_data: fn -> FBInk.get_dump_rect_data(dump, rect) end
+      ]
+
+      for {name, fun} <- calls do
+        fun.()
+        times = Enum.sort(for _ <- 1..@runs, do: elem(:timer.tc(fun), 0))
+        p99 = Enum.at(times, div(@runs * 99, 100))
+        assert p99 < 1_000, "#{name}: 99th percentile #{p99} us"
+      end
+
+      Process.unlink(contender)
+      Process.exit(contender, :kill)
+    end
+  end
+end
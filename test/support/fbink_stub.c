@@ -0,0 +1,617 @@
+/**
+ * fbink_stub.c - In-memory stand-in for libfbink, for host tests
+ *
+ * Implements the FBInk API used by fbink_nif.c against an 8bpp grayscale
+ * screen held in memory, so `mix test` can load the NIF and exercise it on a
+ * machine without a framebuffer. Linked instead of libfbink when the Makefile
+ * is run with FBINK_STUB=1 (mix.exs does so for MIX_ENV=test host builds).
+ *
+ * Drawing primitives, dump/restore, raw data and inversion are emulated pixel
+ * for pixel. Text, bars and grid clears fill the area FBInk would touch with
+ * the background pen; image files, OpenType fonts, input devices and
+ * platform-specific calls return -ENOSYS. Refreshes complete immediately.
+ *
+ * Like FBInk, none of this is thread-safe: the NIF calls it under fbink_lock.
+ *
+ * Copyright (c) 2026 Marc Lainez
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _GNU_SOURCE  // close() under -std=c11
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fbink.h"
+
+// Kobo Clara HD geometry, unrotated
+#define STUB_WIDTH  1072
+#define STUB_HEIGHT 1448
+#define STUB_FONT_W 8
+#define STUB_FONT_H 16
+
+static unsigned char screen[STUB_HEIGHT][STUB_WIDTH];
+static bool initialized = false;
+static FBInkRect last_rect;
+static uint32_t last_marker = 0;
+static uint8_t pen_fg = 0x00;
+static uint8_t pen_bg = 0xFF;
+
+// ============================================================================
+// Helpers
+// ============================================================================
+
+static uint8_t luma(uint8_t r, uint8_t g, uint8_t b) {
+    return (uint8_t)((r * 77U + g * 150U + b * 29U) >> 8);
+}
+
+// Clamp a rect to the screen; an all-zero rect means the whole screen
+static FBInkRect clip_rect(const FBInkRect *rect) {
+    FBInkRect r = { 0, 0, STUB_WIDTH, STUB_HEIGHT };
+    if (rect && (rect->width || rect->height || rect->left || rect->top)) {
+        r = *rect;
+        if (r.left >= STUB_WIDTH || r.top >= STUB_HEIGHT) {
+            r.width = r.height = 0;
+        } else {
+            if (r.width > STUB_WIDTH - r.left) r.width = STUB_WIDTH - r.left;
+            if (r.height > STUB_HEIGHT - r.top) r.height = STUB_HEIGHT - r.top;
+        }
+    }
+    return r;
+}
+
+static void fill(const FBInkRect *r, uint8_t v) {
+    for (unsigned int y = 0; y < r->height; y++)
+        memset(&screen[r->top + y][r->left], v, r->width);
+    last_rect = *r;
+}
+
+// Text-like calls: one cell row of the grid at cfg->row/col
+static int fill_cells(const FBInkConfig *cfg, unsigned int cols, unsigned int rows) {
+    int row = cfg ? cfg->row : 0;
+    int col = cfg ? cfg->col : 0;
+    if (row < 0) row += STUB_HEIGHT / STUB_FONT_H;
+    if (col < 0) col += STUB_WIDTH / STUB_FONT_W;
+    if (row < 0 || col < 0) return -EINVAL;
+
+    FBInkRect r = { (unsigned short)(col * STUB_FONT_W), (unsigned short)(row * STUB_FONT_H),
+                    (unsigned short)(cols * STUB_FONT_W), (unsigned short)(rows * STUB_FONT_H) };
+    r = clip_rect(&r);
+    fill(&r, pen_bg);
+    return 0;
+}
+
+static int dump_area(const FBInkRect *area, bool is_full, FBInkDump *dump) {
+    if (!initialized) return -EBADF;
+
+    FBInkRect r = clip_rect(area);
+    size_t stride = is_full ? STUB_WIDTH : r.width;
+    size_t size = stride * r.height;
+    if (dump->data && dump->size != size) {
+        free(dump->data);
+        dump->data = NULL;
+    }
+    if (!dump->data) {
+        dump->data = malloc(size ? size : 1);
+        if (!dump->data) return -ENOMEM;
+    }
+    for (unsigned int y = 0; y < r.height; y++)
+        memcpy(dump->data + y * stride, &screen[r.top + y][r.left], r.width);
+
+    dump->stride = stride;
+    dump->size = size;
+    dump->area = r;
+    memset(&dump->clip, 0, sizeof(dump->clip));
+    dump->rota = 0;
+    dump->bpp = 8;
+    dump->is_full = is_full;
+    return 0;
+}
+
+// ============================================================================
+// Info and lifecycle
+// ============================================================================
+
+const char *fbink_version(void) {
+    return "stub";
+}
+
+TARGET_INDEX_T fbink_target(void) {
+    return 0;
+}
+
+uint32_t fbink_features(void) {
+    return 0;
+}
+
+int fbink_open(void) {
+    int fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    return fd < 0 ? -errno : fd;
+}
+
+int fbink_close(int fbfd) {
+    return close(fbfd) < 0 ? -errno : 0;
+}
+
+int fbink_init(int fbfd, const FBInkConfig *cfg) {
+    (void)fbfd;
+    if (!initialized) memset(screen, 0xFF, sizeof(screen));
+    initialized = true;
+    return fbink_update_pen_colors(cfg);
+}
+
+int fbink_reinit(int fbfd, const FBInkConfig *cfg) {
+    return fbink_init(fbfd, cfg);
+}
+
+void fbink_get_state(const FBInkConfig *cfg, FBInkState *state) {
+    (void)cfg;
+    memset(state, 0, sizeof(*state));
+    state->user_hz = 100;
+    state->font_name = "IBM";
+    state->view_width = state->screen_width = STUB_WIDTH;
+    state->view_height = state->screen_height = STUB_HEIGHT;
+    state->scanline_stride = STUB_WIDTH;
+    state->bpp = 8;
+    snprintf(state->device_name, sizeof(state->device_name), "Stub");
+    snprintf(state->device_codename, sizeof(state->device_codename), "stub");
+    snprintf(state->device_platform, sizeof(state->device_platform), "host");
+    state->pen_fg_color = pen_fg;
+    state->pen_bg_color = pen_bg;
+    state->screen_dpi = 300;
+    state->font_w = state->glyph_width = STUB_FONT_W;
+    state->font_h = state->glyph_height = STUB_FONT_H;
+    state->fontsize_mult = 1;
+    state->max_cols = STUB_WIDTH / STUB_FONT_W;
+    state->max_rows = STUB_HEIGHT / STUB_FONT_H;
+    for (uint8_t i = 0; i < 4; i++) state->rotation_map[i] = i;
+    state->pixel_format = FBINK_PXFMT_Y8;
+}
+
+void fbink_state_dump(const FBInkConfig *cfg) {
+    (void)cfg;
+}
+
+bool fbink_is_fb_quirky(void) {
+    return false;
+}
+
+FBInkRect fbink_get_last_rect(bool rotated) {
+    (void)rotated;
+    return last_rect;
+}
+
+uint32_t fbink_get_last_marker(void) {
+    return last_marker;
+}
+
+void fbink_update_verbosity(const FBInkConfig *cfg) {
+    (void)cfg;
+}
+
+// ============================================================================
+// Pens
+// ============================================================================
+
+int fbink_update_pen_colors(const FBInkConfig *cfg) {
+    // FG_BLACK..FG_WHITE and BG_WHITE..BG_BLACK step through 16 gray levels
+    if (cfg) {
+        pen_fg = (uint8_t)(0x11 * (cfg->fg_color & 0x0F));
+        pen_bg = (uint8_t)(0xFF - 0x11 * (cfg->bg_color & 0x0F));
+    }
+    return 0;
+}
+
+int fbink_set_fg_pen_gray(uint8_t y, bool quantize, bool update) {
+    (void)update;
+    pen_fg = quantize ? (uint8_t)(((y + 8) / 0x11) * 0x11) : y;
+    return 0;
+}
+
+int fbink_set_bg_pen_gray(uint8_t y, bool quantize, bool update) {
+    (void)update;
+    pen_bg = quantize ? (uint8_t)(((y + 8) / 0x11) * 0x11) : y;
+    return 0;
+}
+
+int fbink_set_fg_pen_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a, bool quantize,
+                          bool update) {
+    (void)a;
+    return fbink_set_fg_pen_gray(luma(r, g, b), quantize, update);
+}
+
+int fbink_set_bg_pen_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a, bool quantize,
+                          bool update) {
+    (void)a;
+    return fbink_set_bg_pen_gray(luma(r, g, b), quantize, update);
+}
+
+// ============================================================================
+// Text, bars and images
+// ============================================================================
+
+int fbink_print(int fbfd, const char *string, const FBInkConfig *cfg) {
+    (void)fbfd;
+    if (!initialized) return -EBADF;
+    size_t len = strlen(string);
+    unsigned int max_cols = STUB_WIDTH / STUB_FONT_W;
+    unsigned int rows = (unsigned int)((len + max_cols - 1) / max_cols);
+    if (rows == 0) rows = 1;
+    int rv = fill_cells(cfg, len < max_cols ? (unsigned int)len : max_cols, rows);
+    return rv < 0 ? rv : (int)rows;
+}
+
+int fbink_add_ot_font(const char *filename, FONT_STYLE_T style) {
+    (void)filename;
+    (void)style;
+    return -ENOSYS;
+}
+
+int fbink_free_ot_fonts(void) {
+    return 0;
+}
+
+int fbink_print_ot(int fbfd, const char *string, const FBInkOTConfig *cfg,
+                   const FBInkConfig *fbink_cfg, FBInkOTFit *fit) {
+    (void)fbfd;
+    (void)string;
+    (void)cfg;
+    (void)fbink_cfg;
+    (void)fit;
+    return -ENOSYS;
+}
+
+int fbink_print_progress_bar(int fbfd, uint8_t percentage, const FBInkConfig *cfg) {
+    (void)fbfd;
+    if (!initialized) return -EBADF;
+    if (percentage > 100) return -EINVAL;
+    return fill_cells(cfg, STUB_WIDTH / STUB_FONT_W, 1);
+}
+
+int fbink_print_activity_bar(int fbfd, uint8_t progress, const FBInkConfig *cfg) {
+    (void)fbfd;
+    (void)progress;
+    if (!initialized) return -EBADF;
+    return fill_cells(cfg, STUB_WIDTH / STUB_FONT_W, 1);
+}
+
+int fbink_print_image(int fbfd, const char *filename, short int x_off, short int y_off,
+                      const FBInkConfig *cfg) {
+    (void)fbfd;
+    (void)filename;
+    (void)x_off;
+    (void)y_off;
+    (void)cfg;
+    return -ENOSYS;
+}
+
+// Gray, gray+alpha, RGB and RGBA; alpha is ignored and there is no scaling
+int fbink_print_raw_data(int fbfd, const unsigned char *data, const int w, const int h,
+                         const size_t len, short int x_off, short int y_off,
+                         const FBInkConfig *cfg) {
+    (void)fbfd;
+    (void)cfg;
+    if (!initialized) return -EBADF;
+    if (w <= 0 || h <= 0 || len % ((size_t)w * (size_t)h) != 0) return -EINVAL;
+    size_t n = len / ((size_t)w * (size_t)h);
+    if (n < 1 || n > 4) return -EINVAL;
+    if (x_off < 0 || y_off < 0) return -EINVAL;
+
+    FBInkRect r = { (unsigned short)x_off, (unsigned short)y_off,
+                    (unsigned short)w, (unsigned short)h };
+    r = clip_rect(&r);
+    for (unsigned int y = 0; y < r.height; y++) {
+        const unsigned char *src = data + (size_t)y * (size_t)w * n;
+        unsigned char *dst = &screen[r.top + y][r.left];
+        for (unsigned int x = 0; x < r.width; x++, src += n)
+            dst[x] = n < 3 ? src[0] : luma(src[0], src[1], src[2]);
+    }
+    last_rect = r;
+    return 0;
+}
+
+// ============================================================================
+// Clearing and refreshing
+// ============================================================================
+
+int fbink_cls(int fbfd, const FBInkConfig *cfg, const FBInkRect *rect, bool no_rota) {
+    (void)fbfd;
+    (void)cfg;
+    (void)no_rota;
+    if (!initialized) return -EBADF;
+    FBInkRect r = clip_rect(rect);
+    fill(&r, pen_bg);
+    return 0;
+}
+
+int fbink_grid_clear(int fbfd, unsigned short int cols, unsigned short int rows,
+                     const FBInkConfig *cfg) {
+    (void)fbfd;
+    if (!initialized) return -EBADF;
+    return fill_cells(cfg, cols, rows);
+}
+
+int fbink_refresh(int fbfd, uint32_t top, uint32_t left, uint32_t width, uint32_t height,
+                  const FBInkConfig *cfg) {
+    (void)fbfd;
+    (void)top;
+    (void)left;
+    (void)width;
+    (void)height;
+    (void)cfg;
+    if (!initialized) return -EBADF;
+    last_marker++;
+    return 0;
+}
+
+int fbink_refresh_rect(int fbfd, const FBInkRect *rect, const FBInkConfig *cfg) {
+    FBInkRect r = clip_rect(rect);
+    return fbink_refresh(fbfd, r.top, r.left, r.width, r.height, cfg);
+}
+
+int fbink_grid_refresh(int fbfd, unsigned short int cols, unsigned short int rows,
+                       const FBInkConfig *cfg) {
+    (void)cols;
+    (void)rows;
+    return fbink_refresh(fbfd, 0, 0, 0, 0, cfg);
+}
+
+int fbink_wait_for_submission(int fbfd, uint32_t marker) {
+    (void)fbfd;
+    return marker > last_marker ? -EINVAL : 0;
+}
+
+int fbink_wait_for_complete(int fbfd, uint32_t marker) {
+    (void)fbfd;
+    return marker > last_marker ? -EINVAL : 0;
+}
+
+int fbink_wait_for_any_complete(int fbfd) {
+    (void)fbfd;
+    return 0;
+}
+
+// ============================================================================
+// Dump/Restore
+// ============================================================================
+
+int fbink_dump(int fbfd, FBInkDump *dump) {
+    (void)fbfd;
+    return dump_area(NULL, true, dump);
+}
+
+int fbink_region_dump(int fbfd, short int x_off, short int y_off, unsigned short int w,
+                      unsigned short int h, const FBInkConfig *cfg, FBInkDump *dump) {
+    (void)fbfd;
+    (void)cfg;
+    // Negative offsets count from the right/bottom edge, as in FBInk
+    int x = x_off < 0 ? STUB_WIDTH + x_off : x_off;
+    int y = y_off < 0 ? STUB_HEIGHT + y_off : y_off;
+    if (x < 0 || y < 0 || w == 0 || h == 0) return -EINVAL;
+    FBInkRect r = { (unsigned short)x, (unsigned short)y, w, h };
+    return dump_area(&r, false, dump);
+}
+
+int fbink_rect_dump(int fbfd, const FBInkRect *rect, FBInkDump *dump) {
+    (void)fbfd;
+    if (!rect || rect->width == 0 || rect->height == 0) return -EINVAL;
+    return dump_area(rect, false, dump);
+}
+
+int fbink_restore(int fbfd, const FBInkConfig *cfg, const FBInkDump *dump) {
+    (void)fbfd;
+    (void)cfg;
+    if (!initialized) return -EBADF;
+    if (!dump->data) return -EINVAL;
+    if (dump->bpp != 8 || dump->rota != 0) return -ENOTSUP;
+
+    // A non-empty clip restores only its intersection with the dumped area
+    FBInkRect r = dump->area;
+    if (dump->clip.width && dump->clip.height) {
+        unsigned int l = dump->clip.left > r.left ? dump->clip.left : r.left;
+        unsigned int t = dump->clip.top > r.top ? dump->clip.top : r.top;
+        unsigned int re = r.left + r.width, ce = dump->clip.left + dump->clip.width;
+        unsigned int be = r.top + r.height, cb = dump->clip.top + dump->clip.height;
+        re = ce < re ? ce : re;
+        be = cb < be ? cb : be;
+        if (re <= l || be <= t) return 0;
+        r = (FBInkRect){ (unsigned short)l, (unsigned short)t,
+                         (unsigned short)(re - l), (unsigned short)(be - t) };
+    }
+    r = clip_rect(&r);
+    for (unsigned int y = 0; y < r.height; y++) {
+        const unsigned char *src = dump->data +
+            (size_t)(r.top + y - dump->area.top) * dump->stride + (r.left - dump->area.left);
+        memcpy(&screen[r.top + y][r.left], src, r.width);
+    }
+    last_rect = r;
+    return 0;
+}
+
+int fbink_free_dump_data(FBInkDump *dump) {
+    if (!dump->data) return -EINVAL;
+    free(dump->data);
+    memset(dump, 0, sizeof(*dump));
+    return 0;
+}
+
+// ============================================================================
+// Inversion, rotation and framebuffer info
+// ============================================================================
+
+int fbink_invert_screen(int fbfd, const FBInkConfig *cfg) {
+    (void)cfg;
+    return fbink_invert_rect(fbfd, NULL, false);
+}
+
+int fbink_invert_rect(int fbfd, const FBInkRect *rect, bool no_rota) {
+    (void)fbfd;
+    (void)no_rota;
+    if (!initialized) return -EBADF;
+    FBInkRect r = clip_rect(rect);
+    for (unsigned int y = 0; y < r.height; y++)
+        for (unsigned int x = 0; x < r.width; x++)
+            screen[r.top + y][r.left + x] ^= 0xFF;
+    last_rect = r;
+    return 0;
+}
+
+uint8_t fbink_rota_native_to_canonical(uint32_t rotate) {
+    return (uint8_t)(rotate & 3);
+}
+
+uint32_t fbink_rota_canonical_to_native(uint8_t rotate) {
+    return rotate & 3U;
+}
+
+int fbink_set_fb_info(int fbfd, uint32_t rota, uint8_t bpp, uint8_t grayscale,
+                      const FBInkConfig *cfg) {
+    (void)fbfd;
+    (void)rota;
+    (void)bpp;
+    (void)grayscale;
+    (void)cfg;
+    return -ENOSYS;
+}
+
+// ============================================================================
+// Drawing primitives
+// ============================================================================
+
+int fbink_fill_rect_gray(int fbfd, const FBInkConfig *cfg, const FBInkRect *rect,
+                         bool no_rota, uint8_t y) {
+    (void)fbfd;
+    (void)cfg;
+    (void)no_rota;
+    if (!initialized) return -EBADF;
+    FBInkRect r = clip_rect(rect);
+    fill(&r, y);
+    return 0;
+}
+
+int fbink_fill_rect_rgba(int fbfd, const FBInkConfig *cfg, const FBInkRect *rect,
+                         bool no_rota, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    (void)a;
+    return fbink_fill_rect_gray(fbfd, cfg, rect, no_rota, luma(r, g, b));
+}
+
+int fbink_put_pixel_gray(int fbfd, uint16_t x, uint16_t y, uint8_t v) {
+    (void)fbfd;
+    if (!initialized) return -EBADF;
+    if (x >= STUB_WIDTH || y >= STUB_HEIGHT) return -ERANGE;
+    screen[y][x] = v;
+    return 0;
+}
+
+int fbink_put_pixel_rgba(int fbfd, uint16_t x, uint16_t y, uint8_t r, uint8_t g, uint8_t b,
+                         uint8_t a) {
+    (void)a;
+    return fbink_put_pixel_gray(fbfd, x, y, luma(r, g, b));
+}
+
+int fbink_get_pixel(int fbfd, uint16_t x, uint16_t y, uint8_t *r, uint8_t *g, uint8_t *b,
+                    uint8_t *a) {
+    (void)fbfd;
+    if (!initialized) return -EBADF;
+    if (x >= STUB_WIDTH || y >= STUB_HEIGHT) return -ERANGE;
+    *r = *g = *b = screen[y][x];
+    *a = 0xFF;
+    return 0;
+}
+
+int fbink_pack_pixel_gray(uint8_t y, uint32_t *px) {
+    *px = y;
+    return 0;
+}
+
+int fbink_pack_pixel_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a, uint32_t *px) {
+    (void)a;
+    *px = luma(r, g, b);
+    return 0;
+}
+
+// ============================================================================
+// Device-specific: not a Kobo, Kindle, sunxi or MTK device
+// ============================================================================
+
+int fbink_wakeup_epdc(void) {
+    return -ENOSYS;
+}
+
+int fbink_sunxi_toggle_ntx_pen_mode(int fbfd, bool toggle) {
+    (void)fbfd;
+    (void)toggle;
+    return -ENOSYS;
+}
+
+int fbink_sunxi_ntx_enforce_rota(int fbfd, SUNXI_FORCE_ROTA_INDEX_T mode,
+                                 const FBInkConfig *cfg) {
+    (void)fbfd;
+    (void)mode;
+    (void)cfg;
+    return -ENOSYS;
+}
+
+int fbink_mtk_set_swipe_data(MTK_SWIPE_DIRECTION_INDEX_T direction, uint8_t steps) {
+    (void)direction;
+    (void)steps;
+    return -ENOSYS;
+}
+
+int fbink_mtk_set_halftone(int fbfd, const FBInkRect exclude_regions[2],
+                           MTK_HALFTONE_MODE_INDEX_T size) {
+    (void)fbfd;
+    (void)exclude_regions;
+    (void)size;
+    return -ENOSYS;
+}
+
+int fbink_mtk_toggle_auto_reagl(int fbfd, bool toggle) {
+    (void)fbfd;
+    (void)toggle;
+    return -ENOSYS;
+}
+
+int fbink_mtk_toggle_pen_mode(int fbfd, bool toggle) {
+    (void)fbfd;
+    (void)toggle;
+    return -ENOSYS;
+}
+
+FBInkInputDevice *fbink_input_scan(INPUT_DEVICE_TYPE_T match_types,
+                                   INPUT_DEVICE_TYPE_T exclude_types,
+                                   INPUT_SETTINGS_TYPE_T settings, size_t *dev_count) {
+    (void)match_types;
+    (void)exclude_types;
+    (void)settings;
+    if (dev_count) *dev_count = 0;
+    return NULL;
+}
+
+FBInkInputDevice *fbink_input_check(const char *filepath, INPUT_DEVICE_TYPE_T match_types,
+                                    INPUT_DEVICE_TYPE_T exclude_types,
+                                    INPUT_SETTINGS_TYPE_T settings) {
+    (void)filepath;
+    (void)match_types;
+    (void)exclude_types;
+    (void)settings;
+    return NULL;
+}
+
+int fbink_button_scan(int fbfd, bool press_button, bool nosleep) {
+    (void)fbfd;
+    (void)press_button;
+    (void)nosleep;
+    return -ENOSYS;
+}
+
+int fbink_wait_for_usbms_processing(int fbfd, bool force_unplug) {
+    (void)fbfd;
+    (void)force_unplug;
+    return -ENOSYS;
+}
@@ -0,0 +1,4 @@
+# Host runs link the NIF against test/support/fbink_stub.c. Tests tagged
+# :device need a framebuffer and the real FBInk; run them on the device with
+# `FBINK_STUB=0 mix test --include device`.
+ExUnit.start(exclude: [:device])
@@ -0,0 +1,43 @@
+defmodule FBInk.WaveformAutoTest do
+  use ExUnit.Case, async: false
+
+  alias FBInk.Constants.WaveformMode
+
+  @quiet %FBInk.Config{is_quiet: true, no_refresh: true}
+  @auto %FBInk.Config{is_quiet: true, wfm_mode: :auto}
+  @area %FBInk.Rect{left: 0, top: 0, width: 64, height: 64}
+
+  setup do
+    {:ok, fb} = FBInk.open()
+    {:ok, _} = FBInk.init(fb, @quiet)
+    {:ok, saved} = FBInk.dump(fb)
+
+    on_exit(fn ->
+      FBInk.restore(fb, @quiet, saved)
+      FBInk.close(fb)
+    end)
+
+    %{fb: fb}
+  end
+
+  test "pure black and white get DU", %{fb: fb} do
+    assert chosen(fb, 0x00) == WaveformMode.du()
+    assert chosen(fb, 0xFF) == WaveformMode.du()
+  end
+
+  test "grays next to black or white don't", %{fb: fb} do
+    assert chosen(fb, 0x01) == WaveformMode.gc16()
+    assert chosen(fb, 0xFE) == WaveformMode.gc16()
+  end
+
+  defp chosen(fb, gray) do
+    {:ok, _} = FBInk.fill_rect_gray(fb, @quiet, @area, false, gray)
+    before = FBInk.waveform_stats()
+    {:ok, _} = FBInk.refresh_rect(fb, @area, @auto)
+
+    [mode] =
+      for {mode, count} <- FBInk.waveform_stats(), count > Map.get(before, mode, 0), do: mode
+
+    mode
+  end
+end